@@ -1,4332 +1,10346 @@
-/* DarkMapGen is free software; you can redistribute it and/or modify
- * it under the terms of the GNU Library General Public License as
- * published by the Free Software Foundation; either version 2 of the
- * License, or (at your option) any later version.
- *
- * DarkMapGen is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
- * GNU Library General Public License for more details.
- *
- * You should have received a copy of the GNU Library General Public
- * License along with DarkMapGen.
- */
-
-#include <ctype.h>
-#include <math.h>
-#if __cplusplus >= 201103L
-#include <stdint.h>
-#endif
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#ifdef _WIN32
-#include <direct.h>
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#include <windows.h>
-#else
-#include <unistd.h>
-#define _copysign copysign
-#define MAX_PATH PATH_MAX
-#endif
-#include <FL/Fl.H>
-#include <FL/Fl_Double_Window.H>
-#include <FL/Fl_Menu_Bar.H>
-#include <FL/Fl_PNG_Image.H>
-#include <FL/fl_draw.H>
-#include <FL/Fl_Tree.H>
-#include <FL/Fl_Scroll.H>
-#include <FL/fl_ask.H>
-#include <FL/Fl_Tooltip.H>
-#include <FL/Fl_File_Chooser.H> 
-#include <FL/Fl_Image_Surface.H>
-#include <FL/Fl_Scheme.H>
-#include <FL/fl_utf8.h>
-#include <png.h>
-
-#ifndef NO_FLEET
-#include "Fle_Colors.hpp"
-#include "Fle_Schemes.hpp"
-#endif
-
-
-/////////////////////////////////////////////////////////////////////
-
-#ifdef _WIN32
-#define DIRSEP_STR "\\"
-#else
-#define DIRSEP_STR "/"
-#endif
-
-#ifndef TRUE
-typedef unsigned char BYTE;
-typedef unsigned short WORD;
-typedef unsigned int UINT;
-typedef int BOOL;
-#define FALSE 0
-#define TRUE 1
-#endif
-#ifndef min
-#define min(a,b) (((a)<(b))?(a):(b))
-#endif
-#ifndef max
-#define max(a,b) (((a)>(b))?(a):(b))
-#endif
-
-/////////////////////////////////////////////////////////////////////
-
-#define DARKMAPGEN_VERSION		"v1.01"
-
-#define DARKMAPGEN_TITLE		"DarkMapGen"
-
-#define PROJ_FILENAME			"DarkMapGen.proj"
-
-
-// min and max zoom levels for image view (don't make max too large because scaled image drawing is crude,
-// it creates a scaled copy of an image, dimmed location drawing also has scaled copies for each location)
-#define MIN_ZOOM				1
-#define MAX_ZOOM				6
-
-// dark engine defined limits for max map pages and max locations per page
-#define MAX_MAPS				40
-#define MAX_LOCATIONS_PER_MAP	256
-
-// max verts per shape
-#define MAX_VERTS				128
-
-#define VERT_HANDLE_RADIUS		3
-#define VERT_RADIUS				1
-
-#define VERT_COLOR				FL_WHITE
-#define CUR_VERT_COLOR			FL_MAGENTA
-#define VERT_FRAME_COLOR		FL_BLACK
-#define CUR_SHAPE_LINE_COLOR	FL_GREEN
-#define INPROGRESS_SHAPE_COLOR	FL_CYAN
-#define SHAPE_LINE_COLOR		FL_YELLOW
-
-#define SNAP_RADIUS				(VERT_HANDLE_RADIUS+3)
-
-
-// transform a coordinate from original map coordinates to image view client space
-#define MAP2CL(_coord) \
-	((int)(_coord) * g_iZoom + g_iCTR)
-
-
-// construct a tree id from a map page index and a location index/id
-#define MAKE_TREE_ID(_mapidx, _locidx) \
-	((((UINT)(_mapidx))<<16) | (UINT)(WORD)(_locidx))
-
-// get map page index from a tree id (-1 if invalid)
-#define MAP_FROM_TREE_ID(_treeid) \
-	((int)(((UINT)(_treeid))>>16))
-
-// get location index/id from a tree id (-1 if invalid)
-#define LOCIDX_FROM_TREE_ID(_treeid) \
-	((int)(short)((UINT)(_treeid)))
-
-// get location array element index from tree id (-1 if invalid)
-#define LOC_FROM_TREE_ID(_treeid) \
-	(MAP_FROM_TREE_ID(_treeid) < 0) ? -1 : g_pProj->maps[MAP_FROM_TREE_ID(_treeid)].GetArrayIndexFromLocationIndex(LOCIDX_FROM_TREE_ID(_treeid))
-
-#define MENU_SET(...) { Fl_Menu_Item __mi = __VA_ARGS__; menu[menu_items++] = __mi; }
-
-#define MENU_MOD_DIV() menu[menu_items-1].flags |= FL_MENU_DIVIDER
-
-#if defined(__unix__) || defined(__UNIX__)
-// work around bug in X11
-#define EVENT_SHIFT() (g_iEventState&FL_SHIFT)
-#define EVENT_CTRL() (g_iEventState&FL_CTRL)
-#define EVENT_ALT() (g_iEventState&FL_ALT)
-#else
-#define EVENT_SHIFT() Fl::event_shift()
-#define EVENT_CTRL() Fl::event_ctrl()
-#define EVENT_ALT() Fl::event_alt()
-#endif
-
-
-enum DisplayMode
-{
-	DM_OUTLINES,		// shapes are drawn as outlines only
-	DM_FILLSEL,			// the selected shape is filled with color, other shapes are drawn as outlines
-	DM_FILLALL,			// all shapes are filled with color
-	DM_DIMMED,			// all shapes are drawn with image data as darkened grayscale
-	DM_FADE_NONSEL,		// alpha fade everything but the selected shape
-
-	DM_NUM_MODES
-};
-
-
-/////////////////////////////////////////////////////////////////////
-
-class cImageView;
-struct sMap;
-struct sLocation;
-
-static void SetModifiedFlag();
-static void ClearModifiedFlag();
-static void ResetMouse();
-static void GenerateLocationImageForView(const sMap &map, sLocation &loc, BOOL bDim = TRUE, const int AA = 4);
-static void FakeTransparentImage(Fl_Image *img, Fl_Color bg, const UINT alpha = 48);
-static void OnCmdDelete(Fl_Widget* = NULL, void* = NULL);
-static void OnWindowResized(int w, int h);
-static int GetScrollViewClientWidth();
-static int GetScrollViewClientHeight();
-static void ScrollImageTo(int Xzoomed, int Yzoomed);
-static BOOL ChangeZoom(int n);
-
-
-/////////////////////////////////////////////////////////////////////
-
-#include "dmg_curs.h"
-
-enum
-{
-	DMG_CURS_STD,
-	DMG_CURS_MOVE,
-	DMG_CURS_ADD,
-	DMG_CURS_DEL,
-	DMG_CURS_ADDDEL,
-	DMG_CURS_LABELPOS,
-	DMG_CURS_PAN,
-};
-
-/////////////////////////////////////////////////////////////////////
-
-struct sVertex
-{
-	short x;
-	short y;
-};
-
-struct sShape
-{
-	sShape()
-	{
-		next = NULL;
-		owner = NULL;
-		bHole = FALSE;
-		memset(iBoundRect, 0, sizeof(iBoundRect));
-		iLabelPos[1] = iLabelPos[0] = 0;
-		iVertCount = 0;
-	}
-
-	void CalcBoundingRect()
-	{
-		iBoundRect[2] = iBoundRect[0] = verts[0].x;
-		iBoundRect[3] = iBoundRect[1] = verts[0].y;
-
-		for (int i=1; i<iVertCount; i++)
-		{
-			if (verts[i].x < iBoundRect[0])
-				iBoundRect[0] = verts[i].x;
-			else if (verts[i].x > iBoundRect[2])
-				iBoundRect[2] = verts[i].x;
-
-			if (verts[i].y < iBoundRect[1])
-				iBoundRect[1] = verts[i].y;
-			else if (verts[i].y > iBoundRect[3])
-				iBoundRect[3] = verts[i].y;
-		}
-	}
-
-	// complex point in poly algorithm posted on the net by Ken McElvain
-
-	/*
-	 * Quadrants:
-	 *    1 | 0
-	 *    -----
-	 *    2 | 3
-	 */
-	static inline int whichquad(const sVertex &pt, const sVertex &orig)
-	{
-		int quad;
-		if (pt.x < orig.x)
-		{
-			if (pt.y < orig.y) quad = 2;
-			else quad = 1;
-		}
-		else
-		{
-			if (pt.y < orig.y) quad = 3;
-			else quad = 0;
-		}
-		return quad;
-	}
-
-	BOOL IsPosInShape(int x, int y) const
-	{
-		if (iVertCount < 3)
-			return FALSE;
-
-		// do a quick bound rect test
-		if (x < iBoundRect[0] || x > iBoundRect[2] || y < iBoundRect[1] || y > iBoundRect[3])
-			return FALSE;
-
-		const sVertex* polypts = verts;
-		const sVertex pt = { (short int)x, (short int)y };
-
-		int wind = 0;
-		sVertex lastpt = polypts[iVertCount-1];
-		/* get starting angle */
-		int oldquad = whichquad(lastpt, pt);
-
-		for (int i=0; i<iVertCount; i++)
-		{
-			sVertex thispt = *polypts++;
-			int newquad = whichquad(thispt, pt);
-
-			if (oldquad != newquad)
-			{
-				/*
-				* use mod 4 comparisons to see if we have
-				* advanced or backed up one quadrant
-				*/
-				if (((oldquad + 1) & 3) == newquad)
-					wind++;
-				else if (((newquad + 1) & 3) == oldquad)
-					wind--;
-				else
-				{
-					/*
-					* upper left to lower right, or
-					* upper right to lower left. Determine
-					* direction of winding  by intersection
-					* with x==0.
-					*/
-					int a = (int)lastpt.y - (int)thispt.y;
-					a *= ((int)pt.x - (int)lastpt.x);
-					int b = (int)lastpt.x - (int)thispt.x;
-					a += (int)lastpt.y * b;
-					b *= (int)pt.y;
-
-					if (a > b) wind += 2;
-					else wind -= 2;
-				}
-				oldquad = newquad;
-			}
-			lastpt = thispt;
-		}
-
-		/* non-zero means point in poly */
-		return wind;
-	}
-
-	// returns TRUE is subShape is this shape or a hole in it
-	BOOL IsPartOf(const sShape &subShape) const
-	{
-		if (&subShape == this)
-			return TRUE;
-
-		if (!bHole)
-			for (const sShape *p=next; p && p->bHole; p=p->next)
-				if (p == &subShape)
-					return TRUE;
-
-		return FALSE;
-	}
-
-	void MovePos(int dx, int dy)
-	{
-		if (iVertCount <= 0)
-			return;
-
-		iBoundRect[0] += dx;
-		iBoundRect[1] += dy;
-		iBoundRect[2] += dx;
-		iBoundRect[3] += dy;
-
-		iLabelPos[0] += dx;
-		iLabelPos[1] += dy;
-
-		for (int i=0; i<iVertCount; i++)
-		{
-			verts[i].x += dx;
-			verts[i].y += dy;
-		}
-	}
-
-	sShape *next;
-	sLocation *owner;
-
-	BOOL bHole;
-
-	int iBoundRect[4];
-	int iLabelPos[2];
-
-	int iVertCount;
-	sVertex verts[MAX_VERTS];
-};
-
-struct sLocation
-{
-	sLocation()
-	{
-		img = NULL;
-		iLocationIndex = 0;
-		memset(iBoundRect, 0, sizeof(iBoundRect));
-		shape = NULL;
-	}
-	~sLocation()
-	{
-		while (shape)
-		{
-			sShape *p = shape;
-			shape = shape->next;
-			p->next = NULL;
-			delete p;
-		}
-	}
-
-	void FlushScaledImages()
-	{
-		if (img)
-		{
-			delete img;
-			img = NULL;
-		}
-	}
-
-	void CalcBoundingRect()
-	{
-		iBoundRect[0] = INT_MAX;
-		iBoundRect[1] = INT_MAX;
-		iBoundRect[2] = INT_MIN;
-		iBoundRect[3] = INT_MIN;
-
-		for (sShape *p=shape; p; p=p->next)
-		{
-			p->CalcBoundingRect();
-
-			if (p->iBoundRect[0] < iBoundRect[0])
-				iBoundRect[0] = p->iBoundRect[0];
-			if (p->iBoundRect[1] < iBoundRect[1])
-				iBoundRect[1] = p->iBoundRect[1];
-			if (p->iBoundRect[2] > iBoundRect[2])
-				iBoundRect[2] = p->iBoundRect[2];
-			if (p->iBoundRect[3] > iBoundRect[3])
-				iBoundRect[3] = p->iBoundRect[3];
-		}
-	}
-
-	// has more than one shape (a shape with holes counts as multiple)
-	BOOL IsMultiShape() const { return shape && shape->next; }
-
-	// has more than one solid shape (holes don't count)
-	BOOL IsMultiSolidShape() const
-	{
-		if (shape && shape->next)
-			for (const sShape *p=shape->next; p; p=p->next)
-				if (!p->bHole)
-					return TRUE;
-
-		return FALSE;
-	}
-
-	BOOL IsPosInLocation(int x, int y) const
-	{
-		for (sShape *p=shape; p; p=p->next)
-			if (!p->bHole && p->IsPosInShape(x, y))
-			{
-				// make sure it's not inside any hole of this shape
-				for (p=p->next; p && p->bHole; p=p->next)
-					if ( p->IsPosInShape(x, y) )
-						goto next_solid;
-				return TRUE;
-next_solid:;
-			}
-
-		return FALSE;
-	}
-
-	sShape* GetShapeContainingPos(int x, int y) const
-	{
-		// return last shape containting pos since that will be on top in the drawing order
-
-		sShape *ret = NULL;
-
-		for (sShape *p=shape; p; p=p->next)
-			if ( p->IsPosInShape(x, y) )
-				ret = p;
-
-		return ret;
-	}
-
-	BOOL IsVertPtrInLocation(const sVertex *pv) const
-	{
-		for (sShape *p=shape; p; p=p->next)
-			if (pv >= p->verts && pv < p->verts+MAX_VERTS)
-				return TRUE;
-
-		return FALSE;
-	}
-
-	// determine is 'ps' is the only non-hole shape in this location
-	BOOL IsOnlyNonHoleShape(const sShape *ps) const
-	{
-		if (!ps || ps->bHole || ps != shape)
-			return FALSE;
-
-		if (shape->next)
-		{
-			const sShape *p = shape->next;
-			while (p && p->bHole)
-				p = p->next;
-
-			return !p;
-		}
-
-		return TRUE;
-	}
-
-	void MovePos(int dx, int dy)
-	{
-		if (!shape)
-			return;
-
-		FlushScaledImages();
-
-		iBoundRect[0] += dx;
-		iBoundRect[1] += dy;
-		iBoundRect[2] += dx;
-		iBoundRect[3] += dy;
-
-		for (sShape *p=shape; p; p=p->next)
-			p->MovePos(dx, dy);
-	}
-
-	void AddShape(const sShape &sh, BOOL bHole = FALSE)
-	{
-		sShape *p = new sShape(sh);
-
-		p->owner = this;
-		p->bHole = bHole;
-
-		if (!shape)
-			shape = p;
-		else
-		{
-			// find last list element
-			sShape *last;
-			for (last=shape; last->next; last=last->next);
-
-			last->next = p;
-		}
-
-		FlushScaledImages();
-		CalcBoundingRect();
-	}
-
-	void AddShapeMaybeHole(const sShape &sh)
-	{
-		// determine if the added shape is a hole or not, by seeing if the first point is inside another shape
-		sShape *p = GetShapeContainingPos(sh.verts[0].x, sh.verts[0].y);
-
-		if (!p)
-			AddShape(sh);
-		else
-		{
-			// the new shape is a hole in 'p', insert the shape after 'p' in the list (as the last hole if it has several)
-
-			sShape *hole = new sShape(sh);
-			hole->owner = this;
-			hole->bHole = TRUE;
-			hole->iLabelPos[1] = hole->iLabelPos[0] = 0;
-
-			for (; p->next && p->next->bHole; p=p->next);
-
-			hole->next = p->next;
-			p->next = hole;
-
-			FlushScaledImages();
-			CalcBoundingRect();
-		}
-	}
-
-	void DeleteShape(sShape *pShape)
-	{
-		if (!pShape)
-			return;
-
-		// delete shape and holes belonging to the shape, if applicable
-
-		const BOOL bDelHoles = !pShape->bHole;
-
-		if (pShape == shape)
-		{
-			shape = pShape->next;
-			pShape->next = NULL;
-			delete pShape;
-
-			if (bDelHoles)
-			{
-				while (shape && shape->bHole)
-				{
-					pShape = shape;
-					shape = pShape->next;
-					pShape->next = NULL;
-					delete pShape;
-				}
-			}
-
-			// make sure the first shape isn't a whole (never should be)
-			if (shape && shape->bHole)
-				shape->bHole = FALSE;
-		}
-		else
-		{
-			for (sShape *p=shape; p; p=p->next)
-			{
-				if (p->next == pShape)
-				{
-					p->next = pShape->next;
-					pShape->next = NULL;
-					delete pShape;
-
-					if (bDelHoles)
-					{
-						while (p->next && p->next->bHole)
-						{
-							pShape = p->next;
-							p->next = pShape->next;
-							pShape->next = NULL;
-							delete pShape;
-						}
-					}
-
-					break;
-				}
-			}
-		}
-
-		FlushScaledImages();
-		CalcBoundingRect();
-	}
-
-	void UpdateShapeOwnerPtrs()
-	{
-		// 'this' pointer changed due to location array reshuffling, update the owner pointer in the shapes
-		for (sShape *p=shape; p; p=p->next)
-			p->owner = this;
-	}
-
-	int iLocationIndex;
-
-	// optional cached image of the location (used in some drawing modes)
-	Fl_Image *img;
-	int iImgViewPos[2];
-
-	int iBoundRect[4];
-
-	sShape *shape;
-};
-
-struct sMap
-{
-	sMap()
-	{
-		img = NULL;
-		imgscaled = NULL;
-		imgHilightSS2 = NULL;
-		iLocationCount = 0;
-	}
-	~sMap()
-	{
-		if (img)
-			delete img;
-		if (imgscaled)
-			delete imgscaled;
-		if (imgHilightSS2)
-			delete imgHilightSS2;
-	}
-
-	void FlushScaledImages()
-	{
-		if (imgscaled)
-		{
-			delete imgscaled;
-			imgscaled = NULL;
-		}
-
-		for (int i=0; i<iLocationCount; i++)
-			locs[i].FlushScaledImages();
-	}
-
-	int GetFreeLocationIndex() const
-	{
-		char used[MAX_LOCATIONS_PER_MAP] = {0};
-
-		for (int i=0; i<iLocationCount; i++)
-			used[locs[i].iLocationIndex] = 1;
-
-		for (int i=0; i<MAX_LOCATIONS_PER_MAP; i++)
-			if (!used[i])
-				return i;
-
-		return -1;
-	}
-
-	const sLocation* GetByLocationIndex(int iLocIdx) const
-	{
-		if (iLocIdx < 0)
-			return NULL;
-
-		for (int i=0; i<iLocationCount; i++)
-			if (locs[i].iLocationIndex == iLocIdx)
-				return &locs[i];
-
-		return NULL;
-	}
-
-	sLocation* GetByLocationIndex(int iLocIdx)
-	{
-		if (iLocIdx < 0)
-			return NULL;
-
-		for (int i=0; i<iLocationCount; i++)
-			if (locs[i].iLocationIndex == iLocIdx)
-				return &locs[i];
-
-		return NULL;
-	}
-
-	int GetArrayIndexFromLocationIndex(int iLocIdx) const
-	{
-		if (iLocIdx < 0)
-			return -1;
-
-		for (int i=0; i<iLocationCount; i++)
-			if (locs[i].iLocationIndex == iLocIdx)
-				return i;
-
-		return -1;
-	}
-
-	void DeleteLocation(int iArrayIndex)
-	{
-		if (iArrayIndex < 0)
-			return;
-
-		locs[iArrayIndex].FlushScaledImages();
-		locs[iArrayIndex].~sLocation();
-
-		if (iArrayIndex < iLocationCount-1)
-			for (int i=iArrayIndex; i<iLocationCount-iArrayIndex-1; i++)
-				locs[i] = locs[i+1];
-
-		iLocationCount--;
-
-		locs[iLocationCount] = sLocation();
-
-		for (int i=iArrayIndex; i<iLocationCount; i++)
-			locs[i].UpdateShapeOwnerPtrs();
-	}
-
-	Fl_Image *img;
-	Fl_Image *imgscaled;
-
-	// only available in SS2 mode, used for generating two sets of location images
-	// one for visited areas and one for hilighted area the player is currently in
-	Fl_Image *imgHilightSS2;
-
-	int iLocationCount;
-	sLocation locs[MAX_LOCATIONS_PER_MAP];
-};
-
-struct sProject
-{
-	sProject()
-	{
-		sDir = NULL;
-		iCurMap = 0;
-		iMapCount = 0;
-		bModified = FALSE;
-	}
-	~sProject()
-	{
-		if (sDir)
-			free(sDir);
-	}
-
-	void FlushScaledImages()
-	{
-		for (int i=0; i<iMapCount; i++)
-			maps[i].FlushScaledImages();
-	}
-
-	BOOL Load()
-	{
-		char s[MAX_PATH+32];
-		sprintf(s, "%s" DIRSEP_STR PROJ_FILENAME, sDir);
-
-		FILE *f = fl_fopen(s, "r");
-		if (!f)
-			// assume no project file, means we're starting a new project
-			return TRUE;
-
-		BOOL ret = TRUE;
-
-		sShape shape;
-		char sCmd[4];
-		int iCurPage = 0;
-
-		sMap *pMap = &maps[0];
-		sLocation *pLoc = &pMap->locs[0];
-
-		while ( !feof(f) )
-		{
-			sCmd[0] = 0;
-			fscanf(f, "%*[ ]");
-			fscanf(f, "%3s ", sCmd);
-
-			if ( feof(f) )
-				break;
-
-			if ( !fl_utf_strcasecmp(sCmd, "PAG") )
-			{
-				// start loading new page
-
-				iCurPage = -999999;
-				fscanf(f, "%d", &iCurPage);
-
-				if ((UINT)iCurPage >= (UINT)MAX_MAPS)
-				{
-					ret = FALSE;
-					break;
-				}
-
-				pMap = &maps[iCurPage];
-				pLoc = &pMap->locs[0];
-			}
-			else if ( !fl_utf_strcasecmp(sCmd, "LOC") )
-			{
-				if (pMap->iLocationCount >= MAX_LOCATIONS_PER_MAP)
-				{
-					ret = FALSE;
-					break;
-				}
-
-				int iVertCount = 0;
-				double dLocIdx = 0;
-
-				fscanf(f, "%lf %d", &dLocIdx, &iVertCount);
-
-				// some silliness to also detect -0 vals as negative (used for hole shapes in location 0)
-				BOOL bHole = _copysign(1.0, dLocIdx) < 0;
-
-				const int iLocIdx = (int)(fabs(dLocIdx) + 0.1);
-
-				if (iLocIdx >= MAX_LOCATIONS_PER_MAP || iVertCount < 3)
-				{
-					ret = FALSE;
-					break;
-				}
-
-				BOOL bNewLoc = TRUE;
-
-				// if location already exists then just add another sub-shape
-				pLoc = pMap->GetByLocationIndex(iLocIdx);
-				if (pLoc)
-					bNewLoc = FALSE;
-				else
-				{
-					pLoc = &pMap->locs[pMap->iLocationCount];
-					pLoc->iLocationIndex = iLocIdx;
-					// the first shape in a location can never be a hole
-					bHole = FALSE;
-				}
-
-				shape.iVertCount = iVertCount;
-
-				for (int i=0; i<iVertCount; i++)
-				{
-					if ( feof(f) )
-					{
-						ret = FALSE;
-						break;
-					}
-
-					int x = -999999, y = -999999;
-					fscanf(f, "%*[ ]");
-					fscanf(f, "(%d %d)", &x, &y);
-
-					if (y == -999999)
-					{
-						ret = FALSE;
-						break;
-					}
-
-					shape.verts[i].x = x;
-					shape.verts[i].y = y;
-				}
-
-				int x = -999999, y = -999999;
-				fscanf(f, "%*[ ]");
-				fscanf(f, "<%d %d>", &x, &y);
-				if (y != -999999)
-				{
-					shape.iLabelPos[0] = x;
-					shape.iLabelPos[1] = y;
-				}
-				else if (bHole)
-				{
-					shape.iLabelPos[0] = 0;
-					shape.iLabelPos[1] = 0;
-				}
-				else
-				{
-					// default label offset to bounds center (can be outside for concave shapes, but the user can move it if desired)
-					shape.CalcBoundingRect();
-					shape.iLabelPos[0] = shape.iBoundRect[0] + ((shape.iBoundRect[2] - shape.iBoundRect[0]) / 2);
-					shape.iLabelPos[1] = shape.iBoundRect[1] + ((shape.iBoundRect[3] - shape.iBoundRect[1]) / 2);
-				}
-
-				pLoc->AddShape(shape, bHole);
-
-				if (bNewLoc)
-					pMap->iLocationCount++;
-			}
-		}
-
-		fclose(f);
-
-		ClearModifiedFlag();
-
-		return ret;
-	}
-
-	BOOL Save()
-	{
-		char s[MAX_PATH+32];
-		sprintf(s, "%s" DIRSEP_STR PROJ_FILENAME, sDir);
-
-		FILE *f = fl_fopen(s, "w");
-		if (!f)
-		{
-			Fl_Window *w = Fl::first_window();
-			if (w)
-				fl_message_position(w);
-			fl_alert("Failed to open project file \"%s\" for saving", s);
-			return FALSE;
-		}
-
-		// save all pages that have locations, even if they have no image currently, it could be that an image failed to load
-		// or temporarily got lost, but wouldn't want to lose existing location data in that case
-		for (int j=0; j<MAX_MAPS; j++)
-		{
-			const sMap &map = maps[j];
-
-			if (!map.iLocationCount)
-				continue;
-
-			fprintf(f, "PAG %d\n", j);
-
-			for (int i=0; i<map.iLocationCount; i++)
-			{
-				const sLocation &loc = map.locs[i];
-
-				if (!loc.shape)
-					continue;
-
-				for (sShape *p=loc.shape; p; p=p->next)
-				{
-					if (p->bHole)
-						fprintf(f, "LOC -%d %d", loc.iLocationIndex, p->iVertCount);
-					else
-						fprintf(f, "LOC %d %d", loc.iLocationIndex, p->iVertCount);
-
-					for (int k=0; k<p->iVertCount; k++)
-						fprintf(f, " (%d %d)", p->verts[k].x, p->verts[k].y);
-
-					if (!p->bHole)
-						fprintf(f, " <%d %d>", p->iLabelPos[0], p->iLabelPos[1]);
-
-					fprintf(f, "\n");
-				}
-			}
-		}
-
-		fclose(f);
-
-		ClearModifiedFlag();
-
-		return TRUE;
-	}
-
-	char *sDir;
-
-	int iCurMap;
-	BOOL bModified;
-
-	int iMapCount;
-	sMap maps[MAX_MAPS];
-};
-
-
-/////////////////////////////////////////////////////////////////////
-
-static char g_sAppTitle[MAX_PATH+128];
-static char g_sAppTitleModified[MAX_PATH+128];
-
-// TRUE if running in System Shock 2 mode
-static BOOL g_bShockMaps = FALSE;
-
-static int g_iLocationImageExtraBorder = 0;
-static int g_iAlphaExportAA = 4;
-
-static sProject *g_pProj = NULL;
-static int g_iZoom = 2;
-static DisplayMode g_displayMode = DM_OUTLINES;
-static BOOL g_bFillNewShape = FALSE;
-static int g_iLineWidth = 0;
-static BOOL g_bDrawLabels = FALSE;
-static BOOL g_bDrawCursorGuides = FALSE;
-static BOOL g_bHideSelectedOutline = FALSE;
-
-static int g_iCurSelTreeId = -1;
-static Fl_Tree_Item *g_pCurSelTreeItem = NULL;
-// pixel center offset in zoomed image view coords
-static int g_iCTR = 0;
-
-static Fl_Double_Window *g_pMainWnd = NULL;
-static Fl_Scroll *g_pScrollView = NULL;
-static cImageView *g_pImageView = NULL;
-static Fl_Tree *g_pTreeView = NULL;
-static Fl_Menu_Bar *g_pMenuBar = NULL;
-static int g_iWplus, g_iHplus;
-static BOOL g_bUserDefinedWindowSize = FALSE;
-
-static BOOL g_bShowingFlInputDialog = FALSE;
-
-#if defined(__unix__) || defined(__UNIX__)
-// work around bug in X11
-static int g_iEventState = 0;
-#endif
-
-
-/////////////////////////////////////////////////////////////////////
-
-// WARNING: ugly mess ahead for all the edit mode/state stuff
-
-class cImageView : public Fl_Widget
-{
-public:
-	enum EditMode
-	{
-		EM_CREATE,
-		EM_MOVE,
-		EM_ADD_DEL,
-		EM_LABELPOS,
-	};
-
-public:
-	cImageView(int X, int Y, int W, int H)
-		: Fl_Widget(X, Y, W, H)
-	{
-		m_mode = EM_CREATE;
-		m_iDragging = 0;
-		m_bCreatingShape = FALSE;
-		m_iMousePos[1] = m_iMousePos[0] = 0;
-		m_iMousePosSnapped[1] = m_iMousePosSnapped[0] = 0;
-		m_iCurCursor = DMG_CURS_STD;
-
-		m_pEditShape = NULL;
-		m_pEditVert = NULL;
-		m_pHilightShape = NULL;
-		m_pHilightVert = NULL;
-		m_iInsEdge = -1;
-		m_pLabelShape = NULL;
-		m_bMaybeDeleteShape = FALSE;
-
-		m_bPanning = FALSE;
-		m_iPanRestoreCursor = 0;
-
-		m_newLoc.shape = &m_newShape;
-		m_newShape.owner = &m_newLoc;
-	}
-
-	virtual ~cImageView()
-	{
-		m_newLoc.shape = NULL;
-	}
-
-	int m_iCurCursor;
-	void set_cursor(int n, BOOL bForce = FALSE)
-	{
-		if (!bForce && m_iCurCursor == n)
-			return;
-
-		m_iCurCursor = n;
-
-		if (g_pImageView != Fl::belowmouse())
-			return;
-
-		const char **xpm = NULL;
-
-		switch (n)
-		{
-		case DMG_CURS_STD: xpm = dmg_std_xpm; break;
-		case DMG_CURS_MOVE: xpm = dmg_move_xpm; break;
-		case DMG_CURS_ADD: xpm = dmg_add_xpm; break;
-		case DMG_CURS_DEL: xpm = dmg_del_xpm; break;
-		case DMG_CURS_ADDDEL: xpm = dmg_adddel_xpm; break;
-		case DMG_CURS_LABELPOS: xpm = dmg_lblpos_xpm; break;
-		case DMG_CURS_PAN: xpm = dmg_pan_xpm; break;
-		}
-
-		Fl_Window *w = Fl::first_window();
-		if (w && xpm)
-		{
-			Fl_Pixmap pxm(xpm);
-			Fl_RGB_Image image(&pxm);
-
-			w->cursor(&image, 0, 0);
-		}
-		else
-			fl_cursor(FL_CURSOR_DEFAULT);
-	}
-
-	void UpdateEditMode()
-	{
-		if (m_iDragging || m_bPanning)
-			return;
-
-		EditMode newMode = EM_CREATE;
-
-		const BOOL bOldMaybeDeleteShape = m_bMaybeDeleteShape;
-		m_bMaybeDeleteShape = FALSE;
-
-		if ( EVENT_CTRL() )
-		{
-			if (EVENT_ALT() && !m_bCreatingShape && LOCIDX_FROM_TREE_ID(g_iCurSelTreeId) >= 0)
-			{
-				newMode = EM_LABELPOS;
-
-				// if the current location only has one label, then make that the labelshape without requiring mouse over
-				int iMap = g_pProj->iCurMap;
-				int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-				if (iMap >= 0 && iLoc >= 0 && !g_pProj->maps[iMap].locs[iLoc].IsMultiSolidShape())
-					m_pLabelShape = g_pProj->maps[iMap].locs[iLoc].shape;
-			}
-			else
-				newMode = EM_MOVE;
-		}
-		else if ( EVENT_ALT() )
-		{
-			if (!m_bCreatingShape)
-				newMode = EM_ADD_DEL;
-
-			m_bMaybeDeleteShape = (newMode == EM_ADD_DEL) && EVENT_SHIFT();
-		}
-		/*else if ( EVENT_SHIFT() )
-		{
-		}*/
-
-		if (m_bMaybeDeleteShape != bOldMaybeDeleteShape && newMode == EM_ADD_DEL)
-			redraw();
-
-		if (newMode == m_mode)
-			return;
-
-		if (m_mode == EM_LABELPOS)
-			// leaving EM_LABELPOS mode
-			m_pLabelShape = NULL;
-
-		m_mode = newMode;
-
-		switch (m_mode)
-		{
-		case EM_CREATE: set_cursor(DMG_CURS_STD); break;
-		case EM_MOVE: set_cursor(DMG_CURS_MOVE); break;
-		case EM_ADD_DEL:
-			if (m_pHilightVert)
-				set_cursor(DMG_CURS_DEL);
-			else if (m_iInsEdge >= 0)
-				set_cursor(DMG_CURS_ADD);
-			else
-				set_cursor(DMG_CURS_ADDDEL);
-			break;
-		case EM_LABELPOS: set_cursor(DMG_CURS_LABELPOS); break;
-		}
-
-		UpdateMouseOverCues();
-
-		redraw();
-	}
-
-	void UpdateMousePos()
-	{
-		int X = Fl::event_x() - x();
-		int Y = Fl::event_y() - y();
-
-		m_iMousePos[0] = X;
-		m_iMousePos[1] = Y;
-
-		m_iMousePosSnapped[0] = X;
-		m_iMousePosSnapped[1] = Y;
-
-		// snapping if shift is pressed
-		if (!EVENT_SHIFT() || g_pProj->iCurMap < 0 || m_mode == EM_LABELPOS)
-			return;
-
-		// "smart-snap (tm)", snap against any other shape vert if within snap radius to it
-		// if no direct snappable vert is found then snap axially against any vertex in the currently edited shape
-
-		sShape *pSnapShape = NULL;
-		int iSnapVert = -1;
-
-		if ( GetPosOverVert(X, Y, pSnapShape, iSnapVert) )
-		{
-			m_iMousePosSnapped[0] = MAP2CL(pSnapShape->verts[iSnapVert].x);
-			m_iMousePosSnapped[1] = MAP2CL(pSnapShape->verts[iSnapVert].y);
-			return;
-		}
-
-		if (!m_iDragging || (m_pEditVert && m_iDragging))
-		{
-			// no snap vert found, do axial alignment snapping to verts of current location
-
-			const sMap &map = g_pProj->maps[g_pProj->iCurMap];
-
-			const sLocation *pSnapLoc = m_bCreatingShape ? &m_newLoc : (m_pEditShape ? m_pEditShape->owner : NULL);
-			if (!pSnapLoc)
-			{
-				int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-				if (iLoc >= 0)
-					pSnapLoc = &map.locs[iLoc];
-			}
-
-			if (pSnapLoc)
-			{
-				const sVertex *pHorzSnap = NULL;
-				const sVertex *pVertSnap = NULL;
-
-				const sLocation &loc = *pSnapLoc;
-
-				for (sShape *p=loc.shape; p; p=p->next)
-				{
-					for (int i=0; i<p->iVertCount; i++)
-					{
-						const sVertex &vert = p->verts[i];
-
-						if (&vert == m_pEditVert)
-							continue;
-
-						const int dx = abs(MAP2CL(vert.x) - X);
-						if (dx < SNAP_RADIUS && (!pHorzSnap || dx < abs(MAP2CL(pHorzSnap->x) - X)))
-							pHorzSnap = &vert;
-
-						const int dy = abs(MAP2CL(vert.y) - Y);
-						if (dy < SNAP_RADIUS && (!pVertSnap || dy < abs(MAP2CL(pVertSnap->y) - Y)))
-							pVertSnap = &vert;
-					}
-				}
-
-				if (pHorzSnap)
-					m_iMousePosSnapped[0] = MAP2CL(pHorzSnap->x);
-
-				if (pVertSnap)
-					m_iMousePosSnapped[1] = MAP2CL(pVertSnap->y);
-			}
-		}
-	}
-
-	void UpdateMouseOverCues()
-	{
-		sVertex *prev = m_pHilightVert;
-		m_pHilightVert = NULL;
-
-		int iPrevEdge = m_iInsEdge;
-		m_iInsEdge = -1;
-
-		if (m_mode == EM_CREATE && m_bCreatingShape)
-		{
-			// if shape can be finalized by clicking on the first vertex then hilight it
-			if (m_newShape.iVertCount > 2 && IsPosOverVert(m_iMousePos[0], m_iMousePos[1], m_newShape.verts[0]))
-			{
-				m_pHilightVert = &m_newShape.verts[0];
-				m_pHilightShape = &m_newShape;
-			}
-		}
-		else if (m_mode == EM_LABELPOS)
-		{
-			// if location has multiple labels then highlight the one the mouse is over
-			int iMap = g_pProj->iCurMap;
-			int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-			if (iMap >= 0 && iLoc >= 0 && g_pProj->maps[iMap].locs[iLoc].IsMultiSolidShape())
-			{
-				const sShape *pPrevLabelShape = m_pLabelShape;
-				m_pLabelShape = NULL;
-				int iCurDist = INT_MAX, iDist;
-
-				for (sShape *p=g_pProj->maps[iMap].locs[iLoc].shape; p; p=p->next)
-					if (!p->bHole && IsPosOverLabel(m_iMousePos[0], m_iMousePos[1], *p, iDist) && iDist < iCurDist)
-					{
-						iCurDist = iDist;
-						m_pLabelShape = p;
-					}
-
-				if (m_pLabelShape != pPrevLabelShape)
-					redraw();
-			}
-		}
-		else if (m_mode == EM_MOVE || (m_mode == EM_ADD_DEL && !m_bCreatingShape))
-		{
-			sLocation *pLoc = m_pEditShape ? m_pEditShape->owner : NULL;
-			if (!pLoc)
-			{
-				int iMap = g_pProj->iCurMap;
-				int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-				if (iMap >= 0 && iLoc >= 0)
-					pLoc = &g_pProj->maps[iMap].locs[iLoc];
-			}
-
-			if (pLoc)
-			{
-				sShape *p;
-				int i;
-
-				if ( GetPosOverVert(m_iMousePos[0], m_iMousePos[1], p, i, pLoc) )
-				{
-					m_pHilightVert = &p->verts[i];
-					m_pHilightShape = p;
-					pLoc = p->owner;
-				}
-			}
-
-			if (m_mode == EM_ADD_DEL && pLoc && !m_pHilightVert)
-			{
-				// check if over an edge and display virtual insert point
-				for (sShape *p=pLoc->shape; p; p=p->next)
-				{
-					for (int i=0; i<p->iVertCount; i++)
-					{
-						if ( IsPosOverEdge(m_iMousePos[0], m_iMousePos[1], p->verts[i], p->verts[(i + 1) % p->iVertCount], m_insVert) )
-						{
-							m_iInsEdge = i;
-							m_pHilightShape = p;
-							goto found_edge;
-						}
-					}
-				}
-found_edge:;
-			}
-		}
-
-		if (!m_pHilightVert && m_iInsEdge < 0)
-			m_pHilightShape = NULL;
-
-		if (m_mode == EM_ADD_DEL)
-		{
-			if (m_pHilightVert)
-				set_cursor(DMG_CURS_DEL);
-			else if (m_iInsEdge >= 0)
-				set_cursor(DMG_CURS_ADD);
-			else
-				set_cursor(DMG_CURS_ADDDEL);
-		}
-
-		if (m_pHilightVert != prev || m_iInsEdge != iPrevEdge || m_iInsEdge >= 0)
-			redraw();
-	}
-
-	static BOOL IsPosOverVert(int Xclient, int Yclient, const sVertex &vtx)
-	{
-		const int D = SNAP_RADIUS;
-
-		const int X = MAP2CL(vtx.x);
-		const int Y = MAP2CL(vtx.y);
-
-		return (Xclient >= X-D && Yclient >= Y-D && Xclient <= X+D && Yclient <= Y+D);
-	}
-
-	static BOOL IsPosOverEdge(int Xclient, int Yclient, const sVertex &v0, sVertex &v1, sVertex &pointOnEdge)
-	{
-		int dx = (v1.x - v0.x) * g_iZoom;
-		int dy = (v1.y - v0.y) * g_iZoom;
-
-		int lensq = dx*dx + dy*dy;
-
-		if (lensq <= 1)
-			return FALSE;
-
-		int mdx = Xclient - MAP2CL(v0.x);
-		int mdy = Yclient - MAP2CL(v0.y);
-
-		float f = (float)(mdx * dx + mdy * dy) / (float)lensq;
-
-		if (f <= 0.0f || f >= 1.0f)
-			return FALSE;
-
-		pointOnEdge.x = (MAP2CL(v0.x) + (int)((float)dx * f)) / g_iZoom;
-		pointOnEdge.y = (MAP2CL(v0.y) + (int)((float)dy * f)) / g_iZoom;
-
-		const int D = SNAP_RADIUS;
-
-		dx = (Xclient / g_iZoom) - pointOnEdge.x;
-		dy = (Yclient / g_iZoom) - pointOnEdge.y;
-
-		return (dx*dx + dy*dy) <= D;
-	}
-
-	static BOOL IsPosOverLabel(int Xclient, int Yclient, const sShape &sh, int &iDistSq)
-	{
-		// a bit larger than actual label size (or half to be precisce, since these values are max distance from center)
-		const int Dx = 16;
-		const int Dy = 10;
-
-		const int X = Xclient / g_iZoom;
-		const int Y = Yclient / g_iZoom;
-
-		iDistSq = (sh.iLabelPos[0]-X)*(sh.iLabelPos[0]-X) + (sh.iLabelPos[1]-Y)*(sh.iLabelPos[1]-Y);
-
-		return (X >= sh.iLabelPos[0]-Dx && Y >= sh.iLabelPos[1]-Dy && X <= sh.iLabelPos[0]+Dx && Y <= sh.iLabelPos[1]+Dy);
-	}
-
-	static int DistSqToVert(const int Xclient, const int Yclient, const sVertex &vert)
-	{
-		const int dx = Xclient - MAP2CL(vert.x);
-		const int dy = Yclient - MAP2CL(vert.y);
-		return dx * dx + dy * dy;
-	}
-
-	BOOL GetPosOverVert(int Xclient, int Yclient, sShape *&pOverShape, int &iOverVert, const sLocation *pLoc = NULL) const
-	{
-		const int D = SNAP_RADIUS;
-
-		pOverShape = NULL;
-		iOverVert = -1;
-		int iOverVertDist = INT_MAX;
-
-		const int iLocs = pLoc ? 1 : g_pProj->maps[g_pProj->iCurMap].iLocationCount;
-
-		for (int j=0; j<iLocs; j++)
-		{
-			sLocation &loc = pLoc ? *(sLocation*)pLoc : g_pProj->maps[g_pProj->iCurMap].locs[j];
-
-			// do a quick bound rect test
-			if ((Xclient < (loc.iBoundRect[0] * g_iZoom)-D || Xclient > (loc.iBoundRect[2] * g_iZoom + g_iZoom-1)+D
-				|| Yclient < (loc.iBoundRect[1] * g_iZoom)-D || Yclient > (loc.iBoundRect[3] * g_iZoom + g_iZoom-1)+D)
-				&& pLoc != &m_newLoc)
-				continue;
-
-			for (sShape *p=loc.shape; p; p=p->next)
-				for (int i=0; i<p->iVertCount; i++)
-					if ( IsPosOverVert(Xclient, Yclient, p->verts[i]) )
-					{
-						const int dist = DistSqToVert(Xclient, Yclient, p->verts[i]);
-						if (dist < iOverVertDist)
-						{
-							iOverVert = i;
-							pOverShape = p;
-							iOverVertDist = dist;
-						}
-					}
-		}
-
-		return iOverVert >= 0;
-	}
-
-	virtual int handle(int ev)
-	{
-		switch (ev)
-		{
-		case FL_PUSH:
-			UpdateMousePos();
-
-			if (m_iDragging)
-				return 1;
-
-			if (m_bPanning)
-			{
-				if (Fl::event_button() == FL_LEFT_MOUSE)
-				{
-					m_iPanRefMousePos[0] = Fl::event_x();
-					m_iPanRefMousePos[1] = Fl::event_y();
-					m_iPanRefScrollPos[0] = g_pScrollView->xposition();
-					m_iPanRefScrollPos[1] = g_pScrollView->yposition();
-					m_iDragging = FL_LEFT_MOUSE;
-				}
-				return 1;
-			}
-
-			if (Fl::event_button() == FL_LEFT_MOUSE)
-			{
-				m_iDragging = FL_LEFT_MOUSE;
-
-				if (m_mode == EM_CREATE)
-				{
-					if (!m_bCreatingShape)
-					{
-						take_focus();
-						m_bCreatingShape = TRUE;
-						m_newShape.iVertCount = 0;
-
-						m_pEditShape = &m_newShape;
-
-						AddShapePoint(m_iMousePosSnapped[0], m_iMousePosSnapped[1]);
-					}
-					else
-					{
-						if (m_pHilightVert == &m_newShape.verts[0] && m_newShape.iVertCount > 2)
-						{
-							// clicked on the first vertex to complete the shape loop
-							CommitShapeAsNewLoc();
-							return 1;
-						}
-
-						AddShapePoint(m_iMousePosSnapped[0], m_iMousePosSnapped[1]);
-					}
-
-					m_pHilightVert = m_pEditVert;
-					m_pHilightShape = m_pEditShape;
-				}
-				else if (m_mode == EM_MOVE)
-				{
-					if (m_pHilightVert)
-					{
-						m_pEditVert = m_pHilightVert;
-						m_pEditShape = m_pHilightShape;
-					}
-				}
-				else if (m_mode == EM_ADD_DEL)
-				{
-					if (m_pHilightVert)
-					{
-						if ( DeleteShapePoint(m_pHilightShape, m_pHilightVert) )
-						{
-							m_pHilightShape = NULL;
-							m_pHilightVert = NULL;
-						}
-						UpdateEditMode();
-					}
-					else if (!m_pHilightVert && m_iInsEdge >= 0 && m_pHilightShape)
-					{
-						InsertShapePoint();
-						redraw();
-					}
-				}
-				else if (m_mode == EM_LABELPOS)
-				{
-					UpdateLabelPos(m_iMousePos[0], m_iMousePos[1]);
-				}
-			}
-			else if (Fl::event_button() == FL_RIGHT_MOUSE)
-			{
-				m_iDragging = FL_RIGHT_MOUSE;
-
-				if (m_mode == EM_CREATE)
-				{
-					if (m_bCreatingShape)
-						DeleteLastNewShapePoint();
-					else
-						SelectShapeFromPos(m_iMousePos[0], m_iMousePos[1]);
-				}
-			}
-			else if (Fl::event_button() == FL_MIDDLE_MOUSE)
-			{
-				if (m_bCreatingShape)
-				{
-					if ( EVENT_ALT() )
-						CommitSubShape();
-					else
-						CommitShapeAsNewLoc();
-				}
-			}
-			return 1;
-
-		case FL_RELEASE:
-			if (Fl::event_button() != m_iDragging)
-				return 1;
-
-			m_iDragging = 0;
-			m_pEditVert = NULL;
-			if (!m_bCreatingShape)
-				m_pEditShape = NULL;
-			UpdateEditMode();
-			UpdateMouseOverCues();
-			redraw();
-			return 1;
-
-		case FL_DRAG:
-			UpdateMousePos();
-
-			if (m_bPanning)
-			{
-				int nx = m_iPanRefScrollPos[0] + (m_iPanRefMousePos[0] - Fl::event_x());
-				int ny = m_iPanRefScrollPos[1] + (m_iPanRefMousePos[1] - Fl::event_y());
-
-				ScrollImageTo(nx, ny);
-
-				return 1;
-			}
-
-			if (m_pEditVert)
-			{
-				// drag-move the just created point until mouse button gets released
-				UpdateCurShapePoint(m_iMousePosSnapped[0], m_iMousePosSnapped[1]);
-				redraw();
-			}
-			else if (m_mode == EM_LABELPOS)
-			{
-				UpdateLabelPos(m_iMousePos[0], m_iMousePos[1]);
-			}
-			else if (m_bCreatingShape || g_bDrawCursorGuides)
-				redraw();
-			return 1;
-
-		case FL_MOVE:
-			UpdateMousePos();
-			if (m_bPanning)
-				return 1;
-			if (m_bCreatingShape || g_bDrawCursorGuides)
-				redraw();
-			UpdateMouseOverCues();
-			return 1;
-
-		case FL_KEYDOWN:
-			if (m_bPanning)
-				return 1;
-
-			switch ( Fl::event_key() )
-			{
-			case FL_Escape:
-				if (m_bCreatingShape)
-					AbortShape();
-				return 1;
-
-			case FL_Enter:
-				if (m_bCreatingShape)
-					CommitShapeAsNewLoc();
-				return 1;
-
-			case FL_Shift_L:
-			case FL_Shift_R:
-#if defined(__unix__) || defined(__UNIX__)
-				g_iEventState |= FL_SHIFT;
-#endif
-				if (m_bCreatingShape)
-				{
-					UpdateMousePos();
-					redraw();
-					return 1;
-				}
-				UpdateEditMode();
-				break;
-
-			case FL_Control_L:
-			case FL_Control_R:
-#if defined(__unix__) || defined(__UNIX__)
-				g_iEventState |= FL_CTRL;
-#endif
-				UpdateEditMode();
-				return 1;
-
-			case FL_Alt_L:
-			case FL_Alt_R:
-#if defined(__unix__) || defined(__UNIX__)
-				g_iEventState |= FL_ALT;
-#endif
-				UpdateEditMode();
-				return 1;
-
-			case FL_Delete:
-			case FL_BackSpace:
-				if (m_bCreatingShape)
-				{
-					DeleteLastNewShapePoint();
-					return 1;
-				}
-				break;
-
-			case FL_Insert:
-				if (m_bCreatingShape)
-				{
-					CommitSubShape();
-					return 1;
-				}
-				break;
-
-			case ' ':
-				if (!m_iDragging && m_mode == EM_CREATE)
-				{
-					m_bPanning = TRUE;
-					m_iPanRestoreCursor = m_iCurCursor;
-					set_cursor(DMG_CURS_PAN);
-					redraw();
-				}
-				break;
-			}
-			break;
-
-		case FL_KEYUP:
-			switch ( Fl::event_key() )
-			{
-			case FL_Shift_L:
-			case FL_Shift_R:
-#if defined(__unix__) || defined(__UNIX__)
-				g_iEventState &= ~FL_SHIFT;
-#endif
-				if (m_bCreatingShape && !m_bPanning)
-				{
-					UpdateMousePos();
-					redraw();
-					return 1;
-				}
-				break;
-
-#if defined(__unix__) || defined(__UNIX__)
-			case FL_Control_L:
-			case FL_Control_R:
-				g_iEventState &= ~FL_CTRL;
-				break;
-
-			case FL_Alt_L:
-			case FL_Alt_R:
-				g_iEventState &= ~FL_ALT;
-				break;
-#endif
-
-			case ' ':
-				if (m_bPanning)
-				{
-					m_bPanning = FALSE;
-					set_cursor(m_iPanRestoreCursor);
-					UpdateEditMode();
-					redraw();
-				}
-				break;
-			}
-			UpdateEditMode();
-			break;
-
-		case FL_MOUSEWHEEL:
-			if (m_iDragging)
-				return 1;
-			if ( EVENT_ALT() )
-			{
-				// zoom around mouse cursor (maintain same orig map XY pos at cursor before and after zoom change)
-				int Xclient = Fl::event_x() - g_pScrollView->x();
-				int Yclient = Fl::event_y() - g_pScrollView->y();
-				// if mouse is outside the client area then zoom around center
-				if (Xclient < 0 || Yclient < 0 || Xclient >= g_pScrollView->w() || Yclient >= g_pScrollView->h())
-				{
-					Xclient = g_pScrollView->w() / 2;
-					Yclient = g_pScrollView->h() / 2;
-				}
-
-				const int Xmap = (g_pScrollView->xposition() + Xclient) / g_iZoom;
-				const int Ymap = (g_pScrollView->yposition() + Yclient) / g_iZoom;
-
-				BOOL ret = FALSE;
-				if (Fl::event_dy() < 0)
-					ret = ChangeZoom(g_iZoom + 1);
-				else if (Fl::event_dy() > 0)
-					ret = ChangeZoom(g_iZoom - 1);
-
-				if (ret)
-					ScrollImageTo(Xmap * g_iZoom - Xclient, Ymap * g_iZoom - Yclient);
-
-				return 1;
-			}
-			else if ( EVENT_CTRL() )
-			{
-				if ( g_pScrollView->hscrollbar.visible() )
-				{
-					const int e_dx = Fl::e_dx;
-					Fl::e_dx = Fl::e_dy;
-
-					g_pScrollView->hscrollbar.handle(FL_MOUSEWHEEL);
-
-					Fl::e_dx = e_dx;
-				}
-				return 1;
-			}
-			break;
-
-		case FL_FOCUS:
-		case FL_UNFOCUS:
-			return 1;
-
-		case FL_ENTER:
-			take_focus();
-			set_cursor(m_iCurCursor, TRUE);
-			return 1;
-
-		case FL_LEAVE:
-			fl_cursor(FL_CURSOR_DEFAULT);
-			m_iDragging = 0;
-			return 1;
-		}
-
-		return Fl_Widget::handle(ev);
-	}
-
-	virtual void draw()
-	{
-		if (g_pProj->iCurMap < 0)
-		{
-			fl_rectf(x(), y(), w(), h(), FL_DARK1);
-			return;
-		}
-
-		fl_push_clip(x(), y(), w(), h());
-
-		const int dx = x();
-		const int dy = y();
-
-		sMap &map = g_pProj->maps[g_pProj->iCurMap];
-
-		// draw page image
-
-		Fl_Image *img = map.img;
-
-		if (map.img)
-		{
-			if (g_displayMode == DM_FADE_NONSEL)
-			{
-				if (!map.imgscaled)
-				{
-					map.imgscaled = img->copy(img->w() * g_iZoom, img->h() * g_iZoom);
-					FakeTransparentImage(map.imgscaled, FL_DARK1);
-				}
-
-				img = map.imgscaled;
-			}
-			else if (g_iZoom != 1)
-			{
-				if (!map.imgscaled)
-					map.imgscaled = img->copy(img->w() * g_iZoom, img->h() * g_iZoom);
-
-				img = map.imgscaled;
-			}
-
-			img->draw(dx, dy);
-		}
-		else
-			fl_rectf(dx, dy, w(), h(), FL_DARK1);
-
-		// draw shapes (currently selected shape is drawn last to ensure it's not obstructed)
-
-		const int AA = min(g_iAlphaExportAA, 4);
-
-		int iCurSel = -1;
-
-		// if shapes are filled then draw locations in two passes, first only the filling, then all outlines, handles and labels
-		// to ensure that important visual cues are always visible and not hidden behind filled shapes
-		const BOOL bFill = g_displayMode == DM_FILLALL;
-		const BOOL bTwoPass = bFill || g_displayMode == DM_DIMMED;
-
-		for (int pass = 0; pass < (bTwoPass ? 2 : 1); pass++)
-		{
-			const BOOL bFillThisPass = bFill ? (bTwoPass ? (pass ? FALSE : 2) : TRUE) : FALSE;
-
-			for (int i=0; i<map.iLocationCount; i++)
-			{
-				const BOOL bCurSel = (g_iCurSelTreeId >= 0 && (UINT)g_iCurSelTreeId == MAKE_TREE_ID(g_pProj->iCurMap, map.locs[i].iLocationIndex));
-				if (bCurSel)
-				{
-					iCurSel = i;
-					continue;
-				}
-
-				if (g_displayMode == DM_DIMMED && map.img)
-				{
-					if (!map.locs[i].img)
-						GenerateLocationImageForView(map, map.locs[i], AA);
-
-					if (map.locs[i].img)
-						map.locs[i].img->draw(dx + map.locs[i].iImgViewPos[0], dy + map.locs[i].iImgViewPos[1]);
-				}
-
-				DrawShape(map.locs[i], SHAPE_LINE_COLOR, FALSE, TRUE, bFillThisPass, g_bDrawLabels);
-			}
-		}
-
-		// currently selected shape
-		if (iCurSel != -1)
-		{
-			const int i = iCurSel;
-			const BOOL bFill = g_displayMode == DM_FILLALL || g_displayMode == DM_FILLSEL;
-
-			BOOL bShowHandles = !m_bCreatingShape;
-
-			if (bShowHandles && g_displayMode > DM_OUTLINES && g_bHideSelectedOutline)
-				// show handles but no outlines
-				bShowHandles = 2;
-
-			if (g_displayMode >= DM_DIMMED && map.img)
-			{
-				if (!map.locs[i].img)
-					GenerateLocationImageForView(map, map.locs[i], g_displayMode != DM_FADE_NONSEL, AA);
-
-				if (map.locs[i].img)
-					map.locs[i].img->draw(dx + map.locs[i].iImgViewPos[0], dy + map.locs[i].iImgViewPos[1]);
-			}
-
-			DrawShape(map.locs[i], CUR_SHAPE_LINE_COLOR, bShowHandles, TRUE, bFill, (m_mode == EM_LABELPOS) ? 2 : g_bDrawLabels);
-		}
-
-		// draw cross-hair guide lines
-		if (g_bDrawCursorGuides && !m_bPanning && m_mode != EM_ADD_DEL)
-		{
-			// snap position to (center of) map pixels
-			int X = MAP2CL(m_iMousePosSnapped[0] / g_iZoom);
-			int Y = MAP2CL(m_iMousePosSnapped[1] / g_iZoom);
-
-			fl_color( fl_color_average(FL_BLACK, INPROGRESS_SHAPE_COLOR, 0.25f) );
-			fl_line_style(FL_DASH, 0);
-			fl_line(dx, dy + Y, dx + w(), dy + Y);
-			fl_line(dx + X, dy, dx + X, dy + h());
-			fl_line_style(0);
-		}
-
-		// draw in-progress shape
-		if (m_bCreatingShape && m_newShape.iVertCount)
-		{
-			if (g_bFillNewShape && m_newShape.iVertCount > 1)
-			{
-				fl_color( fl_color_average(FL_BLACK, INPROGRESS_SHAPE_COLOR, 0.5f) );
-
-				fl_begin_complex_polygon();
-				for (int i=0; i<m_newShape.iVertCount; i++)
-				{
-					int X = dx + MAP2CL(m_newShape.verts[i].x);
-					int Y = dy + MAP2CL(m_newShape.verts[i].y);
-
-					fl_vertex((double)X, (double)Y);
-				}
-
-				fl_vertex((double)(dx + m_iMousePosSnapped[0]), (double)(dy + m_iMousePosSnapped[1]));
-
-				fl_end_complex_polygon();
-			}
-
-			DrawShape(m_newShape, INPROGRESS_SHAPE_COLOR, TRUE, FALSE);
-
-			if (m_mode == EM_CREATE)
-			{
-				// draw rubber-band from last vert to mouse
-				fl_color(INPROGRESS_SHAPE_COLOR);
-				fl_line_style(FL_DOT, g_iLineWidth);
-				const int Xprev = dx + MAP2CL(m_newShape.verts[m_newShape.iVertCount-1].x);
-				const int Yprev = dy + MAP2CL(m_newShape.verts[m_newShape.iVertCount-1].y);
-				fl_line(Xprev, Yprev, dx+m_iMousePosSnapped[0], dy+m_iMousePosSnapped[1]);
-				// draw rubber-band from mouse to first vert if there are at least 2 verts
-				if (m_newShape.iVertCount >= 2)
-				{
-					const int Xfirst = dx + MAP2CL(m_newShape.verts[0].x);
-					const int Yfirst = dy + MAP2CL(m_newShape.verts[0].y);
-					fl_line(dx+m_iMousePosSnapped[0], dy+m_iMousePosSnapped[1], Xfirst, Yfirst);
-				}
-				fl_line_style(0);
-			}
-		}
-
-		// draw insert-point
-		if (m_iInsEdge >= 0 && m_pHilightShape)
-		{
-			const int X = dx + MAP2CL(m_insVert.x);
-			const int Y = dy + MAP2CL(m_insVert.y);
-
-			const int rect[4] = { X-VERT_HANDLE_RADIUS, Y-VERT_HANDLE_RADIUS, VERT_HANDLE_RADIUS*2+1, VERT_HANDLE_RADIUS*2+1 };
-
-			fl_rectf(rect[0]+1, rect[1]+1, rect[2]-2, rect[3]-2, INPROGRESS_SHAPE_COLOR);
-			fl_rect(rect[0], rect[1], rect[2], rect[3], VERT_FRAME_COLOR);
-		}
-
-		fl_pop_clip();
-	}
-
-	void DrawShape(const sLocation &loc, Fl_Color linecolor, BOOL bShowHandles, BOOL bClosed = TRUE, BOOL bFilled = FALSE, BOOL bDrawLabel = FALSE)
-	{
-		const sShape *next = loc.shape;
-		while (next)
-			next = DrawShape(*next, linecolor, bShowHandles, bClosed, bFilled, bDrawLabel);
-	}
-
-	const sShape* DrawShape(const sShape &shape, Fl_Color linecolor, BOOL bShowHandles, BOOL bClosed = TRUE, BOOL bFilled = FALSE, BOOL bDrawLabel = FALSE)
-	{
-		const int dx = x();
-		const int dy = y();
-
-		if (bFilled && shape.iVertCount > 2)
-		{
-			fl_color( fl_color_average(FL_BLACK, linecolor, 0.5f) );
-
-			fl_begin_complex_polygon();
-			for (const sShape *p=&shape; p; p=p->next)
-			{
-				if (p->bHole && p != &shape)
-					fl_gap();
-
-				for (int i=0; i<p->iVertCount; i++)
-				{
-					const int X = dx + MAP2CL(p->verts[i].x);
-					const int Y = dy + MAP2CL(p->verts[i].y);
-
-					fl_vertex((double)X, (double)Y);
-				}
-
-				if (p->next && !p->next->bHole)
-					break;
-			}
-			fl_end_complex_polygon();
-		}
-
-		if (bFilled == 2)
-		{
-			for (const sShape *p=&shape; p; p=p->next)
-				if (p->next && !p->next->bHole)
-					return p->next;
-
-			return NULL;
-		}
-
-		if (bDrawLabel)
-		{
-			const int X = dx + MAP2CL(shape.iLabelPos[0]);
-			const int Y = dy + MAP2CL(shape.iLabelPos[1]);
-
-			char s[16];
-			sprintf(s, "%03d", shape.owner->iLocationIndex);
-
-			int tw, th;
-
-			if (bDrawLabel == 2)
-			{
-				if (m_pLabelShape == &shape)
-				{
-					fl_font(FL_HELVETICA | FL_BOLD, FL_NORMAL_SIZE);
-					fl_measure(s, tw, th);
-					fl_rectf(X-(tw/2)-2, Y-(th/2)-2, tw+4, th+4, CUR_VERT_COLOR);
-					fl_color(FL_BLACK);
-				}
-				else
-				{
-					fl_font(FL_HELVETICA | FL_BOLD, FL_NORMAL_SIZE);
-					fl_measure(s, tw, th);
-					fl_color(CUR_VERT_COLOR);
-				}
-			}
-			else
-			{
-				fl_font(FL_HELVETICA, FL_NORMAL_SIZE);
-				fl_measure(s, tw, th);
-				fl_color(linecolor);
-			}
-			fl_draw(s, X - (tw/2), Y - (th/2), tw, th, FL_ALIGN_LEFT|FL_ALIGN_TOP|FL_ALIGN_INSIDE);
-		}
-
-		int Xprev, Yprev;
-		const sShape *ret = NULL;
-
-		// drawing an open loop is only an option for the main shape, not holes (open loops are only drawn for the in-progress shape
-		// which never is multi-shaped anyway)
-		int n = bClosed ? shape.iVertCount + 1 : shape.iVertCount;
-
-		for (const sShape *p=&shape; p; p=p->next)
-		{
-			// if vertex is hilighted for delete and the shape only has 3 verts, then also hilight all verts to indicate shape deletion
-			// otherwise only hilight all if shape delete modifier key is pressed
-			const BOOL bHilightAllVerts = (m_pHilightVert && m_mode == EM_ADD_DEL && m_pHilightShape && m_pHilightShape->IsPartOf(*p) &&
-				(m_pHilightShape->iVertCount == 3 || m_bMaybeDeleteShape));
-
-			if (p != &shape)
-				n = p->iVertCount + 1;
-
-			if (bShowHandles != 2)
-			{
-				for (int i=0; i<n; i++)
-				{
-					const int j = i % p->iVertCount;
-					const int X = dx + MAP2CL(p->verts[j].x);
-					const int Y = dy + MAP2CL(p->verts[j].y);
-
-					if (!bShowHandles)
-					{
-						const int rect[4] = { X-VERT_RADIUS, Y-VERT_RADIUS, VERT_RADIUS*2+1, VERT_RADIUS*2+1 };
-
-						fl_rectf(rect[0], rect[1], rect[2], rect[3], linecolor);
-					}
-
-					if (i)
-					{
-						fl_color(linecolor);
-						fl_line_style(FL_DOT, g_iLineWidth);
-						fl_line(Xprev, Yprev, X, Y);
-						fl_line_style(0);
-					}
-
-					Xprev = X;
-					Yprev = Y;
-				}
-			}
-
-			if (bShowHandles)
-			{
-				for (int i=0; i<n; i++)
-				{
-					const int j = i % p->iVertCount;
-					const int X = dx + MAP2CL(p->verts[j].x);
-					const int Y = dy + MAP2CL(p->verts[j].y);
-
-					const int rect[4] = { X-VERT_HANDLE_RADIUS, Y-VERT_HANDLE_RADIUS, VERT_HANDLE_RADIUS*2+1, VERT_HANDLE_RADIUS*2+1 };
-
-					const BOOL bHilightVert = m_pHilightVert == &p->verts[j] || bHilightAllVerts;
-
-					fl_rectf(rect[0]+1, rect[1]+1, rect[2]-2, rect[3]-2, bHilightVert ? CUR_VERT_COLOR : VERT_COLOR);
-					fl_rect(rect[0], rect[1], rect[2], rect[3], VERT_FRAME_COLOR);
-
-					Xprev = X;
-					Yprev = Y;
-				}
-			}
-
-			if (p->next && !p->next->bHole)
-			{
-				ret = p->next;
-				break;
-			}
-		}
-
-		return ret;
-	}
-
-	void AddShapePoint(int mouse_x, int mouse_y)
-	{
-		if (m_newShape.iVertCount >= MAX_VERTS || !m_bCreatingShape)
-			return;
-
-		const int X = mouse_x / g_iZoom;
-		const int Y = mouse_y / g_iZoom;
-
-		m_newShape.verts[m_newShape.iVertCount].x = X;
-		m_newShape.verts[m_newShape.iVertCount].y = Y;
-
-		m_pEditVert = &m_newShape.verts[m_newShape.iVertCount];
-
-		m_newShape.iVertCount++;
-		m_newShape.CalcBoundingRect();
-
-		redraw();
-	}
-
-	void UpdateCurShapePoint(int mouse_x, int mouse_y)
-	{
-		if (!m_pEditVert)
-			return;
-
-		const int X = mouse_x / g_iZoom;
-		const int Y = mouse_y / g_iZoom;
-
-		m_pEditVert->x = X;
-		m_pEditVert->y = Y;
-
-		m_pEditShape->owner->CalcBoundingRect();
-		m_pEditShape->owner->FlushScaledImages();
-
-		// if modifying an actual shape in the project then make sure modified flag is set
-		if (m_pEditShape != &m_newShape)
-			SetModifiedFlag();
-	}
-
-	void InsertShapePoint()
-	{
-		if (m_iInsEdge < 0 || !m_pHilightShape || m_pHilightShape->iVertCount >= MAX_VERTS)
-			return;
-
-		sShape &shape = *m_pHilightShape;
-
-		if (m_iInsEdge < shape.iVertCount-1)
-			memmove(shape.verts + m_iInsEdge + 2, shape.verts + m_iInsEdge + 1, sizeof(shape.verts[0]) * (shape.iVertCount - m_iInsEdge - 1));
-		shape.verts[m_iInsEdge+1] = m_insVert;
-
-		shape.iVertCount++;
-
-		m_pHilightVert = &shape.verts[m_iInsEdge+1];
-		m_pEditVert = m_pHilightVert;
-		m_pEditShape = m_pHilightShape;
-		m_iInsEdge = -1;
-
-		shape.owner->CalcBoundingRect();
-		shape.owner->FlushScaledImages();
-
-		// if modifying an actual shape in the project then make sure modified flag is set
-		if (m_pEditShape != &m_newShape)
-			SetModifiedFlag();
-	}
-
-	void DeleteLastNewShapePoint()
-	{
-		if (!m_bCreatingShape)
-			return;
-
-		if (m_newShape.iVertCount > 1)
-		{
-			m_newShape.iVertCount--;
-			m_newShape.CalcBoundingRect();
-			redraw();
-		}
-		else
-			AbortShape();
-	}
-
-	BOOL DeleteShapePoint(sShape *pShape, sVertex *pVert)
-	{
-		if (pShape->iVertCount <= 3 || m_bMaybeDeleteShape)
-		{
-			if (pShape == &m_newShape)
-				return FALSE;
-
-			// if deleting the last shape of the location then ask if location really should be deleted
-			if ( pShape->owner->IsOnlyNonHoleShape(pShape) )
-			{
-				const int n = g_pProj->maps[g_pProj->iCurMap].iLocationCount;
-
-				m_iDragging = 0;
-
-				OnCmdDelete();
-
-				if (g_pProj->maps[g_pProj->iCurMap].iLocationCount != n)
-				{
-					m_pEditVert = NULL;
-					return TRUE;
-				}
-
-				return FALSE;
-			}
-
-			if ( pShape->owner->IsMultiShape() )
-			{
-				sLocation &loc = *pShape->owner;
-
-				loc.DeleteShape(pShape);
-
-				if (m_pEditVert && !loc.IsVertPtrInLocation(m_pEditVert))
-					m_pEditVert = NULL;
-
-				SetModifiedFlag();
-
-				return TRUE;
-			}
-
-			return FALSE;
-		}
-
-		int iVert = -1;
-		for (int i=0; i<pShape->iVertCount; i++)
-			if (&pShape->verts[i] == pVert)
-			{
-				iVert = i;
-				break;
-			}
-
-		if (iVert < 0)
-			return FALSE;
-
-		if (iVert < pShape->iVertCount-1)
-			memmove(pShape->verts + iVert, pShape->verts + iVert + 1, sizeof(pShape->verts[0]) * (pShape->iVertCount - iVert - 1));
-
-		pShape->iVertCount--;
-		pShape->owner->CalcBoundingRect();
-		pShape->owner->FlushScaledImages();
-
-		if (m_pEditVert == pVert)
-			m_pEditVert = NULL;
-
-		// if modifying an actual shape in the project then make sure modified flag is set
-		if (pShape != &m_newShape)
-			SetModifiedFlag();
-
-		return TRUE;
-	}
-
-	void CommitShapeAsNewLoc()
-	{
-		if (!m_bCreatingShape || m_newShape.iVertCount < 3)
-			return;
-
-		const int iNewLocIndex = g_pProj->maps[g_pProj->iCurMap].GetFreeLocationIndex();
-		if (iNewLocIndex < 0)
-			return;
-
-		sMap &map = g_pProj->maps[g_pProj->iCurMap];
-
-		sLocation &newLoc = map.locs[map.iLocationCount];
-		map.iLocationCount++;
-
-		// default label offset to bounds center (can be outside for concave shapes, but the user can move it if desired)
-		m_newShape.CalcBoundingRect();
-		m_newShape.iLabelPos[0] = m_newShape.iBoundRect[0] + ((m_newShape.iBoundRect[2] - m_newShape.iBoundRect[0]) / 2);
-		m_newShape.iLabelPos[1] = m_newShape.iBoundRect[1] + ((m_newShape.iBoundRect[3] - m_newShape.iBoundRect[1]) / 2);
-
-		newLoc.iLocationIndex = iNewLocIndex;
-		newLoc.AddShape(m_newShape);
-
-		g_pTreeView->begin();
-		char s[64];
-		sprintf(s, "PAGE%03d/%03d", g_pProj->iCurMap, iNewLocIndex);
-		Fl_Tree_Item *p = g_pTreeView->add(s);
-		p->user_data( (void*)(intptr_t)MAKE_TREE_ID(g_pProj->iCurMap, iNewLocIndex) );
-		g_pTreeView->end();
-		g_pTreeView->select_only(p);
-		g_pTreeView->set_item_focus(p);
-
-		m_newShape.iVertCount = 0;
-		m_pEditShape = NULL;
-		m_pEditVert = NULL;
-		m_pHilightVert = NULL;
-		m_pHilightShape = NULL;
-		m_bCreatingShape = FALSE;
-
-		SetModifiedFlag();
-
-		redraw();
-	}
-
-	void CommitSubShape()
-	{
-		if (!m_bCreatingShape || m_newShape.iVertCount < 3)
-			return;
-
-		const int iMap = g_pProj->iCurMap;
-		const int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-
-		if (iMap < 0 || iLoc < 0)
-			return;
-
-		sMap &map = g_pProj->maps[g_pProj->iCurMap];
-		sLocation &loc = map.locs[iLoc];
-
-		// default label offset to bounds center (can be outside for concave shapes, but the user can move it if desired)
-		m_newShape.CalcBoundingRect();
-		m_newShape.iLabelPos[0] = m_newShape.iBoundRect[0] + ((m_newShape.iBoundRect[2] - m_newShape.iBoundRect[0]) / 2);
-		m_newShape.iLabelPos[1] = m_newShape.iBoundRect[1] + ((m_newShape.iBoundRect[3] - m_newShape.iBoundRect[1]) / 2);
-
-		// auto-detect if shape is a hole, determined if the first shape point is inside another non-hole shape of the location
-		loc.AddShapeMaybeHole(m_newShape);
-
-		m_newShape.iVertCount = 0;
-		m_pEditShape = NULL;
-		m_pEditVert = NULL;
-		m_pHilightVert = NULL;
-		m_pHilightShape = NULL;
-		m_bCreatingShape = FALSE;
-
-		SetModifiedFlag();
-
-		redraw();
-	}
-
-	void AbortShape()
-	{
-		m_newShape.iVertCount = 0;
-		m_pEditShape = NULL;
-		m_pEditVert = NULL;
-		m_bCreatingShape = FALSE;
-
-		redraw();
-	}
-
-	void UpdateLabelPos(int mouse_x, int mouse_y)
-	{
-		if (!m_pLabelShape)
-			return;
-
-		const int X = mouse_x / g_iZoom;
-		const int Y = mouse_y / g_iZoom;
-
-		m_pLabelShape->iLabelPos[0] = X;
-		m_pLabelShape->iLabelPos[1] = Y;
-
-		SetModifiedFlag();
-
-		redraw();
-	}
-
-	void SelectShapeFromPos(int mouse_x, int mouse_y)
-	{
-		char s[64];
-
-		const int X = mouse_x / g_iZoom;
-		const int Y = mouse_y / g_iZoom;
-
-		// support selection cycling if there are overlapping locations
-		int iCurSelLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId); 
-		if (iCurSelLoc < 0)
-			iCurSelLoc = 0;
-		else
-			iCurSelLoc++;
-
-		for (int k=0, j=iCurSelLoc; k<g_pProj->maps[g_pProj->iCurMap].iLocationCount; k++, j++)
-		{
-			const int i = j % g_pProj->maps[g_pProj->iCurMap].iLocationCount;
-
-			if ( g_pProj->maps[g_pProj->iCurMap].locs[i].IsPosInLocation(X, Y) )
-			{
-				sprintf(s, "PAGE%03d/%03d", g_pProj->iCurMap, g_pProj->maps[g_pProj->iCurMap].locs[i].iLocationIndex);
-				Fl_Tree_Item *pItem = g_pTreeView->find_item(s);
-				if (pItem)
-				{
-					g_pTreeView->select_only(pItem);
-					g_pTreeView->set_item_focus(pItem);
-					redraw();
-				}
-
-				return;
-			}
-		}
-
-		// no shape found, select page (/ deselect current selection)
-		sprintf(s, "PAGE%03d", g_pProj->iCurMap);
-		Fl_Tree_Item *pItem = g_pTreeView->find_item(s);
-		if (pItem)
-		{
-			g_pTreeView->select_only(pItem);
-			g_pTreeView->set_item_focus(pItem);
-			redraw();
-		}
-	}
-
-	EditMode m_mode;
-
-	int m_iDragging;
-
-	// current mouse pos (in local widget coords)
-	int m_iMousePos[2];
-	int m_iMousePosSnapped[2];
-
-	// in-progress drawn shape
-	BOOL m_bCreatingShape;
-	sShape m_newShape;
-	sLocation m_newLoc;
-
-	// current shape and vert being edited
-	sShape *m_pEditShape;
-	sVertex *m_pEditVert;
-
-	sShape *m_pHilightShape;
-	sVertex *m_pHilightVert;
-	int m_iInsEdge;
-	sVertex m_insVert;
-	// current label that can be moved (only valid during EM_LABELPOS)
-	sShape *m_pLabelShape;
-
-	// TRUE when hovering over a vertex and holding down shift in EM_ADD_DEL
-	// used to indicate that a vertex delete operation in this state will delete the entire shape
-	// (this var should never be used if m_pHilightVert is NULL)
-	BOOL m_bMaybeDeleteShape;
-
-	BOOL m_bPanning;
-	int m_iPanRestoreCursor;
-	int m_iPanRefMousePos[2];
-	int m_iPanRefScrollPos[2];
-};
-
-
-/////////////////////////////////////////////////////////////////////
-
-class cMainWindow : public Fl_Double_Window
-{
-public:
-	cMainWindow(int W, int H, const char *l = 0) : Fl_Double_Window(W, H, l) {}
-
-	virtual void resize(int X, int Y, int W, int H)
-	{
-		Fl_Double_Window::resize(X, Y, W, H);
-
-		OnWindowResized(W, H);
-	}
-};
-
-class Fl_Tree_Ex : public Fl_Tree
-{
-public:
-	Fl_Tree_Ex(int X, int Y, int W, int H) : Fl_Tree(X,Y,W,H) {}
-
-	virtual int handle(int ev)
-	{
-		if (ev == FL_ENTER)
-		{
-			take_focus();
-			return 1;
-		}
-
-		return Fl_Tree::handle(ev);
-	}
-};
-
-
-/////////////////////////////////////////////////////////////////////
-
-static BOOL LoadProject(const char *sDir)
-{
-	char s[MAX_PATH*2];
-	char s2[MAX_PATH*2];
-
-	if (g_pProj)
-		delete g_pProj;
-
-	if (g_bShockMaps == -1)
-	{
-		// auto-detect shock/thief mode
-		g_bShockMaps = FALSE;
-
-		struct stat st;
-		sprintf(s, "%s" DIRSEP_STR "page001a.png", sDir);
-		if ( !fl_stat(s, &st) )
-		{
-			sprintf(s, "%s" DIRSEP_STR "page001a-hi.png", sDir);
-			if ( !fl_stat(s, &st) )
-				g_bShockMaps = TRUE;
-		}
-	}
-
-	g_pProj = new sProject;
-
-	g_pProj->sDir = strdup(sDir);
-
-	// loads any map images found, without requiring a gap-free sequence
-	for (int i=0; i<MAX_MAPS; i++)
-	{
-		if (g_bShockMaps)
-			sprintf(s, "%s" DIRSEP_STR "page%03da.png", sDir, i);
-		else
-			sprintf(s, "%s" DIRSEP_STR "page%03d.png", sDir, i);
-
-		Fl_PNG_Image *img = new Fl_PNG_Image(s);
-		if ( !img->w() )
-		{
-			delete img;
-			continue;
-		}
-		if (img->d() != 3 && img->d() != 4)
-		{
-			// will probably never happen, Fl_PNG_Image should load-convert to true-color
-			fl_message_position(g_pMainWnd);
-			fl_alert("Failed to load image \"%s\", not a 24- or 32-bit image", s);
-			delete img;
-			continue;
-		}
-
-		if (g_bShockMaps)
-		{
-			sprintf(s2, "%s" DIRSEP_STR "page%03da-hi.png", sDir, i);
-
-			Fl_PNG_Image *imgHi = new Fl_PNG_Image(s2);
-			if ( !imgHi->w() )
-			{
-				delete img;
-				delete imgHi;
-				continue;
-			}
-			if (imgHi->d() != 3 && imgHi->d() != 4)
-			{
-				// will probably never happen, Fl_PNG_Image should load-convert to true-color
-				fl_message_position(g_pMainWnd);
-				fl_alert("Failed to load image \"%s\", not a 24- or 32-bit image", s2);
-				delete img;
-				delete imgHi;
-				continue;
-			}
-			if (imgHi->w() != img->w() || imgHi->h() != img->h())
-			{
-				// will probably never happen, Fl_PNG_Image should load-convert to true-color
-				fl_message_position(g_pMainWnd);
-				fl_alert("Failed to load map, image \"%s\" and \"%s\" are not the same size", s, s2);
-				delete img;
-				delete imgHi;
-				continue;
-			}
-
-			g_pProj->maps[i].imgHilightSS2 = imgHi;
-		}
-
-		g_pProj->maps[i].img = img;
-		g_pProj->iMapCount = i+1;
-	}
-
-	if ( !g_pProj->Load() )
-		return FALSE;
-
-	return TRUE;
-}
-
-static Fl_RGB_Image* GenerateLocationImage(const sMap &map, const sLocation &loc, int *pOutPos, const int iExtraBorder = 0, const int AA = 4)
-{
-	int brect[4] = { loc.iBoundRect[0], loc.iBoundRect[1], loc.iBoundRect[2], loc.iBoundRect[3] };
-
-	if (iExtraBorder > 0)
-	{
-		brect[0] -= iExtraBorder;
-		brect[1] -= iExtraBorder;
-		brect[2] += iExtraBorder;
-		brect[3] += iExtraBorder;
-
-		if (brect[0] < 0) brect[0] = 0;
-		if (brect[1] < 0) brect[1] = 0;
-		if (brect[2] >= map.img->w()) brect[2] = map.img->w() - 1;
-		if (brect[3] >= map.img->h()) brect[3] = map.img->h() - 1;
-	}
-
-	const int w = brect[2] - brect[0] + 1;
-	const int h = brect[3] - brect[1] + 1;
-
-	if (w <= 0 || h <= 0)
-		return NULL;
-
-	// xy offset for shape upper left corner
-	const int xoffs = brect[0];
-	const int yoffs = brect[1];
-
-	if (pOutPos)
-	{
-		pOutPos[0] = xoffs;
-		pOutPos[1] = yoffs;
-	}
-
-	// draw shape polygon into an off-screen surface to generate an alpha mask
-	// (surface is AA times larger and then downscaled with boxfilter to get an anti-aliased alpha mask)
-
-	Fl_Image_Surface *surf = new Fl_Image_Surface(w*AA, h*AA);
-
-	surf->set_current();
-
-	fl_push_clip(0, 0, w*AA, h*AA);
-
-	fl_rectf(0, 0, w*AA, h*AA, FL_BLACK);
-
-	fl_color(FL_WHITE);
-
-	const double ctr = (double)AA / 2.0;
-
-	const sShape *p = loc.shape;
-	while (p)
-	{
-		fl_begin_complex_polygon();
-		for (; p; p=p->next)
-		{
-			if (p->bHole && p != loc.shape)
-				fl_gap();
-
-			for (int i=0; i<p->iVertCount; i++)
-			{
-				int X = (p->verts[i].x - xoffs) * AA;
-				int Y = (p->verts[i].y - yoffs) * AA;
-
-				fl_vertex((double)X + ctr, (double)Y + ctr);
-			}
-
-			if (p->next && !p->next->bHole)
-				break;
-		}
-		fl_end_complex_polygon();
-
-		if (p)
-			p = p->next;
-	}
-
-	fl_pop_clip();
-
-	Fl_RGB_Image *alphamask = surf->image();
-
-	delete surf;
-	Fl_Display_Device::display_device()->set_current();
-
-	// downscale alphamask to original size
-
-	const BYTE *srcdata = (const BYTE *) alphamask->data()[0];
-	const int Dsrc = alphamask->d();
-	int iPitchSrc = w * AA * Dsrc + alphamask->ld();
-
-	BYTE *data = new BYTE[w * h * 4];
-
-	for (int y=0, ysrc=0; y<h; y++, ysrc+=AA)
-	{
-		for (int x=0, xsrc=0; x<w; x++, xsrc+=AA)
-		{
-			// get average alpha val for the current AAxAA sized box
-			int iAlpha = 0;
-			for (int yy=0; yy<AA; yy++)
-				for (int xx=0; xx<AA; xx++)
-					iAlpha += (int)(UINT)srcdata[(ysrc + yy) * iPitchSrc + (xsrc + xx) * Dsrc];
-			iAlpha /= AA * AA;
-
-			data[(y * w + x) * 4 + 3] = iAlpha;
-		}
-	}
-
-	delete alphamask;
-
-	// copy RGB components for brect from unscaled original map image
-
-	srcdata = (const BYTE*) map.img->data()[0];
-	iPitchSrc = map.img->w() * map.img->d() + map.img->ld();
-
-	if (map.img->d() == 3)
-	{
-		for (int y=0; y<h; y++)
-		{
-			for (int x=0; x<w; x++)
-			{
-				const int i = (y * w + x) * 4;
-				const int j = (y + yoffs) * iPitchSrc + (x + xoffs) * 3;
-
-				data[i+0] = srcdata[j+0];
-				data[i+1] = srcdata[j+1];
-				data[i+2] = srcdata[j+2];
-			}
-		}
-	}
-	else if (map.img->d() == 4)
-	{
-		for (int y=0; y<h; y++)
-		{
-			for (int x=0; x<w; x++)
-			{
-				const int i = (y * w + x) * 4;
-				const int j = (y + yoffs) * iPitchSrc + (x + xoffs) * 4;
-
-				data[i+0] = srcdata[j+0];
-				data[i+1] = srcdata[j+1];
-				data[i+2] = srcdata[j+2];
-			}
-		}
-	}
-
-	// create image object
-
-	Fl_RGB_Image *img = new Fl_RGB_Image(data, w, h, 4);
-
-	return img;
-}
-
-// to be called directly after GenerateLocationImage to get a second variant of the image based on sMap::imgHilightSS2 instead
-static Fl_RGB_Image* GenerateLocationImageHilightSS2(Fl_RGB_Image *pImgNonHi, const sMap &map, int xoffs, int yoffs)
-{
-	// copy RGB components for brect from unscaled original map image
-
-	const int w = pImgNonHi->w();
-	const int h = pImgNonHi->h();
-
-	const BYTE *srcdata = (const BYTE*) map.imgHilightSS2->data()[0];
-	const int iPitchSrc = map.imgHilightSS2->w() * map.imgHilightSS2->d() + map.imgHilightSS2->ld();
-
-	Fl_RGB_Image *img = (Fl_RGB_Image*) pImgNonHi->copy();
-	const int iPitchDst = img->w() * img->d() + img->ld();
-	BYTE *data = (BYTE*) img->data()[0];
-
-	if (map.imgHilightSS2->d() == 3)
-	{
-		for (int y=0; y<h; y++)
-		{
-			for (int x=0; x<w; x++)
-			{
-				const int i = y * iPitchDst + x * 4;
-				const int j = (y + yoffs) * iPitchSrc + (x + xoffs) * 3;
-
-				data[i+0] = srcdata[j+0];
-				data[i+1] = srcdata[j+1];
-				data[i+2] = srcdata[j+2];
-			}
-		}
-	}
-	else if (map.imgHilightSS2->d() == 4)
-	{
-		for (int y=0; y<h; y++)
-		{
-			for (int x=0; x<w; x++)
-			{
-				const int i = y * iPitchDst + x * 4;
-				const int j = (y + yoffs) * iPitchSrc + (x + xoffs) * 4;
-
-				data[i+0] = srcdata[j+0];
-				data[i+1] = srcdata[j+1];
-				data[i+2] = srcdata[j+2];
-			}
-		}
-	}
-
-	return img;
-}
-
-static void GenerateLocationImageForView(const sMap &map, sLocation &loc, BOOL bDim, const int AA)
-{
-	if (loc.img)
-		loc.FlushScaledImages();
-
-	Fl_RGB_Image *img = GenerateLocationImage(map, loc, loc.iImgViewPos, 0, AA);
-	if (!img)
-		return;
-
-	if (bDim)
-	{
-		// desaturate and darken the image
-
-		BYTE *data = (BYTE*) img->data()[0];
-		const int iPitch = img->w() * 4 + img->ld();
-
-		for (int y=0; y<img->h(); y++)
-		{
-			for (int x=0; x<img->w(); x++)
-			{
-				const int i = y * iPitch + x * 4;
-
-				UINT clr = ((UINT)data[i] * 31 + (UINT)data[i+1] * 61 + (UINT)data[i+2] * 8) / 100;
-				clr >>= 1;
-
-				data[i+0] = (BYTE)clr;
-				data[i+1] = (BYTE)clr;
-				data[i+2] = (BYTE)clr;
-			}
-		}
-	}
-
-	// scale to view size if necessary
-	if (g_iZoom != 1)
-	{
-		Fl_Image *scaled = img->copy(img->w() * g_iZoom, img->h() * g_iZoom);
-		delete img;
-		loc.img = scaled;
-	}
-	else
-		loc.img = img;
-
-	loc.iImgViewPos[0] *= g_iZoom;
-	loc.iImgViewPos[1] *= g_iZoom;
-}
-
-
-static void FakeTransparentImage(Fl_Image *img, Fl_Color bg, const UINT alpha)
-{
-	if (!img || (img->d() != 4 && img->d() != 3))
-		return;
-
-	const UINT alpha_inv = 255 - alpha;
-
-	BYTE rgb[3];
-	Fl::get_color(bg, rgb[0], rgb[1], rgb[2]);
-
-	const UINT r = (UINT)rgb[0] * alpha_inv;
-	const UINT g = (UINT)rgb[1] * alpha_inv;
-	const UINT b = (UINT)rgb[2] * alpha_inv;
-
-	BYTE *data = (BYTE*) img->data()[0];
-	const int D = img->d();
-	const int iPitch = img->w() * D + img->ld();
-
-	for (int y=0; y<img->h(); y++)
-	{
-		for (int x=0; x<img->w(); x++)
-		{
-			const int i = y * iPitch + x * D;
-
-			data[i] = (BYTE)(((UINT)data[i] * alpha + r) / 255);
-			data[i+1] = (BYTE)(((UINT)data[i+1] * alpha + g) / 255);
-			data[i+2] = (BYTE)(((UINT)data[i+2] * alpha + b) / 255);
-		}
-	}
-}
-
-
-static void fwrite_png(png_structp pPng, png_bytep data, png_size_t length) { fwrite(data, 1, length, (FILE*)png_get_io_ptr(pPng)); }
-static void fflush_png(png_structp pPng) { fflush( (FILE*)png_get_io_ptr(pPng) ); }
-static png_voidp malloc_png(png_structp, png_alloc_size_t size) { return malloc(size); }
-static void free_png(png_structp, png_voidp p) { free(p); }
-
-#ifndef png_jmpbuf
-#  define png_jmpbuf(pPng) ((pPng)->png_jmpbuf)
-#endif
-
-static BOOL SavePNG32(Fl_RGB_Image *img, char *sFileName)
-{
-	if ( !strchr(sFileName, '.') )
-		strcat(sFileName, ".png");
-
-	if (!img || img->d() != 4)
-		return FALSE;
-
-	FILE *f = fl_fopen(sFileName, "wb");
-	if (!f)
-		return FALSE;
-
-	png_structp pPng = png_create_write_struct_2(PNG_LIBPNG_VER_STRING,
-		NULL, NULL, NULL,
-		NULL, malloc_png, free_png);
-	if (!pPng)
-	{
-		fclose(f);
-		return FALSE;
-	}
-
-	png_infop pPngInfo = png_create_info_struct(pPng);
-	if (!pPngInfo)
-	{
-		png_destroy_write_struct(&pPng, NULL);
-		fclose(f);
-		return FALSE;
-	}
-
-	if ( setjmp( png_jmpbuf(pPng) ) )
-	{
-		// exception thrown during read
-		png_destroy_write_struct(&pPng, &pPngInfo);
-		fclose(f);
-		return FALSE;
-	}
-
-	png_set_write_fn(pPng, (void*)f, fwrite_png, fflush_png);
-
-	png_set_IHDR(pPng, pPngInfo, img->w(), img->h(), 8,
-		PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
-		PNG_FILTER_TYPE_BASE);
-
-	png_bytep *pImgLines = new png_bytep[img->h()];
-
-	const BYTE *srcdata = (const BYTE*) img->data()[0];
-	const int iPitchSrc = img->w() * 4 + img->ld();
-	for (int y=0; y<img->h(); y++)
-		pImgLines[y] = (png_bytep)(srcdata + y * iPitchSrc);
-
-	png_write_info(pPng, pPngInfo);
-	png_write_image(pPng, pImgLines);
-	png_write_end(pPng, pPngInfo);
-	png_destroy_write_struct(&pPng, NULL);
-
-	fclose(f);
-
-	delete[] pImgLines;
-
-	return TRUE;
-}
-
-static BOOL SaveTGA32(Fl_RGB_Image *img, char *sFileName)
-{
-	if ( !strchr(sFileName, '.') )
-		strcat(sFileName, ".tga");
-
-	if (!img || img->d() != 4)
-		return FALSE;
-
-	FILE *f = fl_fopen(sFileName, "wb");
-	if (!f)
-		return FALSE;
-
-	#pragma pack(1)
-	struct sTgaHeader
-	{
-		BYTE id_len;
-		BYTE col_map_type;
-		BYTE img_type;
-		WORD col_map_orig;
-		WORD col_map_len;
-		BYTE col_mat_bpp;
-		WORD x_orig;
-		WORD y_orig;
-		WORD width;
-		WORD height;
-		BYTE bpp;
-		BYTE img_descr;
-	};
-	#pragma pack()
-
-	sTgaHeader hdr = {};
-
-	hdr.img_type = 2;
-	hdr.bpp = 32;
-	hdr.width = img->w();
-	hdr.height = img->h();
-	hdr.img_descr |= 0x20;
-
-	fwrite(&hdr, sizeof(hdr), 1, f);
-
-	const BYTE *srcdata = (const BYTE*) img->data()[0];
-	const int iPitchSrc = img->w() * 4 + img->ld();
-
-	for (int y=0; y<img->h(); y++)
-	{
-		const BYTE *line = srcdata + y * iPitchSrc;
-		for (int x=0; x<img->w(); x++)
-		{
-			const BYTE pixel[4] = { line[x*4+2], line[x*4+1], line[x*4], line[x*4+3] };
-			fwrite(pixel, 4, 1, f);
-		}
-	}
-
-	fclose(f);
-
-	return TRUE;
-}
-
-// save PNG or TGA 32-bit image
-static BOOL SaveImg32(Fl_RGB_Image *img, char *sFileName, BOOL bTGA)
-{
-	return bTGA ? SaveTGA32(img, sFileName) : SavePNG32(img, sFileName);
-}
-
-static void GenerateFiles(BOOL bSaveTGA, int iGenerateMap = -1, int iGenerateLocIdx = -1)
-{
-	fl_cursor(FL_CURSOR_WAIT);
-
-	int iGeneratedImages = 0;
-	int iGeneratedPages = 0;
-	BOOL bErrors = FALSE;
-	char s[MAX_PATH+32];
-
-	for (int i=0; i<g_pProj->iMapCount; i++)
-	{
-		const sMap &map = g_pProj->maps[i];
-
-		if (!map.img || !map.iLocationCount || (iGenerateMap >= 0 && iGenerateMap != i))
-			continue;
-
-		iGeneratedPages++;
-
-		// dark rects file containing the location positions (in index order)
-		sprintf(s, "p%03dra.bin", i);
-		FILE *f = fl_fopen(s, "wb");
-		if (!f)
-		{
-			fl_cursor(FL_CURSOR_DEFAULT);
-			fl_message_position(g_pMainWnd);
-			fl_alert("Failed to save rects file \"%s\"", s);
-			fl_cursor(FL_CURSOR_WAIT);
-			bErrors = TRUE;
-		}
-
-		FILE *f2 = NULL;
-		if (g_bShockMaps)
-		{
-			sprintf(s, "p%03dxa.bin", i);
-			FILE *f2 = fl_fopen(s, "wb");
-			if (!f2)
-			{
-				fl_cursor(FL_CURSOR_DEFAULT);
-				fl_message_position(g_pMainWnd);
-				fl_alert("Failed to save rects file \"%s\"", s);
-				fl_cursor(FL_CURSOR_WAIT);
-				bErrors = TRUE;
-			}
-		}
-
-		for (int j=0; j<map.iLocationCount; j++)
-		{
-			const sLocation *pLoc = map.GetByLocationIndex(j);
-			if (!pLoc)
-			{
-				// no defined location for this index, add dummy entry in rects file
-				short darkRect[4] = {0};
-				if (f)
-					fwrite(darkRect, sizeof(darkRect), 1, f);
-				if (f2)
-					fwrite(darkRect, sizeof(darkRect), 1, f2);
-
-				continue;
-			}
-
-			const sLocation &loc = *pLoc;
-
-			int iImgPos[2];
-			short darkRect[4];
-
-			Fl_RGB_Image *img = GenerateLocationImage(map, loc, iImgPos, g_iLocationImageExtraBorder, g_iAlphaExportAA);
-			if (img)
-			{
-				if (iGenerateLocIdx < 0 || iGenerateLocIdx == j)
-				{
-					if (g_bShockMaps)
-						sprintf(s, "%s" DIRSEP_STR "p%03dx%03d", g_pProj->sDir, i, loc.iLocationIndex);
-					else
-						sprintf(s, "%s" DIRSEP_STR "p%03dr%03d", g_pProj->sDir, i, loc.iLocationIndex);
-
-					if ( !SaveImg32(img, s, bSaveTGA) )
-					{
-						fl_cursor(FL_CURSOR_DEFAULT);
-						fl_message_position(g_pMainWnd);
-						fl_alert("Failed to save location image \"%s\"", s);
-						fl_cursor(FL_CURSOR_WAIT);
-						delete img;
-						bErrors = TRUE;
-						break;
-					}
-
-					if (g_bShockMaps)
-					{
-						Fl_RGB_Image *imgHi = GenerateLocationImageHilightSS2(img, map, iImgPos[0], iImgPos[1]);
-						if (!imgHi)
-						{
-							fl_cursor(FL_CURSOR_DEFAULT);
-							fl_message_position(g_pMainWnd);
-							fl_alert("Failed to generate location hilight image %03d on PAG%03d", loc.iLocationIndex, i);
-							fl_cursor(FL_CURSOR_WAIT);
-							bErrors = TRUE;
-							delete img;
-							break;
-						}
-
-						sprintf(s, "%s" DIRSEP_STR "p%03dr%03d", g_pProj->sDir, i, loc.iLocationIndex);
-
-						if ( !SaveImg32(imgHi, s, bSaveTGA) )
-						{
-							fl_cursor(FL_CURSOR_DEFAULT);
-							fl_message_position(g_pMainWnd);
-							fl_alert("Failed to save location image \"%s\"", s);
-							fl_cursor(FL_CURSOR_WAIT);
-							delete img;
-							delete imgHi;
-							bErrors = TRUE;
-							break;
-						}
-					}
-				}
-
-				// save rect
-				darkRect[0] = (short)iImgPos[0];
-				darkRect[1] = (short)iImgPos[1];
-				darkRect[2] = (short)(iImgPos[0] + img->w());
-				darkRect[3] = (short)(iImgPos[1] + img->h());
-				if (f)
-					fwrite(darkRect, sizeof(darkRect), 1, f);
-				if (f2)
-					fwrite(darkRect, sizeof(darkRect), 1, f2);
-
-				delete img;
-
-				iGeneratedImages++;
-			}
-			else
-			{
-				fl_cursor(FL_CURSOR_DEFAULT);
-				fl_message_position(g_pMainWnd);
-				fl_alert("Failed to generate location image %03d on PAGE%03d", loc.iLocationIndex, i);
-				fl_cursor(FL_CURSOR_WAIT);
-				bErrors = TRUE;
-				break;
-			}
-		}
-
-		if (f)
-			fclose(f);
-		if (f2)
-			fclose(f2);
-	}
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	fl_message_position(g_pMainWnd);
-
-	if (bErrors)
-		fl_alert("Errors occurred, generated files are incomplete");
-	else
-	{
-		if (iGenerateLocIdx >= 0)
-			fl_message("Generated files for location %03d on PAGE%03d", iGenerateLocIdx, iGenerateMap);
-		else if (iGenerateMap >= 0)
-			fl_message("Generated files for %d location(s) on PAGE%03d", iGeneratedImages, iGenerateMap);
-		else
-			fl_message("Generated files for %d locations on %d page(s)", iGeneratedImages, iGeneratedPages);
-	}
-
-	ResetMouse();
-}
-
-
-/////////////////////////////////////////////////////////////////////
-
-static void SetModifiedFlag()
-{
-	if (!g_pProj->bModified)
-	{
-		g_pProj->bModified = TRUE;
-
-		if (g_pMainWnd)
-			g_pMainWnd->label(g_sAppTitleModified);
-	}
-}
-
-static void ClearModifiedFlag()
-{
-	if (g_pProj->bModified)
-	{
-		g_pProj->bModified = FALSE;
-
-		if (g_pMainWnd)
-			g_pMainWnd->label(g_sAppTitle);
-	}
-}
-
-static void ResetMouse()
-{
-	// send a move event to the main window to reset the mouse cursor
-	if (g_pMainWnd)
-		Fl::handle(FL_MOVE, g_pMainWnd);
-}
-
-static void OnWindowResized(int w, int h)
-{
-	const int W = w - g_iWplus;
-	const int H = h - g_iHplus;
-
-	g_pMenuBar->size(W + g_iWplus, g_pMenuBar->h());
-
-	g_pScrollView->size(W, H);
-
-	if (g_pProj->maps[g_pProj->iCurMap].img)
-		g_pImageView->size(g_pProj->maps[g_pProj->iCurMap].img->w() * g_iZoom, g_pProj->maps[g_pProj->iCurMap].img->h() * g_iZoom);
-	else
-		g_pImageView->size(640 * g_iZoom, 480 * g_iZoom);
-
-	g_pTreeView->resize(W, g_pTreeView->y(), g_pTreeView->w(), H);
-
-	// if scroll pos is out of range (can happen when zooming out) then clamp scroll pos
-	int x = g_pScrollView->xposition();
-	int y = g_pScrollView->yposition();
-	if (x > g_pImageView->w() - g_pScrollView->w())
-		x = g_pImageView->w() - g_pScrollView->w();
-	if (y > g_pImageView->h() - g_pScrollView->h())
-		y = g_pImageView->h() - g_pScrollView->h();
-	if (x < 0)
-		x = 0;
-	if (y < 0)
-		y = 0;
-	g_pScrollView->scroll_to(x, y);
-
-	g_pTreeView->redraw();
-	g_pImageView->redraw();
-	g_pScrollView->redraw();
-}
-
-static void ChangeMap(int n, BOOL bZoomChangeOnly = FALSE)
-{
-	if (n >= g_pProj->iMapCount)
-	{
-		// should never happen
-		g_pProj->iCurMap = -1;
-		return;
-	}
-
-	g_pProj->FlushScaledImages();
-
-	g_pProj->iCurMap = n;
-
-	g_iCTR = (g_iZoom - 1) / 2;
-
-	if (!bZoomChangeOnly)
-		g_pScrollView->scroll_to(0, 0);
-
-	OnWindowResized(g_pMainWnd->w(), g_pMainWnd->h());
-}
-
-static BOOL ChangeZoom(int n)
-{
-	if (n < MIN_ZOOM)
-		n = MIN_ZOOM;
-	else if (n > MAX_ZOOM)
-		n = MAX_ZOOM;
-
-	if (g_iZoom == n)
-		return FALSE;
-
-	g_iZoom = n;
-
-	g_pProj->FlushScaledImages();
-
-	ChangeMap(g_pProj->iCurMap, TRUE);
-
-	ResetMouse();
-
-	return TRUE;
-}
-
-static const char* fl_input_ex(const char *label, char *deflt)
-{
-	g_bShowingFlInputDialog = TRUE;
-
-	fl_message_position(g_pMainWnd);
-
-	const char *ret = fl_input("%s", label, deflt);
-
-	g_bShowingFlInputDialog = FALSE;
-
-	return ret;
-}
-
-static void PopulateTree()
-{
-	char s[128];
-
-	g_pTreeView->clear();
-	g_iCurSelTreeId = -1;
-	g_pCurSelTreeItem = NULL;
-
-	if (!g_pProj->iMapCount)
-		return;
-
-	g_pTreeView->begin();
-
-	for (int i=0; i<g_pProj->iMapCount; i++)
-	{
-		if (!g_pProj->maps[i].img)
-			continue;
-
-		sprintf(s, "PAGE%03d", i);
-		Fl_Tree_Item *p = g_pTreeView->add(s);
-		p->user_data((void*)(intptr_t)MAKE_TREE_ID(i, -1));
-		p->labelfont(FL_HELVETICA | FL_BOLD);
-
-		for (int j=0; j<g_pProj->maps[i].iLocationCount; j++)
-		{
-			sLocation &loc = g_pProj->maps[i].locs[j];
-
-			sprintf(s, "PAGE%03d/%03d", i, loc.iLocationIndex);
-			p = g_pTreeView->add(s);
-			p->user_data((void*)(intptr_t)MAKE_TREE_ID(i, loc.iLocationIndex));
-		}
-	}
-
-	g_pTreeView->end();
-
-	Fl_Tree_Item *first = g_pTreeView->next( g_pTreeView->first() );
-	g_pTreeView->select_only(first);
-	g_pTreeView->set_item_focus(first);
-}
-
-static void OnTreeSelChange(Fl_Widget*, void*)
-{
-	Fl_Tree_Item *p = g_pTreeView->first_selected_item();
-	if (!p)
-	{
-		g_iCurSelTreeId = -1;
-		g_pCurSelTreeItem = NULL;
-		g_pImageView->redraw();
-		return;
-	}
-
-	g_iCurSelTreeId = (intptr_t)p->user_data();
-	g_pCurSelTreeItem = p;
-
-	int iMap = MAP_FROM_TREE_ID(g_iCurSelTreeId);
-
-	if (iMap != g_pProj->iCurMap)
-		ChangeMap(iMap);
-	else
-		g_pImageView->redraw();
-}
-
-static void OnMainWndClose(Fl_Widget*, void*)
-{
-	// prevent escape from closing app
-	if (Fl::event() == FL_SHORTCUT && Fl::event_key() == FL_Escape)
-		return;
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	fl_message_position(g_pMainWnd);
-	if (!g_pProj->bModified || !fl_choice("Any unsaved changes will be lost. Exit?", "Yes", "No", NULL))
-		g_pMainWnd->hide();
-	else
-		ResetMouse();
-}
-
-static void OnCmdExit(Fl_Widget*, void*)
-{
-	OnMainWndClose(NULL, NULL);
-}
-
-static void OnCmdSave(Fl_Widget*, void*)
-{
-	g_pProj->Save();
-}
-
-static void OnCmdGenerateFiles(Fl_Widget*, void*)
-{
-	for (int i=0; i<g_pProj->iMapCount; i++)
-		if (g_pProj->maps[i].iLocationCount)
-			goto has_locations;
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	fl_message_position(g_pMainWnd);
-	fl_message("No locations have been defined, nothing to generate.");
-	ResetMouse();
-	return;
-
-has_locations:
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	fl_message_position(g_pMainWnd);
-	int res = fl_choice("Generate files for all map locations.\nExisting files will be overwritten. Proceed?", "Cancel", "OK", "Generate as TGA");
-	ResetMouse();
-	if (!res)
-		return;
-
-	const BOOL bSaveTGA = (res == 2);
-
-	GenerateFiles(bSaveTGA);
-}
-
-static void OnCmdGenerateSelected(Fl_Widget*, void*)
-{
-	int iMap = g_pProj->iCurMap;
-	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-	int iLocIdx = LOCIDX_FROM_TREE_ID(g_iCurSelTreeId);
-
-	if (iMap < 0 && iLoc < 0)
-		return;
-
-	int res;
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	fl_message_position(g_pMainWnd);
-
-	if (iLoc < 0)
-	{
-		if (!g_pProj->maps[iMap].iLocationCount)
-		{
-			fl_message("No locations have been defined on PAGE%03d, nothing to generate.", iMap);
-			return;
-		}
-
-		res = fl_choice("Generate files for PAGE%03d.\nExisting files will be overwritten. Proceed?", "Cancel", "OK", "Generate as TGA", iMap);
-	}
-	else
-		res = fl_choice("Generate files for location %03d on PAGE%03d.\nExisting files will be overwritten. Proceed?", "Cancel", "OK", "Generate as TGA", iLocIdx, iMap);
-
-	ResetMouse();
-
-	if (!res)
-		return;
-
-	const BOOL bSaveTGA = (res == 2);
-
-	GenerateFiles(bSaveTGA, iMap, iLocIdx);
-}
-
-static void OnCmdDelete(Fl_Widget*, void*)
-{
-	if (!g_pCurSelTreeItem || g_pImageView->m_iDragging || g_pImageView->m_bPanning)
-		return;
-
-	int iMap = g_pProj->iCurMap;
-	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-	int iLocIndex = LOCIDX_FROM_TREE_ID(g_iCurSelTreeId);
-
-	if (iMap < 0)
-		return;
-
-	if (iLocIndex < 0)
-	{
-		// page item selected in tree, ask if all shapes should be deleted
-
-		if (!g_pProj->maps[iMap].iLocationCount)
-			return;
-
-		fl_cursor(FL_CURSOR_DEFAULT);
-		fl_message_position(g_pMainWnd);
-		if ( !fl_choice("Delete all locations on PAGE%03d?", "Cancel", "OK", NULL, iMap))
-		{
-			fl_message_position(g_pMainWnd);
-			if ( !fl_choice("Are you really sure that you want to delete all locations on PAGE%03d?", "Cancel", "OK", NULL, iMap) )
-			{
-				ResetMouse();
-				return;
-			}
-		}
-
-		g_pProj->maps[iMap].FlushScaledImages();
-		g_pProj->maps[iMap].iLocationCount = 0;
-		SetModifiedFlag();
-
-		// delete all child tree items for page
-		while ( g_pCurSelTreeItem->children() )
-			g_pTreeView->remove( g_pCurSelTreeItem->child(0) );
-	}
-	else
-	{
-		fl_cursor(FL_CURSOR_DEFAULT);
-		fl_message_position(g_pMainWnd);
-		if ( !fl_choice("Delete location %03d on PAGE%03d?", "Cancel", "OK", NULL, iLocIndex, iMap) )
-		{
-			ResetMouse();
-			return;
-		}
-
-		g_pProj->maps[iMap].DeleteLocation(iLoc);
-		SetModifiedFlag();
-
-		// delete tree item
-		{
-			// get next item on same page to be selected after deletion
-			Fl_Tree_Item *pNewSel = g_pCurSelTreeItem->next_sibling();
-			// if the last item was deleted then move selection to prev instead
-			if (!pNewSel)
-			{
-				pNewSel = g_pCurSelTreeItem->prev_sibling();
-				// if there's no prev either then select the page
-				if (!pNewSel)
-					pNewSel = g_pCurSelTreeItem->parent();
-			}
-
-			g_pTreeView->remove(g_pCurSelTreeItem);
-			g_iCurSelTreeId = -1;
-			g_pCurSelTreeItem = NULL;
-
-			// select new tree item
-			if (pNewSel)
-			{
-				g_pTreeView->select_only(pNewSel);
-				g_pTreeView->set_item_focus(pNewSel);
-			}
-		}
-	}
-
-	ResetMouse();
-
-	g_pTreeView->redraw();
-	g_pImageView->redraw();
-}
-
-static void OnCmdEditIndex(Fl_Widget*, void*)
-{
-	if (g_pImageView->m_iDragging || g_pImageView->m_bPanning)
-		return;
-
-	int iMap = g_pProj->iCurMap;
-	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-
-	if (iLoc < 0)
-		return;
-
-	char s[64];
-	sprintf(s, "%d", g_pProj->maps[iMap].locs[iLoc].iLocationIndex);
-
-retry:
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	const char *t = fl_input_ex("New Index", s);
-	ResetMouse();
-	if (!t)
-		return;
-
-	const int iNewIndex = atoi(t);
-
-	if (iNewIndex < 0 || iNewIndex > MAX_LOCATIONS_PER_MAP-1)
-	{
-		fl_cursor(FL_CURSOR_DEFAULT);
-		fl_message_position(g_pMainWnd);
-		fl_alert("Invalid index, must be a value in the range 0 to %d", MAX_LOCATIONS_PER_MAP-1);
-		goto retry;
-	}
-
-	if (iNewIndex == g_pProj->maps[iMap].locs[iLoc].iLocationIndex)
-		return;
-
-	sLocation *pPrevLoc = g_pProj->maps[iMap].GetByLocationIndex(iNewIndex);
-	if (pPrevLoc)
-	{
-		fl_cursor(FL_CURSOR_DEFAULT);
-		fl_message_position(g_pMainWnd);
-		if ( !fl_choice("Another location with index %03d already exists. Swap indices?", "Cancel", "OK", NULL, iNewIndex) )
-		{
-			ResetMouse();
-			return;
-		}
-
-		ResetMouse();
-
-		pPrevLoc->iLocationIndex = g_pProj->maps[iMap].locs[iLoc].iLocationIndex;
-	}
-
-	// change tree item
-
-	g_pProj->maps[iMap].locs[iLoc].iLocationIndex = iNewIndex;
-	SetModifiedFlag();
-
-	if (pPrevLoc)
-	{
-		// indices were swapped, ju re-select the new name
-
-		g_iCurSelTreeId = -1;
-		g_pCurSelTreeItem = NULL;
-
-		sprintf(s, "PAGE%03d/%03d", iMap, iNewIndex);
-		Fl_Tree_Item *pItem = g_pTreeView->find_item(s);
-		if (pItem)
-		{
-			g_pTreeView->select_only(pItem);
-			g_pTreeView->set_item_focus(pItem);
-		}
-	}
-	else
-	{
-		// rename tree item
-
-		g_pTreeView->remove(g_pCurSelTreeItem);
-
-		g_iCurSelTreeId = -1;
-		g_pCurSelTreeItem = NULL;
-
-		sprintf(s, "PAGE%03d/%03d", iMap, iNewIndex);
-		g_pTreeView->begin();
-		Fl_Tree_Item *pItem = g_pTreeView->add(s);
-		pItem->user_data( (void*)(intptr_t)MAKE_TREE_ID(iMap, iNewIndex) );
-		g_pTreeView->end();
-		g_pTreeView->select_only(pItem);
-		g_pTreeView->set_item_focus(pItem);
-	}
-
-	g_pImageView->redraw();
-}
-
-static void OnCmdMove(Fl_Widget*, void*)
-{
-	if (g_pImageView->m_iDragging || g_pImageView->m_bPanning)
-		return;
-
-	int iMap = g_pProj->iCurMap;
-	int iLocIndex = LOCIDX_FROM_TREE_ID(g_iCurSelTreeId);
-	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-
-	if (iMap < 0)
-		return;
-
-	if (iLocIndex < 0)
-	{
-		fl_cursor(FL_CURSOR_DEFAULT);
-		fl_message_position(g_pMainWnd);
-
-		if (!g_pProj->maps[iMap].iLocationCount)
-		{
-			fl_message("No locations on this page");
-			ResetMouse();
-			return;
-		}
-
-		if ( !fl_choice("Move all locations on PAGE%03d?", "Cancel", "OK", NULL, iMap) )
-		{
-			ResetMouse();
-			return;
-		}
-
-		if ( !fl_choice("Are you really sure that you want to move all locations on PAGE%03d?", "Cancel", "OK", NULL, iMap) )
-		{
-			ResetMouse();
-			return;
-		}
-	}
-	// should never happen
-	else if (iLoc < 0)
-		return;
-
-	// static so dialog defaults to previously used vals
-	static char s[256] = "0 0";
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	const char *t = fl_input_ex("Move Delta (dX dY)", s);
-	ResetMouse();
-	if (!t)
-		return;
-
-	int dx = 0, dy = 0;
-	sscanf(t, "%d %d", &dx, &dy);
-
-	sprintf(s, "%d %d", dx, dy);
-
-	if (!dx && !dy)
-		return;
-
-	if (abs(dx) > 4096 || abs(dy) > 4096)
-		return;
-
-	if (iLocIndex < 0)
-	{
-		for (int i=0; i<g_pProj->maps[iMap].iLocationCount; i++)
-			g_pProj->maps[iMap].locs[i].MovePos(dx, dy);
-	}
-	else
-		g_pProj->maps[iMap].locs[iLoc].MovePos(dx, dy);
-
-	SetModifiedFlag();
-	g_pImageView->redraw();
-}
-
-static void OnCmdInfo(Fl_Widget*, void *)
-{
-	int iMap = g_pProj->iCurMap;
-	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
-
-	if (iMap < 0 || iLoc < 0)
-		return;
-
-	const sLocation &loc = g_pProj->maps[iMap].locs[iLoc];
-
-	int brect[4] = { loc.iBoundRect[0], loc.iBoundRect[1], loc.iBoundRect[2], loc.iBoundRect[3] };
-	if (g_iLocationImageExtraBorder > 0)
-	{
-		brect[0] -= g_iLocationImageExtraBorder;
-		brect[1] -= g_iLocationImageExtraBorder;
-		brect[2] += g_iLocationImageExtraBorder;
-		brect[3] += g_iLocationImageExtraBorder;
-
-		if (brect[0] < 0) brect[0] = 0;
-		if (brect[1] < 0) brect[1] = 0;
-		if (brect[2] >= g_pProj->maps[iMap].img->w()) brect[2] = g_pProj->maps[iMap].img->w() - 1;
-		if (brect[3] >= g_pProj->maps[iMap].img->h()) brect[3] = g_pProj->maps[iMap].img->h() - 1;
-	}
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	fl_message_position(g_pMainWnd);
-	fl_message(
-		"Location %03d on PAGE%03d\n"
-		"\n"
-		"Origin: %d, %d\n"
-		"Size: %d x %d\n"
-		,
-		loc.iLocationIndex, iMap,
-		brect[0], brect[1],
-		brect[2]-brect[0]+1, brect[3]-brect[1]+1
-		);
-	ResetMouse();
-}
-
-static void OnCmdRecover(Fl_Widget*, void*)
-{
-	if (g_pProj->iMapCount == 0 || g_pProj->maps[g_pProj->iCurMap].iLocationCount > 0)
-	{
-		fl_cursor(FL_CURSOR_DEFAULT);
-		fl_message_position(g_pMainWnd);
-		fl_message("PAGE%03d must have no existing locations before attempting recovery", g_pProj->iCurMap);
-		ResetMouse();
-		return;
-	}
-
-	int iLocations = 0;
-	BOOL bErrors = FALSE;
-	char s[12];
-
-	fl_cursor(FL_CURSOR_WAIT);
-
-	// dark rects file containing the location positions (in index order)
-	sprintf(s, "p%03dra.bin", g_pProj->iCurMap);
-	FILE *f = fl_fopen(s, "rb");
-	if (!f && g_bShockMaps)
-	{
-		fl_cursor(FL_CURSOR_DEFAULT);
-		fl_message_position(g_pMainWnd);
-		fl_alert("Could not locate rects file \"%s\" for recovery", s);
-		fl_cursor(FL_CURSOR_WAIT);
-		sprintf(s, "p%03dxa.bin", g_pProj->iCurMap);
-		f = fl_fopen(s, "rb");
-	}
-	if (!f)
-	{
-		fl_cursor(FL_CURSOR_DEFAULT);
-		fl_message_position(g_pMainWnd);
-		fl_alert("Could not locate rects file \"%s\" for recovery", s);
-		ResetMouse();
-		return;
-	}
-
-	short darkRect[4] = {0};
-	sShape shape;
-	shape.iVertCount = 4;
-
-	while ( 1 == fread(darkRect, sizeof(darkRect), 1, f) )
-	{
-		const int iNewLocIndex = g_pProj->maps[g_pProj->iCurMap].GetFreeLocationIndex();
-		if (iNewLocIndex < 0)
-		{
-			bErrors = TRUE;
-			break;
-		}
-
-		sMap &map = g_pProj->maps[g_pProj->iCurMap];
-
-		// construct rectangle (clockwise)
-		shape.verts[0].x = darkRect[0];
-		shape.verts[0].y = darkRect[1];
-		shape.verts[1].x = darkRect[2];
-		shape.verts[1].y = darkRect[1];
-		shape.verts[2].x = darkRect[2];
-		shape.verts[2].y = darkRect[3];
-		shape.verts[3].x = darkRect[0];
-		shape.verts[3].y = darkRect[3];
-
-		sLocation &newLoc = map.locs[map.iLocationCount];
-		map.iLocationCount++;
-
-		// default label offset to bounds center
-		shape.CalcBoundingRect();
-		shape.iLabelPos[0] = shape.iBoundRect[0] + ((shape.iBoundRect[2] - shape.iBoundRect[0]) / 2);
-		shape.iLabelPos[1] = shape.iBoundRect[1] + ((shape.iBoundRect[3] - shape.iBoundRect[1]) / 2);
-
-		newLoc.iLocationIndex = iNewLocIndex;
-		newLoc.AddShape(shape);
-
-		g_pTreeView->begin();
-		sprintf(s, "PAGE%03d/%03d", g_pProj->iCurMap, iNewLocIndex);
-		Fl_Tree_Item *p = g_pTreeView->add(s);
-		p->user_data( (void*)(intptr_t)MAKE_TREE_ID(g_pProj->iCurMap, iNewLocIndex) );
-		g_pTreeView->end();
-
-		iLocations++;
-	}
-
-	fclose(f);
-
-	fl_cursor(FL_CURSOR_DEFAULT);
-	fl_message_position(g_pMainWnd);
-
-	if (bErrors)
-		fl_alert("Errors occurred, not all locations could be recovered");
-	else
-		fl_message("Successfully recovered %d locations", iLocations);
-
-	ResetMouse();
-
-	SetModifiedFlag();
-
-	g_pTreeView->redraw();
-	g_pImageView->redraw();
-}
-
-static void OnCmdDisplayMode(Fl_Widget*, void *p)
-{
-	if (g_displayMode == (DisplayMode)(intptr_t)p)
-		return;
-
-	if ((g_displayMode == DM_FADE_NONSEL || (intptr_t)p == DM_FADE_NONSEL) && g_pProj)
-		g_pProj->FlushScaledImages();
-
-	g_displayMode = (DisplayMode)(intptr_t)p;
-	g_pImageView->redraw();
-}
-
-static void OnCmdZoom(Fl_Widget*, void *p)
-{
-	if (g_pImageView->m_iDragging || g_pImageView->m_bPanning)
-		return;
-
-	// zoom around view center (maintain same orig map XY pos at center before and after zoom change)
-	const int Xclient = g_pScrollView->w() / 2;
-	const int Yclient = g_pScrollView->h() / 2;
-	const int Xmap = (g_pScrollView->xposition() + Xclient) / g_iZoom;
-	const int Ymap = (g_pScrollView->yposition() + Yclient) / g_iZoom;
-
-	if ( ChangeZoom(g_iZoom + (intptr_t)p) )
-		ScrollImageTo(Xmap * g_iZoom - Xclient, Ymap * g_iZoom - Yclient);
-}
-
-static void OnCmdToggleThickLines(Fl_Widget*, void*)
-{
-	g_iLineWidth = g_iLineWidth ? 0 : 2;
-	g_pImageView->redraw();
-}
-
-static void OnCmdToggleLabels(Fl_Widget*, void*)
-{
-	g_bDrawLabels = !g_bDrawLabels;
-	g_pImageView->redraw();
-}
-
-static void OnCmdToggleFillNewShape(Fl_Widget*, void*)
-{
-	g_bFillNewShape = !g_bFillNewShape;
-	g_pImageView->redraw();
-}
-
-static void OnCmdToggleCursorGuides(Fl_Widget*, void*)
-{
-	g_bDrawCursorGuides = !g_bDrawCursorGuides;
-	g_pImageView->redraw();
-}
-
-static void OnCmdToggleHideSelOutlines(Fl_Widget*, void*)
-{
-	g_bHideSelectedOutline = !g_bHideSelectedOutline;
-	g_pImageView->redraw();
-}
-
-static void OnCmdChangePage(Fl_Widget*, void *p)
-{
-	if (!g_pCurSelTreeItem || g_pImageView->m_bCreatingShape || g_pImageView->m_iDragging || g_pImageView->m_bPanning)
-		return;
-
-	char s[64];
-	sprintf(s, "PAGE%03d", g_pProj->iCurMap + (int)(intptr_t)p);
-	Fl_Tree_Item *pItem = g_pTreeView->find_item(s);
-	if (pItem)
-	{
-		g_pTreeView->select_only(pItem);
-		g_pTreeView->set_item_focus(pItem);
-	}
-}
-
-static void OnCmdWidgetScheme(Fl_Widget*, void *p)
-{
-	const char *scheme = (const char *)p;
-
-	if (!Fl::is_scheme(scheme))
-		Fl::scheme(scheme);
-
-	g_pMainWnd->redraw();
-}
-
-#ifndef NO_FLEET
-static void OnCmdWidgetExScheme(Fl_Widget*, void *p)
-{
-	const char *scheme = (const char *)p;
-
-	fle_set_scheme(scheme);
-
-	g_pMainWnd->redraw();
-}
-
-static void OnCmdColorScheme(Fl_Widget*, void *p)
-{
-	const char *colors = (const char *)p;
-
-	fle_set_colors(colors);
-
-	g_pMainWnd->redraw();
-}
-#endif
-
-static void OnCmdAbout(Fl_Widget*, void*)
-{
-	fl_cursor(FL_CURSOR_DEFAULT);
-	fl_message_position(g_pMainWnd);
-	fl_message(
-		"DarkMapGen " DARKMAPGEN_VERSION "\n"
-		"\n"
-		"A tool for defining and generating auto-map locations for the Dark engine.\n"
-		"\n"
-		"\n"
-		"This program uses:\n"
-		"\n"
-		"    FLTK (fltk.org)\n"
-		"    libpng (libpng.org)\n"
-		);
-	ResetMouse();
-}
-
-
-/////////////////////////////////////////////////////////////////////
-
-static void InitControls()
-{
-	sprintf(g_sAppTitle, DARKMAPGEN_TITLE " " DARKMAPGEN_VERSION " %s - %s", g_bShockMaps?"[SS2]":"[Thief]", g_pProj->sDir);
-	strcpy(g_sAppTitleModified, g_sAppTitle);
-	if (strlen(g_sAppTitleModified)+2 < sizeof(g_sAppTitleModified))
-		strcat(g_sAppTitleModified, " *");
-
-	g_pMainWnd->label(g_sAppTitle);
-
-	// center on desktop
-	g_pMainWnd->position(
-		Fl::x() + ((Fl::w() - g_pMainWnd->w()) / 2),
-		Fl::y() + ((Fl::h() - g_pMainWnd->h()) / 2)
-		);
-
-	// main menu
-
-	const int MAX_MENU_ITEMS = 128;
-	int menu_items = 0;
-
-	// NOTE: don't forget to update the command-line InvokeShortcutFLTK calls if any shortcuts here change or display modes are added
-
-	static Fl_Menu_Item menu[MAX_MENU_ITEMS];
-
-	MENU_SET( {"&File", 0, NULL, NULL, FL_SUBMENU, 0, 0, 0, 0} );
-		MENU_SET( {"&Save Project", FL_COMMAND+'s', OnCmdSave, NULL, FL_MENU_DIVIDER, 0, 0, 0, 0} );
-		MENU_SET( {"&Generate Map Files ", FL_F+7, OnCmdGenerateFiles, NULL, 0, 0, 0, 0, 0} );
-		MENU_SET( {"G&enerate Selected Only ", FL_COMMAND+(FL_F+7), OnCmdGenerateSelected, NULL, FL_MENU_DIVIDER, 0, 0, 0, 0} );
-		MENU_SET( {"E&xit", FL_ALT+'x', OnCmdExit, NULL, 0, 0, 0, 0, 0} );
-		MENU_SET( {} );
-
-	MENU_SET( {"&Edit", 0, NULL, NULL, FL_SUBMENU, 0, 0, 0, 0} );
-		MENU_SET( {"&Delete Selected Location ", FL_Delete, OnCmdDelete, NULL, 0, 0, 0, 0, 0} );
-		MENU_SET( {"Edit Location &Index ", FL_F+9, OnCmdEditIndex, NULL, 0, 0, 0, 0, 0} );
-		MENU_SET( {"&Move Selected Location ", 'm', OnCmdMove, NULL, 0, 0, 0, 0, 0} );
-		MENU_SET( {"&View Location Info", 'i', OnCmdInfo, NULL, 0, 0, 0, 0, 0} );
-		MENU_SET( {"&Recover Page Locations", 'r', OnCmdRecover, NULL, 0, 0, 0, 0, 0} );
-		MENU_SET( {} );
-
-	MENU_SET( {"&View", 0, NULL, NULL, FL_SUBMENU, 0, 0, 0, 0} );
-		MENU_SET( {"&Outlines Only", FL_COMMAND+'1', OnCmdDisplayMode, (void*)DM_OUTLINES, FL_MENU_RADIO|FL_MENU_VALUE, 0, 0, 0, 0} );
-		MENU_SET( {"Fill &Selection", FL_COMMAND+'2', OnCmdDisplayMode, (void*)DM_FILLSEL, FL_MENU_RADIO, 0, 0, 0, 0} );
-		MENU_SET( {"Fill &All", FL_COMMAND+'3', OnCmdDisplayMode, (void*)DM_FILLALL, FL_MENU_RADIO, 0, 0, 0, 0} );
-		MENU_SET( {"&Dim All", FL_COMMAND+'4', OnCmdDisplayMode, (void*)DM_DIMMED, FL_MENU_RADIO, 0, 0, 0, 0} );
-		MENU_SET( {"Fade &Unselected", FL_COMMAND+'5', OnCmdDisplayMode, (void*)DM_FADE_NONSEL, FL_MENU_RADIO|FL_MENU_DIVIDER, 0, 0, 0, 0} );
-		MENU_SET( {"&Thick Lines", FL_COMMAND+'t', OnCmdToggleThickLines, NULL, FL_MENU_TOGGLE, 0, 0, 0, 0} );
-		MENU_SET( {"Draw &Labels", FL_COMMAND+'l', OnCmdToggleLabels, NULL, FL_MENU_TOGGLE, 0, 0, 0, 0} );
-		MENU_SET( {"&Fill Create Shape", FL_COMMAND+'f', OnCmdToggleFillNewShape, NULL, FL_MENU_TOGGLE, 0, 0, 0, 0} );
-		MENU_SET( {"Draw Cursor &Guides", FL_COMMAND+'g', OnCmdToggleCursorGuides, NULL, FL_MENU_TOGGLE, 0, 0, 0, 0} );
-		MENU_SET( {"&Hide Selection Outline ", FL_COMMAND+'h', OnCmdToggleHideSelOutlines, NULL, FL_MENU_TOGGLE|FL_MENU_DIVIDER, 0, 0, 0, 0} );
-		MENU_SET( {"Zoom O&ut", FL_KP+'-', OnCmdZoom, (void*)-1, 0, 0, 0, 0, 0} );
-		MENU_SET( {"Zoom &In", FL_KP+'+', OnCmdZoom, (void*)1, FL_MENU_DIVIDER, 0, 0, 0, 0} );
-		MENU_SET( {"T&heme", 0, NULL, NULL, FL_SUBMENU, 0, 0, 0, 0} );
-			for (int i=0; i<Fl_Scheme::num_schemes(); i++)
-			{
-				const char *scheme = Fl_Scheme::names()[i];
-				MENU_SET( {scheme, 0, OnCmdWidgetScheme, (void*)scheme, FL_MENU_RADIO|(Fl::is_scheme(scheme)?FL_MENU_VALUE:0), 0, 0, 0, 0} );
-			}
-#ifndef NO_FLEET
-			for (int i=0; i<fle_num_schemes(); i++)
-			{
-				const char *scheme = fle_scheme_name(i);
-				MENU_SET( {scheme, 0, OnCmdWidgetExScheme, (void*)scheme, FL_MENU_RADIO|(!strcmp(scheme,fle_get_scheme())?FL_MENU_VALUE:0), 0, 0, 0, 0} );
-			}
-			MENU_SET( {} );
-		MENU_SET( {"&Colors", 0, NULL, NULL, FL_SUBMENU|FL_MENU_DIVIDER, 0, 0, 0, 0} );
-			for (int i=0; i<fle_num_colors(); i++)
-			{
-				const char *colors = fle_colors_name(i);
-				MENU_SET( {colors, 0, OnCmdColorScheme, (void*)colors, FL_MENU_RADIO|(!strcmp(colors,fle_get_colors())?FL_MENU_VALUE:0), 0, 0, 0, 0} );
-			}
-#endif
-			MENU_SET( {} );
-		MENU_SET( {"About...", 0, OnCmdAbout, NULL, 0, 0, 0, 0, 0} );
-		MENU_SET( {} );
-
-	// hidden entries, only provide app-wide shortcuts
-	MENU_SET( {"Prev Page", FL_Page_Up, OnCmdChangePage, (void*)-1, FL_MENU_INVISIBLE, 0, 0, 0, 0} );
-	MENU_SET( {"Next Page", FL_Page_Down, OnCmdChangePage, (void*)1, FL_MENU_INVISIBLE, 0, 0, 0, 0} );
-
-	MENU_SET( {} );
-
-	g_pMenuBar->menu(menu);
-
-	PopulateTree();
-
-	for (int i=0; i<g_pProj->iMapCount; i++)
-		if (g_pProj->maps[i].img)
-		{
-			ChangeMap(i);
-			if (!g_bUserDefinedWindowSize)
-			{
-				int cx = g_pMainWnd->x() + (g_pMainWnd->w() / 2);
-				int cy = g_pMainWnd->y() + (g_pMainWnd->h() / 2);
-
-				int iZoom = g_iZoom > 2 ? 2 : g_iZoom;
-				int w = g_pProj->maps[i].img->w() * iZoom + g_iWplus;
-				int h = g_pProj->maps[i].img->h() * iZoom + g_iHplus;
-
-				g_pMainWnd->resize(cx - (w / 2), cy - (h / 2), w, h);
-			}
-			break;
-		}
-}
-
-
-static void MakeWindow(int W, int H)
-{
-	if (W <= 0 || H <= 0)
-	{
-		W = 800;
-		H = 507;
-	}
-
-	g_pMainWnd = new cMainWindow(W, H, DARKMAPGEN_TITLE);
-	g_pMainWnd->end();
-
-    g_pMenuBar = new Fl_Menu_Bar(0, 0, W, 25);
-	g_pMainWnd->add(g_pMenuBar);
-
-	g_pScrollView = new Fl_Scroll(0, 25, W-160, H-27);
-	g_pScrollView->end();
-	g_pMainWnd->add(g_pScrollView);
-	g_pScrollView->box(FL_FLAT_BOX);
-
-	g_pImageView = new cImageView(0, 25, W-160, H-27);
-	g_pScrollView->add(g_pImageView);
-
-    g_pTreeView = new Fl_Tree_Ex(W-160, 25, 160, H-27);
-	g_pMainWnd->add(g_pTreeView);
-	//g_pTreeView->color(FL_LIGHT3);
-	g_pTreeView->selectmode(FL_TREE_SELECT_SINGLE);
-	g_pTreeView->sortorder(FL_TREE_SORT_ASCENDING);
-	g_pTreeView->showroot(0);
-	g_pTreeView->when(FL_WHEN_CHANGED);
-	g_pTreeView->callback(OnTreeSelChange);
-	g_pTreeView->marginleft(0);
-
-    g_pMainWnd->resizable(g_pScrollView);
-	g_pMainWnd->callback(OnMainWndClose);
-
-	// get number of pixels to add to g_pScrollView to get the window size
-	g_iWplus = g_pMainWnd->w() - g_pScrollView->w();
-	g_iHplus = g_pMainWnd->h() - g_pScrollView->h();
-
-	g_pMainWnd->size_range(320 + g_iWplus, 240 + g_iHplus, 0, 0);
-}
-
-
-static int GetScrollViewClientWidth()
-{
-	if (g_pScrollView)
-	{
-		if ( g_pScrollView->scrollbar.visible() )
-			return g_pScrollView->scrollbar_size() ? g_pScrollView->w() - g_pScrollView->scrollbar_size() : g_pScrollView->w() - Fl::scrollbar_size();
-
-		return g_pScrollView->w();
-	}
-
-	return 0;
-}
-
-static int GetScrollViewClientHeight()
-{
-	if (g_pScrollView)
-	{
-		if ( g_pScrollView->hscrollbar.visible() )
-			return g_pScrollView->scrollbar_size() ? g_pScrollView->h() - g_pScrollView->scrollbar_size() : g_pScrollView->h() - Fl::scrollbar_size();
-
-		return g_pScrollView->h();
-	}
-
-	return 0;
-}
-
-static void ScrollImageTo(int Xzoomed, int Yzoomed)
-{
-	if (Xzoomed < 0)
-		Xzoomed = 0;
-	else
-	{
-		const int xmax = g_pImageView->w() - GetScrollViewClientWidth();
-		if (Xzoomed > xmax)
-			Xzoomed = xmax;
-		if (Xzoomed < 0)
-			Xzoomed = 0;
-	}
-
-	if (Yzoomed < 0)
-		Yzoomed = 0;
-	else
-	{
-		const int ymax = g_pImageView->h() - GetScrollViewClientHeight();
-		if (Yzoomed > ymax)
-			Yzoomed = ymax;
-		if (Yzoomed < 0)
-			Yzoomed = 0;
-	}
-
-	g_pScrollView->scroll_to(Xzoomed, Yzoomed);
-}
-
-
-static void InitFLTK(const char *lpszFlTheme, const char *lpszColors)
-{
-	Fl::visual(FL_RGB);
-
-#ifndef NO_FLEET
-	fle_set_colors(lpszColors);
-#endif
-	Fl::scheme(lpszFlTheme);
-
-	fl_message_icon()->box(FL_FLAT_BOX);
-	fl_message_icon()->color(FL_GRAY0+20);
-}
-
-static BOOL HasCommandLineOption(int argc, char **argv, const char *lpszOption)
-{
-	for (int i=1; i<argc; i++)
-		if ( !fl_utf_strcasecmp(argv[i], lpszOption) )
-			return TRUE;
-
-	return FALSE;
-}
-
-static BOOL GetCommandLineInt(int argc, char **argv, const char *lpszOption, int &iVal)
-{
-	for (int i=1; i<argc; i++)
-		if (!fl_utf_strcasecmp(argv[i], lpszOption) && argc > i+1 && isdigit((int)(UINT)(BYTE)argv[i+1][0]))
-		{
-			iVal = atoi(argv[i+1]);
-			return TRUE;
-		}
-
-	return FALSE;
-}
-
-static BOOL GetCommandLineString(int argc, char **argv, const char *lpszOption, const char *&pszVal)
-{
-	for (int i=1; i<argc; i++)
-		if (!fl_utf_strcasecmp(argv[i], lpszOption) && argc > i+1 && argv[i+1][0] != '-')
-		{
-			pszVal = argv[i+1];
-			return TRUE;
-		}
-
-	return FALSE;
-}
-
-static void InvokeShortcutFLTK(int key)
-{
-	int e_state = Fl::e_state;
-	int e_keysym = Fl::e_keysym;
-	char *e_text = Fl::e_text;
-	int e_length = Fl::e_length;
-
-	char s[1] = {0};
-	Fl::e_text = s;
-	Fl::e_length = 0;
-
-	Fl::e_state = (e_state & FL_NUM_LOCK) | (key & ~FL_KEY_MASK);
-	Fl::e_keysym = key & FL_KEY_MASK;
-
-	g_pMenuBar->handle(FL_SHORTCUT);
-
-	Fl::e_state = e_state;
-	Fl::e_keysym = e_keysym;
-	Fl::e_text = e_text;
-	Fl::e_length = e_length;
-}
-
-
-/////////////////////////////////////////////////////////////////////
-
-int main(int argc, char **argv)
-{
-	BOOL bUseCurrentDir = FALSE;
-#ifdef DEF_THEME
-#define DEF_THEME_S(s) DEF_THEME_S_(s)
-#define DEF_THEME_S_(s) #s
-	char szFlTheme[32] = DEF_THEME_S(DEF_THEME);
-#undef DEF_THEME_S
-#undef DEF_THEME_S_
-#else
-	char szFlTheme[32] = "gtk+";
-#endif
-#ifdef DEF_COLORS
-#define DEF_COLORS_S(s) DEF_COLORS_S_(s)
-#define DEF_COLORS_S_(s) #s
-	char szColors[32] = DEF_COLORS_S(DEF_COLORS);
-#undef DEF_COLORS_S
-#undef DEF_COLORS_S_
-#else
-	char szColors[32] = "default";
-#endif
-	int w = -1, h = -1;
-
-	g_bShockMaps = -1;
-
-	if (argc > 1)
-	{
-		if ( HasCommandLineOption(argc, argv, "--thief") )
-			g_bShockMaps = FALSE;
-		else if ( HasCommandLineOption(argc, argv, "--shock") )
-			g_bShockMaps = TRUE;
-		bUseCurrentDir = HasCommandLineOption(argc, argv, "--cwd");
-
-		if ( GetCommandLineInt(argc, argv, "--zoom", g_iZoom) )
-		{
-				if (g_iZoom < MIN_ZOOM)
-					g_iZoom = MIN_ZOOM;
-				else if (g_iZoom > MAX_ZOOM)
-					g_iZoom = MAX_ZOOM;
-		}
-
-		if ( GetCommandLineInt(argc, argv, "--margin", g_iLocationImageExtraBorder) )
-			if (g_iLocationImageExtraBorder < 0)
-				g_iLocationImageExtraBorder = 0;
-
-		if ( GetCommandLineInt(argc, argv, "--aa", g_iAlphaExportAA) )
-		{
-			if (g_iAlphaExportAA < 1)
-				g_iAlphaExportAA = 1;
-			else if (g_iAlphaExportAA > 8)
-				g_iAlphaExportAA = 8;
-		}
-
-		const char *szArg;
-		if ( GetCommandLineString(argc, argv, "--theme", szArg) )
-		{
-			strncpy(szFlTheme, szArg, sizeof(szFlTheme)-1);
-			szFlTheme[sizeof(szFlTheme)-1] = '\0';
-		}
-		if ( GetCommandLineString(argc, argv, "--colors", szArg) )
-		{
-			strncpy(szColors, szArg, sizeof(szColors)-1);
-			szColors[sizeof(szColors)-1] = '\0';
-		}
-
-		for (int i=1; i<argc; i++)
-			if (!fl_utf_strcasecmp(argv[i], "--winsize") && argc > i+1)
-			{
-				sscanf(argv[i+1], "%dx%d", &w, &h);
-				if (h > 0)
-				{
-					if (w < 320 + g_iWplus)
-						w = 320 + g_iWplus;
-					if (h < 240 + g_iHplus)
-						h = 240 + g_iHplus;
-
-					g_bUserDefinedWindowSize = TRUE;
-				}
-			}
-	}
-
-	InitFLTK(szFlTheme, szColors);
-
-    MakeWindow(w, h);
-
-	if (g_pMainWnd)
-	{
-		if (!bUseCurrentDir)
-		{
-			char *sDir = fl_dir_chooser("Select Map Directory", NULL, 0);
-			if (!sDir)
-			{
-				delete g_pMainWnd;
-				return 0;
-			}
-
-			fl_chdir(sDir);
-		}
-
-		char s[MAX_PATH];
-		LoadProject( fl_getcwd(s, sizeof(s)) );
-
-		if (!g_pProj->iMapCount)
-		{
-			fl_alert("No map pages found. Make sure that the working directory contains properly named map page images as PNG.");
-			return 0;
-		}
-
-		InitControls();
-
-		g_pMainWnd->show();
-
-		// apply any command-line settings for UI configurable settings
-		if (argc > 1)
-		{
-			int i;
-
-			if (GetCommandLineInt(argc, argv, "--viewmode", i) && i >= 1 && i < DM_NUM_MODES)
-				InvokeShortcutFLTK(FL_COMMAND+'1'+(i-1));
-			if ( HasCommandLineOption(argc, argv, "--thicklines") )
-				InvokeShortcutFLTK(FL_COMMAND+'t');
-			if ( HasCommandLineOption(argc, argv, "--labels") )
-				InvokeShortcutFLTK(FL_COMMAND+'l');
-			if ( HasCommandLineOption(argc, argv, "--cguides") )
-				InvokeShortcutFLTK(FL_COMMAND+'g');
-			if ( HasCommandLineOption(argc, argv, "--fillnew") )
-				InvokeShortcutFLTK(FL_COMMAND+'f');
-			if ( HasCommandLineOption(argc, argv, "--hidelines") )
-				InvokeShortcutFLTK(FL_COMMAND+'h');
-		}
-
-		Fl::run();
-
-		delete g_pMainWnd;
-
-		if (g_pProj)
-		{
-			delete g_pProj;
-			g_pProj = NULL;
-		}
-	}
-
-	return 0;
-}
+/* DarkMapGen is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * DarkMapGen is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with DarkMapGen.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <new>
+#include <stdarg.h>
+#if __cplusplus >= 201103L
+#include <stdint.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+// needed for condition variables
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#define _copysign copysign
+#define MAX_PATH PATH_MAX
+#endif
+#include <FL/Fl.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Menu_Bar.H>
+#include <FL/Fl_PNG_Image.H>
+#include <FL/fl_draw.H>
+#include <FL/Fl_Tree.H>
+#include <FL/Fl_Scroll.H>
+#include <FL/Fl_Box.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Progress.H>
+#include <FL/fl_ask.H>
+#include <FL/Fl_Tooltip.H>
+#include <FL/Fl_File_Chooser.H> 
+#include <FL/Fl_Image_Surface.H>
+#include <FL/Fl_Scheme.H>
+#include <FL/fl_utf8.h>
+#include <png.h>
+
+#ifndef NO_FLEET
+#include "Fle_Colors.hpp"
+#include "Fle_Schemes.hpp"
+#endif
+
+
+/////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+#define DIRSEP_STR "\\"
+#else
+#define DIRSEP_STR "/"
+#endif
+
+#ifndef TRUE
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int UINT;
+typedef int BOOL;
+typedef long long INT64;
+typedef unsigned long long UINT64;
+#define FALSE 0
+#define TRUE 1
+#endif
+#ifndef min
+#define min(a,b) (((a)<(b))?(a):(b))
+#endif
+#ifndef max
+#define max(a,b) (((a)>(b))?(a):(b))
+#endif
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define vsnprintf _vsnprintf
+#endif
+
+/////////////////////////////////////////////////////////////////////
+
+#define DARKMAPGEN_VERSION		"v1.01"
+
+#define DARKMAPGEN_TITLE		"DarkMapGen"
+
+#define PROJ_FILENAME			"DarkMapGen.proj"
+#define PROJ_BIN_FILENAME		"DarkMapGen.projb"
+#define PROJ_JOURNAL_FILENAME	"DarkMapGen.journal"
+#define MANIFEST_FILENAME		"DarkMapGen.manifest"
+
+
+// min and max zoom levels for image view (don't make max too large because dimmed location drawing has scaled copies
+// of each location, the page image itself is scaled in tiles of the visible area, both are kept in the view cache)
+#define MIN_ZOOM				1
+#define MAX_ZOOM				6
+
+// dark engine defined limits for max map pages and max locations per page
+#define MAX_MAPS				40
+#define MAX_LOCATIONS_PER_MAP	256
+
+// size of the zoomed map page tiles and memory limit of the scaled image cache of the image view
+#define VIEW_TILE_SIZE			256
+#define VIEW_IMAGE_CACHE_MEM	(128*1024*1024)
+#define VIEW_IMAGE_CACHE_BUCKETS	1024
+
+// cell size (in map pixels) of the location grid index used for hit-testing
+#define LOCATION_GRID_CELL		64
+
+// size of the pixel blocks classified by the adaptive mask rasterizer, only blocks crossed by an edge are supersampled
+#define MASK_BLOCK_SIZE			8
+
+// max verts per shape (only a sanity limit for loading, the vertex arrays are sized to the shapes)
+#define MAX_VERTS				32767
+
+// vertex pool block size and the largest vertex array that is allocated from the pool (in vertices)
+#define VERTEX_POOL_BLOCK		16384
+#define VERTEX_POOL_MAX_ARRAY	1024
+
+#define VERT_HANDLE_RADIUS		3
+#define VERT_RADIUS				1
+
+#define VERT_COLOR				FL_WHITE
+#define CUR_VERT_COLOR			FL_MAGENTA
+#define VERT_FRAME_COLOR		FL_BLACK
+#define CUR_SHAPE_LINE_COLOR	FL_GREEN
+#define INPROGRESS_SHAPE_COLOR	FL_CYAN
+#define SHAPE_LINE_COLOR		FL_YELLOW
+
+#define SNAP_RADIUS				(VERT_HANDLE_RADIUS+3)
+
+// max distance from the label pos that a drawn label covers (in client pixels, used for partial redraws)
+#define LABEL_DAMAGE_W			24
+#define LABEL_DAMAGE_H			14
+
+
+// transform a coordinate from original map coordinates to image view client space
+#define MAP2CL(_coord) \
+	((int)(_coord) * g_iZoom + g_iCTR)
+
+
+// construct a tree id from a map page index and a location index/id
+#define MAKE_TREE_ID(_mapidx, _locidx) \
+	((((UINT)(_mapidx))<<16) | (UINT)(WORD)(_locidx))
+
+// get map page index from a tree id (-1 if invalid)
+#define MAP_FROM_TREE_ID(_treeid) \
+	((int)(((UINT)(_treeid))>>16))
+
+// get location index/id from a tree id (-1 if invalid)
+#define LOCIDX_FROM_TREE_ID(_treeid) \
+	((int)(short)((UINT)(_treeid)))
+
+// get location array element index from tree id (-1 if invalid)
+#define LOC_FROM_TREE_ID(_treeid) \
+	(MAP_FROM_TREE_ID(_treeid) < 0) ? -1 : g_pProj->maps[MAP_FROM_TREE_ID(_treeid)].GetArrayIndexFromLocationIndex(LOCIDX_FROM_TREE_ID(_treeid))
+
+#define MENU_SET(...) { Fl_Menu_Item __mi = __VA_ARGS__; menu[menu_items++] = __mi; }
+
+#define MENU_MOD_DIV() menu[menu_items-1].flags |= FL_MENU_DIVIDER
+
+#if defined(__unix__) || defined(__UNIX__)
+// work around bug in X11
+#define EVENT_SHIFT() (g_iEventState&FL_SHIFT)
+#define EVENT_CTRL() (g_iEventState&FL_CTRL)
+#define EVENT_ALT() (g_iEventState&FL_ALT)
+#else
+#define EVENT_SHIFT() Fl::event_shift()
+#define EVENT_CTRL() Fl::event_ctrl()
+#define EVENT_ALT() Fl::event_alt()
+#endif
+
+
+// rasterizers for location image alpha masks
+enum RasterMode
+{
+	RM_FLTK,			// supersampled FLTK polygon drawing into an off-screen surface (needs a display connection)
+	RM_ANALYTIC,		// built-in scanline rasterizer with exact area coverage
+	RM_ADAPTIVE,		// built-in supersampling rasterizer that only supersamples the pixel blocks crossed by edges
+
+	RM_NUM_MODES
+};
+
+// PNG encoder presets for generated location images
+enum PngPreset
+{
+	PNG_PRESET_FAST,		// zlib level 1 and only the sub filter, for quick iterations
+	PNG_PRESET_DEFAULT,		// libpng defaults
+	PNG_PRESET_SMALLEST,	// zlib level 9 and all filters tried, for release builds
+
+	PNG_NUM_PRESETS
+};
+
+static const char *g_sPngPresetNames[PNG_NUM_PRESETS] = { "fast", "default", "smallest" };
+
+enum DisplayMode
+{
+	DM_OUTLINES,		// shapes are drawn as outlines only
+	DM_FILLSEL,			// the selected shape is filled with color, other shapes are drawn as outlines
+	DM_FILLALL,			// all shapes are filled with color
+	DM_DIMMED,			// all shapes are drawn with image data as darkened grayscale
+	DM_FADE_NONSEL,		// alpha fade everything but the selected shape
+
+	DM_NUM_MODES
+};
+
+
+/////////////////////////////////////////////////////////////////////
+
+class cImageView;
+struct sMap;
+struct sLocation;
+struct sLocationSnapshot;
+struct sMapSnapshot;
+
+static void SetModifiedFlag();
+static void ClearModifiedFlag();
+static void ResetMouse();
+static void ReportError(const char *fmt, ...);
+static void ReleaseLocationSnapshot(sLocationSnapshot *p);
+static void ReleaseMapSnapshot(sMapSnapshot *p);
+static BOOL LoadPageImages(int iMap, BOOL bReportErrors = TRUE);
+static void DownsampleMask(const BYTE *src, int iPitchSrc, int Dsrc, int w, int h, int AA, BYTE *data);
+static Fl_Image* GetLocationImageForView(const sMap &map, const sLocation &loc, int *pViewPos, BOOL bDim = TRUE, const int AA = 4);
+static void FakeTransparentImage(Fl_Image *img, Fl_Color bg, const UINT alpha = 48);
+static void OnCmdDelete(Fl_Widget* = NULL, void* = NULL);
+static void OnWindowResized(int w, int h);
+static int GetScrollViewClientWidth();
+static int GetScrollViewClientHeight();
+static void ScrollImageTo(int Xzoomed, int Yzoomed);
+static BOOL ChangeZoom(int n);
+
+
+/////////////////////////////////////////////////////////////////////
+
+#include "dmg_curs.h"
+
+enum
+{
+	DMG_CURS_STD,
+	DMG_CURS_MOVE,
+	DMG_CURS_ADD,
+	DMG_CURS_DEL,
+	DMG_CURS_ADDDEL,
+	DMG_CURS_LABELPOS,
+	DMG_CURS_PAN,
+};
+
+/////////////////////////////////////////////////////////////////////
+
+struct sVertex
+{
+	short x;
+	short y;
+};
+
+// allocator for the vertex arrays of shapes, the arrays have power of two sizes and are carved out of large blocks,
+// freed arrays are recycled through a free list per size, so shapes don't need a heap allocation each and the vertices
+// of shapes that are loaded or created together end up next to each other (only used on the main thread)
+class cVertexPool
+{
+public:
+	cVertexPool()
+	{
+		m_pBlocks = NULL;
+		m_iBlockUsed = VERTEX_POOL_BLOCK;
+		memset(m_pFree, 0, sizeof(m_pFree));
+	}
+
+	~cVertexPool()
+	{
+		while (m_pBlocks)
+		{
+			sBlock *p = m_pBlocks;
+			m_pBlocks = p->next;
+			free(p);
+		}
+	}
+
+	// get the array size that is allocated for 'n' vertices
+	static int GetArraySize(int n)
+	{
+		int iSize = MIN_ARRAY;
+		while (iSize < n)
+			iSize *= 2;
+		return iSize;
+	}
+
+	// 'iSize' must be a size returned by GetArraySize
+	sVertex* Alloc(int iSize)
+	{
+		if (iSize > VERTEX_POOL_MAX_ARRAY)
+			return new sVertex[iSize];
+
+		const int iClass = GetClass(iSize);
+
+		if (m_pFree[iClass])
+		{
+			sFree *p = m_pFree[iClass];
+			m_pFree[iClass] = p->next;
+			return (sVertex*)p;
+		}
+
+		if (m_iBlockUsed + iSize > VERTEX_POOL_BLOCK)
+		{
+			sBlock *p = (sBlock*) malloc(sizeof(sBlock));
+			p->next = m_pBlocks;
+			m_pBlocks = p;
+			m_iBlockUsed = 0;
+		}
+
+		sVertex *ret = m_pBlocks->verts + m_iBlockUsed;
+		m_iBlockUsed += iSize;
+
+		return ret;
+	}
+
+	void Free(sVertex *p, int iSize)
+	{
+		if (!p || !iSize)
+			return;
+
+		if (iSize > VERTEX_POOL_MAX_ARRAY)
+		{
+			delete[] p;
+			return;
+		}
+
+		const int iClass = GetClass(iSize);
+
+		sFree *f = (sFree*)p;
+		f->next = m_pFree[iClass];
+		m_pFree[iClass] = f;
+	}
+
+private:
+	// smallest array, must be large enough to hold a free list link
+	enum { MIN_ARRAY = 4 };
+
+	static int GetClass(int iSize)
+	{
+		int iClass = 0;
+		for (int n=MIN_ARRAY; n<iSize; n*=2)
+			iClass++;
+		return iClass;
+	}
+
+	struct sBlock
+	{
+		sBlock *next;
+		sVertex verts[VERTEX_POOL_BLOCK];
+	};
+
+	struct sFree
+	{
+		sFree *next;
+	};
+
+	sBlock *m_pBlocks;
+	int m_iBlockUsed;		// verts used in the first block
+	sFree *m_pFree[16];		// free lists per size class
+};
+
+static cVertexPool g_vertexPool;
+
+struct sShape
+{
+	sShape()
+	{
+		next = NULL;
+		owner = NULL;
+		bHole = FALSE;
+		memset(iBoundRect, 0, sizeof(iBoundRect));
+		iLabelPos[1] = iLabelPos[0] = 0;
+		iVertCount = 0;
+		iMaxVerts = 0;
+		verts = NULL;
+	}
+	sShape(const sShape &sh)
+	{
+		iVertCount = 0;
+		iMaxVerts = 0;
+		verts = NULL;
+		*this = sh;
+	}
+	~sShape()
+	{
+		g_vertexPool.Free(verts, iMaxVerts);
+	}
+
+	sShape& operator=(const sShape &sh)
+	{
+		if (&sh == this)
+			return *this;
+
+		next = sh.next;
+		owner = sh.owner;
+		bHole = sh.bHole;
+		memcpy(iBoundRect, sh.iBoundRect, sizeof(iBoundRect));
+		memcpy(iLabelPos, sh.iLabelPos, sizeof(iLabelPos));
+
+		SetVertCount(sh.iVertCount);
+		if (iVertCount)
+			memcpy(verts, sh.verts, sizeof(sVertex) * iVertCount);
+
+		return *this;
+	}
+
+	// resize the vertex array, existing vertices are kept
+	void SetVertCount(int n)
+	{
+		if (n > iMaxVerts)
+		{
+			const int iSize = cVertexPool::GetArraySize(n);
+
+			sVertex *p = g_vertexPool.Alloc(iSize);
+			if (iVertCount)
+				memcpy(p, verts, sizeof(sVertex) * min(iVertCount, n));
+
+			g_vertexPool.Free(verts, iMaxVerts);
+			verts = p;
+			iMaxVerts = iSize;
+		}
+
+		iVertCount = n;
+	}
+
+	// insert a vertex before vertex 'i' (the vertex array may be reallocated)
+	void InsertVert(int i, const sVertex &v)
+	{
+		SetVertCount(iVertCount + 1);
+
+		if (i < iVertCount-1)
+			memmove(verts + i + 1, verts + i, sizeof(sVertex) * (iVertCount - i - 1));
+		verts[i] = v;
+	}
+
+	// use vertices that aren't owned by the shape (in a mapped binary project file), they're copied to an own array
+	// when the vertex count grows or the shape is copied
+	void SetMappedVerts(sVertex *p, int n)
+	{
+		g_vertexPool.Free(verts, iMaxVerts);
+
+		verts = p;
+		iVertCount = n;
+		iMaxVerts = 0;
+	}
+
+	// copy mapped vertices to an own array
+	void DetachMappedVerts()
+	{
+		if (iMaxVerts || !iVertCount)
+			return;
+
+		const int n = iVertCount;
+		iVertCount = 0;
+
+		sVertex *p = verts;
+		SetVertCount(n);
+		memcpy(verts, p, sizeof(sVertex) * n);
+	}
+
+	void DeleteVert(int i)
+	{
+		if (i < iVertCount-1)
+			memmove(verts + i, verts + i + 1, sizeof(sVertex) * (iVertCount - i - 1));
+		iVertCount--;
+	}
+
+	void CalcBoundingRect()
+	{
+		iBoundRect[2] = iBoundRect[0] = verts[0].x;
+		iBoundRect[3] = iBoundRect[1] = verts[0].y;
+
+		for (int i=1; i<iVertCount; i++)
+		{
+			if (verts[i].x < iBoundRect[0])
+				iBoundRect[0] = verts[i].x;
+			else if (verts[i].x > iBoundRect[2])
+				iBoundRect[2] = verts[i].x;
+
+			if (verts[i].y < iBoundRect[1])
+				iBoundRect[1] = verts[i].y;
+			else if (verts[i].y > iBoundRect[3])
+				iBoundRect[3] = verts[i].y;
+		}
+	}
+
+	// complex point in poly algorithm posted on the net by Ken McElvain
+
+	/*
+	 * Quadrants:
+	 *    1 | 0
+	 *    -----
+	 *    2 | 3
+	 */
+	static inline int whichquad(const sVertex &pt, const sVertex &orig)
+	{
+		int quad;
+		if (pt.x < orig.x)
+		{
+			if (pt.y < orig.y) quad = 2;
+			else quad = 1;
+		}
+		else
+		{
+			if (pt.y < orig.y) quad = 3;
+			else quad = 0;
+		}
+		return quad;
+	}
+
+	BOOL IsPosInShape(int x, int y) const
+	{
+		if (iVertCount < 3)
+			return FALSE;
+
+		// do a quick bound rect test
+		if (x < iBoundRect[0] || x > iBoundRect[2] || y < iBoundRect[1] || y > iBoundRect[3])
+			return FALSE;
+
+		const sVertex* polypts = verts;
+		const sVertex pt = { (short int)x, (short int)y };
+
+		int wind = 0;
+		sVertex lastpt = polypts[iVertCount-1];
+		/* get starting angle */
+		int oldquad = whichquad(lastpt, pt);
+
+		for (int i=0; i<iVertCount; i++)
+		{
+			sVertex thispt = *polypts++;
+			int newquad = whichquad(thispt, pt);
+
+			if (oldquad != newquad)
+			{
+				/*
+				* use mod 4 comparisons to see if we have
+				* advanced or backed up one quadrant
+				*/
+				if (((oldquad + 1) & 3) == newquad)
+					wind++;
+				else if (((newquad + 1) & 3) == oldquad)
+					wind--;
+				else
+				{
+					/*
+					* upper left to lower right, or
+					* upper right to lower left. Determine
+					* direction of winding  by intersection
+					* with x==0.
+					*/
+					int a = (int)lastpt.y - (int)thispt.y;
+					a *= ((int)pt.x - (int)lastpt.x);
+					int b = (int)lastpt.x - (int)thispt.x;
+					a += (int)lastpt.y * b;
+					b *= (int)pt.y;
+
+					if (a > b) wind += 2;
+					else wind -= 2;
+				}
+				oldquad = newquad;
+			}
+			lastpt = thispt;
+		}
+
+		/* non-zero means point in poly */
+		return wind;
+	}
+
+	// returns TRUE is subShape is this shape or a hole in it
+	BOOL IsPartOf(const sShape &subShape) const
+	{
+		if (&subShape == this)
+			return TRUE;
+
+		if (!bHole)
+			for (const sShape *p=next; p && p->bHole; p=p->next)
+				if (p == &subShape)
+					return TRUE;
+
+		return FALSE;
+	}
+
+	void MovePos(int dx, int dy)
+	{
+		if (iVertCount <= 0)
+			return;
+
+		iBoundRect[0] += dx;
+		iBoundRect[1] += dy;
+		iBoundRect[2] += dx;
+		iBoundRect[3] += dy;
+
+		iLabelPos[0] += dx;
+		iLabelPos[1] += dy;
+
+		for (int i=0; i<iVertCount; i++)
+		{
+			verts[i].x += dx;
+			verts[i].y += dy;
+		}
+	}
+
+	sShape *next;
+	sLocation *owner;
+
+	BOOL bHole;
+
+	int iBoundRect[4];
+	int iLabelPos[2];
+
+	int iVertCount;
+	int iMaxVerts;		// size of the vertex array (0 if the vertices aren't owned, see SetMappedVerts)
+	sVertex *verts;		// allocated from g_vertexPool
+};
+
+// cache of scaled images for the image view, holds zoomed map page tiles and location preview images for any number of
+// pages, zoom levels and drawing variants so that revisiting a page or zoom level doesn't have to scale everything
+// again. The least recently drawn images are discarded when the cache exceeds VIEW_IMAGE_CACHE_MEM. Entries are keyed
+// by the address of the owning map or location, so the owner must flush its entries when it changes or goes away.
+class cViewImageCache
+{
+public:
+	cViewImageCache()
+	{
+		m_pEntries = NULL;
+		m_iMaxEntries = 0;
+		m_iUsedEntries = 0;
+		m_iFreeList = -1;
+		m_iMemSize = 0;
+		m_iFrame = 0;
+
+		for (int i=0; i<VIEW_IMAGE_CACHE_BUCKETS; i++)
+			m_iBuckets[i] = -1;
+	}
+
+	~cViewImageCache()
+	{
+		Flush();
+		delete[] m_pEntries;
+	}
+
+	// images drawn after this call are protected from being discarded until the next call
+	void BeginFrame() { m_iFrame++; }
+
+	void Flush()
+	{
+		for (int i=0; i<m_iUsedEntries; i++)
+			if (m_pEntries[i].img)
+				delete m_pEntries[i].img;
+
+		m_iUsedEntries = 0;
+		m_iFreeList = -1;
+		m_iMemSize = 0;
+
+		for (int i=0; i<VIEW_IMAGE_CACHE_BUCKETS; i++)
+			m_iBuckets[i] = -1;
+	}
+
+	// discard all images of an owner
+	void Flush(const void *owner)
+	{
+		if (!m_iMemSize)
+			return;
+
+		for (int i=0; i<m_iUsedEntries; i++)
+			if (m_pEntries[i].img && m_pEntries[i].owner == owner)
+				Remove(i);
+	}
+
+	// get a cached image (and its view position if one was stored with it), NULL if not cached
+	Fl_Image* Find(const void *owner, int iZoom, int iVariant, int iTile = 0, int *pPos = NULL)
+	{
+		for (int i=m_iBuckets[Hash(owner, iZoom, iVariant, iTile)]; i>=0; i=m_pEntries[i].iNext)
+		{
+			sEntry &e = m_pEntries[i];
+
+			if (e.owner == owner && e.iZoom == iZoom && e.iVariant == iVariant && e.iTile == iTile)
+			{
+				e.iLastUse = m_iFrame;
+
+				if (pPos)
+				{
+					pPos[0] = e.iPos[0];
+					pPos[1] = e.iPos[1];
+				}
+
+				return e.img;
+			}
+		}
+
+		return NULL;
+	}
+
+	// add an image to the cache (the cache takes ownership of it)
+	void Add(const void *owner, int iZoom, int iVariant, int iTile, Fl_Image *img, const int *pPos = NULL)
+	{
+		int i = m_iFreeList;
+		if (i >= 0)
+			m_iFreeList = m_pEntries[i].iNext;
+		else
+		{
+			if (m_iUsedEntries == m_iMaxEntries)
+			{
+				m_iMaxEntries = m_iMaxEntries ? m_iMaxEntries * 2 : 256;
+				sEntry *p = new sEntry[m_iMaxEntries];
+				if (m_iUsedEntries)
+					memcpy(p, m_pEntries, sizeof(sEntry) * m_iUsedEntries);
+				delete[] m_pEntries;
+				m_pEntries = p;
+			}
+
+			i = m_iUsedEntries++;
+		}
+
+		const int h = Hash(owner, iZoom, iVariant, iTile);
+
+		sEntry &e = m_pEntries[i];
+		e.owner = owner;
+		e.iZoom = iZoom;
+		e.iVariant = iVariant;
+		e.iTile = iTile;
+		e.img = img;
+		e.iPos[0] = pPos ? pPos[0] : 0;
+		e.iPos[1] = pPos ? pPos[1] : 0;
+		e.iLastUse = m_iFrame;
+		e.iNext = m_iBuckets[h];
+		m_iBuckets[h] = i;
+
+		m_iMemSize += GetImageMemSize(img);
+
+		Trim();
+	}
+
+	// draw the visible part of a map page image scaled by 'iZoom' at dx,dy (faded to the background color if 'bFade'
+	// is set), the scaled image is split into tiles which are only created when they intersect the visible area
+	void DrawPage(const void *owner, const Fl_Image *img, int iZoom, BOOL bFade, int dx, int dy)
+	{
+		int X, Y, W, H;
+		fl_clip_box(dx, dy, img->w() * iZoom, img->h() * iZoom, X, Y, W, H);
+		if (W <= 0 || H <= 0)
+			return;
+
+		const int tx0 = (X - dx) / VIEW_TILE_SIZE;
+		const int ty0 = (Y - dy) / VIEW_TILE_SIZE;
+		const int tx1 = (X - dx + W - 1) / VIEW_TILE_SIZE;
+		const int ty1 = (Y - dy + H - 1) / VIEW_TILE_SIZE;
+
+		for (int ty=ty0; ty<=ty1; ty++)
+			for (int tx=tx0; tx<=tx1; tx++)
+			{
+				const int iTile = (ty << 16) | tx;
+
+				Fl_Image *tile = Find(owner, iZoom, bFade, iTile);
+				if (!tile)
+				{
+					tile = ScaleTile(img, iZoom, bFade, tx, ty);
+					Add(owner, iZoom, bFade, iTile, tile);
+				}
+
+				tile->draw(dx + tx * VIEW_TILE_SIZE, dy + ty * VIEW_TILE_SIZE);
+			}
+	}
+
+private:
+	struct sEntry
+	{
+		const void *owner;
+		int iZoom;
+		int iVariant;
+		int iTile;
+		Fl_Image *img;
+		int iPos[2];
+		UINT iLastUse;
+		// next entry in hash bucket or free list
+		int iNext;
+	};
+
+	static int Hash(const void *owner, int iZoom, int iVariant, int iTile)
+	{
+		UINT h = (UINT)((intptr_t)owner >> 4);
+		h = h * 31 + (UINT)iZoom;
+		h = h * 31 + (UINT)iVariant;
+		h = h * 31 + (UINT)iTile;
+		h ^= h >> 13;
+		h *= 0x5bd1e995;
+		h ^= h >> 15;
+		return (int)(h & (VIEW_IMAGE_CACHE_BUCKETS - 1));
+	}
+
+	static int GetImageMemSize(const Fl_Image *img)
+	{
+		return img->w() * img->h() * img->d();
+	}
+
+	void Remove(int i)
+	{
+		sEntry &e = m_pEntries[i];
+
+		// unlink from hash bucket
+		int *pLink = &m_iBuckets[Hash(e.owner, e.iZoom, e.iVariant, e.iTile)];
+		while (*pLink != i)
+			pLink = &m_pEntries[*pLink].iNext;
+		*pLink = e.iNext;
+
+		m_iMemSize -= GetImageMemSize(e.img);
+		delete e.img;
+		e.img = NULL;
+
+		e.iNext = m_iFreeList;
+		m_iFreeList = i;
+	}
+
+	// nearest neighbor scale the part of 'img' covered by a tile
+	static Fl_RGB_Image* ScaleTile(const Fl_Image *img, int iZoom, BOOL bFade, int tx, int ty)
+	{
+		const int X0 = tx * VIEW_TILE_SIZE;
+		const int Y0 = ty * VIEW_TILE_SIZE;
+		const int w = min(VIEW_TILE_SIZE, img->w() * iZoom - X0);
+		const int h = min(VIEW_TILE_SIZE, img->h() * iZoom - Y0);
+
+		const int D = img->d();
+		const BYTE *srcdata = (const BYTE*) img->data()[0];
+		const int iPitchSrc = img->w() * D + img->ld();
+
+		BYTE *data = new BYTE[w * h * D];
+		const int iPitch = w * D;
+
+		for (int y=0; y<h; y++)
+		{
+			BYTE *dst = data + y * iPitch;
+
+			// consecutive rows from the same source row are identical
+			if (y > 0 && (Y0 + y) / iZoom == (Y0 + y - 1) / iZoom)
+			{
+				memcpy(dst, dst - iPitch, iPitch);
+				continue;
+			}
+
+			const BYTE *src = srcdata + ((Y0 + y) / iZoom) * iPitchSrc;
+			for (int x=0; x<w; x++, dst+=D)
+				memcpy(dst, src + ((X0 + x) / iZoom) * D, D);
+		}
+
+		Fl_RGB_Image *tile = new Fl_RGB_Image(data, w, h, D);
+		tile->alloc_array = 1;
+
+		if (bFade)
+			FakeTransparentImage(tile, FL_DARK1);
+
+		return tile;
+	}
+
+	// discard least recently drawn images (but never the ones drawn this frame) until within the memory limit
+	void Trim()
+	{
+		while (m_iMemSize > VIEW_IMAGE_CACHE_MEM)
+		{
+			int iOldest = -1;
+			for (int i=0; i<m_iUsedEntries; i++)
+				if (m_pEntries[i].img && m_pEntries[i].iLastUse != m_iFrame
+					&& (iOldest < 0 || m_pEntries[i].iLastUse < m_pEntries[iOldest].iLastUse))
+					iOldest = i;
+
+			if (iOldest < 0)
+				break;
+
+			Remove(iOldest);
+		}
+	}
+
+	sEntry *m_pEntries;
+	int m_iMaxEntries;
+	int m_iUsedEntries;
+	int m_iFreeList;
+	int m_iBuckets[VIEW_IMAGE_CACHE_BUCKETS];
+	int m_iMemSize;
+	UINT m_iFrame;
+};
+
+static cViewImageCache g_viewCache;
+
+struct sLocation
+{
+	sLocation()
+	{
+		pMap = NULL;
+		iSerial = 0;
+		iLocationIndex = 0;
+		memset(iBoundRect, 0, sizeof(iBoundRect));
+		shape = NULL;
+		iShapeCount = 0;
+		iMaxShapes = 0;
+		pSnapshot = NULL;
+	}
+	~sLocation()
+	{
+		FlushScaledImages();
+		ReleaseLocationSnapshot(pSnapshot);
+		FreeShapes();
+	}
+
+	void FreeShapes()
+	{
+		for (int i=0; i<iShapeCount; i++)
+			shape[i].~sShape();
+
+		if (iMaxShapes)
+			free(shape);
+
+		shape = NULL;
+		iShapeCount = 0;
+		iMaxShapes = 0;
+	}
+
+	void FlushScaledImages()
+	{
+		g_viewCache.Flush(this);
+	}
+
+	void CalcBoundingRect()
+	{
+		iBoundRect[0] = INT_MAX;
+		iBoundRect[1] = INT_MAX;
+		iBoundRect[2] = INT_MIN;
+		iBoundRect[3] = INT_MIN;
+
+		for (sShape *p=shape; p; p=p->next)
+		{
+			p->CalcBoundingRect();
+
+			if (p->iBoundRect[0] < iBoundRect[0])
+				iBoundRect[0] = p->iBoundRect[0];
+			if (p->iBoundRect[1] < iBoundRect[1])
+				iBoundRect[1] = p->iBoundRect[1];
+			if (p->iBoundRect[2] > iBoundRect[2])
+				iBoundRect[2] = p->iBoundRect[2];
+			if (p->iBoundRect[3] > iBoundRect[3])
+				iBoundRect[3] = p->iBoundRect[3];
+		}
+
+		OnChanged();
+	}
+
+	// must be called whenever the location changes (updates serials and the location index of the map)
+	void OnChanged();
+
+	// has more than one shape (a shape with holes counts as multiple)
+	BOOL IsMultiShape() const { return shape && shape->next; }
+
+	// has more than one solid shape (holes don't count)
+	BOOL IsMultiSolidShape() const
+	{
+		if (shape && shape->next)
+			for (const sShape *p=shape->next; p; p=p->next)
+				if (!p->bHole)
+					return TRUE;
+
+		return FALSE;
+	}
+
+	BOOL IsPosInLocation(int x, int y) const
+	{
+		for (sShape *p=shape; p; p=p->next)
+			if (!p->bHole && p->IsPosInShape(x, y))
+			{
+				// make sure it's not inside any hole of this shape
+				for (p=p->next; p && p->bHole; p=p->next)
+					if ( p->IsPosInShape(x, y) )
+						goto next_solid;
+				return TRUE;
+next_solid:;
+			}
+
+		return FALSE;
+	}
+
+	sShape* GetShapeContainingPos(int x, int y) const
+	{
+		// return last shape containting pos since that will be on top in the drawing order
+
+		sShape *ret = NULL;
+
+		for (sShape *p=shape; p; p=p->next)
+			if ( p->IsPosInShape(x, y) )
+				ret = p;
+
+		return ret;
+	}
+
+	BOOL IsVertPtrInLocation(const sVertex *pv) const
+	{
+		for (sShape *p=shape; p; p=p->next)
+			if (pv >= p->verts && pv < p->verts+p->iVertCount)
+				return TRUE;
+
+		return FALSE;
+	}
+
+	// determine is 'ps' is the only non-hole shape in this location
+	BOOL IsOnlyNonHoleShape(const sShape *ps) const
+	{
+		if (!ps || ps->bHole || ps != shape)
+			return FALSE;
+
+		if (shape->next)
+		{
+			const sShape *p = shape->next;
+			while (p && p->bHole)
+				p = p->next;
+
+			return !p;
+		}
+
+		return TRUE;
+	}
+
+	void MovePos(int dx, int dy)
+	{
+		if (!shape)
+			return;
+
+		FlushScaledImages();
+
+		iBoundRect[0] += dx;
+		iBoundRect[1] += dy;
+		iBoundRect[2] += dx;
+		iBoundRect[3] += dy;
+
+		for (sShape *p=shape; p; p=p->next)
+			p->MovePos(dx, dy);
+
+		OnChanged();
+	}
+
+	sShape* AddShape(const sShape &sh, BOOL bHole = FALSE)
+	{
+		return AddShapeAt(iShapeCount, sh, bHole);
+	}
+
+	// insert a shape before shape 'i' in the drawing order (pointers to the shapes of this location aren't valid anymore)
+	sShape* AddShapeAt(int i, const sShape &sh, BOOL bHole)
+	{
+		sShape *p = InsertShape(i, sh);
+		p->bHole = bHole;
+
+		FlushScaledImages();
+		CalcBoundingRect();
+
+		return p;
+	}
+
+	sShape* AddShapeMaybeHole(const sShape &sh)
+	{
+		// determine if the added shape is a hole or not, by seeing if the first point is inside another shape
+		sShape *p = GetShapeContainingPos(sh.verts[0].x, sh.verts[0].y);
+
+		if (!p)
+			return AddShape(sh);
+
+		// the new shape is a hole in 'p', insert the shape after 'p' in the list (as the last hole if it has several)
+
+		for (; p->next && p->next->bHole; p=p->next);
+
+		sShape *hole = AddShapeAt((int)(p - shape) + 1, sh, TRUE);
+		hole->iLabelPos[1] = hole->iLabelPos[0] = 0;
+
+		return hole;
+	}
+
+	void DeleteShape(sShape *pShape)
+	{
+		if (!pShape)
+			return;
+
+		// delete shape and holes belonging to the shape, if applicable
+
+		const int i = (int)(pShape - shape);
+		int n = 1;
+
+		if (!pShape->bHole)
+			while (i+n < iShapeCount && shape[i+n].bHole)
+				n++;
+
+		for (int j=i; j<i+n; j++)
+			shape[j].~sShape();
+
+		if (i+n < iShapeCount)
+			memmove((void*)(shape + i), shape + i + n, sizeof(sShape) * (iShapeCount - i - n));
+
+		iShapeCount -= n;
+
+		if (!iShapeCount)
+			FreeShapes();
+		else
+		{
+			// make sure the first shape isn't a whole (never should be)
+			shape->bHole = FALSE;
+
+			LinkShapes();
+		}
+
+		FlushScaledImages();
+		CalcBoundingRect();
+	}
+
+	// append an empty shape (for the project loader, call CalcBoundingRect when all shapes are added)
+	sShape* AppendShape()
+	{
+		return InsertShape(iShapeCount, sShape());
+	}
+
+	// replace the shapes with copies of the shapes of 'src' (without touching the view cache or the serial)
+	void CopyShapes(const sLocation &src)
+	{
+		FreeShapes();
+
+		if (!src.iShapeCount)
+			return;
+
+		shape = (sShape*) malloc(sizeof(sShape) * src.iShapeCount);
+		iMaxShapes = src.iShapeCount;
+
+		for (int i=0; i<src.iShapeCount; i++)
+			new (&shape[i]) sShape(src.shape[i]);
+		iShapeCount = src.iShapeCount;
+
+		LinkShapes();
+	}
+
+	void UpdateShapeOwnerPtrs()
+	{
+		// 'this' pointer changed due to location array reshuffling, update the owner pointer in the shapes
+		for (sShape *p=shape; p; p=p->next)
+			p->owner = this;
+	}
+
+	// free the shapes and snapshot and reset the location to an empty one of the same map (without touching the view
+	// cache)
+	void Reset()
+	{
+		ReleaseLocationSnapshot(pSnapshot);
+		pSnapshot = NULL;
+		FreeShapes();
+
+		iSerial = 0;
+		iLocationIndex = 0;
+		memset(iBoundRect, 0, sizeof(iBoundRect));
+	}
+
+	// take over the contents of 'src' when locations are moved within or between location arrays, 'src' is left
+	// empty (the view cache entries of both addresses must be flushed by the caller, they're keyed by address)
+	void MoveFrom(sLocation &src)
+	{
+		Reset();
+
+		pMap = src.pMap;
+		iSerial = src.iSerial;
+		iLocationIndex = src.iLocationIndex;
+		memcpy(iBoundRect, src.iBoundRect, sizeof(iBoundRect));
+		shape = src.shape;
+		iShapeCount = src.iShapeCount;
+		iMaxShapes = src.iMaxShapes;
+		pSnapshot = src.pSnapshot;
+
+		src.shape = NULL;
+		src.iShapeCount = 0;
+		src.iMaxShapes = 0;
+		src.pSnapshot = NULL;
+		src.Reset();
+
+		UpdateShapeOwnerPtrs();
+	}
+
+private:
+	// locations own their shapes and snapshot, they're only moved with MoveFrom (not implemented)
+	sLocation(const sLocation&);
+	sLocation& operator=(const sLocation&);
+
+	// insert a copy of 'sh' before shape 'i', shapes are moved in memory with memmove (they don't point into
+	// themselves), so pointers to the shapes of this location aren't valid anymore after that
+	sShape* InsertShape(int i, const sShape &sh)
+	{
+		if (iShapeCount == iMaxShapes)
+		{
+			iMaxShapes = iMaxShapes ? iMaxShapes * 2 : 2;
+			shape = (sShape*) realloc((void*)shape, sizeof(sShape) * iMaxShapes);
+		}
+
+		if (i < iShapeCount)
+			memmove((void*)(shape + i + 1), shape + i, sizeof(sShape) * (iShapeCount - i));
+
+		new (&shape[i]) sShape(sh);
+		iShapeCount++;
+
+		LinkShapes();
+
+		return &shape[i];
+	}
+
+	void LinkShapes()
+	{
+		for (int i=0; i<iShapeCount; i++)
+		{
+			shape[i].next = i < iShapeCount-1 ? &shape[i+1] : NULL;
+			shape[i].owner = this;
+		}
+	}
+
+public:
+
+	// map that contains this location (NULL for locations that aren't part of a map)
+	sMap *pMap;
+
+	// incremented on every change
+	int iSerial;
+
+	int iLocationIndex;
+
+	int iBoundRect[4];
+
+	// the shapes in drawing order (holes follow the shape they belong to) are kept in one array, which can be iterated
+	// through the 'next' links starting at 'shape' (NULL if there are no shapes)
+	sShape *shape;
+	int iShapeCount;
+	int iMaxShapes;		// size of the array (0 if it's not owned by the location)
+
+	// last snapshot taken of this location, reused by TakeLocationSnapshot until the serial changes
+	sLocationSnapshot *pSnapshot;
+};
+
+// uniform grid over the location bound rects of a map, used to find the locations near a map position without
+// testing every location (the grid size is based on the page image size, anything outside goes to the border cells)
+class cLocationIndex
+{
+public:
+	cLocationIndex()
+	{
+		m_pCells = NULL;
+		m_iGridSize[1] = m_iGridSize[0] = 0;
+		m_bValid = FALSE;
+	}
+
+	~cLocationIndex()
+	{
+		Free();
+	}
+
+	BOOL IsValid() const { return m_bValid; }
+
+	// the index is rebuilt on the next query (needed when location array indices change)
+	void Invalidate() { m_bValid = FALSE; }
+
+	void Rebuild(const sLocation *locs, int iLocationCount, int w, int h)
+	{
+		Free();
+
+		m_iGridSize[0] = max(1, (w + LOCATION_GRID_CELL - 1) / LOCATION_GRID_CELL);
+		m_iGridSize[1] = max(1, (h + LOCATION_GRID_CELL - 1) / LOCATION_GRID_CELL);
+		m_pCells = new sCell[m_iGridSize[0] * m_iGridSize[1]];
+		memset(m_pCells, 0, sizeof(sCell) * m_iGridSize[0] * m_iGridSize[1]);
+
+		for (int i=0; i<MAX_LOCATIONS_PER_MAP; i++)
+			m_iCellRect[i][0] = -1;
+
+		m_bValid = TRUE;
+
+		for (int i=0; i<iLocationCount; i++)
+			Update(locs[i], i);
+	}
+
+	// re-insert a location after its bounds changed
+	void Update(const sLocation &loc, int iLoc)
+	{
+		if (!m_bValid)
+			return;
+
+		int *r = m_iCellRect[iLoc];
+
+		if (r[0] >= 0)
+		{
+			for (int cy=r[1]; cy<=r[3]; cy++)
+				for (int cx=r[0]; cx<=r[2]; cx++)
+					m_pCells[cy * m_iGridSize[0] + cx].Remove(iLoc);
+
+			r[0] = -1;
+		}
+
+		if (!loc.shape || loc.iBoundRect[2] < loc.iBoundRect[0])
+			return;
+
+		GetCellRect(loc.iBoundRect[0], loc.iBoundRect[1], loc.iBoundRect[2], loc.iBoundRect[3], r);
+
+		for (int cy=r[1]; cy<=r[3]; cy++)
+			for (int cx=r[0]; cx<=r[2]; cx++)
+				m_pCells[cy * m_iGridSize[0] + cx].Add(iLoc);
+	}
+
+	// get the array indices (in ascending order) of the locations in the grid cells overlapping a map rect (inclusive),
+	// the locations themselves may not overlap the rect, returns the number of locations
+	int Query(int x0, int y0, int x1, int y1, int *pOut) const
+	{
+		BYTE found[MAX_LOCATIONS_PER_MAP] = {0};
+
+		int r[4];
+		GetCellRect(x0, y0, x1, y1, r);
+
+		for (int cy=r[1]; cy<=r[3]; cy++)
+			for (int cx=r[0]; cx<=r[2]; cx++)
+			{
+				const sCell &cell = m_pCells[cy * m_iGridSize[0] + cx];
+				for (int i=0; i<cell.iCount; i++)
+					found[cell.pLocs[i]] = 1;
+			}
+
+		int n = 0;
+		for (int i=0; i<MAX_LOCATIONS_PER_MAP; i++)
+			if (found[i])
+				pOut[n++] = i;
+
+		return n;
+	}
+
+private:
+	struct sCell
+	{
+		void Add(int iLoc)
+		{
+			if (iCount == iMaxCount)
+			{
+				iMaxCount = iMaxCount ? iMaxCount * 2 : 8;
+				BYTE *p = new BYTE[iMaxCount];
+				if (iCount)
+					memcpy(p, pLocs, iCount);
+				delete[] pLocs;
+				pLocs = p;
+			}
+
+			pLocs[iCount++] = (BYTE)iLoc;
+		}
+
+		void Remove(int iLoc)
+		{
+			for (int i=0; i<iCount; i++)
+				if (pLocs[i] == iLoc)
+				{
+					pLocs[i] = pLocs[--iCount];
+					return;
+				}
+		}
+
+		BYTE *pLocs;
+		int iCount;
+		int iMaxCount;
+	};
+
+	void Free()
+	{
+		if (m_pCells)
+		{
+			for (int i=0; i<m_iGridSize[0]*m_iGridSize[1]; i++)
+				delete[] m_pCells[i].pLocs;
+
+			delete[] m_pCells;
+			m_pCells = NULL;
+		}
+
+		m_bValid = FALSE;
+	}
+
+	void GetCellRect(int x0, int y0, int x1, int y1, int *r) const
+	{
+		r[0] = min(max(x0, 0) / LOCATION_GRID_CELL, m_iGridSize[0] - 1);
+		r[1] = min(max(y0, 0) / LOCATION_GRID_CELL, m_iGridSize[1] - 1);
+		r[2] = min(max(x1, 0) / LOCATION_GRID_CELL, m_iGridSize[0] - 1);
+		r[3] = min(max(y1, 0) / LOCATION_GRID_CELL, m_iGridSize[1] - 1);
+	}
+
+	sCell *m_pCells;
+	int m_iGridSize[2];
+	BOOL m_bValid;
+
+	// cells occupied by each location (x0 is -1 if not in the grid)
+	int m_iCellRect[MAX_LOCATIONS_PER_MAP][4];
+};
+
+struct sMap
+{
+	sMap()
+	{
+		img = NULL;
+		imgHilightSS2 = NULL;
+		iImgSize[1] = iImgSize[0] = 0;
+		iLastUse = 0;
+		iPinCount = 0;
+		bLoadFailed = FALSE;
+		iLocationCount = 0;
+		iMaxLocations = 0;
+		locs = NULL;
+		iSerial = 0;
+		pSnapshot = NULL;
+	}
+	~sMap()
+	{
+		ReleaseMapSnapshot(pSnapshot);
+
+		delete[] locs;
+
+		if (img)
+			delete img;
+		if (imgHilightSS2)
+			delete imgHilightSS2;
+	}
+
+	void FlushScaledImages()
+	{
+		g_viewCache.Flush(this);
+
+		for (int i=0; i<iLocationCount; i++)
+			locs[i].FlushScaledImages();
+	}
+
+	// TRUE if a map page image exists for this map (the image itself may not be loaded yet, see LoadPageImages)
+	BOOL IsValid() const { return iImgSize[0] > 0; }
+
+	int GetFreeLocationIndex() const
+	{
+		char used[MAX_LOCATIONS_PER_MAP] = {0};
+
+		for (int i=0; i<iLocationCount; i++)
+			used[locs[i].iLocationIndex] = 1;
+
+		for (int i=0; i<MAX_LOCATIONS_PER_MAP; i++)
+			if (!used[i])
+				return i;
+
+		return -1;
+	}
+
+	const sLocation* GetByLocationIndex(int iLocIdx) const
+	{
+		if (iLocIdx < 0)
+			return NULL;
+
+		for (int i=0; i<iLocationCount; i++)
+			if (locs[i].iLocationIndex == iLocIdx)
+				return &locs[i];
+
+		return NULL;
+	}
+
+	sLocation* GetByLocationIndex(int iLocIdx)
+	{
+		if (iLocIdx < 0)
+			return NULL;
+
+		for (int i=0; i<iLocationCount; i++)
+			if (locs[i].iLocationIndex == iLocIdx)
+				return &locs[i];
+
+		return NULL;
+	}
+
+	int GetArrayIndexFromLocationIndex(int iLocIdx) const
+	{
+		if (iLocIdx < 0)
+			return -1;
+
+		for (int i=0; i<iLocationCount; i++)
+			if (locs[i].iLocationIndex == iLocIdx)
+				return i;
+
+		return -1;
+	}
+
+	// append a location without shapes, the location array may be reallocated (this invalidates pointers to the
+	// locations of this map, but not to their shapes)
+	sLocation& AddLocation(int iLocIdx)
+	{
+		if (iLocationCount == iMaxLocations)
+		{
+			const int n = iMaxLocations ? min(iMaxLocations * 2, MAX_LOCATIONS_PER_MAP) : 8;
+
+			sLocation *p = new sLocation[n];
+
+			for (int i=0; i<n; i++)
+				p[i].pMap = this;
+
+			// move the locations (the view cache entries of the old addresses are flushed when they're deleted)
+			for (int i=0; i<iLocationCount; i++)
+			{
+				p[i].MoveFrom(locs[i]);
+				p[i].pMap = this;
+			}
+
+			delete[] locs;
+			locs = p;
+			iMaxLocations = n;
+		}
+
+		sLocation &loc = locs[iLocationCount++];
+		loc.iLocationIndex = iLocIdx;
+
+		return loc;
+	}
+
+	// insert a location without shapes at an array index, this invalidates pointers to the locations of this map
+	sLocation& InsertLocation(int iArrayIndex, int iLocIdx)
+	{
+		AddLocation(iLocIdx);
+
+		// cached view images are keyed by location address, so flush them for all locations that get moved
+		for (int i=iArrayIndex; i<iLocationCount-1; i++)
+			locs[i].FlushScaledImages();
+
+		for (int i=iLocationCount-1; i>iArrayIndex; i--)
+			locs[i].MoveFrom(locs[i-1]);
+
+		locs[iArrayIndex].iLocationIndex = iLocIdx;
+
+		// array indices changed
+		index.Invalidate();
+		iSerial++;
+
+		return locs[iArrayIndex];
+	}
+
+	void DeleteAllLocations()
+	{
+		delete[] locs;
+		locs = NULL;
+		iMaxLocations = 0;
+		iLocationCount = 0;
+
+		index.Invalidate();
+		iSerial++;
+	}
+
+	void DeleteLocation(int iArrayIndex)
+	{
+		if (iArrayIndex < 0)
+			return;
+
+		// cached view images are keyed by location address, so flush them for all locations that get moved
+		for (int i=iArrayIndex; i<iLocationCount; i++)
+			locs[i].FlushScaledImages();
+
+		locs[iArrayIndex].Reset();
+
+		for (int i=iArrayIndex; i<iLocationCount-1; i++)
+			locs[i].MoveFrom(locs[i+1]);
+
+		iLocationCount--;
+
+		// array indices changed
+		index.Invalidate();
+		iSerial++;
+	}
+
+	// get the array indices (in ascending order) of locations whose bounds may overlap a map rect (inclusive), returns
+	// the number of locations
+	int QueryLocations(int x0, int y0, int x1, int y1, int *pOut)
+	{
+		if ( !index.IsValid() )
+			index.Rebuild(locs, iLocationCount, iImgSize[0], iImgSize[1]);
+
+		int n = index.Query(x0, y0, x1, y1, pOut);
+
+		// there may be stale entries past the end after locations were cleared
+		while (n > 0 && pOut[n-1] >= iLocationCount)
+			n--;
+
+		return n;
+	}
+
+	// decoded on demand by LoadPageImages and may be evicted again, use iImgSize for the dimensions
+	Fl_Image *img;
+
+
+	// only available in SS2 mode, used for generating two sets of location images
+	// one for visited areas and one for hilighted area the player is currently in
+	Fl_Image *imgHilightSS2;
+
+	int iImgSize[2];
+	UINT iLastUse;		// LRU stamp for evicting decoded pages
+	int iPinCount;		// pages are never evicted while pinned
+	BOOL bLoadFailed;
+
+	int iLocationCount;
+	int iMaxLocations;	// size of the location array (grows up to MAX_LOCATIONS_PER_MAP)
+	sLocation *locs;
+
+	cLocationIndex index;
+
+	// incremented whenever any location on the page changes
+	int iSerial;
+
+	// last snapshot taken of this page, reused by TakeMapSnapshot until the serial changes
+	sMapSnapshot *pSnapshot;
+};
+
+inline void sLocation::OnChanged()
+{
+	iSerial++;
+
+	FlushScaledImages();
+
+	if (pMap)
+	{
+		pMap->iSerial++;
+		pMap->index.Update(*this, (int)(this - pMap->locs));
+	}
+}
+
+// a file mapped into memory with private copy-on-write pages, so data that points into the mapping can be modified in
+// place without changing the file
+class cMappedFile
+{
+public:
+	cMappedFile()
+	{
+		m_pData = NULL;
+		m_iSize = 0;
+	}
+	~cMappedFile()
+	{
+		Close();
+	}
+
+	BOOL Open(const char *sFileName)
+	{
+		Close();
+
+#ifdef _WIN32
+		wchar_t wsFileName[MAX_PATH+32];
+		if ( !MultiByteToWideChar(CP_UTF8, 0, sFileName, -1, wsFileName, sizeof(wsFileName)/sizeof(wsFileName[0])) )
+			return FALSE;
+
+		HANDLE hFile = CreateFileW(wsFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+			return FALSE;
+
+		LARGE_INTEGER size;
+		HANDLE hMapping = NULL;
+		if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0 && size.HighPart == 0)
+			hMapping = CreateFileMappingW(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+		if (hMapping)
+		{
+			m_pData = (BYTE*) MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+			m_iSize = m_pData ? (size_t)size.QuadPart : 0;
+			CloseHandle(hMapping);
+		}
+
+		CloseHandle(hFile);
+#else
+		const int fd = open(sFileName, O_RDONLY);
+		if (fd < 0)
+			return FALSE;
+
+		struct stat st;
+		if (!fstat(fd, &st) && st.st_size > 0)
+		{
+			void *p = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				m_pData = (BYTE*)p;
+				m_iSize = (size_t)st.st_size;
+			}
+		}
+
+		close(fd);
+#endif
+
+		return m_pData != NULL;
+	}
+
+	void Close()
+	{
+		if (!m_pData)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(m_pData);
+#else
+		munmap(m_pData, m_iSize);
+#endif
+
+		m_pData = NULL;
+		m_iSize = 0;
+	}
+
+	BYTE* GetData() const { return m_pData; }
+	size_t GetSize() const { return m_iSize; }
+
+private:
+	BYTE *m_pData;
+	size_t m_iSize;
+};
+
+// binary project file, the header is followed by the page, location and shape tables and the vertices of all shapes
+// (sVertex), everything is stored in native byte order (little endian on all supported platforms). the tables refer
+// to ranges of the next table with first index and count, pages and locations are stored in array order
+#define PROJ_BIN_MAGIC			0x50474D44		// "DMGP"
+#define PROJ_BIN_VERSION		1
+
+struct sBinProjHeader
+{
+	UINT iMagic;
+	UINT iVersion;
+	UINT iPageCount;
+	UINT iLocationCount;
+	UINT iShapeCount;
+	UINT iVertCount;
+};
+
+struct sBinProjPage
+{
+	UINT iPage;
+	UINT iFirstLocation;
+	UINT iLocationCount;
+};
+
+struct sBinProjLocation
+{
+	UINT iLocationIndex;
+	UINT iFirstShape;
+	UINT iShapeCount;
+};
+
+struct sBinProjShape
+{
+	UINT bHole;
+	int iLabelPos[2];
+	UINT iFirstVert;
+	UINT iVertCount;
+};
+
+// cursor for parsing text project files, keeps track of the line and column of the last token for error messages
+struct sTextCursor
+{
+	sTextCursor(const char *pText)
+	{
+		p = pText;
+		pLineStart = pText;
+		iLine = 1;
+		pToken = pText;
+		pTokenLineStart = pText;
+		iTokenLine = 1;
+	}
+
+	void SkipSpace()
+	{
+		for (; *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'; p++)
+			if (*p == '\n')
+			{
+				iLine++;
+				pLineStart = p + 1;
+			}
+	}
+
+	// case insensitive
+	BOOL IsKeyword(const char *s)
+	{
+		BeginToken();
+
+		int n;
+		for (n=0; s[n]; n++)
+			if (toupper((int)(BYTE)p[n]) != s[n])
+				return FALSE;
+
+		p += n;
+		return TRUE;
+	}
+
+	BOOL Expect(char c)
+	{
+		BeginToken();
+
+		if (*p != c)
+			return FALSE;
+
+		p++;
+		return TRUE;
+	}
+
+	// 'pNegative' is set for negative values including -0, values out of range are clamped
+	BOOL ReadInt(int &i, BOOL *pNegative = NULL)
+	{
+		BeginToken();
+
+		const char *q = p;
+
+		const BOOL bNegative = *q == '-';
+		if (*q == '-' || *q == '+')
+			q++;
+
+		if (*q < '0' || *q > '9')
+			return FALSE;
+
+		INT64 v = 0;
+		for (; *q >= '0' && *q <= '9'; q++)
+			if (v < INT_MAX)
+				v = v * 10 + (*q - '0');
+
+		if (v > INT_MAX)
+			v = INT_MAX;
+
+		i = bNegative ? -(int)v : (int)v;
+		if (pNegative)
+			*pNegative = bNegative;
+
+		p = q;
+		return TRUE;
+	}
+
+	// position of the last token (or where one was expected)
+	void GetErrorPos(int &iErrorLine, int &iErrorColumn) const
+	{
+		iErrorLine = iTokenLine;
+		iErrorColumn = (int)(pToken - pTokenLineStart) + 1;
+	}
+
+	const char *p;
+
+private:
+	void BeginToken()
+	{
+		SkipSpace();
+
+		pToken = p;
+		pTokenLineStart = pLineStart;
+		iTokenLine = iLine;
+	}
+
+	const char *pLineStart;
+	int iLine;
+
+	const char *pToken;
+	const char *pTokenLineStart;
+	int iTokenLine;
+};
+
+struct sProject
+{
+	sProject()
+	{
+		sDir = NULL;
+		iCurMap = 0;
+		iMapCount = 0;
+		bModified = FALSE;
+		bBinary = FALSE;
+	}
+	~sProject()
+	{
+		if (sDir)
+			free(sDir);
+
+		// cached images are keyed by map and location addresses
+		g_viewCache.Flush();
+	}
+
+	void FlushScaledImages()
+	{
+		for (int i=0; i<iMapCount; i++)
+			maps[i].FlushScaledImages();
+	}
+
+	// load the binary project file if there is one, otherwise the text project file
+	BOOL Load()
+	{
+		char s[MAX_PATH+32];
+		sprintf(s, "%s" DIRSEP_STR PROJ_BIN_FILENAME, sDir);
+
+		struct stat st;
+		BOOL ret;
+		if ( !fl_stat(s, &st) )
+			ret = LoadBinary(s);
+		else
+		{
+			sprintf(s, "%s" DIRSEP_STR PROJ_FILENAME, sDir);
+			ret = LoadText(s);
+		}
+
+		ClearModifiedFlag();
+
+		return ret;
+	}
+
+	BOOL LoadText(const char *sFileName)
+	{
+		FILE *f = fl_fopen(sFileName, "rb");
+		if (!f)
+			// assume no project file, means we're starting a new project
+			return TRUE;
+
+		// the parser works on the whole file in one buffer
+		fseek(f, 0, SEEK_END);
+		const long iSize = ftell(f);
+		fseek(f, 0, SEEK_SET);
+
+		char *pText = (char*) malloc(iSize > 0 ? iSize + 1 : 1);
+		const BOOL bRead = iSize >= 0 && fread(pText, 1, iSize, f) == (size_t)iSize;
+		fclose(f);
+
+		if (!bRead)
+		{
+			free(pText);
+			ReportError("Failed to read project file \"%s\"", sFileName);
+			return FALSE;
+		}
+
+		pText[iSize > 0 ? iSize : 0] = '\0';
+
+		char sError[128];
+		int iErrorLine, iErrorColumn;
+		const BOOL ret = ParseText(pText, sError, iErrorLine, iErrorColumn);
+
+		free(pText);
+
+		if (!ret)
+			ReportError("Error in project file \"%s\" at line %d, column %d: %s", sFileName, iErrorLine, iErrorColumn, sError);
+
+		return ret;
+	}
+
+	// parse a text project file (terminated with 0) in a single pass, the vertices are parsed directly into the shapes
+	// of the project, on errors the position of the error is returned and the records before it stay loaded
+	BOOL ParseText(const char *pText, char *sError, int &iErrorLine, int &iErrorColumn)
+	{
+		sTextCursor cur(pText);
+
+		sMap *pMap = &maps[0];
+
+		const char *pszError = NULL;
+
+		for (;;)
+		{
+			cur.SkipSpace();
+			if (!*cur.p)
+				break;
+
+			if ( cur.IsKeyword("PAG") )
+			{
+				// start loading new page
+
+				int iPage;
+				if ( !cur.ReadInt(iPage) )
+				{
+					pszError = "page number expected";
+					break;
+				}
+
+				if ((UINT)iPage >= (UINT)MAX_MAPS)
+				{
+					pszError = "invalid page number";
+					break;
+				}
+
+				pMap = &maps[iPage];
+			}
+			else if ( cur.IsKeyword("LOC") )
+			{
+				// holes are stored with a negative location index (-0 is used for hole shapes in location 0)
+				int iLocIdx, iVertCount;
+				BOOL bHole;
+
+				if ( !cur.ReadInt(iLocIdx, &bHole) )
+				{
+					pszError = "location index expected";
+					break;
+				}
+				if (bHole)
+					iLocIdx = -iLocIdx;
+				if (iLocIdx < 0 || iLocIdx >= MAX_LOCATIONS_PER_MAP)
+				{
+					pszError = "invalid location index";
+					break;
+				}
+
+				if ( !cur.ReadInt(iVertCount) )
+				{
+					pszError = "vertex count expected";
+					break;
+				}
+				if (iVertCount < 3 || iVertCount > MAX_VERTS)
+				{
+					pszError = "invalid vertex count";
+					break;
+				}
+
+				// if location already exists then just add another sub-shape
+				sLocation *pLoc = pMap->GetByLocationIndex(iLocIdx);
+				if (!pLoc)
+				{
+					if (pMap->iLocationCount >= MAX_LOCATIONS_PER_MAP)
+					{
+						pszError = "too many locations on page";
+						break;
+					}
+
+					pLoc = &pMap->AddLocation(iLocIdx);
+					// the first shape in a location can never be a hole
+					bHole = FALSE;
+				}
+
+				sShape *pShape = pLoc->AppendShape();
+				pShape->bHole = bHole;
+				pShape->SetVertCount(iVertCount);
+
+				for (int i=0; i<iVertCount && !pszError; i++)
+				{
+					int x, y;
+					if (!cur.Expect('(') || !cur.ReadInt(x) || !cur.ReadInt(y) || !cur.Expect(')'))
+						pszError = "vertex expected";
+					else
+					{
+						pShape->verts[i].x = x;
+						pShape->verts[i].y = y;
+					}
+				}
+
+				if (pszError)
+				{
+					pLoc->DeleteShape(pShape);
+					break;
+				}
+
+				pShape->CalcBoundingRect();
+
+				// optional label position
+				cur.SkipSpace();
+				if (*cur.p == '<')
+				{
+					int x, y;
+					if (!cur.Expect('<') || !cur.ReadInt(x) || !cur.ReadInt(y) || !cur.Expect('>'))
+					{
+						pszError = "label position expected";
+						break;
+					}
+
+					pShape->iLabelPos[0] = x;
+					pShape->iLabelPos[1] = y;
+				}
+				else if (!bHole)
+				{
+					// default label offset to bounds center (can be outside for concave shapes, but the user can move it if desired)
+					pShape->iLabelPos[0] = pShape->iBoundRect[0] + ((pShape->iBoundRect[2] - pShape->iBoundRect[0]) / 2);
+					pShape->iLabelPos[1] = pShape->iBoundRect[1] + ((pShape->iBoundRect[3] - pShape->iBoundRect[1]) / 2);
+				}
+			}
+			else
+			{
+				pszError = "PAG or LOC expected";
+				break;
+			}
+		}
+
+		// the location bounds are only calculated once all shapes are loaded
+		for (int j=0; j<MAX_MAPS; j++)
+			for (int i=0; i<maps[j].iLocationCount; i++)
+				maps[j].locs[i].CalcBoundingRect();
+
+		if (pszError)
+		{
+			strcpy(sError, pszError);
+			cur.GetErrorPos(iErrorLine, iErrorColumn);
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	// the file stays mapped and the shapes use the vertices in place until the project is saved
+	BOOL LoadBinary(const char *sFileName)
+	{
+		bBinary = TRUE;
+
+		if ( !mapping.Open(sFileName) )
+			return FALSE;
+
+		BYTE *pData = mapping.GetData();
+
+		if (mapping.GetSize() < sizeof(sBinProjHeader))
+			return FALSE;
+
+		const sBinProjHeader &hdr = *(const sBinProjHeader*)pData;
+		if (hdr.iMagic != PROJ_BIN_MAGIC || hdr.iVersion != PROJ_BIN_VERSION)
+			return FALSE;
+
+		const UINT64 iSize = sizeof(sBinProjHeader) + (UINT64)hdr.iPageCount * sizeof(sBinProjPage)
+			+ (UINT64)hdr.iLocationCount * sizeof(sBinProjLocation) + (UINT64)hdr.iShapeCount * sizeof(sBinProjShape)
+			+ (UINT64)hdr.iVertCount * sizeof(sVertex);
+		if (iSize > mapping.GetSize())
+			return FALSE;
+
+		const sBinProjPage *pPages = (const sBinProjPage*)(pData + sizeof(sBinProjHeader));
+		const sBinProjLocation *pLocs = (const sBinProjLocation*)(pPages + hdr.iPageCount);
+		const sBinProjShape *pShapes = (const sBinProjShape*)(pLocs + hdr.iLocationCount);
+		sVertex *pVerts = (sVertex*)(pShapes + hdr.iShapeCount);
+
+		// the ranges are checked with subtraction so corrupt values can't overflow
+		for (UINT i=0; i<hdr.iPageCount; i++)
+		{
+			const sBinProjPage &page = pPages[i];
+			if (page.iPage >= MAX_MAPS || page.iFirstLocation > hdr.iLocationCount
+				|| page.iLocationCount > hdr.iLocationCount - page.iFirstLocation)
+				return FALSE;
+
+			sMap &map = maps[page.iPage];
+
+			for (UINT j=page.iFirstLocation; j<page.iFirstLocation+page.iLocationCount; j++)
+			{
+				const sBinProjLocation &l = pLocs[j];
+				if (l.iLocationIndex >= MAX_LOCATIONS_PER_MAP || map.GetByLocationIndex(l.iLocationIndex)
+					|| !l.iShapeCount || l.iFirstShape > hdr.iShapeCount || l.iShapeCount > hdr.iShapeCount - l.iFirstShape)
+					return FALSE;
+
+				sLocation &loc = map.AddLocation(l.iLocationIndex);
+
+				for (UINT k=l.iFirstShape; k<l.iFirstShape+l.iShapeCount; k++)
+				{
+					const sBinProjShape &sh = pShapes[k];
+					if (sh.iVertCount < 3 || sh.iVertCount > MAX_VERTS || sh.iFirstVert > hdr.iVertCount
+						|| sh.iVertCount > hdr.iVertCount - sh.iFirstVert)
+						return FALSE;
+
+					sShape *p = loc.AppendShape();
+					// the first shape in a location can never be a hole
+					p->bHole = sh.bHole && k != l.iFirstShape;
+					p->iLabelPos[0] = sh.iLabelPos[0];
+					p->iLabelPos[1] = sh.iLabelPos[1];
+					p->SetMappedVerts(pVerts + sh.iFirstVert, sh.iVertCount);
+				}
+
+				loc.CalcBoundingRect();
+			}
+		}
+
+		return TRUE;
+	}
+
+	// save in the format the project was loaded in (binary if --binary-project is used)
+	BOOL Save()
+	{
+		char s[MAX_PATH+32];
+		sprintf(s, "%s" DIRSEP_STR "%s", sDir, bBinary ? PROJ_BIN_FILENAME : PROJ_FILENAME);
+
+		// the binary file is overwritten, so it can't stay mapped
+		if (bBinary)
+			DetachMappedVerts();
+
+		if ( !(bBinary ? SaveBinary(s) : SaveText(s)) )
+		{
+			Fl_Window *w = Fl::first_window();
+			if (w)
+				fl_message_position(w);
+			fl_alert("Failed to save project file \"%s\"", s);
+			return FALSE;
+		}
+
+		ClearModifiedFlag();
+
+		return TRUE;
+	}
+
+	// write the project in the text format, independent of the format it's saved in (for diffing)
+	BOOL ExportText() const
+	{
+		char s[MAX_PATH+32];
+		sprintf(s, "%s" DIRSEP_STR PROJ_FILENAME, sDir);
+
+		if ( !SaveText(s) )
+		{
+			ReportError("Failed to save project file \"%s\"", s);
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	BOOL SaveBinary(const char *sFileName) const
+	{
+		sBinProjHeader hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.iMagic = PROJ_BIN_MAGIC;
+		hdr.iVersion = PROJ_BIN_VERSION;
+
+		// same as the text format, locations without shapes aren't saved
+		for (int j=0; j<MAX_MAPS; j++)
+		{
+			const sMap &map = maps[j];
+
+			int n = 0;
+			for (int i=0; i<map.iLocationCount; i++)
+				if (map.locs[i].shape)
+				{
+					n++;
+					hdr.iShapeCount += map.locs[i].iShapeCount;
+
+					for (const sShape *p=map.locs[i].shape; p; p=p->next)
+						hdr.iVertCount += p->iVertCount;
+				}
+
+			if (n)
+			{
+				hdr.iPageCount++;
+				hdr.iLocationCount += n;
+			}
+		}
+
+		sBinProjPage *pPages = new sBinProjPage[hdr.iPageCount + 1];
+		sBinProjLocation *pLocs = new sBinProjLocation[hdr.iLocationCount + 1];
+		sBinProjShape *pShapes = new sBinProjShape[hdr.iShapeCount + 1];
+
+		UINT iPage = 0, iLoc = 0, iShape = 0, iVert = 0;
+
+		for (int j=0; j<MAX_MAPS; j++)
+		{
+			const sMap &map = maps[j];
+			const UINT iFirstLoc = iLoc;
+
+			for (int i=0; i<map.iLocationCount; i++)
+			{
+				const sLocation &loc = map.locs[i];
+				if (!loc.shape)
+					continue;
+
+				sBinProjLocation &l = pLocs[iLoc++];
+				l.iLocationIndex = loc.iLocationIndex;
+				l.iFirstShape = iShape;
+				l.iShapeCount = loc.iShapeCount;
+
+				for (const sShape *p=loc.shape; p; p=p->next)
+				{
+					sBinProjShape &sh = pShapes[iShape++];
+					sh.bHole = p->bHole ? 1 : 0;
+					sh.iLabelPos[0] = p->bHole ? 0 : p->iLabelPos[0];
+					sh.iLabelPos[1] = p->bHole ? 0 : p->iLabelPos[1];
+					sh.iFirstVert = iVert;
+					sh.iVertCount = p->iVertCount;
+					iVert += p->iVertCount;
+				}
+			}
+
+			if (iLoc != iFirstLoc)
+			{
+				sBinProjPage &page = pPages[iPage++];
+				page.iPage = j;
+				page.iFirstLocation = iFirstLoc;
+				page.iLocationCount = iLoc - iFirstLoc;
+			}
+		}
+
+		BOOL ret = FALSE;
+
+		FILE *f = fl_fopen(sFileName, "wb");
+		if (f)
+		{
+			ret = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+				&& fwrite(pPages, sizeof(sBinProjPage), hdr.iPageCount, f) == hdr.iPageCount
+				&& fwrite(pLocs, sizeof(sBinProjLocation), hdr.iLocationCount, f) == hdr.iLocationCount
+				&& fwrite(pShapes, sizeof(sBinProjShape), hdr.iShapeCount, f) == hdr.iShapeCount;
+
+			for (int j=0; j<MAX_MAPS && ret; j++)
+				for (int i=0; i<maps[j].iLocationCount && ret; i++)
+					for (const sShape *p=maps[j].locs[i].shape; p && ret; p=p->next)
+						ret = fwrite(p->verts, sizeof(sVertex), p->iVertCount, f) == (size_t)p->iVertCount;
+
+			if (fclose(f))
+				ret = FALSE;
+		}
+
+		delete[] pPages;
+		delete[] pLocs;
+		delete[] pShapes;
+
+		return ret;
+	}
+
+	BOOL SaveText(const char *sFileName) const
+	{
+		FILE *f = fl_fopen(sFileName, "w");
+		if (!f)
+			return FALSE;
+
+		// save all pages that have locations, even if they have no image currently, it could be that an image failed to load
+		// or temporarily got lost, but wouldn't want to lose existing location data in that case
+		for (int j=0; j<MAX_MAPS; j++)
+		{
+			const sMap &map = maps[j];
+
+			if (!map.iLocationCount)
+				continue;
+
+			fprintf(f, "PAG %d\n", j);
+
+			for (int i=0; i<map.iLocationCount; i++)
+			{
+				const sLocation &loc = map.locs[i];
+
+				if (!loc.shape)
+					continue;
+
+				for (sShape *p=loc.shape; p; p=p->next)
+				{
+					if (p->bHole)
+						fprintf(f, "LOC -%d %d", loc.iLocationIndex, p->iVertCount);
+					else
+						fprintf(f, "LOC %d %d", loc.iLocationIndex, p->iVertCount);
+
+					for (int k=0; k<p->iVertCount; k++)
+						fprintf(f, " (%d %d)", p->verts[k].x, p->verts[k].y);
+
+					if (!p->bHole)
+						fprintf(f, " <%d %d>", p->iLabelPos[0], p->iLabelPos[1]);
+
+					fprintf(f, "\n");
+				}
+			}
+		}
+
+		return !fclose(f);
+	}
+
+	// copy all vertices that are still used in place from the mapped binary project file and unmap it
+	void DetachMappedVerts()
+	{
+		if ( !mapping.GetData() )
+			return;
+
+		for (int j=0; j<MAX_MAPS; j++)
+			for (int i=0; i<maps[j].iLocationCount; i++)
+				for (sShape *p=maps[j].locs[i].shape; p; p=p->next)
+					p->DetachMappedVerts();
+
+		mapping.Close();
+	}
+
+	char *sDir;
+
+	int iCurMap;
+	BOOL bModified;
+
+	// save in the binary format
+	BOOL bBinary;
+
+	// binary project file, the shapes point into it until they're modified or the project is saved (must be declared
+	// before the maps, so it's unmapped after them)
+	cMappedFile mapping;
+
+	int iMapCount;
+	sMap maps[MAX_MAPS];
+};
+
+
+/////////////////////////////////////////////////////////////////////
+// project snapshots
+//
+// immutable copies of the location geometry of a project that background tasks can hold while the project is being
+// edited, snapshots are shared: a location is only copied again after its serial changed and a page snapshot is only
+// rebuilt after anything on the page changed, so taking a snapshot of an unchanged project only costs a few
+// reference counts. snapshots are taken and released on the main thread, but can be read from any thread
+
+struct sLocationSnapshot
+{
+	int iRefs;
+	int iSerial;		// serial of the location the copy was made of
+
+	sLocation loc;		// not part of a map (pMap is NULL)
+};
+
+struct sMapSnapshot
+{
+	int iRefs;
+	int iSerial;		// serial of the page the snapshot was made of
+
+	int iImgSize[2];
+
+	int iLocationCount;
+	sLocationSnapshot **locs;
+
+	const sLocation* GetByLocationIndex(int iLocIdx) const
+	{
+		if (iLocIdx < 0)
+			return NULL;
+
+		for (int i=0; i<iLocationCount; i++)
+			if (locs[i]->loc.iLocationIndex == iLocIdx)
+				return &locs[i]->loc;
+
+		return NULL;
+	}
+};
+
+struct sProjectSnapshot
+{
+	int iRefs;
+
+	int iMapCount;
+	sMapSnapshot *maps[MAX_MAPS];	// NULL for pages without a map image
+};
+
+static sLocationSnapshot* TakeLocationSnapshot(sLocation &loc)
+{
+	sLocationSnapshot *p = loc.pSnapshot;
+
+	if (p && p->iSerial == loc.iSerial)
+	{
+		p->iRefs++;
+		return p;
+	}
+
+	ReleaseLocationSnapshot(p);
+
+	p = new sLocationSnapshot;
+	p->iRefs = 2;
+	p->iSerial = loc.iSerial;
+	p->loc.iSerial = loc.iSerial;
+	p->loc.iLocationIndex = loc.iLocationIndex;
+	memcpy(p->loc.iBoundRect, loc.iBoundRect, sizeof(loc.iBoundRect));
+	p->loc.CopyShapes(loc);
+
+	loc.pSnapshot = p;
+
+	return p;
+}
+
+static void ReleaseLocationSnapshot(sLocationSnapshot *p)
+{
+	if (p && !--p->iRefs)
+		delete p;
+}
+
+static sMapSnapshot* TakeMapSnapshot(sMap &map)
+{
+	sMapSnapshot *p = map.pSnapshot;
+
+	if (p && p->iSerial == map.iSerial)
+	{
+		p->iRefs++;
+		return p;
+	}
+
+	ReleaseMapSnapshot(p);
+
+	p = new sMapSnapshot;
+	p->iRefs = 2;
+	p->iSerial = map.iSerial;
+	p->iImgSize[0] = map.iImgSize[0];
+	p->iImgSize[1] = map.iImgSize[1];
+	p->iLocationCount = map.iLocationCount;
+	p->locs = new sLocationSnapshot*[max(map.iLocationCount, 1)];
+
+	for (int i=0; i<map.iLocationCount; i++)
+		p->locs[i] = TakeLocationSnapshot(map.locs[i]);
+
+	map.pSnapshot = p;
+
+	return p;
+}
+
+static void ReleaseMapSnapshot(sMapSnapshot *p)
+{
+	if (!p || --p->iRefs)
+		return;
+
+	for (int i=0; i<p->iLocationCount; i++)
+		ReleaseLocationSnapshot(p->locs[i]);
+
+	delete[] p->locs;
+	delete p;
+}
+
+static sProjectSnapshot* TakeProjectSnapshot(sProject &proj)
+{
+	sProjectSnapshot *p = new sProjectSnapshot;
+	p->iRefs = 1;
+	p->iMapCount = proj.iMapCount;
+
+	for (int i=0; i<MAX_MAPS; i++)
+		p->maps[i] = i < proj.iMapCount && proj.maps[i].IsValid() ? TakeMapSnapshot(proj.maps[i]) : NULL;
+
+	return p;
+}
+
+static void ReleaseProjectSnapshot(sProjectSnapshot *p)
+{
+	if (!p || --p->iRefs)
+		return;
+
+	for (int i=0; i<MAX_MAPS; i++)
+		ReleaseMapSnapshot(p->maps[i]);
+
+	delete p;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+
+static char g_sAppTitle[MAX_PATH+128];
+static char g_sAppTitleModified[MAX_PATH+128];
+
+// TRUE if running in System Shock 2 mode
+static BOOL g_bShockMaps = FALSE;
+
+static int g_iLocationImageExtraBorder = 0;
+static int g_iAlphaExportAA = 4;
+static int g_iRasterMode = RM_FLTK;
+static int g_iPngPreset = PNG_PRESET_DEFAULT;
+static BOOL g_bSaveTgaRLE = FALSE;
+// zlib compression level for PNG images (-1 = use the level of the preset)
+static int g_iPngLevel = -1;
+// number of worker threads used for generating location images (0 = number of hardware threads)
+static int g_iGenerateThreads = 0;
+// memory budget in MB for decoded map page images (0 = unlimited)
+static int g_iMaxPageMem = 0;
+// memory budget in MB for the undo history (0 = unlimited)
+static int g_iMaxUndoMem = 16;
+static UINT g_iPageUseCounter = 0;
+// keep decoded map page images in the page cache directory, so they don't have to be decoded again
+static BOOL g_bPageCache = TRUE;
+// save projects in the binary format (projects that were loaded from a binary file are always saved as binary)
+static BOOL g_bBinaryProject = FALSE;
+
+static sProject *g_pProj = NULL;
+static int g_iZoom = 2;
+static DisplayMode g_displayMode = DM_OUTLINES;
+static BOOL g_bFillNewShape = FALSE;
+static int g_iLineWidth = 0;
+static BOOL g_bDrawLabels = FALSE;
+static BOOL g_bDrawCursorGuides = FALSE;
+static BOOL g_bHideSelectedOutline = FALSE;
+
+static int g_iCurSelTreeId = -1;
+static Fl_Tree_Item *g_pCurSelTreeItem = NULL;
+// pixel center offset in zoomed image view coords
+static int g_iCTR = 0;
+
+static Fl_Double_Window *g_pMainWnd = NULL;
+static Fl_Scroll *g_pScrollView = NULL;
+static cImageView *g_pImageView = NULL;
+static Fl_Tree *g_pTreeView = NULL;
+static Fl_Menu_Bar *g_pMenuBar = NULL;
+static int g_iWplus, g_iHplus;
+static BOOL g_bUserDefinedWindowSize = FALSE;
+
+static BOOL g_bShowingFlInputDialog = FALSE;
+
+// TRUE when running in command-line batch mode (no windows, errors go to stderr)
+static BOOL g_bHeadless = FALSE;
+
+#if defined(__unix__) || defined(__UNIX__)
+// work around bug in X11
+static int g_iEventState = 0;
+#endif
+
+
+/////////////////////////////////////////////////////////////////////
+// edit journal
+//
+// every edit of the project is appended to a journal file next to the project file as it happens (the records are
+// made by the undo stack, see cUndoStack), so the edits of a session that didn't exit properly can be replayed on the
+// next start. the journal is deleted when the project is saved (the project file then contains all edits) or when the
+// application is closed without saving. locations are identified by page and location index and shapes and vertices
+// by array index, which are the same when the records are replayed in order on the project file the journal was
+// started for
+
+#define JOURNAL_MAGIC			0x4A474D44		// "DMGJ"
+#define JOURNAL_VERSION			1
+
+enum JournalRecordType
+{
+	JR_SET_VERT = 1,			// vertex moved to x, y
+	JR_INSERT_VERT,				// vertex inserted before vertex iVert at x, y
+	JR_DELETE_VERT,
+	JR_SET_LABEL_POS,			// label of shape moved to x, y
+	JR_ADD_SHAPE,				// shape inserted before shape iShape, the location is created if it doesn't exist
+	JR_DELETE_SHAPE,			// shape and the holes that belong to it deleted
+	JR_DELETE_LOCATION,
+	JR_DELETE_ALL_LOCATIONS,	// all locations on a page deleted
+	JR_SET_LOCATION_INDEX,		// location index changed to x (swapped with the location that had index x, if any)
+	JR_MOVE_LOCATION,			// location moved by x, y (all locations on the page if iLocIdx is -1)
+	JR_ADD_LOCATION,			// location without shapes inserted at location array index x
+};
+
+// the header identifies the project file the journal applies to by its size and modification time
+struct sJournalHeader
+{
+	UINT iMagic;
+	UINT iVersion;
+	UINT64 iProjFileSize;
+	UINT64 iProjFileTime;
+};
+
+struct sJournalRecord
+{
+	int iType;
+	int iMap;
+	int iLocIdx;
+	int iShape;
+	int iVert;		// vertex index (vertex count for JR_ADD_SHAPE, the vertices follow the record)
+	int x, y;
+	int bHole;
+};
+
+// size of a record including the vertices that follow it
+static inline int GetJournalRecordSize(const sJournalRecord &rec)
+{
+	return sizeof(sJournalRecord) + (rec.iType == JR_ADD_SHAPE ? rec.iVert * sizeof(sVertex) : 0);
+}
+
+class cEditJournal
+{
+public:
+	cEditJournal()
+	{
+		m_sDir[0] = '\0';
+		m_sFileName[0] = '\0';
+		m_pFile = NULL;
+	}
+	~cEditJournal()
+	{
+		Close();
+	}
+
+	// start journaling the edits of the project in 'sDir' (nothing is written until the first edit)
+	void Open(const char *sDir)
+	{
+		Close();
+		strncpy(m_sDir, sDir, sizeof(m_sDir)-1);
+		m_sDir[sizeof(m_sDir)-1] = '\0';
+		sprintf(m_sFileName, "%s" DIRSEP_STR PROJ_JOURNAL_FILENAME, m_sDir);
+	}
+
+	void Close()
+	{
+		if (m_pFile)
+		{
+			fclose(m_pFile);
+			m_pFile = NULL;
+		}
+	}
+
+	// delete the journal, after the project was saved or when unsaved changes are discarded
+	void Discard()
+	{
+		if (!m_sFileName[0])
+			return;
+
+		Close();
+		fl_unlink(m_sFileName);
+	}
+
+	// TRUE if a journal with records was left behind by a previous session
+	BOOL HasRecords() const
+	{
+		struct stat st;
+		return m_sFileName[0] && !fl_stat(m_sFileName, &st) && (UINT64)st.st_size >= sizeof(sJournalHeader) + sizeof(sJournalRecord);
+	}
+
+	// apply the records of the journal to a freshly loaded project, returns the number of records applied or -1 if the
+	// journal doesn't belong to the project file. replaying stops at the first record that is truncated or doesn't fit
+	// the project, the journal is cut off there so new records can be appended
+	int Replay(sProject &proj)
+	{
+		FILE *f = fl_fopen(m_sFileName, "rb");
+		if (!f)
+			return -1;
+
+		fseek(f, 0, SEEK_END);
+		const long iSize = ftell(f);
+		fseek(f, 0, SEEK_SET);
+
+		BYTE *pData = (BYTE*) malloc(iSize > 0 ? iSize : 1);
+		const BOOL bRead = iSize >= 0 && fread(pData, 1, iSize, f) == (size_t)iSize;
+		fclose(f);
+
+		sJournalHeader hdr;
+		GetHeader(hdr);
+
+		if (!bRead || (size_t)iSize < sizeof(hdr) || memcmp(pData, &hdr, sizeof(hdr)))
+		{
+			free(pData);
+			return -1;
+		}
+
+		int iRecords = 0;
+		size_t pos = sizeof(hdr);
+
+		while (pos + sizeof(sJournalRecord) <= (size_t)iSize)
+		{
+			const sJournalRecord &rec = *(const sJournalRecord*)(pData + pos);
+
+			if (rec.iType == JR_ADD_SHAPE && (rec.iVert < 3 || rec.iVert > MAX_VERTS))
+				break;
+
+			const size_t n = GetJournalRecordSize(rec);
+			if (n > (size_t)iSize - pos)
+				break;
+
+			if ( !ApplyRecord(proj, rec, (const sVertex*)(pData + pos + sizeof(sJournalRecord))) )
+				break;
+
+			pos += n;
+			iRecords++;
+		}
+
+		if (pos < (size_t)iSize)
+			ReportError("The edit journal \"%s\" is incomplete, only the first %d edits were restored", m_sFileName, iRecords);
+
+		// rewrite the journal without the records that couldn't be applied and keep it open for new records
+		Close();
+		m_pFile = fl_fopen(m_sFileName, "wb");
+		if (!m_pFile || fwrite(pData, 1, pos, m_pFile) != pos || fflush(m_pFile))
+			OnWriteFailed();
+
+		free(pData);
+
+		return iRecords;
+	}
+
+	// append a record (the vertices of a JR_ADD_SHAPE record are in 'pVerts'), records are flushed one by one, so they
+	// survive a crash of the application
+	void Write(const sJournalRecord &rec, const sVertex *pVerts)
+	{
+		if (!m_sFileName[0])
+			return;
+
+		if (!m_pFile)
+		{
+			// first edit since the project was loaded or saved, start a new journal
+			sJournalHeader hdr;
+			GetHeader(hdr);
+
+			m_pFile = fl_fopen(m_sFileName, "wb");
+			if (!m_pFile || fwrite(&hdr, sizeof(hdr), 1, m_pFile) != 1)
+			{
+				OnWriteFailed();
+				return;
+			}
+		}
+
+		if (fwrite(&rec, sizeof(rec), 1, m_pFile) != 1
+			|| (rec.iType == JR_ADD_SHAPE && fwrite(pVerts, sizeof(sVertex), rec.iVert, m_pFile) != (size_t)rec.iVert)
+			|| fflush(m_pFile))
+			OnWriteFailed();
+	}
+
+	// apply a record to a project, returns FALSE if the record doesn't fit the project
+	static BOOL ApplyRecord(sProject &proj, const sJournalRecord &rec, const sVertex *pVerts)
+	{
+		if ((UINT)rec.iMap >= (UINT)MAX_MAPS)
+			return FALSE;
+
+		sMap &map = proj.maps[rec.iMap];
+
+		if (rec.iType == JR_DELETE_ALL_LOCATIONS)
+		{
+			map.FlushScaledImages();
+			map.DeleteAllLocations();
+			return TRUE;
+		}
+
+		if (rec.iType == JR_MOVE_LOCATION && rec.iLocIdx == -1)
+		{
+			for (int i=0; i<map.iLocationCount; i++)
+				map.locs[i].MovePos(rec.x, rec.y);
+			return TRUE;
+		}
+
+		sLocation *pLoc = map.GetByLocationIndex(rec.iLocIdx);
+
+		if (rec.iType == JR_ADD_LOCATION)
+		{
+			if (pLoc || (UINT)rec.iLocIdx >= (UINT)MAX_LOCATIONS_PER_MAP || map.iLocationCount >= MAX_LOCATIONS_PER_MAP
+				|| (UINT)rec.x > (UINT)map.iLocationCount)
+				return FALSE;
+
+			map.InsertLocation(rec.x, rec.iLocIdx);
+			return TRUE;
+		}
+
+		if (rec.iType == JR_ADD_SHAPE)
+		{
+			if (!pLoc)
+			{
+				if ((UINT)rec.iLocIdx >= (UINT)MAX_LOCATIONS_PER_MAP || map.iLocationCount >= MAX_LOCATIONS_PER_MAP
+					|| rec.iShape)
+					return FALSE;
+				pLoc = &map.AddLocation(rec.iLocIdx);
+			}
+			else if ((UINT)rec.iShape > (UINT)pLoc->iShapeCount)
+				return FALSE;
+
+			sShape sh;
+			sh.SetVertCount(rec.iVert);
+			memcpy(sh.verts, pVerts, sizeof(sVertex) * rec.iVert);
+			sh.iLabelPos[0] = rec.x;
+			sh.iLabelPos[1] = rec.y;
+
+			// the first shape in a location can never be a hole
+			pLoc->AddShapeAt(rec.iShape, sh, rec.bHole && rec.iShape);
+			return TRUE;
+		}
+
+		if (!pLoc)
+			return FALSE;
+
+		switch (rec.iType)
+		{
+		case JR_DELETE_LOCATION:
+			map.DeleteLocation( (int)(pLoc - map.locs) );
+			return TRUE;
+
+		case JR_SET_LOCATION_INDEX:
+			{
+				if ((UINT)rec.x >= (UINT)MAX_LOCATIONS_PER_MAP)
+					return FALSE;
+
+				sLocation *pPrevLoc = map.GetByLocationIndex(rec.x);
+				if (pPrevLoc)
+				{
+					pPrevLoc->iLocationIndex = pLoc->iLocationIndex;
+					pPrevLoc->OnChanged();
+				}
+
+				pLoc->iLocationIndex = rec.x;
+				pLoc->OnChanged();
+			}
+			return TRUE;
+
+		case JR_MOVE_LOCATION:
+			pLoc->MovePos(rec.x, rec.y);
+			return TRUE;
+		}
+
+		if ((UINT)rec.iShape >= (UINT)pLoc->iShapeCount)
+			return FALSE;
+
+		sShape &sh = pLoc->shape[rec.iShape];
+
+		switch (rec.iType)
+		{
+		case JR_SET_VERT:
+			if ((UINT)rec.iVert >= (UINT)sh.iVertCount)
+				return FALSE;
+			sh.verts[rec.iVert].x = rec.x;
+			sh.verts[rec.iVert].y = rec.y;
+			break;
+
+		case JR_INSERT_VERT:
+			{
+				if ((UINT)rec.iVert > (UINT)sh.iVertCount || sh.iVertCount >= MAX_VERTS)
+					return FALSE;
+
+				const sVertex v = { (short int)rec.x, (short int)rec.y };
+				sh.InsertVert(rec.iVert, v);
+			}
+			break;
+
+		case JR_DELETE_VERT:
+			if ((UINT)rec.iVert >= (UINT)sh.iVertCount || sh.iVertCount <= 3)
+				return FALSE;
+			sh.DeleteVert(rec.iVert);
+			break;
+
+		case JR_SET_LABEL_POS:
+			sh.iLabelPos[0] = rec.x;
+			sh.iLabelPos[1] = rec.y;
+			pLoc->OnChanged();
+			return TRUE;
+
+		case JR_DELETE_SHAPE:
+			pLoc->DeleteShape(&sh);
+			return TRUE;
+
+		default:
+			return FALSE;
+		}
+
+		pLoc->CalcBoundingRect();
+
+		return TRUE;
+	}
+
+private:
+	// the project file is identified the same way sProject::Load picks it, the binary file if there is one
+	void GetHeader(sJournalHeader &hdr) const
+	{
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.iMagic = JOURNAL_MAGIC;
+		hdr.iVersion = JOURNAL_VERSION;
+
+		char s[MAX_PATH+32];
+		struct stat st;
+
+		sprintf(s, "%s" DIRSEP_STR PROJ_BIN_FILENAME, m_sDir);
+		if ( fl_stat(s, &st) )
+		{
+			sprintf(s, "%s" DIRSEP_STR PROJ_FILENAME, m_sDir);
+			if ( fl_stat(s, &st) )
+				return;
+		}
+
+		hdr.iProjFileSize = (UINT64)st.st_size;
+		hdr.iProjFileTime = (UINT64)st.st_mtime;
+	}
+
+	// stop journaling for the rest of the session, a partially written journal is useless
+	void OnWriteFailed()
+	{
+		ReportError("Failed to write the edit journal \"%s\", unsaved changes can't be restored after a crash", m_sFileName);
+
+		Discard();
+		m_sFileName[0] = '\0';
+	}
+
+	char m_sDir[MAX_PATH];
+	char m_sFileName[MAX_PATH+32];
+	FILE *m_pFile;
+};
+
+static cEditJournal g_journal;
+
+
+/////////////////////////////////////////////////////////////////////
+// undo / redo
+//
+// each undo step stores the journal records that make the edits of the step and the records that revert them, so a
+// step only takes the size of the changed data (a vertex move is two records, a deleted location the records that
+// recreate its shapes) and undoing or redoing it only applies those records. the records that are applied are also
+// written to the edit journal, so the journal always has the same edits as the project. the oldest steps are dropped
+// when the steps take more than g_iMaxUndoMem
+
+// growable buffer of journal records
+struct sRecordBuffer
+{
+	void Append(const void *p, int n)
+	{
+		Reserve(iSize + n);
+		memcpy(pData + iSize, p, n);
+		iSize += n;
+	}
+
+	void Append(const sJournalRecord &rec, const sVertex *pVerts = NULL)
+	{
+		Append(&rec, sizeof(rec));
+		if (rec.iType == JR_ADD_SHAPE && pVerts)
+			Append(pVerts, rec.iVert * sizeof(sVertex));
+	}
+
+	// insert the records of 'buf' before the records of this buffer
+	void Prepend(const sRecordBuffer &buf)
+	{
+		if (!buf.iSize)
+			return;
+
+		Reserve(iSize + buf.iSize);
+		memmove(pData + buf.iSize, pData, iSize);
+		memcpy(pData, buf.pData, buf.iSize);
+		iSize += buf.iSize;
+	}
+
+	void Reserve(int n)
+	{
+		if (n <= iMaxSize)
+			return;
+
+		iMaxSize = max(n, iMaxSize * 2);
+		pData = (BYTE*) realloc(pData, iMaxSize);
+	}
+
+	void Free()
+	{
+		free(pData);
+		pData = NULL;
+		iSize = 0;
+		iMaxSize = 0;
+	}
+
+	BYTE *pData;
+	int iSize;
+	int iMaxSize;
+};
+
+struct sUndoStep
+{
+	sRecordBuffer redo;		// records that make the edits, in order
+	sRecordBuffer undo;		// records that revert the edits, in order
+	int iLastRedoRecord;	// offset of the last redo record, for merging vertex and label drags
+	BOOL bClosed;			// nothing is merged into a closed step
+};
+
+class cUndoStack
+{
+public:
+	cUndoStack()
+	{
+		m_pSteps = NULL;
+		m_iStepCount = 0;
+		m_iMaxSteps = 0;
+		m_iCurStep = 0;
+		m_iSavedStep = 0;
+		m_iGroupDepth = 0;
+		m_bGroupStarted = FALSE;
+		m_iMemUsed = 0;
+	}
+	~cUndoStack()
+	{
+		Clear();
+		free(m_pSteps);
+	}
+
+	void Clear()
+	{
+		for (int i=0; i<m_iStepCount; i++)
+			FreeStep(i);
+
+		m_iStepCount = 0;
+		m_iCurStep = 0;
+		m_iSavedStep = -1;
+		m_iMemUsed = 0;
+	}
+
+	BOOL CanUndo() const { return m_iCurStep > 0; }
+	BOOL CanRedo() const { return m_iCurStep < m_iStepCount; }
+
+	// the project is in the state it was saved in (or the state it was loaded in, if bSaved is FALSE the loaded state
+	// isn't the saved one, e.g. after restoring edits from the journal)
+	void SetSavePoint(BOOL bSaved = TRUE)
+	{
+		m_iSavedStep = bSaved ? m_iCurStep : -1;
+		CloseStep();
+	}
+
+	BOOL IsAtSavePoint() const { return m_iCurStep == m_iSavedStep; }
+
+	// revert the last step, returns the page that was changed or -1 if there's nothing to undo
+	int Undo(sProject &proj)
+	{
+		if ( !CanUndo() )
+			return -1;
+
+		sUndoStep &step = m_pSteps[--m_iCurStep];
+		step.bClosed = TRUE;
+
+		return Apply(proj, step.undo);
+	}
+
+	// make the last undone step again, returns the page that was changed or -1 if there's nothing to redo
+	int Redo(sProject &proj)
+	{
+		if ( !CanRedo() )
+			return -1;
+
+		sUndoStep &step = m_pSteps[m_iCurStep++];
+		step.bClosed = TRUE;
+
+		return Apply(proj, step.redo);
+	}
+
+	// all edits until EndStep are undone together
+	void BeginStep()
+	{
+		if (!m_iGroupDepth++)
+			m_bGroupStarted = FALSE;
+	}
+
+	void EndStep()
+	{
+		if (--m_iGroupDepth)
+			return;
+
+		if (m_bGroupStarted)
+			CloseStep();
+	}
+
+	// end merging drag edits into the last step (when the mouse button is released)
+	void CloseStep()
+	{
+		if (m_iCurStep > 0)
+			m_pSteps[m_iCurStep-1].bClosed = TRUE;
+	}
+
+	// the edits of the image view and the commands, called after the edit was made (before for deletions, while the
+	// data is still there). edits of shapes that aren't part of the project are ignored
+
+	void SetVert(const sShape &sh, int iVert, const sVertex &oldPos)
+	{
+		sJournalRecord rec, inv;
+		if ( !InitShapeRecord(rec, JR_SET_VERT, sh) )
+			return;
+
+		rec.iVert = iVert;
+		rec.x = sh.verts[iVert].x;
+		rec.y = sh.verts[iVert].y;
+
+		if ( Merge(rec) )
+			return;
+
+		inv = rec;
+		inv.x = oldPos.x;
+		inv.y = oldPos.y;
+
+		Add(rec, NULL, inv, NULL, FALSE);
+	}
+
+	void InsertVert(const sShape &sh, int iVert)
+	{
+		sJournalRecord rec, inv;
+		if ( !InitShapeRecord(rec, JR_INSERT_VERT, sh) )
+			return;
+
+		rec.iVert = iVert;
+		rec.x = sh.verts[iVert].x;
+		rec.y = sh.verts[iVert].y;
+
+		inv = rec;
+		inv.iType = JR_DELETE_VERT;
+
+		// the new vertex is usually dragged right away, which is merged into this step
+		Add(rec, NULL, inv, NULL, FALSE);
+	}
+
+	void DeleteVert(const sShape &sh, int iVert)
+	{
+		sJournalRecord rec, inv;
+		if ( !InitShapeRecord(rec, JR_DELETE_VERT, sh) )
+			return;
+
+		rec.iVert = iVert;
+
+		inv = rec;
+		inv.iType = JR_INSERT_VERT;
+		inv.x = sh.verts[iVert].x;
+		inv.y = sh.verts[iVert].y;
+
+		Add(rec, NULL, inv, NULL);
+	}
+
+	void SetLabelPos(const sShape &sh, int iOldX, int iOldY)
+	{
+		sJournalRecord rec, inv;
+		if ( !InitShapeRecord(rec, JR_SET_LABEL_POS, sh) )
+			return;
+
+		rec.x = sh.iLabelPos[0];
+		rec.y = sh.iLabelPos[1];
+
+		if ( Merge(rec) )
+			return;
+
+		inv = rec;
+		inv.x = iOldX;
+		inv.y = iOldY;
+
+		Add(rec, NULL, inv, NULL, FALSE);
+	}
+
+	void AddShape(const sShape &sh)
+	{
+		sJournalRecord rec, inv;
+		if ( !InitShapeRecord(rec, JR_ADD_SHAPE, sh) )
+			return;
+
+		rec.iVert = sh.iVertCount;
+		rec.x = sh.iLabelPos[0];
+		rec.y = sh.iLabelPos[1];
+		rec.bHole = sh.bHole;
+
+		// the first shape creates the location, so undoing it deletes the location again
+		inv = rec;
+		inv.iType = sh.owner->iShapeCount == 1 ? JR_DELETE_LOCATION : JR_DELETE_SHAPE;
+
+		Add(rec, sh.verts, inv, NULL);
+	}
+
+	void DeleteShape(const sShape &sh)
+	{
+		sJournalRecord rec;
+		if ( !InitShapeRecord(rec, JR_DELETE_SHAPE, sh) )
+			return;
+
+		// the holes of a shape are deleted with it
+		const sLocation &loc = *sh.owner;
+		const int i = rec.iShape;
+		int n = 1;
+		if (!sh.bHole)
+			while (i+n < loc.iShapeCount && loc.shape[i+n].bHole)
+				n++;
+
+		sRecordBuffer undo = {NULL, 0, 0};
+		for (int j=i; j<i+n; j++)
+			AppendShapeRecord(undo, loc.shape[j]);
+
+		Add(rec, undo);
+	}
+
+	void DeleteLocation(const sLocation &loc)
+	{
+		sJournalRecord rec;
+		InitRecord(rec, JR_DELETE_LOCATION, GetMapIndex(*loc.pMap), loc.iLocationIndex);
+
+		sRecordBuffer undo = {NULL, 0, 0};
+		AppendLocationRecords(undo, loc);
+
+		Add(rec, undo);
+	}
+
+	void DeleteAllLocations(const sMap &map)
+	{
+		sJournalRecord rec;
+		InitRecord(rec, JR_DELETE_ALL_LOCATIONS, GetMapIndex(map), -1);
+
+		sRecordBuffer undo = {NULL, 0, 0};
+		for (int i=0; i<map.iLocationCount; i++)
+			AppendLocationRecords(undo, map.locs[i]);
+
+		Add(rec, undo);
+	}
+
+	void SetLocationIndex(int iMap, int iLocIdx, int iNewLocIdx)
+	{
+		sJournalRecord rec, inv;
+		InitRecord(rec, JR_SET_LOCATION_INDEX, iMap, iLocIdx);
+		rec.x = iNewLocIdx;
+
+		// swapping back restores both indices
+		InitRecord(inv, JR_SET_LOCATION_INDEX, iMap, iNewLocIdx);
+		inv.x = iLocIdx;
+
+		Add(rec, NULL, inv, NULL);
+	}
+
+	void MoveLocation(int iMap, int iLocIdx, int dx, int dy)
+	{
+		sJournalRecord rec, inv;
+		InitRecord(rec, JR_MOVE_LOCATION, iMap, iLocIdx);
+		rec.x = dx;
+		rec.y = dy;
+
+		inv = rec;
+		inv.x = -dx;
+		inv.y = -dy;
+
+		Add(rec, NULL, inv, NULL);
+	}
+
+private:
+	static void InitRecord(sJournalRecord &rec, int iType, int iMap, int iLocIdx)
+	{
+		memset(&rec, 0, sizeof(rec));
+		rec.iType = iType;
+		rec.iMap = iMap;
+		rec.iLocIdx = iLocIdx;
+	}
+
+	static int GetMapIndex(const sMap &map)
+	{
+		return (int)(&map - g_pProj->maps);
+	}
+
+	static BOOL InitShapeRecord(sJournalRecord &rec, int iType, const sShape &sh)
+	{
+		const sLocation *pLoc = sh.owner;
+		if (!pLoc || !pLoc->pMap || !g_pProj)
+			return FALSE;
+
+		InitRecord(rec, iType, GetMapIndex(*pLoc->pMap), pLoc->iLocationIndex);
+		rec.iShape = (int)(&sh - pLoc->shape);
+
+		return TRUE;
+	}
+
+	static void AppendShapeRecord(sRecordBuffer &buf, const sShape &sh)
+	{
+		sJournalRecord rec;
+		if ( !InitShapeRecord(rec, JR_ADD_SHAPE, sh) )
+			return;
+		rec.iVert = sh.iVertCount;
+		rec.x = sh.iLabelPos[0];
+		rec.y = sh.iLabelPos[1];
+		rec.bHole = sh.bHole;
+
+		buf.Append(rec, sh.verts);
+	}
+
+	// records that recreate a location at its current array index
+	static void AppendLocationRecords(sRecordBuffer &buf, const sLocation &loc)
+	{
+		sJournalRecord rec;
+		InitRecord(rec, JR_ADD_LOCATION, GetMapIndex(*loc.pMap), loc.iLocationIndex);
+		rec.x = (int)(&loc - loc.pMap->locs);
+		buf.Append(rec);
+
+		for (const sShape *p=loc.shape; p; p=p->next)
+			AppendShapeRecord(buf, *p);
+	}
+
+	// merge a vertex or label drag into the last step if it moves the same vertex or label as the last record
+	BOOL Merge(const sJournalRecord &rec)
+	{
+		if (!m_iCurStep || m_iCurStep != m_iStepCount || m_iSavedStep == m_iCurStep)
+			return FALSE;
+
+		sUndoStep &step = m_pSteps[m_iCurStep-1];
+		if (step.bClosed)
+			return FALSE;
+
+		sJournalRecord &last = *(sJournalRecord*)(step.redo.pData + step.iLastRedoRecord);
+		if (last.iMap != rec.iMap || last.iLocIdx != rec.iLocIdx || last.iShape != rec.iShape)
+			return FALSE;
+
+		BOOL bSameTarget;
+		if (rec.iType == JR_SET_VERT)
+			bSameTarget = (last.iType == JR_SET_VERT || last.iType == JR_INSERT_VERT) && last.iVert == rec.iVert;
+		else
+			bSameTarget = last.iType == JR_SET_LABEL_POS;
+
+		if (!bSameTarget)
+			return FALSE;
+
+		last.x = rec.x;
+		last.y = rec.y;
+
+		g_journal.Write(rec, NULL);
+
+		return TRUE;
+	}
+
+	void Add(const sJournalRecord &rec, const sVertex *pVerts, const sJournalRecord &inv, const sVertex *pInvVerts, BOOL bClose = TRUE)
+	{
+		sRecordBuffer undo = {NULL, 0, 0};
+		undo.Append(inv, pInvVerts);
+
+		Add(rec, undo, pVerts, bClose);
+	}
+
+	// add an edit to the current step or a new one, takes ownership of 'undo'
+	void Add(const sJournalRecord &rec, sRecordBuffer &undo, const sVertex *pVerts = NULL, BOOL bClose = TRUE)
+	{
+		g_journal.Write(rec, pVerts);
+
+		if (!m_iGroupDepth || !m_bGroupStarted)
+		{
+			NewStep();
+			m_bGroupStarted = m_iGroupDepth > 0;
+		}
+
+		sUndoStep &step = m_pSteps[m_iCurStep-1];
+
+		m_iMemUsed -= step.redo.iMaxSize + step.undo.iMaxSize;
+
+		step.iLastRedoRecord = step.redo.iSize;
+		step.redo.Append(rec, pVerts);
+
+		// the edits of a step are reverted in reverse order
+		step.undo.Prepend(undo);
+		undo.Free();
+
+		step.bClosed = bClose && !m_iGroupDepth;
+
+		m_iMemUsed += step.redo.iMaxSize + step.undo.iMaxSize;
+
+		LimitMemUsed();
+	}
+
+	void NewStep()
+	{
+		// a new edit discards the steps that could be redone
+		for (int i=m_iCurStep; i<m_iStepCount; i++)
+			FreeStep(i);
+		m_iStepCount = m_iCurStep;
+
+		if (m_iSavedStep > m_iCurStep)
+			m_iSavedStep = -1;
+
+		if (m_iStepCount == m_iMaxSteps)
+		{
+			m_iMaxSteps = m_iMaxSteps ? m_iMaxSteps * 2 : 64;
+			m_pSteps = (sUndoStep*) realloc(m_pSteps, sizeof(sUndoStep) * m_iMaxSteps);
+		}
+
+		sUndoStep &step = m_pSteps[m_iStepCount++];
+		memset(&step, 0, sizeof(step));
+		m_iCurStep = m_iStepCount;
+
+		m_iMemUsed += sizeof(sUndoStep);
+	}
+
+	void FreeStep(int i)
+	{
+		sUndoStep &step = m_pSteps[i];
+		m_iMemUsed -= sizeof(sUndoStep) + step.redo.iMaxSize + step.undo.iMaxSize;
+
+		step.redo.Free();
+		step.undo.Free();
+	}
+
+	// drop the oldest steps, the last step is always kept
+	void LimitMemUsed()
+	{
+		if (g_iMaxUndoMem <= 0)
+			return;
+
+		const UINT64 iMaxMem = (UINT64)g_iMaxUndoMem * 1024 * 1024;
+
+		int n = 0;
+		while (m_iMemUsed > iMaxMem && n < m_iCurStep-1)
+			FreeStep(n++);
+
+		if (!n)
+			return;
+
+		memmove(m_pSteps, m_pSteps + n, sizeof(sUndoStep) * (m_iStepCount - n));
+		m_iStepCount -= n;
+		m_iCurStep -= n;
+		m_iSavedStep = m_iSavedStep >= n ? m_iSavedStep - n : -1;
+	}
+
+	// apply the records of a step and write them to the journal, returns the page of the first record
+	int Apply(sProject &proj, const sRecordBuffer &buf)
+	{
+		int iMap = -1;
+
+		for (int pos=0; pos<buf.iSize; )
+		{
+			const sJournalRecord &rec = *(const sJournalRecord*)(buf.pData + pos);
+			const sVertex *pVerts = (const sVertex*)(buf.pData + pos + sizeof(sJournalRecord));
+
+			if ( !cEditJournal::ApplyRecord(proj, rec, pVerts) )
+			{
+				// should never happen, the steps no longer match the project
+				ReportError("Failed to undo or redo an edit, the undo history is cleared");
+				Clear();
+				break;
+			}
+
+			g_journal.Write(rec, pVerts);
+
+			if (iMap < 0)
+				iMap = rec.iMap;
+
+			pos += GetJournalRecordSize(rec);
+		}
+
+		return iMap;
+	}
+
+	sUndoStep *m_pSteps;
+	int m_iStepCount;
+	int m_iMaxSteps;
+	int m_iCurStep;			// steps before this one can be undone, the others redone
+	int m_iSavedStep;		// m_iCurStep when the project was saved (-1 if that step is gone)
+	int m_iGroupDepth;
+	BOOL m_bGroupStarted;
+	UINT64 m_iMemUsed;
+};
+
+static cUndoStack g_undo;
+
+
+/////////////////////////////////////////////////////////////////////
+
+// WARNING: ugly mess ahead for all the edit mode/state stuff
+
+class cImageView : public Fl_Widget
+{
+public:
+	enum EditMode
+	{
+		EM_CREATE,
+		EM_MOVE,
+		EM_ADD_DEL,
+		EM_LABELPOS,
+	};
+
+public:
+	cImageView(int X, int Y, int W, int H)
+		: Fl_Widget(X, Y, W, H)
+	{
+		m_mode = EM_CREATE;
+		m_iDragging = 0;
+		m_bCreatingShape = FALSE;
+		m_iMousePos[1] = m_iMousePos[0] = 0;
+		m_iMousePosSnapped[1] = m_iMousePosSnapped[0] = 0;
+		m_iCurCursor = DMG_CURS_STD;
+
+		m_pEditShape = NULL;
+		m_pEditVert = NULL;
+		m_pHilightShape = NULL;
+		m_pHilightVert = NULL;
+		m_iInsEdge = -1;
+		m_pLabelShape = NULL;
+		m_bMaybeDeleteShape = FALSE;
+
+		m_bPanning = FALSE;
+		m_iPanRestoreCursor = 0;
+
+		m_iDrawnCueCount = 0;
+
+		m_iDrawOrigin[0] = X;
+		m_iDrawOrigin[1] = Y;
+
+		m_baseLayer = 0;
+
+		m_newLoc.shape = &m_newShape;
+		m_newShape.owner = &m_newLoc;
+	}
+
+	virtual ~cImageView()
+	{
+		if (m_baseLayer)
+			fl_delete_offscreen(m_baseLayer);
+
+		m_newLoc.shape = NULL;
+	}
+
+	int m_iCurCursor;
+	void set_cursor(int n, BOOL bForce = FALSE)
+	{
+		if (!bForce && m_iCurCursor == n)
+			return;
+
+		m_iCurCursor = n;
+
+		if (g_pImageView != Fl::belowmouse())
+			return;
+
+		const char **xpm = NULL;
+
+		switch (n)
+		{
+		case DMG_CURS_STD: xpm = dmg_std_xpm; break;
+		case DMG_CURS_MOVE: xpm = dmg_move_xpm; break;
+		case DMG_CURS_ADD: xpm = dmg_add_xpm; break;
+		case DMG_CURS_DEL: xpm = dmg_del_xpm; break;
+		case DMG_CURS_ADDDEL: xpm = dmg_adddel_xpm; break;
+		case DMG_CURS_LABELPOS: xpm = dmg_lblpos_xpm; break;
+		case DMG_CURS_PAN: xpm = dmg_pan_xpm; break;
+		}
+
+		Fl_Window *w = Fl::first_window();
+		if (w && xpm)
+		{
+			Fl_Pixmap pxm(xpm);
+			Fl_RGB_Image image(&pxm);
+
+			w->cursor(&image, 0, 0);
+		}
+		else
+			fl_cursor(FL_CURSOR_DEFAULT);
+	}
+
+	void UpdateEditMode()
+	{
+		if (m_iDragging || m_bPanning)
+			return;
+
+		EditMode newMode = EM_CREATE;
+
+		const BOOL bOldMaybeDeleteShape = m_bMaybeDeleteShape;
+		m_bMaybeDeleteShape = FALSE;
+
+		if ( EVENT_CTRL() )
+		{
+			if (EVENT_ALT() && !m_bCreatingShape && LOCIDX_FROM_TREE_ID(g_iCurSelTreeId) >= 0)
+			{
+				newMode = EM_LABELPOS;
+
+				// if the current location only has one label, then make that the labelshape without requiring mouse over
+				int iMap = g_pProj->iCurMap;
+				int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+				if (iMap >= 0 && iLoc >= 0 && !g_pProj->maps[iMap].locs[iLoc].IsMultiSolidShape())
+					m_pLabelShape = g_pProj->maps[iMap].locs[iLoc].shape;
+			}
+			else
+				newMode = EM_MOVE;
+		}
+		else if ( EVENT_ALT() )
+		{
+			if (!m_bCreatingShape)
+				newMode = EM_ADD_DEL;
+
+			m_bMaybeDeleteShape = (newMode == EM_ADD_DEL) && EVENT_SHIFT();
+		}
+		/*else if ( EVENT_SHIFT() )
+		{
+		}*/
+
+		if (m_bMaybeDeleteShape != bOldMaybeDeleteShape && newMode == EM_ADD_DEL)
+			redraw();
+
+		if (newMode == m_mode)
+			return;
+
+		if (m_mode == EM_LABELPOS)
+			// leaving EM_LABELPOS mode
+			m_pLabelShape = NULL;
+
+		m_mode = newMode;
+
+		switch (m_mode)
+		{
+		case EM_CREATE: set_cursor(DMG_CURS_STD); break;
+		case EM_MOVE: set_cursor(DMG_CURS_MOVE); break;
+		case EM_ADD_DEL:
+			if (m_pHilightVert)
+				set_cursor(DMG_CURS_DEL);
+			else if (m_iInsEdge >= 0)
+				set_cursor(DMG_CURS_ADD);
+			else
+				set_cursor(DMG_CURS_ADDDEL);
+			break;
+		case EM_LABELPOS: set_cursor(DMG_CURS_LABELPOS); break;
+		}
+
+		UpdateMouseOverCues();
+
+		redraw();
+	}
+
+	void UpdateMousePos()
+	{
+		int X = Fl::event_x() - x();
+		int Y = Fl::event_y() - y();
+
+		m_iMousePos[0] = X;
+		m_iMousePos[1] = Y;
+
+		m_iMousePosSnapped[0] = X;
+		m_iMousePosSnapped[1] = Y;
+
+		// snapping if shift is pressed
+		if (!EVENT_SHIFT() || g_pProj->iCurMap < 0 || m_mode == EM_LABELPOS)
+			return;
+
+		// "smart-snap (tm)", snap against any other shape vert if within snap radius to it
+		// if no direct snappable vert is found then snap axially against any vertex in the currently edited shape
+
+		sShape *pSnapShape = NULL;
+		int iSnapVert = -1;
+
+		if ( GetPosOverVert(X, Y, pSnapShape, iSnapVert) )
+		{
+			m_iMousePosSnapped[0] = MAP2CL(pSnapShape->verts[iSnapVert].x);
+			m_iMousePosSnapped[1] = MAP2CL(pSnapShape->verts[iSnapVert].y);
+			return;
+		}
+
+		if (!m_iDragging || (m_pEditVert && m_iDragging))
+		{
+			// no snap vert found, do axial alignment snapping to verts of current location
+
+			const sMap &map = g_pProj->maps[g_pProj->iCurMap];
+
+			const sLocation *pSnapLoc = m_bCreatingShape ? &m_newLoc : (m_pEditShape ? m_pEditShape->owner : NULL);
+			if (!pSnapLoc)
+			{
+				int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+				if (iLoc >= 0)
+					pSnapLoc = &map.locs[iLoc];
+			}
+
+			if (pSnapLoc)
+			{
+				const sVertex *pHorzSnap = NULL;
+				const sVertex *pVertSnap = NULL;
+
+				const sLocation &loc = *pSnapLoc;
+
+				for (sShape *p=loc.shape; p; p=p->next)
+				{
+					for (int i=0; i<p->iVertCount; i++)
+					{
+						const sVertex &vert = p->verts[i];
+
+						if (&vert == m_pEditVert)
+							continue;
+
+						const int dx = abs(MAP2CL(vert.x) - X);
+						if (dx < SNAP_RADIUS && (!pHorzSnap || dx < abs(MAP2CL(pHorzSnap->x) - X)))
+							pHorzSnap = &vert;
+
+						const int dy = abs(MAP2CL(vert.y) - Y);
+						if (dy < SNAP_RADIUS && (!pVertSnap || dy < abs(MAP2CL(pVertSnap->y) - Y)))
+							pVertSnap = &vert;
+					}
+				}
+
+				if (pHorzSnap)
+					m_iMousePosSnapped[0] = MAP2CL(pHorzSnap->x);
+
+				if (pVertSnap)
+					m_iMousePosSnapped[1] = MAP2CL(pVertSnap->y);
+			}
+		}
+	}
+
+	void UpdateMouseOverCues()
+	{
+		sVertex *prev = m_pHilightVert;
+		m_pHilightVert = NULL;
+
+		int iPrevEdge = m_iInsEdge;
+		m_iInsEdge = -1;
+
+		if (m_mode == EM_CREATE && m_bCreatingShape)
+		{
+			// if shape can be finalized by clicking on the first vertex then hilight it
+			if (m_newShape.iVertCount > 2 && IsPosOverVert(m_iMousePos[0], m_iMousePos[1], m_newShape.verts[0]))
+			{
+				m_pHilightVert = &m_newShape.verts[0];
+				m_pHilightShape = &m_newShape;
+			}
+		}
+		else if (m_mode == EM_LABELPOS)
+		{
+			// if location has multiple labels then highlight the one the mouse is over
+			int iMap = g_pProj->iCurMap;
+			int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+			if (iMap >= 0 && iLoc >= 0 && g_pProj->maps[iMap].locs[iLoc].IsMultiSolidShape())
+			{
+				const sShape *pPrevLabelShape = m_pLabelShape;
+				m_pLabelShape = NULL;
+				int iCurDist = INT_MAX, iDist;
+
+				for (sShape *p=g_pProj->maps[iMap].locs[iLoc].shape; p; p=p->next)
+					if (!p->bHole && IsPosOverLabel(m_iMousePos[0], m_iMousePos[1], *p, iDist) && iDist < iCurDist)
+					{
+						iCurDist = iDist;
+						m_pLabelShape = p;
+					}
+
+				if (m_pLabelShape != pPrevLabelShape)
+					RedrawCues();
+			}
+		}
+		else if (m_mode == EM_MOVE || (m_mode == EM_ADD_DEL && !m_bCreatingShape))
+		{
+			sLocation *pLoc = m_pEditShape ? m_pEditShape->owner : NULL;
+			if (!pLoc)
+			{
+				int iMap = g_pProj->iCurMap;
+				int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+				if (iMap >= 0 && iLoc >= 0)
+					pLoc = &g_pProj->maps[iMap].locs[iLoc];
+			}
+
+			if (pLoc)
+			{
+				sShape *p;
+				int i;
+
+				if ( GetPosOverVert(m_iMousePos[0], m_iMousePos[1], p, i, pLoc) )
+				{
+					m_pHilightVert = &p->verts[i];
+					m_pHilightShape = p;
+					pLoc = p->owner;
+				}
+			}
+
+			if (m_mode == EM_ADD_DEL && pLoc && !m_pHilightVert)
+			{
+				// check if over an edge and display virtual insert point
+				const int X = m_iMousePos[0] / g_iZoom;
+				const int Y = m_iMousePos[1] / g_iZoom;
+
+				for (sShape *p=pLoc->shape; p; p=p->next)
+				{
+					// do a quick bound rect test
+					if ((X < p->iBoundRect[0]-SNAP_RADIUS || X > p->iBoundRect[2]+SNAP_RADIUS
+						|| Y < p->iBoundRect[1]-SNAP_RADIUS || Y > p->iBoundRect[3]+SNAP_RADIUS)
+						&& pLoc != &m_newLoc)
+						continue;
+
+					for (int i=0; i<p->iVertCount; i++)
+					{
+						if ( IsPosOverEdge(m_iMousePos[0], m_iMousePos[1], p->verts[i], p->verts[(i + 1) % p->iVertCount], m_insVert) )
+						{
+							m_iInsEdge = i;
+							m_pHilightShape = p;
+							goto found_edge;
+						}
+					}
+				}
+found_edge:;
+			}
+		}
+
+		if (!m_pHilightVert && m_iInsEdge < 0)
+			m_pHilightShape = NULL;
+
+		if (m_mode == EM_ADD_DEL)
+		{
+			if (m_pHilightVert)
+				set_cursor(DMG_CURS_DEL);
+			else if (m_iInsEdge >= 0)
+				set_cursor(DMG_CURS_ADD);
+			else
+				set_cursor(DMG_CURS_ADDDEL);
+		}
+
+		if (m_pHilightVert != prev || m_iInsEdge != iPrevEdge || m_iInsEdge >= 0)
+			RedrawCues();
+	}
+
+	static BOOL IsPosOverVert(int Xclient, int Yclient, const sVertex &vtx)
+	{
+		const int D = SNAP_RADIUS;
+
+		const int X = MAP2CL(vtx.x);
+		const int Y = MAP2CL(vtx.y);
+
+		return (Xclient >= X-D && Yclient >= Y-D && Xclient <= X+D && Yclient <= Y+D);
+	}
+
+	static BOOL IsPosOverEdge(int Xclient, int Yclient, const sVertex &v0, sVertex &v1, sVertex &pointOnEdge)
+	{
+		int dx = (v1.x - v0.x) * g_iZoom;
+		int dy = (v1.y - v0.y) * g_iZoom;
+
+		int lensq = dx*dx + dy*dy;
+
+		if (lensq <= 1)
+			return FALSE;
+
+		int mdx = Xclient - MAP2CL(v0.x);
+		int mdy = Yclient - MAP2CL(v0.y);
+
+		float f = (float)(mdx * dx + mdy * dy) / (float)lensq;
+
+		if (f <= 0.0f || f >= 1.0f)
+			return FALSE;
+
+		pointOnEdge.x = (MAP2CL(v0.x) + (int)((float)dx * f)) / g_iZoom;
+		pointOnEdge.y = (MAP2CL(v0.y) + (int)((float)dy * f)) / g_iZoom;
+
+		const int D = SNAP_RADIUS;
+
+		dx = (Xclient / g_iZoom) - pointOnEdge.x;
+		dy = (Yclient / g_iZoom) - pointOnEdge.y;
+
+		return (dx*dx + dy*dy) <= D;
+	}
+
+	static BOOL IsPosOverLabel(int Xclient, int Yclient, const sShape &sh, int &iDistSq)
+	{
+		// a bit larger than actual label size (or half to be precisce, since these values are max distance from center)
+		const int Dx = 16;
+		const int Dy = 10;
+
+		const int X = Xclient / g_iZoom;
+		const int Y = Yclient / g_iZoom;
+
+		iDistSq = (sh.iLabelPos[0]-X)*(sh.iLabelPos[0]-X) + (sh.iLabelPos[1]-Y)*(sh.iLabelPos[1]-Y);
+
+		return (X >= sh.iLabelPos[0]-Dx && Y >= sh.iLabelPos[1]-Dy && X <= sh.iLabelPos[0]+Dx && Y <= sh.iLabelPos[1]+Dy);
+	}
+
+	static int DistSqToVert(const int Xclient, const int Yclient, const sVertex &vert)
+	{
+		const int dx = Xclient - MAP2CL(vert.x);
+		const int dy = Yclient - MAP2CL(vert.y);
+		return dx * dx + dy * dy;
+	}
+
+	BOOL GetPosOverVert(int Xclient, int Yclient, sShape *&pOverShape, int &iOverVert, const sLocation *pLoc = NULL) const
+	{
+		const int D = SNAP_RADIUS;
+
+		pOverShape = NULL;
+		iOverVert = -1;
+		int iOverVertDist = INT_MAX;
+
+		sMap &map = g_pProj->maps[g_pProj->iCurMap];
+
+		// only check locations near the position
+		int iCandidates[MAX_LOCATIONS_PER_MAP];
+		const int iLocs = pLoc ? 1 : map.QueryLocations((Xclient - D) / g_iZoom - 1, (Yclient - D) / g_iZoom - 1,
+			(Xclient + D) / g_iZoom + 1, (Yclient + D) / g_iZoom + 1, iCandidates);
+
+		for (int j=0; j<iLocs; j++)
+		{
+			sLocation &loc = pLoc ? *(sLocation*)pLoc : map.locs[iCandidates[j]];
+
+			// do a quick bound rect test
+			if ((Xclient < (loc.iBoundRect[0] * g_iZoom)-D || Xclient > (loc.iBoundRect[2] * g_iZoom + g_iZoom-1)+D
+				|| Yclient < (loc.iBoundRect[1] * g_iZoom)-D || Yclient > (loc.iBoundRect[3] * g_iZoom + g_iZoom-1)+D)
+				&& pLoc != &m_newLoc)
+				continue;
+
+			for (sShape *p=loc.shape; p; p=p->next)
+				for (int i=0; i<p->iVertCount; i++)
+					if ( IsPosOverVert(Xclient, Yclient, p->verts[i]) )
+					{
+						const int dist = DistSqToVert(Xclient, Yclient, p->verts[i]);
+						if (dist < iOverVertDist)
+						{
+							iOverVert = i;
+							pOverShape = p;
+							iOverVertDist = dist;
+						}
+					}
+		}
+
+		return iOverVert >= 0;
+	}
+
+	virtual int handle(int ev)
+	{
+		switch (ev)
+		{
+		case FL_PUSH:
+			UpdateMousePos();
+
+			if (m_iDragging)
+				return 1;
+
+			if (m_bPanning)
+			{
+				if (Fl::event_button() == FL_LEFT_MOUSE)
+				{
+					m_iPanRefMousePos[0] = Fl::event_x();
+					m_iPanRefMousePos[1] = Fl::event_y();
+					m_iPanRefScrollPos[0] = g_pScrollView->xposition();
+					m_iPanRefScrollPos[1] = g_pScrollView->yposition();
+					m_iDragging = FL_LEFT_MOUSE;
+				}
+				return 1;
+			}
+
+			if (Fl::event_button() == FL_LEFT_MOUSE)
+			{
+				m_iDragging = FL_LEFT_MOUSE;
+
+				if (m_mode == EM_CREATE)
+				{
+					if (!m_bCreatingShape)
+					{
+						take_focus();
+						m_bCreatingShape = TRUE;
+						m_newShape.iVertCount = 0;
+
+						m_pEditShape = &m_newShape;
+
+						AddShapePoint(m_iMousePosSnapped[0], m_iMousePosSnapped[1]);
+					}
+					else
+					{
+						if (m_pHilightVert == &m_newShape.verts[0] && m_newShape.iVertCount > 2)
+						{
+							// clicked on the first vertex to complete the shape loop
+							CommitShapeAsNewLoc();
+							return 1;
+						}
+
+						AddShapePoint(m_iMousePosSnapped[0], m_iMousePosSnapped[1]);
+					}
+
+					m_pHilightVert = m_pEditVert;
+					m_pHilightShape = m_pEditShape;
+				}
+				else if (m_mode == EM_MOVE)
+				{
+					if (m_pHilightVert)
+					{
+						m_pEditVert = m_pHilightVert;
+						m_pEditShape = m_pHilightShape;
+					}
+				}
+				else if (m_mode == EM_ADD_DEL)
+				{
+					if (m_pHilightVert)
+					{
+						if ( DeleteShapePoint(m_pHilightShape, m_pHilightVert) )
+						{
+							m_pHilightShape = NULL;
+							m_pHilightVert = NULL;
+						}
+						UpdateEditMode();
+					}
+					else if (!m_pHilightVert && m_iInsEdge >= 0 && m_pHilightShape)
+					{
+						InsertShapePoint();
+						redraw();
+					}
+				}
+				else if (m_mode == EM_LABELPOS)
+				{
+					UpdateLabelPos(m_iMousePos[0], m_iMousePos[1]);
+				}
+			}
+			else if (Fl::event_button() == FL_RIGHT_MOUSE)
+			{
+				m_iDragging = FL_RIGHT_MOUSE;
+
+				if (m_mode == EM_CREATE)
+				{
+					if (m_bCreatingShape)
+						DeleteLastNewShapePoint();
+					else
+						SelectShapeFromPos(m_iMousePos[0], m_iMousePos[1]);
+				}
+			}
+			else if (Fl::event_button() == FL_MIDDLE_MOUSE)
+			{
+				if (m_bCreatingShape)
+				{
+					if ( EVENT_ALT() )
+						CommitSubShape();
+					else
+						CommitShapeAsNewLoc();
+				}
+			}
+			return 1;
+
+		case FL_RELEASE:
+			if (Fl::event_button() != m_iDragging)
+				return 1;
+
+			m_iDragging = 0;
+			m_pEditVert = NULL;
+			if (!m_bCreatingShape)
+				m_pEditShape = NULL;
+			// a drag is undone as a whole
+			g_undo.CloseStep();
+			UpdateEditMode();
+			UpdateMouseOverCues();
+			redraw();
+			return 1;
+
+		case FL_DRAG:
+			UpdateMousePos();
+
+			if (m_bPanning)
+			{
+				int nx = m_iPanRefScrollPos[0] + (m_iPanRefMousePos[0] - Fl::event_x());
+				int ny = m_iPanRefScrollPos[1] + (m_iPanRefMousePos[1] - Fl::event_y());
+
+				ScrollImageTo(nx, ny);
+
+				return 1;
+			}
+
+			if (m_pEditVert)
+			{
+				// drag-move the just created point until mouse button gets released
+				DamageLocation(*m_pEditShape->owner);
+				UpdateCurShapePoint(m_iMousePosSnapped[0], m_iMousePosSnapped[1]);
+				DamageLocation(*m_pEditShape->owner);
+				RedrawCues();
+			}
+			else if (m_mode == EM_LABELPOS)
+			{
+				UpdateLabelPos(m_iMousePos[0], m_iMousePos[1]);
+			}
+			else if (m_bCreatingShape || g_bDrawCursorGuides)
+				RedrawCues();
+			return 1;
+
+		case FL_MOVE:
+			UpdateMousePos();
+			if (m_bPanning)
+				return 1;
+			UpdateMouseOverCues();
+			RedrawCues();
+			return 1;
+
+		case FL_KEYDOWN:
+			if (m_bPanning)
+				return 1;
+
+			switch ( Fl::event_key() )
+			{
+			case FL_Escape:
+				if (m_bCreatingShape)
+					AbortShape();
+				return 1;
+
+			case FL_Enter:
+				if (m_bCreatingShape)
+					CommitShapeAsNewLoc();
+				return 1;
+
+			case FL_Shift_L:
+			case FL_Shift_R:
+#if defined(__unix__) || defined(__UNIX__)
+				g_iEventState |= FL_SHIFT;
+#endif
+				if (m_bCreatingShape)
+				{
+					UpdateMousePos();
+					RedrawCues();
+					return 1;
+				}
+				UpdateEditMode();
+				break;
+
+			case FL_Control_L:
+			case FL_Control_R:
+#if defined(__unix__) || defined(__UNIX__)
+				g_iEventState |= FL_CTRL;
+#endif
+				UpdateEditMode();
+				return 1;
+
+			case FL_Alt_L:
+			case FL_Alt_R:
+#if defined(__unix__) || defined(__UNIX__)
+				g_iEventState |= FL_ALT;
+#endif
+				UpdateEditMode();
+				return 1;
+
+			case FL_Delete:
+			case FL_BackSpace:
+				if (m_bCreatingShape)
+				{
+					DeleteLastNewShapePoint();
+					return 1;
+				}
+				break;
+
+			case FL_Insert:
+				if (m_bCreatingShape)
+				{
+					CommitSubShape();
+					return 1;
+				}
+				break;
+
+			case ' ':
+				if (!m_iDragging && m_mode == EM_CREATE)
+				{
+					m_bPanning = TRUE;
+					m_iPanRestoreCursor = m_iCurCursor;
+					set_cursor(DMG_CURS_PAN);
+					redraw();
+				}
+				break;
+			}
+			break;
+
+		case FL_KEYUP:
+			switch ( Fl::event_key() )
+			{
+			case FL_Shift_L:
+			case FL_Shift_R:
+#if defined(__unix__) || defined(__UNIX__)
+				g_iEventState &= ~FL_SHIFT;
+#endif
+				if (m_bCreatingShape && !m_bPanning)
+				{
+					UpdateMousePos();
+					RedrawCues();
+					return 1;
+				}
+				break;
+
+#if defined(__unix__) || defined(__UNIX__)
+			case FL_Control_L:
+			case FL_Control_R:
+				g_iEventState &= ~FL_CTRL;
+				break;
+
+			case FL_Alt_L:
+			case FL_Alt_R:
+				g_iEventState &= ~FL_ALT;
+				break;
+#endif
+
+			case ' ':
+				if (m_bPanning)
+				{
+					m_bPanning = FALSE;
+					set_cursor(m_iPanRestoreCursor);
+					UpdateEditMode();
+					redraw();
+				}
+				break;
+			}
+			UpdateEditMode();
+			break;
+
+		case FL_MOUSEWHEEL:
+			if (m_iDragging)
+				return 1;
+			if ( EVENT_ALT() )
+			{
+				// zoom around mouse cursor (maintain same orig map XY pos at cursor before and after zoom change)
+				int Xclient = Fl::event_x() - g_pScrollView->x();
+				int Yclient = Fl::event_y() - g_pScrollView->y();
+				// if mouse is outside the client area then zoom around center
+				if (Xclient < 0 || Yclient < 0 || Xclient >= g_pScrollView->w() || Yclient >= g_pScrollView->h())
+				{
+					Xclient = g_pScrollView->w() / 2;
+					Yclient = g_pScrollView->h() / 2;
+				}
+
+				const int Xmap = (g_pScrollView->xposition() + Xclient) / g_iZoom;
+				const int Ymap = (g_pScrollView->yposition() + Yclient) / g_iZoom;
+
+				BOOL ret = FALSE;
+				if (Fl::event_dy() < 0)
+					ret = ChangeZoom(g_iZoom + 1);
+				else if (Fl::event_dy() > 0)
+					ret = ChangeZoom(g_iZoom - 1);
+
+				if (ret)
+					ScrollImageTo(Xmap * g_iZoom - Xclient, Ymap * g_iZoom - Yclient);
+
+				return 1;
+			}
+			else if ( EVENT_CTRL() )
+			{
+				if ( g_pScrollView->hscrollbar.visible() )
+				{
+					const int e_dx = Fl::e_dx;
+					Fl::e_dx = Fl::e_dy;
+
+					g_pScrollView->hscrollbar.handle(FL_MOUSEWHEEL);
+
+					Fl::e_dx = e_dx;
+				}
+				return 1;
+			}
+			break;
+
+		case FL_FOCUS:
+		case FL_UNFOCUS:
+			return 1;
+
+		case FL_ENTER:
+			take_focus();
+			set_cursor(m_iCurCursor, TRUE);
+			return 1;
+
+		case FL_LEAVE:
+			fl_cursor(FL_CURSOR_DEFAULT);
+			m_iDragging = 0;
+			return 1;
+		}
+
+		return Fl_Widget::handle(ev);
+	}
+
+	// damaged area tracking, mouse interaction only redraws the parts of the view that changed (client coords)
+
+	struct sClientRect
+	{
+		void Set(int X0, int Y0, int X1, int Y1, int pad)
+		{
+			x = min(X0, X1) - pad;
+			y = min(Y0, Y1) - pad;
+			w = abs(X1 - X0) + pad * 2 + 1;
+			h = abs(Y1 - Y0) + pad * 2 + 1;
+		}
+
+		void Add(const sClientRect &r)
+		{
+			if (w <= 0 || h <= 0)
+			{
+				*this = r;
+				return;
+			}
+
+			const int X1 = max(x + w, r.x + r.w);
+			const int Y1 = max(y + h, r.y + r.h);
+			x = min(x, r.x);
+			y = min(y, r.y);
+			w = X1 - x;
+			h = Y1 - y;
+		}
+
+		int x, y, w, h;
+	};
+
+	// add a client area rect to the region that gets redrawn
+	void DamageRect(const sClientRect &r)
+	{
+		if (r.w > 0 && r.h > 0)
+			damage(FL_DAMAGE_USER1, x() + r.x, y() + r.y, r.w, r.h);
+	}
+
+	// get client area covered by a location (outlines, handles, labels and view image)
+	static BOOL GetLocationRect(const sLocation &loc, sClientRect &r)
+	{
+		// (the view image covers whole zoomed pixels of the bound rect)
+		const int pad = VERT_HANDLE_RADIUS + g_iLineWidth + g_iZoom;
+
+		r.w = r.h = 0;
+
+		for (const sShape *p=loc.shape; p; p=p->next)
+		{
+			if (!p->iVertCount)
+				continue;
+
+			sClientRect sr;
+			sr.Set(MAP2CL(p->iBoundRect[0]), MAP2CL(p->iBoundRect[1]), MAP2CL(p->iBoundRect[2]), MAP2CL(p->iBoundRect[3]), pad);
+			r.Add(sr);
+
+			sr.Set(MAP2CL(p->iLabelPos[0]) - LABEL_DAMAGE_W, MAP2CL(p->iLabelPos[1]) - LABEL_DAMAGE_H,
+				MAP2CL(p->iLabelPos[0]) + LABEL_DAMAGE_W, MAP2CL(p->iLabelPos[1]) + LABEL_DAMAGE_H, 0);
+			r.Add(sr);
+		}
+
+		return r.w > 0;
+	}
+
+	void DamageLocation(const sLocation &loc)
+	{
+		sClientRect r;
+		if ( GetLocationRect(loc, r) )
+			DamageRect(r);
+	}
+
+	// get the client rects of the interactive cues that depend on the mouse pos and hover state (guide lines, rubber-band,
+	// insert point, hilighted vertex and label), returns the number of rects
+	int GetCueRects(sClientRect *r) const
+	{
+		int n = 0;
+
+		const int pad = VERT_HANDLE_RADIUS + g_iLineWidth + 1;
+
+		if (g_pProj->iCurMap < 0)
+			return 0;
+
+		if (g_bDrawCursorGuides && !m_bPanning && m_mode != EM_ADD_DEL)
+		{
+			const int X = MAP2CL(m_iMousePosSnapped[0] / g_iZoom);
+			const int Y = MAP2CL(m_iMousePosSnapped[1] / g_iZoom);
+
+			r[n++].Set(0, Y, w(), Y, 1);
+			r[n++].Set(X, 0, X, h(), 1);
+		}
+
+		if (m_bCreatingShape && m_newShape.iVertCount)
+		{
+			// rubber-band from last vert to mouse to first vert, also contains the part of the filled in-progress
+			// shape that changes with the mouse pos
+			const sVertex &first = m_newShape.verts[0];
+			const sVertex &last = m_newShape.verts[m_newShape.iVertCount-1];
+
+			sClientRect &rb = r[n++];
+			rb.Set(MAP2CL(first.x), MAP2CL(first.y), MAP2CL(last.x), MAP2CL(last.y), pad);
+
+			sClientRect mr;
+			mr.Set(m_iMousePosSnapped[0], m_iMousePosSnapped[1], m_iMousePosSnapped[0], m_iMousePosSnapped[1], pad);
+			rb.Add(mr);
+		}
+
+		if (m_iInsEdge >= 0 && m_pHilightShape)
+			r[n++].Set(MAP2CL(m_insVert.x), MAP2CL(m_insVert.y), MAP2CL(m_insVert.x), MAP2CL(m_insVert.y), VERT_HANDLE_RADIUS + 1);
+
+		if (m_pHilightVert && m_pHilightShape)
+		{
+			// all verts of the location are hilighted to indicate shape deletion
+			const BOOL bHilightAllVerts = m_mode == EM_ADD_DEL && (m_pHilightShape->iVertCount == 3 || m_bMaybeDeleteShape);
+
+			if (!bHilightAllVerts || !GetLocationRect(*m_pHilightShape->owner, r[n]))
+				r[n].Set(MAP2CL(m_pHilightVert->x), MAP2CL(m_pHilightVert->y), MAP2CL(m_pHilightVert->x), MAP2CL(m_pHilightVert->y), pad);
+			n++;
+		}
+
+		if (m_mode == EM_LABELPOS && m_pLabelShape)
+			r[n++].Set(MAP2CL(m_pLabelShape->iLabelPos[0]) - LABEL_DAMAGE_W, MAP2CL(m_pLabelShape->iLabelPos[1]) - LABEL_DAMAGE_H,
+				MAP2CL(m_pLabelShape->iLabelPos[0]) + LABEL_DAMAGE_W, MAP2CL(m_pLabelShape->iLabelPos[1]) + LABEL_DAMAGE_H, 0);
+
+		return n;
+	}
+
+	// redraw the interactive cues as they were last drawn and as they are now
+	void RedrawCues()
+	{
+		sClientRect r[MAX_CUE_RECTS];
+		const int n = GetCueRects(r);
+
+		// nothing changed since last draw
+		if (n == m_iDrawnCueCount && !memcmp(r, m_drawnCues, sizeof(r[0]) * n))
+			return;
+
+		for (int i=0; i<m_iDrawnCueCount; i++)
+			DamageRect(m_drawnCues[i]);
+
+		for (int i=0; i<n; i++)
+			DamageRect(r[i]);
+	}
+
+	// draw page image and all locations except the selected one (at the given client origin)
+	void DrawBaseLayer(sMap &map, int iCurSel, int dx, int dy)
+	{
+		m_iDrawOrigin[0] = dx;
+		m_iDrawOrigin[1] = dy;
+
+		if (map.img)
+		{
+			if (g_displayMode == DM_FADE_NONSEL || g_iZoom != 1)
+				g_viewCache.DrawPage(&map, map.img, g_iZoom, g_displayMode == DM_FADE_NONSEL, dx, dy);
+			else
+				map.img->draw(dx, dy);
+		}
+		else
+			fl_rectf(dx, dy, w(), h(), FL_DARK1);
+
+		// draw shapes (currently selected shape is drawn last to ensure it's not obstructed)
+
+		const int AA = min(g_iAlphaExportAA, 4);
+
+		// if shapes are filled then draw locations in two passes, first only the filling, then all outlines, handles and labels
+		// to ensure that important visual cues are always visible and not hidden behind filled shapes
+		const BOOL bFill = g_displayMode == DM_FILLALL;
+		const BOOL bTwoPass = bFill || g_displayMode == DM_DIMMED;
+
+		for (int pass = 0; pass < (bTwoPass ? 2 : 1); pass++)
+		{
+			const BOOL bFillThisPass = bFill ? (bTwoPass ? (pass ? FALSE : 2) : TRUE) : FALSE;
+
+			for (int i=0; i<map.iLocationCount; i++)
+			{
+				if (i == iCurSel)
+					continue;
+
+				// skip locations outside the damaged area
+				if (!IsLocationVisible(map.locs[i], dx, dy))
+					continue;
+
+				if (g_displayMode == DM_DIMMED && map.img)
+				{
+					int pos[2];
+					Fl_Image *img = GetLocationImageForView(map, map.locs[i], pos, TRUE, AA);
+					if (img)
+						img->draw(dx + pos[0], dy + pos[1]);
+				}
+
+				DrawShape(map.locs[i], SHAPE_LINE_COLOR, FALSE, TRUE, bFillThisPass, g_bDrawLabels);
+			}
+		}
+
+		m_iDrawOrigin[0] = x();
+		m_iDrawOrigin[1] = y();
+	}
+
+	// the base layer is drawn to an off-screen buffer covering the visible part of the view, which is reused until
+	// something else than the selected location, the cursor cues or the in-progress shape changes
+	void DrawCachedBaseLayer(sMap &map, int iCurSel)
+	{
+		sBaseLayerKey key;
+		memset(&key, 0, sizeof(key));
+
+		key.iRect[0] = max(x(), g_pScrollView->x()) - x();
+		key.iRect[1] = max(y(), g_pScrollView->y()) - y();
+		key.iRect[2] = min(x() + w(), g_pScrollView->x() + GetScrollViewClientWidth()) - x() - key.iRect[0];
+		key.iRect[3] = min(y() + h(), g_pScrollView->y() + GetScrollViewClientHeight()) - y() - key.iRect[1];
+
+		if (key.iRect[2] <= 0 || key.iRect[3] <= 0)
+			return;
+
+		key.iMap = g_pProj->iCurMap;
+		key.iSelLoc = iCurSel;
+		// only count changes of other locations than the selected one
+		key.iSerial = map.iSerial - (iCurSel >= 0 ? map.locs[iCurSel].iSerial : 0);
+		key.img = map.img;
+		key.iZoom = g_iZoom;
+		key.iDisplayMode = g_displayMode;
+		key.iAA = g_iAlphaExportAA;
+		key.iLineWidth = g_iLineWidth;
+		key.bDrawLabels = g_bDrawLabels;
+
+		if (!m_baseLayer || memcmp(&key, &m_baseLayerKey, sizeof(key)))
+		{
+			if (m_baseLayer && (key.iRect[2] != m_baseLayerKey.iRect[2] || key.iRect[3] != m_baseLayerKey.iRect[3]))
+			{
+				fl_delete_offscreen(m_baseLayer);
+				m_baseLayer = 0;
+			}
+
+			if (!m_baseLayer)
+				m_baseLayer = fl_create_offscreen(key.iRect[2], key.iRect[3]);
+
+			fl_begin_offscreen(m_baseLayer);
+			fl_push_clip(0, 0, key.iRect[2], key.iRect[3]);
+			DrawBaseLayer(map, iCurSel, -key.iRect[0], -key.iRect[1]);
+			fl_pop_clip();
+			fl_end_offscreen();
+
+			m_baseLayerKey = key;
+		}
+
+		// only copy the damaged part
+		int X, Y, W, H;
+		fl_clip_box(x() + key.iRect[0], y() + key.iRect[1], key.iRect[2], key.iRect[3], X, Y, W, H);
+		if (W > 0 && H > 0)
+			fl_copy_offscreen(X, Y, W, H, m_baseLayer, X - x() - key.iRect[0], Y - y() - key.iRect[1]);
+	}
+
+	virtual void draw()
+	{
+		if (g_pProj->iCurMap < 0)
+		{
+			fl_rectf(x(), y(), w(), h(), FL_DARK1);
+			return;
+		}
+
+		fl_push_clip(x(), y(), w(), h());
+
+		const int dx = x();
+		const int dy = y();
+
+		m_iDrawOrigin[0] = dx;
+		m_iDrawOrigin[1] = dy;
+
+		g_viewCache.BeginFrame();
+
+		sMap &map = g_pProj->maps[g_pProj->iCurMap];
+
+		// normally already loaded by ChangeMap, unless it was evicted in the meantime (no error message boxes
+		// while drawing)
+		LoadPageImages(g_pProj->iCurMap, FALSE);
+
+		const int AA = min(g_iAlphaExportAA, 4);
+
+		int iCurSel = -1;
+		for (int i=0; i<map.iLocationCount; i++)
+			if (g_iCurSelTreeId >= 0 && (UINT)g_iCurSelTreeId == MAKE_TREE_ID(g_pProj->iCurMap, map.locs[i].iLocationIndex))
+			{
+				iCurSel = i;
+				break;
+			}
+
+		// draw page image and all other locations, in the modes where they are expensive to draw they're cached
+		if (g_displayMode == DM_FILLALL || g_displayMode == DM_DIMMED)
+			DrawCachedBaseLayer(map, iCurSel);
+		else
+			DrawBaseLayer(map, iCurSel, dx, dy);
+
+		// currently selected shape
+		if (iCurSel != -1 && IsLocationVisible(map.locs[iCurSel], dx, dy))
+		{
+			const int i = iCurSel;
+			const BOOL bFill = g_displayMode == DM_FILLALL || g_displayMode == DM_FILLSEL;
+
+			BOOL bShowHandles = !m_bCreatingShape;
+
+			if (bShowHandles && g_displayMode > DM_OUTLINES && g_bHideSelectedOutline)
+				// show handles but no outlines
+				bShowHandles = 2;
+
+			if (g_displayMode >= DM_DIMMED && map.img)
+			{
+				int pos[2];
+				Fl_Image *img = GetLocationImageForView(map, map.locs[i], pos, g_displayMode != DM_FADE_NONSEL, AA);
+				if (img)
+					img->draw(dx + pos[0], dy + pos[1]);
+			}
+
+			DrawShape(map.locs[i], CUR_SHAPE_LINE_COLOR, bShowHandles, TRUE, bFill, (m_mode == EM_LABELPOS) ? 2 : g_bDrawLabels);
+		}
+
+		// draw cross-hair guide lines
+		if (g_bDrawCursorGuides && !m_bPanning && m_mode != EM_ADD_DEL)
+		{
+			// snap position to (center of) map pixels
+			int X = MAP2CL(m_iMousePosSnapped[0] / g_iZoom);
+			int Y = MAP2CL(m_iMousePosSnapped[1] / g_iZoom);
+
+			fl_color( fl_color_average(FL_BLACK, INPROGRESS_SHAPE_COLOR, 0.25f) );
+			fl_line_style(FL_DASH, 0);
+			fl_line(dx, dy + Y, dx + w(), dy + Y);
+			fl_line(dx + X, dy, dx + X, dy + h());
+			fl_line_style(0);
+		}
+
+		// draw in-progress shape
+		if (m_bCreatingShape && m_newShape.iVertCount)
+		{
+			if (g_bFillNewShape && m_newShape.iVertCount > 1)
+			{
+				fl_color( fl_color_average(FL_BLACK, INPROGRESS_SHAPE_COLOR, 0.5f) );
+
+				fl_begin_complex_polygon();
+				for (int i=0; i<m_newShape.iVertCount; i++)
+				{
+					int X = dx + MAP2CL(m_newShape.verts[i].x);
+					int Y = dy + MAP2CL(m_newShape.verts[i].y);
+
+					fl_vertex((double)X, (double)Y);
+				}
+
+				fl_vertex((double)(dx + m_iMousePosSnapped[0]), (double)(dy + m_iMousePosSnapped[1]));
+
+				fl_end_complex_polygon();
+			}
+
+			DrawShape(m_newShape, INPROGRESS_SHAPE_COLOR, TRUE, FALSE);
+
+			if (m_mode == EM_CREATE)
+			{
+				// draw rubber-band from last vert to mouse
+				fl_color(INPROGRESS_SHAPE_COLOR);
+				fl_line_style(FL_DOT, g_iLineWidth);
+				const int Xprev = dx + MAP2CL(m_newShape.verts[m_newShape.iVertCount-1].x);
+				const int Yprev = dy + MAP2CL(m_newShape.verts[m_newShape.iVertCount-1].y);
+				fl_line(Xprev, Yprev, dx+m_iMousePosSnapped[0], dy+m_iMousePosSnapped[1]);
+				// draw rubber-band from mouse to first vert if there are at least 2 verts
+				if (m_newShape.iVertCount >= 2)
+				{
+					const int Xfirst = dx + MAP2CL(m_newShape.verts[0].x);
+					const int Yfirst = dy + MAP2CL(m_newShape.verts[0].y);
+					fl_line(dx+m_iMousePosSnapped[0], dy+m_iMousePosSnapped[1], Xfirst, Yfirst);
+				}
+				fl_line_style(0);
+			}
+		}
+
+		// draw insert-point
+		if (m_iInsEdge >= 0 && m_pHilightShape)
+		{
+			const int X = dx + MAP2CL(m_insVert.x);
+			const int Y = dy + MAP2CL(m_insVert.y);
+
+			const int rect[4] = { X-VERT_HANDLE_RADIUS, Y-VERT_HANDLE_RADIUS, VERT_HANDLE_RADIUS*2+1, VERT_HANDLE_RADIUS*2+1 };
+
+			fl_rectf(rect[0]+1, rect[1]+1, rect[2]-2, rect[3]-2, INPROGRESS_SHAPE_COLOR);
+			fl_rect(rect[0], rect[1], rect[2], rect[3], VERT_FRAME_COLOR);
+		}
+
+		fl_pop_clip();
+
+		m_iDrawnCueCount = GetCueRects(m_drawnCues);
+	}
+
+	BOOL IsLocationVisible(const sLocation &loc, int dx, int dy) const
+	{
+		sClientRect r;
+		return GetLocationRect(loc, r) && fl_not_clipped(dx + r.x, dy + r.y, r.w, r.h);
+	}
+
+	void DrawShape(const sLocation &loc, Fl_Color linecolor, BOOL bShowHandles, BOOL bClosed = TRUE, BOOL bFilled = FALSE, BOOL bDrawLabel = FALSE)
+	{
+		const sShape *next = loc.shape;
+		while (next)
+			next = DrawShape(*next, linecolor, bShowHandles, bClosed, bFilled, bDrawLabel);
+	}
+
+	const sShape* DrawShape(const sShape &shape, Fl_Color linecolor, BOOL bShowHandles, BOOL bClosed = TRUE, BOOL bFilled = FALSE, BOOL bDrawLabel = FALSE)
+	{
+		const int dx = m_iDrawOrigin[0];
+		const int dy = m_iDrawOrigin[1];
+
+		if (bFilled && shape.iVertCount > 2)
+		{
+			fl_color( fl_color_average(FL_BLACK, linecolor, 0.5f) );
+
+			fl_begin_complex_polygon();
+			for (const sShape *p=&shape; p; p=p->next)
+			{
+				if (p->bHole && p != &shape)
+					fl_gap();
+
+				for (int i=0; i<p->iVertCount; i++)
+				{
+					const int X = dx + MAP2CL(p->verts[i].x);
+					const int Y = dy + MAP2CL(p->verts[i].y);
+
+					fl_vertex((double)X, (double)Y);
+				}
+
+				if (p->next && !p->next->bHole)
+					break;
+			}
+			fl_end_complex_polygon();
+		}
+
+		if (bFilled == 2)
+		{
+			for (const sShape *p=&shape; p; p=p->next)
+				if (p->next && !p->next->bHole)
+					return p->next;
+
+			return NULL;
+		}
+
+		if (bDrawLabel)
+		{
+			const int X = dx + MAP2CL(shape.iLabelPos[0]);
+			const int Y = dy + MAP2CL(shape.iLabelPos[1]);
+
+			char s[16];
+			sprintf(s, "%03d", shape.owner->iLocationIndex);
+
+			int tw, th;
+
+			if (bDrawLabel == 2)
+			{
+				if (m_pLabelShape == &shape)
+				{
+					fl_font(FL_HELVETICA | FL_BOLD, FL_NORMAL_SIZE);
+					fl_measure(s, tw, th);
+					fl_rectf(X-(tw/2)-2, Y-(th/2)-2, tw+4, th+4, CUR_VERT_COLOR);
+					fl_color(FL_BLACK);
+				}
+				else
+				{
+					fl_font(FL_HELVETICA | FL_BOLD, FL_NORMAL_SIZE);
+					fl_measure(s, tw, th);
+					fl_color(CUR_VERT_COLOR);
+				}
+			}
+			else
+			{
+				fl_font(FL_HELVETICA, FL_NORMAL_SIZE);
+				fl_measure(s, tw, th);
+				fl_color(linecolor);
+			}
+			fl_draw(s, X - (tw/2), Y - (th/2), tw, th, FL_ALIGN_LEFT|FL_ALIGN_TOP|FL_ALIGN_INSIDE);
+		}
+
+		int Xprev, Yprev;
+		const sShape *ret = NULL;
+
+		// drawing an open loop is only an option for the main shape, not holes (open loops are only drawn for the in-progress shape
+		// which never is multi-shaped anyway)
+		int n = bClosed ? shape.iVertCount + 1 : shape.iVertCount;
+
+		for (const sShape *p=&shape; p; p=p->next)
+		{
+			// if vertex is hilighted for delete and the shape only has 3 verts, then also hilight all verts to indicate shape deletion
+			// otherwise only hilight all if shape delete modifier key is pressed
+			const BOOL bHilightAllVerts = (m_pHilightVert && m_mode == EM_ADD_DEL && m_pHilightShape && m_pHilightShape->IsPartOf(*p) &&
+				(m_pHilightShape->iVertCount == 3 || m_bMaybeDeleteShape));
+
+			if (p != &shape)
+				n = p->iVertCount + 1;
+
+			if (bShowHandles != 2)
+			{
+				for (int i=0; i<n; i++)
+				{
+					const int j = i % p->iVertCount;
+					const int X = dx + MAP2CL(p->verts[j].x);
+					const int Y = dy + MAP2CL(p->verts[j].y);
+
+					if (!bShowHandles)
+					{
+						const int rect[4] = { X-VERT_RADIUS, Y-VERT_RADIUS, VERT_RADIUS*2+1, VERT_RADIUS*2+1 };
+
+						fl_rectf(rect[0], rect[1], rect[2], rect[3], linecolor);
+					}
+
+					if (i)
+					{
+						fl_color(linecolor);
+						fl_line_style(FL_DOT, g_iLineWidth);
+						fl_line(Xprev, Yprev, X, Y);
+						fl_line_style(0);
+					}
+
+					Xprev = X;
+					Yprev = Y;
+				}
+			}
+
+			if (bShowHandles)
+			{
+				for (int i=0; i<n; i++)
+				{
+					const int j = i % p->iVertCount;
+					const int X = dx + MAP2CL(p->verts[j].x);
+					const int Y = dy + MAP2CL(p->verts[j].y);
+
+					const int rect[4] = { X-VERT_HANDLE_RADIUS, Y-VERT_HANDLE_RADIUS, VERT_HANDLE_RADIUS*2+1, VERT_HANDLE_RADIUS*2+1 };
+
+					const BOOL bHilightVert = m_pHilightVert == &p->verts[j] || bHilightAllVerts;
+
+					fl_rectf(rect[0]+1, rect[1]+1, rect[2]-2, rect[3]-2, bHilightVert ? CUR_VERT_COLOR : VERT_COLOR);
+					fl_rect(rect[0], rect[1], rect[2], rect[3], VERT_FRAME_COLOR);
+
+					Xprev = X;
+					Yprev = Y;
+				}
+			}
+
+			if (p->next && !p->next->bHole)
+			{
+				ret = p->next;
+				break;
+			}
+		}
+
+		return ret;
+	}
+
+	void AddShapePoint(int mouse_x, int mouse_y)
+	{
+		if (m_newShape.iVertCount >= MAX_VERTS || !m_bCreatingShape)
+			return;
+
+		const int X = mouse_x / g_iZoom;
+		const int Y = mouse_y / g_iZoom;
+
+		// may reallocate the vertex array, the caller updates the hilighted vertex
+		m_newShape.SetVertCount(m_newShape.iVertCount + 1);
+
+		m_pEditVert = &m_newShape.verts[m_newShape.iVertCount-1];
+		m_pEditVert->x = X;
+		m_pEditVert->y = Y;
+
+		m_newShape.CalcBoundingRect();
+
+		redraw();
+	}
+
+	void UpdateCurShapePoint(int mouse_x, int mouse_y)
+	{
+		if (!m_pEditVert)
+			return;
+
+		const int X = mouse_x / g_iZoom;
+		const int Y = mouse_y / g_iZoom;
+
+		const sVertex oldPos = *m_pEditVert;
+
+		m_pEditVert->x = X;
+		m_pEditVert->y = Y;
+
+		m_pEditShape->owner->CalcBoundingRect();
+		m_pEditShape->owner->FlushScaledImages();
+
+		// if modifying an actual shape in the project then make sure modified flag is set
+		if (m_pEditShape != &m_newShape)
+		{
+			SetModifiedFlag();
+			g_undo.SetVert(*m_pEditShape, (int)(m_pEditVert - m_pEditShape->verts), oldPos);
+		}
+	}
+
+	void InsertShapePoint()
+	{
+		if (m_iInsEdge < 0 || !m_pHilightShape || m_pHilightShape->iVertCount >= MAX_VERTS)
+			return;
+
+		sShape &shape = *m_pHilightShape;
+
+		// may reallocate the vertex array
+		shape.InsertVert(m_iInsEdge+1, m_insVert);
+
+		m_pHilightVert = &shape.verts[m_iInsEdge+1];
+		m_pEditVert = m_pHilightVert;
+		m_pEditShape = m_pHilightShape;
+		m_iInsEdge = -1;
+
+		shape.owner->CalcBoundingRect();
+		shape.owner->FlushScaledImages();
+
+		// if modifying an actual shape in the project then make sure modified flag is set
+		if (m_pEditShape != &m_newShape)
+		{
+			SetModifiedFlag();
+			g_undo.InsertVert(shape, (int)(m_pEditVert - shape.verts));
+		}
+	}
+
+	void DeleteLastNewShapePoint()
+	{
+		if (!m_bCreatingShape)
+			return;
+
+		if (m_newShape.iVertCount > 1)
+		{
+			m_newShape.iVertCount--;
+			m_newShape.CalcBoundingRect();
+			redraw();
+		}
+		else
+			AbortShape();
+	}
+
+	BOOL DeleteShapePoint(sShape *pShape, sVertex *pVert)
+	{
+		if (pShape->iVertCount <= 3 || m_bMaybeDeleteShape)
+		{
+			if (pShape == &m_newShape)
+				return FALSE;
+
+			// if deleting the last shape of the location then ask if location really should be deleted
+			if ( pShape->owner->IsOnlyNonHoleShape(pShape) )
+			{
+				const int n = g_pProj->maps[g_pProj->iCurMap].iLocationCount;
+
+				m_iDragging = 0;
+
+				OnCmdDelete();
+
+				if (g_pProj->maps[g_pProj->iCurMap].iLocationCount != n)
+				{
+					m_pEditVert = NULL;
+					return TRUE;
+				}
+
+				return FALSE;
+			}
+
+			if ( pShape->owner->IsMultiShape() )
+			{
+				sLocation &loc = *pShape->owner;
+
+				g_undo.DeleteShape(*pShape);
+				loc.DeleteShape(pShape);
+
+				if (m_pEditVert && !loc.IsVertPtrInLocation(m_pEditVert))
+					m_pEditVert = NULL;
+
+				SetModifiedFlag();
+
+				return TRUE;
+			}
+
+			return FALSE;
+		}
+
+		int iVert = -1;
+		for (int i=0; i<pShape->iVertCount; i++)
+			if (&pShape->verts[i] == pVert)
+			{
+				iVert = i;
+				break;
+			}
+
+		if (iVert < 0)
+			return FALSE;
+
+		g_undo.DeleteVert(*pShape, iVert);
+		pShape->DeleteVert(iVert);
+		pShape->owner->CalcBoundingRect();
+		pShape->owner->FlushScaledImages();
+
+		if (m_pEditVert == pVert)
+			m_pEditVert = NULL;
+
+		// if modifying an actual shape in the project then make sure modified flag is set
+		if (pShape != &m_newShape)
+			SetModifiedFlag();
+
+		return TRUE;
+	}
+
+	void CommitShapeAsNewLoc()
+	{
+		if (!m_bCreatingShape || m_newShape.iVertCount < 3)
+			return;
+
+		const int iNewLocIndex = g_pProj->maps[g_pProj->iCurMap].GetFreeLocationIndex();
+		if (iNewLocIndex < 0)
+			return;
+
+		sMap &map = g_pProj->maps[g_pProj->iCurMap];
+
+		sLocation &newLoc = map.AddLocation(iNewLocIndex);
+
+		// default label offset to bounds center (can be outside for concave shapes, but the user can move it if desired)
+		m_newShape.CalcBoundingRect();
+		m_newShape.iLabelPos[0] = m_newShape.iBoundRect[0] + ((m_newShape.iBoundRect[2] - m_newShape.iBoundRect[0]) / 2);
+		m_newShape.iLabelPos[1] = m_newShape.iBoundRect[1] + ((m_newShape.iBoundRect[3] - m_newShape.iBoundRect[1]) / 2);
+
+		g_undo.AddShape( *newLoc.AddShape(m_newShape) );
+
+		g_pTreeView->begin();
+		char s[64];
+		sprintf(s, "PAGE%03d/%03d", g_pProj->iCurMap, iNewLocIndex);
+		Fl_Tree_Item *p = g_pTreeView->add(s);
+		p->user_data( (void*)(intptr_t)MAKE_TREE_ID(g_pProj->iCurMap, iNewLocIndex) );
+		g_pTreeView->end();
+		g_pTreeView->select_only(p);
+		g_pTreeView->set_item_focus(p);
+
+		m_newShape.iVertCount = 0;
+		m_pEditShape = NULL;
+		m_pEditVert = NULL;
+		m_pHilightVert = NULL;
+		m_pHilightShape = NULL;
+		m_bCreatingShape = FALSE;
+
+		SetModifiedFlag();
+
+		redraw();
+	}
+
+	void CommitSubShape()
+	{
+		if (!m_bCreatingShape || m_newShape.iVertCount < 3)
+			return;
+
+		const int iMap = g_pProj->iCurMap;
+		const int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+
+		if (iMap < 0 || iLoc < 0)
+			return;
+
+		sMap &map = g_pProj->maps[g_pProj->iCurMap];
+		sLocation &loc = map.locs[iLoc];
+
+		// default label offset to bounds center (can be outside for concave shapes, but the user can move it if desired)
+		m_newShape.CalcBoundingRect();
+		m_newShape.iLabelPos[0] = m_newShape.iBoundRect[0] + ((m_newShape.iBoundRect[2] - m_newShape.iBoundRect[0]) / 2);
+		m_newShape.iLabelPos[1] = m_newShape.iBoundRect[1] + ((m_newShape.iBoundRect[3] - m_newShape.iBoundRect[1]) / 2);
+
+		// auto-detect if shape is a hole, determined if the first shape point is inside another non-hole shape of the location
+		g_undo.AddShape( *loc.AddShapeMaybeHole(m_newShape) );
+
+		m_newShape.iVertCount = 0;
+		m_pEditShape = NULL;
+		m_pEditVert = NULL;
+		m_pHilightVert = NULL;
+		m_pHilightShape = NULL;
+		m_bCreatingShape = FALSE;
+
+		SetModifiedFlag();
+
+		redraw();
+	}
+
+	// forget hilighted shapes and vertices, after the project was changed from outside the image view (they're updated
+	// again on the next mouse move)
+	void ClearHilight()
+	{
+		m_pHilightVert = NULL;
+		m_pHilightShape = NULL;
+		m_pLabelShape = NULL;
+		m_iInsEdge = -1;
+	}
+
+	void AbortShape()
+	{
+		m_newShape.iVertCount = 0;
+		m_pEditShape = NULL;
+		m_pEditVert = NULL;
+		m_bCreatingShape = FALSE;
+
+		redraw();
+	}
+
+	void UpdateLabelPos(int mouse_x, int mouse_y)
+	{
+		if (!m_pLabelShape)
+			return;
+
+		const int X = mouse_x / g_iZoom;
+		const int Y = mouse_y / g_iZoom;
+
+		DamageLocation(*m_pLabelShape->owner);
+
+		const int iOldX = m_pLabelShape->iLabelPos[0];
+		const int iOldY = m_pLabelShape->iLabelPos[1];
+
+		m_pLabelShape->iLabelPos[0] = X;
+		m_pLabelShape->iLabelPos[1] = Y;
+		m_pLabelShape->owner->OnChanged();
+
+		SetModifiedFlag();
+		g_undo.SetLabelPos(*m_pLabelShape, iOldX, iOldY);
+
+		DamageLocation(*m_pLabelShape->owner);
+		RedrawCues();
+	}
+
+	void SelectShapeFromPos(int mouse_x, int mouse_y)
+	{
+		char s[64];
+
+		const int X = mouse_x / g_iZoom;
+		const int Y = mouse_y / g_iZoom;
+
+		// support selection cycling if there are overlapping locations
+		int iCurSelLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId); 
+		if (iCurSelLoc < 0)
+			iCurSelLoc = 0;
+		else
+			iCurSelLoc++;
+
+		// only locations near the position need to be checked, start with the first one after the current selection
+		int iCandidates[MAX_LOCATIONS_PER_MAP];
+		const int n = g_pProj->maps[g_pProj->iCurMap].QueryLocations(X, Y, X, Y, iCandidates);
+
+		int iStart = 0;
+		while (iStart < n && iCandidates[iStart] < iCurSelLoc)
+			iStart++;
+
+		for (int k=0; k<n; k++)
+		{
+			const int i = iCandidates[(iStart + k) % n];
+
+			if ( g_pProj->maps[g_pProj->iCurMap].locs[i].IsPosInLocation(X, Y) )
+			{
+				sprintf(s, "PAGE%03d/%03d", g_pProj->iCurMap, g_pProj->maps[g_pProj->iCurMap].locs[i].iLocationIndex);
+				Fl_Tree_Item *pItem = g_pTreeView->find_item(s);
+				if (pItem)
+				{
+					g_pTreeView->select_only(pItem);
+					g_pTreeView->set_item_focus(pItem);
+					redraw();
+				}
+
+				return;
+			}
+		}
+
+		// no shape found, select page (/ deselect current selection)
+		sprintf(s, "PAGE%03d", g_pProj->iCurMap);
+		Fl_Tree_Item *pItem = g_pTreeView->find_item(s);
+		if (pItem)
+		{
+			g_pTreeView->select_only(pItem);
+			g_pTreeView->set_item_focus(pItem);
+			redraw();
+		}
+	}
+
+	EditMode m_mode;
+
+	int m_iDragging;
+
+	// current mouse pos (in local widget coords)
+	int m_iMousePos[2];
+	int m_iMousePosSnapped[2];
+
+	// in-progress drawn shape
+	BOOL m_bCreatingShape;
+	sShape m_newShape;
+	sLocation m_newLoc;
+
+	// current shape and vert being edited
+	sShape *m_pEditShape;
+	sVertex *m_pEditVert;
+
+	sShape *m_pHilightShape;
+	sVertex *m_pHilightVert;
+	int m_iInsEdge;
+	sVertex m_insVert;
+	// current label that can be moved (only valid during EM_LABELPOS)
+	sShape *m_pLabelShape;
+
+	// TRUE when hovering over a vertex and holding down shift in EM_ADD_DEL
+	// used to indicate that a vertex delete operation in this state will delete the entire shape
+	// (this var should never be used if m_pHilightVert is NULL)
+	BOOL m_bMaybeDeleteShape;
+
+	BOOL m_bPanning;
+	int m_iPanRestoreCursor;
+	int m_iPanRefMousePos[2];
+	int m_iPanRefScrollPos[2];
+
+	// cues as they were last drawn
+	enum { MAX_CUE_RECTS = 8 };
+	sClientRect m_drawnCues[MAX_CUE_RECTS];
+	int m_iDrawnCueCount;
+
+	// origin of the client area in the current drawing surface (DrawShape)
+	int m_iDrawOrigin[2];
+
+	// settings and state that the cached base layer was drawn with
+	struct sBaseLayerKey
+	{
+		int iRect[4];
+		int iMap;
+		int iSelLoc;
+		int iSerial;
+		const void *img;
+		int iZoom;
+		int iDisplayMode;
+		int iAA;
+		int iLineWidth;
+		int bDrawLabels;
+	};
+
+	Fl_Offscreen m_baseLayer;
+	sBaseLayerKey m_baseLayerKey;
+};
+
+
+/////////////////////////////////////////////////////////////////////
+
+class cMainWindow : public Fl_Double_Window
+{
+public:
+	cMainWindow(int W, int H, const char *l = 0) : Fl_Double_Window(W, H, l) {}
+
+	virtual void resize(int X, int Y, int W, int H)
+	{
+		Fl_Double_Window::resize(X, Y, W, H);
+
+		OnWindowResized(W, H);
+	}
+};
+
+class Fl_Tree_Ex : public Fl_Tree
+{
+public:
+	Fl_Tree_Ex(int X, int Y, int W, int H) : Fl_Tree(X,Y,W,H) {}
+
+	virtual int handle(int ev)
+	{
+		if (ev == FL_ENTER)
+		{
+			take_focus();
+			return 1;
+		}
+
+		return Fl_Tree::handle(ev);
+	}
+};
+
+
+/////////////////////////////////////////////////////////////////////
+
+// minimal threading support (Win32 threads or pthreads)
+
+#ifdef _WIN32
+typedef HANDLE ThreadHandle;
+#else
+typedef pthread_t ThreadHandle;
+#endif
+
+class cMutex
+{
+public:
+#ifdef _WIN32
+	cMutex() { InitializeCriticalSection(&m_cs); }
+	~cMutex() { DeleteCriticalSection(&m_cs); }
+
+	void Lock() { EnterCriticalSection(&m_cs); }
+	void Unlock() { LeaveCriticalSection(&m_cs); }
+#else
+	cMutex() { pthread_mutex_init(&m_cs, NULL); }
+	~cMutex() { pthread_mutex_destroy(&m_cs); }
+
+	void Lock() { pthread_mutex_lock(&m_cs); }
+	void Unlock() { pthread_mutex_unlock(&m_cs); }
+#endif
+
+private:
+	friend class cCondition;
+
+#ifdef _WIN32
+	CRITICAL_SECTION m_cs;
+#else
+	pthread_mutex_t m_cs;
+#endif
+};
+
+class cCondition
+{
+public:
+#ifdef _WIN32
+	cCondition() { InitializeConditionVariable(&m_cv); }
+	~cCondition() {}
+
+	// mutex must be locked by the caller
+	void Wait(cMutex &mutex) { SleepConditionVariableCS(&m_cv, &mutex.m_cs, INFINITE); }
+	void Signal() { WakeConditionVariable(&m_cv); }
+	void Broadcast() { WakeAllConditionVariable(&m_cv); }
+#else
+	cCondition() { pthread_cond_init(&m_cv, NULL); }
+	~cCondition() { pthread_cond_destroy(&m_cv); }
+
+	// mutex must be locked by the caller
+	void Wait(cMutex &mutex) { pthread_cond_wait(&m_cv, &mutex.m_cs); }
+	void Signal() { pthread_cond_signal(&m_cv); }
+	void Broadcast() { pthread_cond_broadcast(&m_cv); }
+#endif
+
+private:
+#ifdef _WIN32
+	CONDITION_VARIABLE m_cv;
+#else
+	pthread_cond_t m_cv;
+#endif
+};
+
+static int GetHardwareThreadCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	const int n = (int)si.dwNumberOfProcessors;
+#else
+	const int n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? n : 1;
+}
+
+typedef void (*ThreadTaskFunc)(void *pArg);
+
+// fixed size pool of worker threads that execute tasks in FIFO order, tasks may add further tasks
+// (with a thread count of 0 or 1 no threads are created and tasks are executed directly in AddTask)
+class cThreadPool
+{
+public:
+	cThreadPool(int iThreads)
+	{
+		m_pHead = NULL;
+		m_pTail = NULL;
+		m_iPending = 0;
+		m_bQuit = FALSE;
+
+		m_iThreads = iThreads > 1 ? iThreads : 0;
+		m_pThreads = m_iThreads ? new ThreadHandle[m_iThreads] : NULL;
+
+		for (int i=0; i<m_iThreads; i++)
+		{
+#ifdef _WIN32
+			m_pThreads[i] = (HANDLE)_beginthreadex(NULL, 0, ThreadProc, this, 0, NULL);
+#else
+			pthread_create(&m_pThreads[i], NULL, ThreadProc, this);
+#endif
+		}
+	}
+
+	~cThreadPool()
+	{
+		Wait();
+
+		m_lock.Lock();
+		m_bQuit = TRUE;
+		m_condWork.Broadcast();
+		m_lock.Unlock();
+
+		for (int i=0; i<m_iThreads; i++)
+		{
+#ifdef _WIN32
+			WaitForSingleObject(m_pThreads[i], INFINITE);
+			CloseHandle(m_pThreads[i]);
+#else
+			pthread_join(m_pThreads[i], NULL);
+#endif
+		}
+
+		delete[] m_pThreads;
+	}
+
+	int GetThreadCount() const { return m_iThreads ? m_iThreads : 1; }
+
+	void AddTask(ThreadTaskFunc pFunc, void *pArg)
+	{
+		if (!m_iThreads)
+		{
+			pFunc(pArg);
+			return;
+		}
+
+		sTask *pTask = new sTask;
+		pTask->pFunc = pFunc;
+		pTask->pArg = pArg;
+		pTask->next = NULL;
+
+		m_lock.Lock();
+
+		if (m_pTail)
+			m_pTail->next = pTask;
+		else
+			m_pHead = pTask;
+		m_pTail = pTask;
+
+		m_iPending++;
+
+		m_condWork.Signal();
+		m_lock.Unlock();
+	}
+
+	// wait until no more than 'iMaxPending' tasks are queued or running (tasks may queue further tasks)
+	void Wait(int iMaxPending = 0)
+	{
+		m_lock.Lock();
+		while (m_iPending > iMaxPending)
+			m_condIdle.Wait(m_lock);
+		m_lock.Unlock();
+	}
+
+private:
+	struct sTask
+	{
+		ThreadTaskFunc pFunc;
+		void *pArg;
+		sTask *next;
+	};
+
+#ifdef _WIN32
+	static unsigned __stdcall ThreadProc(void *p)
+#else
+	static void* ThreadProc(void *p)
+#endif
+	{
+		((cThreadPool*)p)->WorkerLoop();
+		return 0;
+	}
+
+	void WorkerLoop()
+	{
+		m_lock.Lock();
+
+		for (;;)
+		{
+			while (!m_pHead && !m_bQuit)
+				m_condWork.Wait(m_lock);
+
+			if (!m_pHead)
+				break;
+
+			sTask *pTask = m_pHead;
+			m_pHead = pTask->next;
+			if (!m_pHead)
+				m_pTail = NULL;
+
+			m_lock.Unlock();
+
+			pTask->pFunc(pTask->pArg);
+			delete pTask;
+
+			m_lock.Lock();
+
+			m_iPending--;
+			m_condIdle.Broadcast();
+		}
+
+		m_lock.Unlock();
+	}
+
+	int m_iThreads;
+	ThreadHandle *m_pThreads;
+
+	cMutex m_lock;
+	cCondition m_condWork;
+	cCondition m_condIdle;
+
+	sTask *m_pHead;
+	sTask *m_pTail;
+	int m_iPending;
+	BOOL m_bQuit;
+};
+
+struct sThreadStart
+{
+	ThreadTaskFunc pFunc;
+	void *pArg;
+};
+
+#ifdef _WIN32
+static unsigned __stdcall ThreadStartProc(void *p)
+#else
+static void* ThreadStartProc(void *p)
+#endif
+{
+	const sThreadStart start = *(sThreadStart*)p;
+	delete (sThreadStart*)p;
+
+	start.pFunc(start.pArg);
+	return 0;
+}
+
+// run a function on a new thread, which must be waited for with JoinThread
+static ThreadHandle StartThread(ThreadTaskFunc pFunc, void *pArg)
+{
+	sThreadStart *pStart = new sThreadStart;
+	pStart->pFunc = pFunc;
+	pStart->pArg = pArg;
+
+	ThreadHandle h;
+#ifdef _WIN32
+	h = (HANDLE)_beginthreadex(NULL, 0, ThreadStartProc, pStart, 0, NULL);
+#else
+	pthread_create(&h, NULL, ThreadStartProc, pStart);
+#endif
+	return h;
+}
+
+static void JoinThread(ThreadHandle h)
+{
+#ifdef _WIN32
+	WaitForSingleObject(h, INFINITE);
+	CloseHandle(h);
+#else
+	pthread_join(h, NULL);
+#endif
+}
+
+// monotonic time in seconds (only useful for measuring durations)
+static double GetTimeSeconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, t;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+// fopen with UTF-8 file names that is safe to call from worker threads (fl_fopen uses a static conversion
+// buffer on Windows)
+static FILE* fopen_utf8_mt(const char *sFileName, const char *sMode)
+{
+#ifdef _WIN32
+	wchar_t wsFileName[MAX_PATH+32];
+	wchar_t wsMode[8];
+	if ( !MultiByteToWideChar(CP_UTF8, 0, sFileName, -1, wsFileName, sizeof(wsFileName)/sizeof(wsFileName[0]))
+		|| !MultiByteToWideChar(CP_UTF8, 0, sMode, -1, wsMode, sizeof(wsMode)/sizeof(wsMode[0])) )
+		return NULL;
+	return _wfopen(wsFileName, wsMode);
+#else
+	return fopen(sFileName, sMode);
+#endif
+}
+
+// create a directory (UTF-8 name, safe to call from worker threads), returns TRUE if it exists afterwards
+static BOOL mkdir_utf8_mt(const char *sDir)
+{
+#ifdef _WIN32
+	wchar_t wsDir[MAX_PATH+32];
+	if ( !MultiByteToWideChar(CP_UTF8, 0, sDir, -1, wsDir, sizeof(wsDir)/sizeof(wsDir[0])) )
+		return FALSE;
+	return CreateDirectoryW(wsDir, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	return !mkdir(sDir, 0777) || errno == EEXIST;
+#endif
+}
+
+// rename a file (UTF-8 names, safe to call from worker threads), an existing file 'sTo' is replaced
+static BOOL rename_utf8_mt(const char *sFrom, const char *sTo)
+{
+#ifdef _WIN32
+	wchar_t wsFrom[MAX_PATH+32];
+	wchar_t wsTo[MAX_PATH+32];
+	if ( !MultiByteToWideChar(CP_UTF8, 0, sFrom, -1, wsFrom, sizeof(wsFrom)/sizeof(wsFrom[0]))
+		|| !MultiByteToWideChar(CP_UTF8, 0, sTo, -1, wsTo, sizeof(wsTo)/sizeof(wsTo[0])) )
+		return FALSE;
+	return MoveFileExW(wsFrom, wsTo, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return !rename(sFrom, sTo);
+#endif
+}
+
+// delete a file (UTF-8 name, safe to call from worker threads)
+static void unlink_utf8_mt(const char *sFileName)
+{
+#ifdef _WIN32
+	wchar_t wsFileName[MAX_PATH+32];
+	if ( MultiByteToWideChar(CP_UTF8, 0, sFileName, -1, wsFileName, sizeof(wsFileName)/sizeof(wsFileName[0])) )
+		DeleteFileW(wsFileName);
+#else
+	unlink(sFileName);
+#endif
+}
+
+// 64-bit FNV-1a hash
+#define FNV64_OFFSET_BASIS		0xCBF29CE484222325ULL
+#define FNV64_PRIME				0x00000100000001B3ULL
+
+static inline UINT64 HashBytes(UINT64 h, const void *data, int size)
+{
+	const BYTE *p = (const BYTE*)data;
+	for (int i=0; i<size; i++)
+		h = (h ^ p[i]) * FNV64_PRIME;
+	return h;
+}
+
+static inline UINT64 HashInt(UINT64 h, int n)
+{
+	return HashBytes(h, &n, sizeof(n));
+}
+
+
+/////////////////////////////////////////////////////////////////////
+
+static void fwrite_png(png_structp pPng, png_bytep data, png_size_t length) { fwrite(data, 1, length, (FILE*)png_get_io_ptr(pPng)); }
+static void fflush_png(png_structp pPng) { fflush( (FILE*)png_get_io_ptr(pPng) ); }
+static png_voidp malloc_png(png_structp, png_alloc_size_t size) { return malloc(size); }
+static void free_png(png_structp, png_voidp p) { free(p); }
+
+#ifndef png_jmpbuf
+#  define png_jmpbuf(pPng) ((pPng)->png_jmpbuf)
+#endif
+
+static void fread_png(png_structp pPng, png_bytep data, png_size_t length)
+{
+	if (fread(data, 1, length, (FILE*)png_get_io_ptr(pPng)) != length)
+		png_error(pPng, "read error");
+}
+
+// decode a true-color PNG image into a new[] allocated 24- or 32-bit buffer (same conversions as Fl_PNG_Image),
+// unlike Fl_PNG_Image it's safe to call from worker threads
+static BYTE* DecodePNG(const char *sFileName, int *pWidth, int *pHeight, int *pDepth)
+{
+	FILE *f = fopen_utf8_mt(sFileName, "rb");
+	if (!f)
+		return NULL;
+
+	png_structp pPng = png_create_read_struct_2(PNG_LIBPNG_VER_STRING,
+		NULL, NULL, NULL,
+		NULL, malloc_png, free_png);
+	if (!pPng)
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	png_infop pPngInfo = png_create_info_struct(pPng);
+	if (!pPngInfo)
+	{
+		png_destroy_read_struct(&pPng, NULL, NULL);
+		fclose(f);
+		return NULL;
+	}
+
+	BYTE * volatile pData = NULL;
+	png_bytep * volatile pImgLines = NULL;
+
+	if ( setjmp( png_jmpbuf(pPng) ) )
+	{
+		// exception thrown during read
+		png_destroy_read_struct(&pPng, &pPngInfo, NULL);
+		fclose(f);
+		delete[] pData;
+		delete[] pImgLines;
+		return NULL;
+	}
+
+	png_set_read_fn(pPng, (void*)f, fread_png);
+
+	png_read_info(pPng, pPngInfo);
+
+	const int iColorType = png_get_color_type(pPng, pPngInfo);
+	if (iColorType == PNG_COLOR_TYPE_GRAY || iColorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_error(pPng, "not a true-color image");
+
+	if (iColorType == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(pPng);
+	if ( png_get_valid(pPng, pPngInfo, PNG_INFO_tRNS) )
+		png_set_tRNS_to_alpha(pPng);
+	if (png_get_bit_depth(pPng, pPngInfo) == 16)
+		png_set_strip_16(pPng);
+	png_set_interlace_handling(pPng);
+
+	png_read_update_info(pPng, pPngInfo);
+
+	const int w = png_get_image_width(pPng, pPngInfo);
+	const int h = png_get_image_height(pPng, pPngInfo);
+	const int d = png_get_channels(pPng, pPngInfo);
+
+	pData = new BYTE[w * h * d];
+	pImgLines = new png_bytep[h];
+	for (int y=0; y<h; y++)
+		pImgLines[y] = pData + y * w * d;
+
+	png_read_image(pPng, pImgLines);
+	png_read_end(pPng, NULL);
+	png_destroy_read_struct(&pPng, &pPngInfo, NULL);
+
+	fclose(f);
+
+	delete[] pImgLines;
+
+	*pWidth = w;
+	*pHeight = h;
+	*pDepth = d;
+
+	return pData;
+}
+
+// decoded map page images are kept in uncompressed files in the page cache directory of the map directory, so pages
+// that were decoded before are mapped into memory instead of decoding the PNG again. a cache file is only used while
+// the size, modification time and a hash of the start and end of its PNG file are the same as when it was written.
+// the pixels directly follow the header, in the same layout as the decoded image (rows aren't padded)
+#define PAGE_CACHE_DIR			".dmgcache"
+#define PAGE_CACHE_MAGIC		0x43474D44		// "DMGC"
+#define PAGE_CACHE_VERSION		1
+
+// bytes hashed at the start and at the end of a PNG file for the page cache key
+#define PAGE_CACHE_HASH_BYTES	4096
+
+struct sPageCacheHeader
+{
+	UINT iMagic;
+	UINT iVersion;
+	UINT64 iSrcSize;
+	UINT64 iSrcTime;
+	UINT64 iSrcHash;
+	int iWidth;
+	int iHeight;
+	int iDepth;
+	int iReserved;
+};
+
+// a map page image whose pixels are in a mapped page cache file
+class cMappedPageImage : public Fl_RGB_Image
+{
+public:
+	// takes ownership of 'pFile'
+	cMappedPageImage(cMappedFile *pFile, const sPageCacheHeader &hdr)
+		: Fl_RGB_Image(pFile->GetData() + sizeof(sPageCacheHeader), hdr.iWidth, hdr.iHeight, hdr.iDepth)
+	{
+		m_pFile = pFile;
+	}
+	~cMappedPageImage()
+	{
+		uncache();
+		delete m_pFile;
+	}
+
+private:
+	cMappedFile *m_pFile;
+};
+
+// a map page image decoded by a worker thread
+struct sPageDecodeJob
+{
+	int iMap;
+	BOOL bHilightSS2;
+	BOOL bUseCache;
+	char sFileName[MAX_PATH*2];
+	char sCacheFileName[MAX_PATH*2];
+
+	// decoded image data, or the mapped page cache file that holds it
+	BYTE *pData;
+	cMappedFile *pCacheFile;
+	int iSize[2];
+	int iDepth;
+};
+
+// get the page cache key of a PNG file, returns FALSE if the file can't be read
+static BOOL GetPageCacheKey(const char *sFileName, sPageCacheHeader &hdr)
+{
+	FILE *f = fopen_utf8_mt(sFileName, "rb");
+	if (!f)
+		return FALSE;
+
+#ifdef _WIN32
+	struct _stat64 st;
+	BOOL ret = !_fstat64(_fileno(f), &st);
+#else
+	struct stat st;
+	BOOL ret = !fstat(fileno(f), &st);
+#endif
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.iMagic = PAGE_CACHE_MAGIC;
+	hdr.iVersion = PAGE_CACHE_VERSION;
+
+	if (ret)
+	{
+		hdr.iSrcSize = (UINT64)st.st_size;
+		hdr.iSrcTime = (UINT64)st.st_mtime;
+
+		// an edit that keeps the size and time almost certainly changes the compressed data at the end (or the header)
+		BYTE buf[PAGE_CACHE_HASH_BYTES];
+		const int n = (int) fread(buf, 1, sizeof(buf), f);
+		hdr.iSrcHash = HashBytes(FNV64_OFFSET_BASIS, buf, n);
+
+		if (hdr.iSrcSize > sizeof(buf) && !fseek(f, -(long)sizeof(buf), SEEK_END))
+			hdr.iSrcHash = HashBytes(hdr.iSrcHash, buf, (int) fread(buf, 1, sizeof(buf), f));
+	}
+
+	fclose(f);
+
+	return ret;
+}
+
+// map the page cache file of a job if it's up to date
+static BOOL OpenPageCache(sPageDecodeJob &job, const sPageCacheHeader &key)
+{
+	cMappedFile *pFile = new cMappedFile;
+
+	if ( pFile->Open(job.sCacheFileName) && pFile->GetSize() >= sizeof(sPageCacheHeader) )
+	{
+		const sPageCacheHeader &hdr = *(const sPageCacheHeader*) pFile->GetData();
+
+		if (hdr.iMagic == key.iMagic && hdr.iVersion == key.iVersion
+			&& hdr.iSrcSize == key.iSrcSize && hdr.iSrcTime == key.iSrcTime && hdr.iSrcHash == key.iSrcHash
+			&& hdr.iWidth > 0 && hdr.iHeight > 0 && (hdr.iDepth == 3 || hdr.iDepth == 4)
+			&& pFile->GetSize() == sizeof(hdr) + (size_t)hdr.iWidth * hdr.iHeight * hdr.iDepth)
+		{
+			job.pCacheFile = pFile;
+			job.iSize[0] = hdr.iWidth;
+			job.iSize[1] = hdr.iHeight;
+			job.iDepth = hdr.iDepth;
+			return TRUE;
+		}
+	}
+
+	delete pFile;
+	return FALSE;
+}
+
+// write the decoded image of a job to its page cache file, the file is written under a temporary name first so a
+// partially written file is never used
+static void WritePageCache(const sPageDecodeJob &job, const sPageCacheHeader &key)
+{
+	char sDir[MAX_PATH*2];
+	strcpy(sDir, job.sCacheFileName);
+	*strrchr(sDir, DIRSEP_STR[0]) = '\0';
+
+	if ( !mkdir_utf8_mt(sDir) )
+		return;
+
+	sPageCacheHeader hdr = key;
+	hdr.iWidth = job.iSize[0];
+	hdr.iHeight = job.iSize[1];
+	hdr.iDepth = job.iDepth;
+
+	// the same page can be decoded by the main thread and a generate run at the same time
+	char sTempFileName[MAX_PATH*2+32];
+	sprintf(sTempFileName, "%s.%p.tmp", job.sCacheFileName, (const void*)&job);
+
+	FILE *f = fopen_utf8_mt(sTempFileName, "wb");
+	if (!f)
+		return;
+
+	const size_t n = (size_t)job.iSize[0] * job.iSize[1] * job.iDepth;
+	BOOL ret = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && fwrite(job.pData, 1, n, f) == n;
+	ret = !fclose(f) && ret;
+
+	if ( !ret || !rename_utf8_mt(sTempFileName, job.sCacheFileName) )
+		unlink_utf8_mt(sTempFileName);
+}
+
+static void PageDecodeTask(void *p)
+{
+	sPageDecodeJob &job = *(sPageDecodeJob*)p;
+
+	sPageCacheHeader key;
+	const BOOL bUseCache = job.bUseCache && GetPageCacheKey(job.sFileName, key);
+
+	if ( bUseCache && OpenPageCache(job, key) )
+		return;
+
+	job.pData = DecodePNG(job.sFileName, &job.iSize[0], &job.iSize[1], &job.iDepth);
+
+	if (bUseCache && job.pData)
+		WritePageCache(job, key);
+}
+
+// make an Fl_RGB_Image that owns the decoded image data or mapped page cache file of a job
+static Fl_RGB_Image* MakePageImage(sPageDecodeJob &job)
+{
+	if (job.pCacheFile)
+	{
+		Fl_RGB_Image *img = new cMappedPageImage(job.pCacheFile, *(const sPageCacheHeader*) job.pCacheFile->GetData());
+		job.pCacheFile = NULL;
+		return img;
+	}
+
+	Fl_RGB_Image *img = new Fl_RGB_Image(job.pData, job.iSize[0], job.iSize[1], job.iDepth);
+	img->alloc_array = 1;
+	job.pData = NULL;
+	return img;
+}
+
+// free the image of a job that wasn't installed
+static void FreePageDecodeJob(sPageDecodeJob &job)
+{
+	delete[] job.pData;
+	delete job.pCacheFile;
+	job.pData = NULL;
+	job.pCacheFile = NULL;
+}
+
+// get the file name of a map page image (the SS2 hilight variant if 'bHilightSS2' is set)
+static void GetPageImageFileName(char *s, const char *sDir, int iMap, BOOL bHilightSS2)
+{
+	if (g_bShockMaps)
+		sprintf(s, "%s" DIRSEP_STR "page%03da%s.png", sDir, iMap, bHilightSS2 ? "-hi" : "");
+	else
+		sprintf(s, "%s" DIRSEP_STR "page%03d.png", sDir, iMap);
+}
+
+// get the file name of the page cache file of a map page image
+static void GetPageCacheFileName(char *s, const char *sDir, int iMap, BOOL bHilightSS2)
+{
+	if (g_bShockMaps)
+		sprintf(s, "%s" DIRSEP_STR PAGE_CACHE_DIR DIRSEP_STR "page%03da%s.rgb", sDir, iMap, bHilightSS2 ? "-hi" : "");
+	else
+		sprintf(s, "%s" DIRSEP_STR PAGE_CACHE_DIR DIRSEP_STR "page%03d.rgb", sDir, iMap);
+}
+
+// read the dimensions of a PNG image from its header without decoding it, returns 0 if the file doesn't exist or isn't
+// a PNG, -1 if it's not a true-color image (Fl_PNG_Image doesn't convert grayscale images)
+static int ReadPNGHeader(const char *sFileName, int *pWidth, int *pHeight)
+{
+	FILE *f = fl_fopen(sFileName, "rb");
+	if (!f)
+		return 0;
+
+	// signature, IHDR chunk length and type, width, height, bit depth and color type
+	BYTE hdr[26];
+	const BOOL bRead = fread(hdr, sizeof(hdr), 1, f) == 1;
+	fclose(f);
+
+	if (!bRead || png_sig_cmp(hdr, 0, 8) || memcmp(hdr + 12, "IHDR", 4))
+		return 0;
+
+	*pWidth = (hdr[16] << 24) | (hdr[17] << 16) | (hdr[18] << 8) | hdr[19];
+	*pHeight = (hdr[20] << 24) | (hdr[21] << 16) | (hdr[22] << 8) | hdr[23];
+
+	if (*pWidth <= 0 || *pHeight <= 0)
+		return 0;
+
+	const BYTE iColorType = hdr[25];
+	if (iColorType == PNG_COLOR_TYPE_GRAY || iColorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+		return -1;
+
+	return 1;
+}
+
+static UINT64 GetPageMemSize(const sMap &map)
+{
+	UINT64 n = 0;
+	if (map.img)
+		n += (UINT64)map.img->w() * map.img->h() * map.img->d();
+	if (map.imgHilightSS2)
+		n += (UINT64)map.imgHilightSS2->w() * map.imgHilightSS2->h() * map.imgHilightSS2->d();
+	return n;
+}
+
+// free the decoded images of a map page (they're decoded again on demand)
+static void UnloadPageImages(int iMap)
+{
+	sMap &map = g_pProj->maps[iMap];
+	if (map.img)
+	{
+		delete map.img;
+		map.img = NULL;
+	}
+	if (map.imgHilightSS2)
+	{
+		delete map.imgHilightSS2;
+		map.imgHilightSS2 = NULL;
+	}
+
+	// scaled images in the view cache stay valid, they're only discarded by the cache's own memory limit
+}
+
+// evict least recently used decoded map pages until the total is within the --max-page-mem budget (pages that are
+// pinned or 'iKeepMap' are never evicted)
+static void EvictPageImages(int iKeepMap)
+{
+	if (g_iMaxPageMem <= 0)
+		return;
+
+	const UINT64 iBudget = (UINT64)g_iMaxPageMem * 1024 * 1024;
+
+	for (;;)
+	{
+		UINT64 iTotal = 0;
+		int iOldest = -1;
+
+		for (int i=0; i<g_pProj->iMapCount; i++)
+		{
+			const sMap &map = g_pProj->maps[i];
+			if (!map.img)
+				continue;
+
+			iTotal += GetPageMemSize(map);
+
+			if (i != iKeepMap && !map.iPinCount && (iOldest < 0 || map.iLastUse < g_pProj->maps[iOldest].iLastUse))
+				iOldest = i;
+		}
+
+		if (iTotal <= iBudget || iOldest < 0)
+			break;
+
+		UnloadPageImages(iOldest);
+	}
+}
+
+static BOOL IsPageDecodeJobOk(const sPageDecodeJob &job, const int iImgSize[2])
+{
+	return (job.pData || job.pCacheFile) && job.iSize[0] == iImgSize[0] && job.iSize[1] == iImgSize[1];
+}
+
+// install decoded page images (in SS2 mode each page image must be followed by its hilight image), frees the data
+// of images that failed to load and returns FALSE if any did
+static BOOL InstallPageImages(sPageDecodeJob *pJobs, int iJobs, BOOL bReportErrors)
+{
+	const int iImagesPerPage = g_bShockMaps ? 2 : 1;
+
+	BOOL ret = TRUE;
+
+	for (int i=0; i<iJobs; i+=iImagesPerPage)
+	{
+		sMap &map = g_pProj->maps[pJobs[i].iMap];
+
+		BOOL bOk = TRUE;
+		for (int j=i; j<i+iImagesPerPage && bOk; j++)
+		{
+			const sPageDecodeJob &job = pJobs[j];
+			if ( !IsPageDecodeJobOk(job, map.iImgSize) )
+			{
+				if (bReportErrors)
+					ReportError("Failed to load image \"%s\"", job.sFileName);
+				bOk = FALSE;
+			}
+		}
+
+		if (!bOk)
+		{
+			for (int j=i; j<i+iImagesPerPage; j++)
+				FreePageDecodeJob(pJobs[j]);
+
+			map.bLoadFailed = TRUE;
+			ret = FALSE;
+			continue;
+		}
+
+		map.img = MakePageImage(pJobs[i]);
+		if (g_bShockMaps)
+			map.imgHilightSS2 = MakePageImage(pJobs[i+1]);
+	}
+
+	return ret;
+}
+
+static void InitPageDecodeJob(sPageDecodeJob &job, int iMap, BOOL bHilightSS2)
+{
+	job.iMap = iMap;
+	job.bHilightSS2 = bHilightSS2;
+	job.bUseCache = g_bPageCache;
+	GetPageImageFileName(job.sFileName, g_pProj->sDir, iMap, bHilightSS2);
+	GetPageCacheFileName(job.sCacheFileName, g_pProj->sDir, iMap, bHilightSS2);
+	job.pData = NULL;
+	job.pCacheFile = NULL;
+}
+
+// make sure the images of a map page are decoded, returns FALSE if the page doesn't exist or failed to load (the
+// error is only reported once)
+static BOOL LoadPageImages(int iMap, BOOL bReportErrors)
+{
+	if (iMap < 0 || iMap >= g_pProj->iMapCount)
+		return FALSE;
+
+	sMap &map = g_pProj->maps[iMap];
+	if (!map.IsValid() || map.bLoadFailed)
+		return FALSE;
+
+	map.iLastUse = ++g_iPageUseCounter;
+
+	if (map.img)
+		return TRUE;
+
+	sPageDecodeJob jobs[2];
+	const int iJobs = g_bShockMaps ? 2 : 1;
+
+	for (int i=0; i<iJobs; i++)
+	{
+		InitPageDecodeJob(jobs[i], iMap, i == 1);
+		PageDecodeTask(&jobs[i]);
+	}
+
+	if ( !InstallPageImages(jobs, iJobs, bReportErrors) )
+		return FALSE;
+
+	EvictPageImages(iMap);
+
+	return TRUE;
+}
+
+static BOOL LoadProject(const char *sDir)
+{
+	char s[MAX_PATH*2];
+	char s2[MAX_PATH*2];
+
+	if (g_pProj)
+		delete g_pProj;
+
+	if (g_bShockMaps == -1)
+	{
+		// auto-detect shock/thief mode
+		g_bShockMaps = FALSE;
+
+		struct stat st;
+		sprintf(s, "%s" DIRSEP_STR "page001a.png", sDir);
+		if ( !fl_stat(s, &st) )
+		{
+			sprintf(s, "%s" DIRSEP_STR "page001a-hi.png", sDir);
+			if ( !fl_stat(s, &st) )
+				g_bShockMaps = TRUE;
+		}
+	}
+
+	g_pProj = new sProject;
+
+	g_pProj->sDir = strdup(sDir);
+
+	// finds any map images, without requiring a gap-free sequence, only the image headers are read here and the pages
+	// are decoded on demand by LoadPageImages
+	for (int i=0; i<MAX_MAPS; i++)
+	{
+		int w, h;
+		GetPageImageFileName(s, sDir, i, FALSE);
+
+		const int res = ReadPNGHeader(s, &w, &h);
+		if (!res)
+			continue;
+		if (res < 0)
+		{
+			ReportError("Failed to load image \"%s\", not a 24- or 32-bit image", s);
+			continue;
+		}
+
+		if (g_bShockMaps)
+		{
+			int w2, h2;
+			GetPageImageFileName(s2, sDir, i, TRUE);
+
+			const int res2 = ReadPNGHeader(s2, &w2, &h2);
+			if (!res2)
+				continue;
+			if (res2 < 0)
+			{
+				ReportError("Failed to load image \"%s\", not a 24- or 32-bit image", s2);
+				continue;
+			}
+			if (w2 != w || h2 != h)
+			{
+				ReportError("Failed to load map, image \"%s\" and \"%s\" are not the same size", s, s2);
+				continue;
+			}
+		}
+
+		g_pProj->maps[i].iImgSize[0] = w;
+		g_pProj->maps[i].iImgSize[1] = h;
+		g_pProj->iMapCount = i+1;
+	}
+
+	if ( !g_pProj->Load() )
+		return FALSE;
+
+	if (g_bBinaryProject)
+		g_pProj->bBinary = TRUE;
+
+	return TRUE;
+}
+
+// get the rect (inclusive) of the location image for 'loc', including any extra border, returns FALSE if empty
+static BOOL GetLocationImageRect(const int iImgSize[2], const sLocation &loc, int *brect, const int iExtraBorder = 0)
+{
+	brect[0] = loc.iBoundRect[0];
+	brect[1] = loc.iBoundRect[1];
+	brect[2] = loc.iBoundRect[2];
+	brect[3] = loc.iBoundRect[3];
+
+	if (iExtraBorder > 0)
+	{
+		brect[0] -= iExtraBorder;
+		brect[1] -= iExtraBorder;
+		brect[2] += iExtraBorder;
+		brect[3] += iExtraBorder;
+
+		if (brect[0] < 0) brect[0] = 0;
+		if (brect[1] < 0) brect[1] = 0;
+		if (brect[2] >= iImgSize[0]) brect[2] = iImgSize[0] - 1;
+		if (brect[3] >= iImgSize[1]) brect[3] = iImgSize[1] - 1;
+	}
+
+	return brect[2] >= brect[0] && brect[3] >= brect[1];
+}
+
+// render the alpha mask of a location into the alpha channel of a w*h RGBA buffer ('xoffs' and 'yoffs' is the map
+// position of the upper left corner), uses FLTK drawing so it must be called from the main thread
+static void GenerateLocationMaskFLTK(const sLocation &loc, int xoffs, int yoffs, int w, int h, BYTE *data, const int AA = 4)
+{
+	// draw shape polygon into an off-screen surface to generate an alpha mask
+	// (surface is AA times larger and then downscaled with boxfilter to get an anti-aliased alpha mask)
+
+	Fl_Image_Surface *surf = new Fl_Image_Surface(w*AA, h*AA);
+
+	surf->set_current();
+
+	fl_push_clip(0, 0, w*AA, h*AA);
+
+	fl_rectf(0, 0, w*AA, h*AA, FL_BLACK);
+
+	fl_color(FL_WHITE);
+
+	const double ctr = (double)AA / 2.0;
+
+	const sShape *p = loc.shape;
+	while (p)
+	{
+		fl_begin_complex_polygon();
+		for (; p; p=p->next)
+		{
+			if (p->bHole && p != loc.shape)
+				fl_gap();
+
+			for (int i=0; i<p->iVertCount; i++)
+			{
+				int X = (p->verts[i].x - xoffs) * AA;
+				int Y = (p->verts[i].y - yoffs) * AA;
+
+				fl_vertex((double)X + ctr, (double)Y + ctr);
+			}
+
+			if (p->next && !p->next->bHole)
+				break;
+		}
+		fl_end_complex_polygon();
+
+		if (p)
+			p = p->next;
+	}
+
+	fl_pop_clip();
+
+	Fl_RGB_Image *alphamask = surf->image();
+
+	delete surf;
+	Fl_Display_Device::display_device()->set_current();
+
+	// downscale alphamask to original size
+
+	const BYTE *srcdata = (const BYTE *) alphamask->data()[0];
+	const int Dsrc = alphamask->d();
+	const int iPitchSrc = w * AA * Dsrc + alphamask->ld();
+
+	DownsampleMask(srcdata, iPitchSrc, Dsrc, w, h, AA, data);
+
+	delete alphamask;
+}
+
+// accumulate the signed area coverage of a line segment into a per-row cell buffer (each row has 'pitch' cells, of
+// which the first w+2 are valid), 'fSign' is +1 or -1 and determines the winding contribution of the segment
+static void RasterizeCoverageLine(float *acc, int pitch, int w, int h, float x0, float y0, float x1, float y1, float fSign)
+{
+	if (y0 == y1)
+		return;
+
+	float dir = fSign;
+	if (y0 > y1)
+	{
+		float t;
+		t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+		dir = -dir;
+	}
+
+	if (y1 <= 0.0f || y0 >= (float)h)
+		return;
+
+	const float dxdy = (x1 - x0) / (y1 - y0);
+
+	float x = x0;
+	if (y0 < 0.0f)
+	{
+		x -= y0 * dxdy;
+		y0 = 0.0f;
+	}
+
+	const int ystart = (int)y0;
+	const int yend = min(h, (int)ceilf(y1));
+
+	for (int y=ystart; y<yend; y++)
+	{
+		float *row = acc + y * pitch;
+
+		const float dy = min((float)(y + 1), y1) - max((float)y, y0);
+		const float xnext = x + dxdy * dy;
+		const float d = dy * dir;
+
+		// clamp to the cell range, coverage left of the buffer ends up in the first cell and anything right of it is
+		// never accumulated into visible pixels
+		float xa = x < xnext ? x : xnext;
+		float xb = x < xnext ? xnext : x;
+		xa = min(max(xa, 0.0f), (float)w);
+		xb = min(max(xb, 0.0f), (float)w);
+
+		const float x0floor = floorf(xa);
+		const int x0i = (int)x0floor;
+		const float x1ceil = ceilf(xb);
+		const int x1i = (int)x1ceil;
+
+		if (x1i <= x0i + 1)
+		{
+			// segment within a single cell
+			const float xmf = 0.5f * (xa + xb) - x0floor;
+			row[x0i] += d - d * xmf;
+			row[x0i + 1] += d * xmf;
+		}
+		else
+		{
+			// segment spans multiple cells, distribute the trapezoid areas
+			const float s = 1.0f / (xb - xa);
+			const float x0f = xa - x0floor;
+			const float a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+			const float x1f = xb - x1ceil + 1.0f;
+			const float am = 0.5f * s * x1f * x1f;
+
+			row[x0i] += d * a0;
+
+			if (x1i == x0i + 2)
+				row[x0i + 1] += d * (1.0f - a0 - am);
+			else
+			{
+				const float a1 = s * (1.5f - x0f);
+				row[x0i + 1] += d * (a1 - a0);
+				for (int xi=x0i+2; xi<x1i-1; xi++)
+					row[xi] += d * s;
+				const float a2 = a1 + (float)(x1i - x0i - 3) * s;
+				row[x1i - 1] += d * (1.0f - a2 - am);
+			}
+
+			row[x1i] += d * am;
+		}
+
+		x = xnext;
+	}
+}
+
+// render the alpha mask of a location by computing the exact area coverage of each pixel with a scanline polygon
+// rasterizer, at native resolution regardless of the AA level and without any FLTK drawing (so it's safe to call from
+// worker threads). the output differs slightly from GenerateLocationMaskFLTK: edge pixels get their exact coverage
+// instead of one quantized to AA*AA samples, and where the edges of several shapes cross the same pixel their
+// coverages are summed (and saturated) instead of sampled. the lobes of a self-intersecting shape are filled
+// regardless of their winding direction, like the even-odd fill of the FLTK rasterizer
+static void GenerateLocationMaskAnalytic(const sLocation &loc, int xoffs, int yoffs, int w, int h, BYTE *data)
+{
+	// one extra cell per row since segments can touch the right edge, rows are accumulated separately
+	const int pitch = w + 2;
+	float *acc = new float[pitch * h];
+	memset(acc, 0, sizeof(float) * pitch * h);
+
+	for (const sShape *p=loc.shape; p; p=p->next)
+	{
+		if (p->iVertCount < 3)
+			continue;
+
+		// solid shapes add a winding of +1 and holes subtract one (regardless of the vertex order the shape was
+		// drawn in), so the coverage of a hole cancels out the coverage of its solid shape and overlapping solid
+		// shapes are unioned
+		int iArea2 = 0;
+		for (int i=0, j=p->iVertCount-1; i<p->iVertCount; j=i++)
+			iArea2 += (int)p->verts[j].x * (int)p->verts[i].y - (int)p->verts[i].x * (int)p->verts[j].y;
+
+		float fSign = iArea2 > 0 ? -1.0f : 1.0f;
+		if (p->bHole && p != loc.shape)
+			fSign = -fSign;
+
+		// vertices are at the pixel centers (same as GenerateLocationMaskFLTK)
+		for (int i=0, j=p->iVertCount-1; i<p->iVertCount; j=i++)
+		{
+			RasterizeCoverageLine(acc, pitch, w, h,
+				(float)(p->verts[j].x - xoffs) + 0.5f, (float)(p->verts[j].y - yoffs) + 0.5f,
+				(float)(p->verts[i].x - xoffs) + 0.5f, (float)(p->verts[i].y - yoffs) + 0.5f,
+				fSign);
+		}
+	}
+
+	for (int y=0; y<h; y++)
+	{
+		const float *row = acc + y * pitch;
+		BYTE *dst = data + y * w * 4 + 3;
+
+		float a = 0.0f;
+		for (int x=0; x<w; x++, dst+=4)
+		{
+			a += row[x];
+
+			// non-zero winding, oppositely wound lobes of a self-intersecting shape accumulate a negative coverage
+			const float c = min(fabsf(a), 1.0f);
+			*dst = (BYTE)(int)(c * 255.0f + 0.5f);
+		}
+	}
+
+	delete[] acc;
+}
+
+// edge of a shape in the sample space of GenerateLocationMaskAdaptive (y0 <= y1)
+struct sMaskEdge
+{
+	int x0, y0, x1, y1;
+	int iDir;			// +1 if the edge goes down in the shape's vertex order, -1 if it goes up
+	int iShape;
+};
+
+// intersection of an edge with a row of samples
+struct sMaskCrossing
+{
+	double x;
+	int iDir;
+	int iShape;
+};
+
+// same as sLocation::IsPosInLocation, except that the first shape is always treated as solid (like the rasterizers do)
+static BOOL IsPosInLocationMask(const sLocation &loc, int x, int y)
+{
+	for (const sShape *p=loc.shape; p; )
+	{
+		BOOL bInside = p->IsPosInShape(x, y);
+
+		for (p=p->next; p && p->bHole; p=p->next)
+			if (bInside && p->IsPosInShape(x, y))
+				bInside = FALSE;
+
+		if (bInside)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+// render the alpha mask of a location by classifying MASK_BLOCK_SIZE pixel blocks against the shape edges, blocks that
+// no edge passes through are entirely inside or outside and are filled directly, only the remaining blocks are
+// supersampled with AA*AA samples per pixel (same sample positions as GenerateLocationMaskFLTK and the same
+// non-zero winding rule and hole handling as sShape::IsPosInShape), safe to call from worker threads
+static void GenerateLocationMaskAdaptive(const sLocation &loc, int xoffs, int yoffs, int w, int h, BYTE *data, const int AA = 4)
+{
+	// in sample space each pixel is 2*AA units wide, the samples are at the odd coordinates and the vertices are at the
+	// pixel centers, so everything stays integer except for the edge crossings
+
+	int iShapeCount = 0;
+	int iEdgeCount = 0;
+	const sShape *p;
+
+	for (p=loc.shape; p; p=p->next)
+	{
+		iShapeCount++;
+		if (p->iVertCount >= 3)
+			iEdgeCount += p->iVertCount;
+	}
+
+	sMaskEdge *edges = new sMaskEdge[iEdgeCount + 1];
+	sMaskCrossing *crossings = new sMaskCrossing[iEdgeCount + 1];
+	// solid shape index of each shape (holes belong to the preceding solid shape) and winding number of each shape
+	int *iGroup = new int[iShapeCount + 1];
+	int *iWind = new int[iShapeCount + 1];
+	// number of holes of each solid shape that currently contain the sample position
+	int *iHolesInside = new int[iShapeCount + 1];
+
+	int n = 0;
+	int s = 0;
+	for (p=loc.shape; p; p=p->next, s++)
+	{
+		iGroup[s] = (p->bHole && p != loc.shape) ? iGroup[s - 1] : s;
+
+		if (p->iVertCount < 3)
+			continue;
+
+		for (int i=0, j=p->iVertCount-1; i<p->iVertCount; j=i++)
+		{
+			sMaskEdge &e = edges[n++];
+
+			const int x0 = (2 * (p->verts[j].x - xoffs) + 1) * AA;
+			const int y0 = (2 * (p->verts[j].y - yoffs) + 1) * AA;
+			const int x1 = (2 * (p->verts[i].x - xoffs) + 1) * AA;
+			const int y1 = (2 * (p->verts[i].y - yoffs) + 1) * AA;
+
+			if (y0 <= y1)
+			{
+				e.x0 = x0; e.y0 = y0; e.x1 = x1; e.y1 = y1;
+				e.iDir = 1;
+			}
+			else
+			{
+				e.x0 = x1; e.y0 = y1; e.x1 = x0; e.y1 = y0;
+				e.iDir = -1;
+			}
+			e.iShape = s;
+		}
+	}
+
+	// mark the blocks that an edge passes through
+
+	const int B = MASK_BLOCK_SIZE;
+	const int BS = B * 2 * AA;
+	const int bw = (w + B - 1) / B;
+	const int bh = (h + B - 1) / B;
+
+	BYTE *bEdgeBlock = new BYTE[bw * bh];
+	memset(bEdgeBlock, 0, bw * bh);
+
+	for (int i=0; i<n; i++)
+	{
+		const sMaskEdge &e = edges[i];
+
+		const int ex0 = min(e.x0, e.x1);
+		const int ex1 = max(e.x0, e.x1);
+
+		if (ex1 < 0 || ex0 > w * 2 * AA || e.y1 < 0 || e.y0 > h * 2 * AA)
+			continue;
+
+		const int bx0 = max(ex0, 0) / BS;
+		const int bx1 = min(ex1 / BS, bw - 1);
+		const int by0 = max(e.y0, 0) / BS;
+		const int by1 = min(e.y1 / BS, bh - 1);
+
+		const double dx = (double)(e.x1 - e.x0);
+		const double dy = (double)(e.y1 - e.y0);
+
+		for (int by=by0; by<=by1; by++)
+		{
+			for (int bx=bx0; bx<=bx1; bx++)
+			{
+				if ( bEdgeBlock[by * bw + bx] )
+					continue;
+
+				// the edge's line passes through the block if its corners aren't all on the same side of it
+				int iSides = 0;
+				for (int c=0; c<4; c++)
+				{
+					const double cx = (double)((bx + (c & 1)) * BS - e.x0);
+					const double cy = (double)((by + (c >> 1)) * BS - e.y0);
+					const double d = dx * cy - dy * cx;
+					iSides |= d > 0.0 ? 1 : (d < 0.0 ? 2 : 3);
+				}
+
+				if (iSides == 3)
+					bEdgeBlock[by * bw + bx] = 1;
+			}
+		}
+	}
+
+	int *iCounts = new int[w];
+
+	for (int by=0; by<bh; by++)
+	{
+		const int y0 = by * B;
+		const int y1 = min(y0 + B, h);
+
+		// blocks without edges have the same coverage everywhere, classify them by a pixel center (which is on the map
+		// pixel grid)
+
+		BOOL bAnyEdges = FALSE;
+
+		for (int bx=0; bx<bw; bx++)
+		{
+			if ( bEdgeBlock[by * bw + bx] )
+			{
+				bAnyEdges = TRUE;
+				continue;
+			}
+
+			const int x0 = bx * B;
+			const int x1 = min(x0 + B, w);
+
+			const BYTE a = IsPosInLocationMask(loc, x0 + xoffs, y0 + yoffs) ? 255 : 0;
+
+			for (int y=y0; y<y1; y++)
+			{
+				BYTE *dst = data + (y * w + x0) * 4 + 3;
+				for (int x=x0; x<x1; x++, dst+=4)
+					*dst = a;
+			}
+		}
+
+		if (!bAnyEdges)
+			continue;
+
+		// supersample the edge blocks one row of samples at a time
+
+		for (int y=y0; y<y1; y++)
+		{
+			memset(iCounts, 0, sizeof(int) * w);
+
+			for (int sy=0; sy<AA; sy++)
+			{
+				const int Y = 2 * (y * AA + sy) + 1;
+
+				// sorted crossings of the edges with the sample row (edges are half-open at the bottom so shared
+				// vertices are only counted once)
+				int iCrossings = 0;
+				for (int i=0; i<n; i++)
+				{
+					const sMaskEdge &e = edges[i];
+					if (Y < e.y0 || Y >= e.y1)
+						continue;
+
+					sMaskCrossing c;
+					c.x = (double)e.x0 + (double)(Y - e.y0) * (double)(e.x1 - e.x0) / (double)(e.y1 - e.y0);
+					c.iDir = e.iDir;
+					c.iShape = e.iShape;
+
+					int k = iCrossings++;
+					for (; k > 0 && crossings[k - 1].x > c.x; k--)
+						crossings[k] = crossings[k - 1];
+					crossings[k] = c;
+				}
+
+				memset(iWind, 0, sizeof(int) * iShapeCount);
+				memset(iHolesInside, 0, sizeof(int) * iShapeCount);
+				int iInside = 0;
+				int ci = 0;
+
+				for (int bx=0; bx<bw; bx++)
+				{
+					if ( !bEdgeBlock[by * bw + bx] )
+						continue;
+
+					const int x1 = min(bx * B + B, w);
+
+					for (int x=bx*B; x<x1; x++)
+					{
+						for (int sx=0; sx<AA; sx++)
+						{
+							const double X = (double)(2 * (x * AA + sx) + 1);
+
+							// apply the crossings left of the sample, tracking how many solid shapes currently contain
+							// it without any of their holes containing it as well
+							for (; ci < iCrossings && crossings[ci].x < X; ci++)
+							{
+								const int is = crossings[ci].iShape;
+								const int g = iGroup[is];
+								const BOOL bWasInside = iWind[g] && !iHolesInside[g];
+
+								const BOOL bWasInShape = iWind[is] != 0;
+								iWind[is] += crossings[ci].iDir;
+								if (is != g && bWasInShape != (iWind[is] != 0))
+									iHolesInside[g] += bWasInShape ? -1 : 1;
+
+								const BOOL bInside = iWind[g] && !iHolesInside[g];
+								if (bInside != bWasInside)
+									iInside += bInside ? 1 : -1;
+							}
+
+							if (iInside)
+								iCounts[x]++;
+						}
+					}
+				}
+			}
+
+			for (int bx=0; bx<bw; bx++)
+			{
+				if ( !bEdgeBlock[by * bw + bx] )
+					continue;
+
+				const int x1 = min(bx * B + B, w);
+
+				BYTE *dst = data + (y * w + bx * B) * 4 + 3;
+				for (int x=bx*B; x<x1; x++, dst+=4)
+					*dst = (BYTE)(iCounts[x] * 255 / (AA * AA));
+			}
+		}
+	}
+
+	delete[] iCounts;
+	delete[] bEdgeBlock;
+	delete[] iHolesInside;
+	delete[] iWind;
+	delete[] iGroup;
+	delete[] crossings;
+	delete[] edges;
+}
+
+// TRUE if the alpha masks can be rendered by worker threads
+static BOOL IsLocationMaskThreadSafe(int iRasterMode)
+{
+	return iRasterMode != RM_FLTK;
+}
+
+// render the alpha mask of a location into the alpha channel of a w*h RGBA buffer with the given rasterizer (RasterMode)
+static void GenerateLocationMask(const sLocation &loc, int xoffs, int yoffs, int w, int h, BYTE *data, const int AA, const int iRasterMode)
+{
+	if (iRasterMode == RM_ANALYTIC)
+		GenerateLocationMaskAnalytic(loc, xoffs, yoffs, w, h, data);
+	else if (iRasterMode == RM_ADAPTIVE)
+		GenerateLocationMaskAdaptive(loc, xoffs, yoffs, w, h, data, AA);
+	else
+		GenerateLocationMaskFLTK(loc, xoffs, yoffs, w, h, data, AA);
+}
+
+/////////////////////////////////////////////////////////////////////
+// pixel kernels
+//
+// the per-pixel post-processing loops have vectorized variants, the best one supported by the CPU is picked at
+// startup (all variants must produce exactly the same output as the scalar ones, see --selftest)
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define DMG_SIMD_SSE2
+#include <emmintrin.h>
+#if (defined(_MSC_VER) && _MSC_VER >= 1700) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || defined(__clang__)
+// AVX2 intrinsics need VS2012 or GCC 4.9 or later
+#define DMG_SIMD_AVX2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DMG_TARGET_SSE2
+#define DMG_TARGET_AVX2
+#else
+#define DMG_TARGET_SSE2 __attribute__((target("sse2")))
+#define DMG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+struct sPixelKernels
+{
+	const char *sName;
+
+	// blend the RGB components of 'n' pixels of 'D' (3 or 4) bytes with a constant color: c = (c * alpha + add) / 255
+	void (*BlendRGB)(BYTE *p, int n, int D, UINT alpha, const UINT *add);
+
+	// desaturate and darken 'n' RGBA pixels
+	void (*DimRGBA)(BYTE *p, int n);
+
+	// copy the RGB components of 'n' pixels of 'D' (3 or 4) bytes to RGBA pixels, the destination alpha is left untouched
+	void (*CopyRGB)(BYTE *dst, const BYTE *src, int n, int D);
+
+	// swap R and B components of 'n' RGBA pixels
+	void (*SwapRB)(BYTE *dst, const BYTE *src, int n);
+
+	// sum 'n' bytes of 'iRows' rows (max 257) that are 'iPitch' bytes apart
+	void (*SumRows)(WORD *dst, const BYTE *src, int iPitch, int iRows, int n);
+};
+
+static void BlendRGB_Scalar(BYTE *p, int n, int D, UINT alpha, const UINT *add)
+{
+	for (int i=0; i<n; i++, p+=D)
+	{
+		p[0] = (BYTE)(((UINT)p[0] * alpha + add[0]) / 255);
+		p[1] = (BYTE)(((UINT)p[1] * alpha + add[1]) / 255);
+		p[2] = (BYTE)(((UINT)p[2] * alpha + add[2]) / 255);
+	}
+}
+
+static void DimRGBA_Scalar(BYTE *p, int n)
+{
+	for (int i=0; i<n; i++, p+=4)
+	{
+		UINT clr = ((UINT)p[0] * 31 + (UINT)p[1] * 61 + (UINT)p[2] * 8) / 100;
+		clr >>= 1;
+
+		p[0] = (BYTE)clr;
+		p[1] = (BYTE)clr;
+		p[2] = (BYTE)clr;
+	}
+}
+
+static void CopyRGB_Scalar(BYTE *dst, const BYTE *src, int n, int D)
+{
+	for (int i=0; i<n; i++, dst+=4, src+=D)
+	{
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+	}
+}
+
+static void SwapRB_Scalar(BYTE *dst, const BYTE *src, int n)
+{
+	for (int i=0; i<n; i++, dst+=4, src+=4)
+	{
+		const BYTE r = src[0];
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = r;
+		dst[3] = src[3];
+	}
+}
+
+static void SumRows_Scalar(WORD *dst, const BYTE *src, int iPitch, int iRows, int n)
+{
+	for (int i=0; i<n; i++)
+	{
+		UINT iSum = 0;
+		for (int r=0; r<iRows; r++)
+			iSum += src[r * iPitch + i];
+		dst[i] = (WORD)iSum;
+	}
+}
+
+static const sPixelKernels g_pixelKernelsScalar = { "scalar", BlendRGB_Scalar, DimRGBA_Scalar, CopyRGB_Scalar, SwapRB_Scalar, SumRows_Scalar };
+
+#ifdef DMG_SIMD_SSE2
+
+// x / 255 for 16-bit lanes with x <= 255*255
+#define DIV255_EPI16(_x) \
+	_mm_srli_epi16(_mm_add_epi16(_mm_add_epi16((_x), _mm_set1_epi16(1)), _mm_srli_epi16((_x), 8)), 8)
+
+DMG_TARGET_SSE2 static void BlendRGB_SSE2(BYTE *p, int n, int D, UINT alpha, const UINT *add)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const int iBytes = n * D;
+	int i = 0;
+
+	if (D == 4)
+	{
+		// alpha component is multiplied by 255/255
+		const __m128i mul = _mm_setr_epi16((short)alpha, (short)alpha, (short)alpha, 255, (short)alpha, (short)alpha, (short)alpha, 255);
+		const __m128i addv = _mm_setr_epi16((short)add[0], (short)add[1], (short)add[2], 0, (short)add[0], (short)add[1], (short)add[2], 0);
+
+		for (; i+16<=iBytes; i+=16)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul), addv);
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul), addv);
+			lo = DIV255_EPI16(lo);
+			hi = DIV255_EPI16(hi);
+			_mm_storeu_si128((__m128i*)(p + i), _mm_packus_epi16(lo, hi));
+		}
+	}
+	else
+	{
+		// component order repeats every 48 bytes
+		const __m128i mul = _mm_set1_epi16((short)alpha);
+		__m128i addv[6];
+		for (int k=0; k<6; k++)
+		{
+			short a[8];
+			for (int j=0; j<8; j++)
+				a[j] = (short)add[(k * 8 + j) % 3];
+			addv[k] = _mm_loadu_si128((const __m128i*)a);
+		}
+
+		for (; i+48<=iBytes; i+=48)
+		{
+			for (int k=0; k<3; k++)
+			{
+				const __m128i v = _mm_loadu_si128((const __m128i*)(p + i + k * 16));
+				__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul), addv[k * 2]);
+				__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul), addv[k * 2 + 1]);
+				lo = DIV255_EPI16(lo);
+				hi = DIV255_EPI16(hi);
+				_mm_storeu_si128((__m128i*)(p + i + k * 16), _mm_packus_epi16(lo, hi));
+			}
+		}
+	}
+
+	BlendRGB_Scalar(p + i, (iBytes - i) / D, D, alpha, add);
+}
+
+DMG_TARGET_SSE2 static void DimRGBA_SSE2(BYTE *p, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights = _mm_setr_epi16(31, 61, 8, 0, 31, 61, 8, 0);
+	// x / 100 == (x * 5243) >> 19 for x <= 255*100
+	const __m128i div100 = _mm_set1_epi16(5243);
+	const __m128i alphamask = _mm_set1_epi32((int)0xFF000000);
+
+	int i = 0;
+	for (; i+4<=n; i+=4)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*)(p + i * 4));
+
+		// r*31 + g*61 and b*8 per pixel, then sum the pairs
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights);
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights);
+		lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+		hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+		const __m128i x = _mm_castps_si128( _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2,0,2,0)) );
+
+		__m128i c = _mm_srli_epi16(_mm_mulhi_epu16(_mm_packs_epi32(x, x), div100), 3 + 1);
+		c = _mm_unpacklo_epi16(c, zero);
+
+		c = _mm_or_si128(_mm_or_si128(c, _mm_slli_epi32(c, 8)), _mm_slli_epi32(c, 16));
+		_mm_storeu_si128((__m128i*)(p + i * 4), _mm_or_si128(c, _mm_and_si128(v, alphamask)));
+	}
+
+	DimRGBA_Scalar(p + i * 4, n - i);
+}
+
+DMG_TARGET_SSE2 static void CopyRGB_SSE2(BYTE *dst, const BYTE *src, int n, int D)
+{
+	const __m128i alphamask = _mm_set1_epi32((int)0xFF000000);
+	int i = 0;
+
+	if (D == 4)
+	{
+		for (; i+4<=n; i+=4)
+		{
+			const __m128i s = _mm_loadu_si128((const __m128i*)(src + i * 4));
+			const __m128i d = _mm_loadu_si128((const __m128i*)(dst + i * 4));
+			_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_andnot_si128(alphamask, s), _mm_and_si128(d, alphamask)));
+		}
+	}
+	else
+	{
+		// expand 4 pixels at a time by shifting each one into place (loads 16 bytes, so stop 6 pixels before the end)
+		const __m128i m0 = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+		const __m128i m1 = _mm_setr_epi32(0, 0x00FFFFFF, 0, 0);
+		const __m128i m2 = _mm_setr_epi32(0, 0, 0x00FFFFFF, 0);
+		const __m128i m3 = _mm_setr_epi32(0, 0, 0, 0x00FFFFFF);
+
+		for (; i+6<=n; i+=4)
+		{
+			const __m128i s = _mm_loadu_si128((const __m128i*)(src + i * 3));
+			const __m128i d = _mm_loadu_si128((const __m128i*)(dst + i * 4));
+
+			__m128i rgb = _mm_and_si128(s, m0);
+			rgb = _mm_or_si128(rgb, _mm_and_si128(_mm_slli_si128(s, 1), m1));
+			rgb = _mm_or_si128(rgb, _mm_and_si128(_mm_slli_si128(s, 2), m2));
+			rgb = _mm_or_si128(rgb, _mm_and_si128(_mm_slli_si128(s, 3), m3));
+
+			_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(rgb, _mm_and_si128(d, alphamask)));
+		}
+	}
+
+	CopyRGB_Scalar(dst + i * 4, src + i * D, n - i, D);
+}
+
+DMG_TARGET_SSE2 static void SwapRB_SSE2(BYTE *dst, const BYTE *src, int n)
+{
+	const __m128i gamask = _mm_set1_epi32((int)0xFF00FF00);
+	int i = 0;
+
+	for (; i+4<=n; i+=4)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		const __m128i rb = _mm_andnot_si128(gamask, v);
+		const __m128i br = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_and_si128(v, gamask), br));
+	}
+
+	SwapRB_Scalar(dst + i * 4, src + i * 4, n - i);
+}
+
+DMG_TARGET_SSE2 static void SumRows_SSE2(WORD *dst, const BYTE *src, int iPitch, int iRows, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+
+	for (; i+16<=n; i+=16)
+	{
+		__m128i lo = zero;
+		__m128i hi = zero;
+
+		const BYTE *s = src + i;
+		for (int r=0; r<iRows; r++, s+=iPitch)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)s);
+			lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+			hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+		}
+
+		_mm_storeu_si128((__m128i*)(dst + i), lo);
+		_mm_storeu_si128((__m128i*)(dst + i + 8), hi);
+	}
+
+	SumRows_Scalar(dst + i, src + i, iPitch, iRows, n - i);
+}
+
+static const sPixelKernels g_pixelKernelsSSE2 = { "sse2", BlendRGB_SSE2, DimRGBA_SSE2, CopyRGB_SSE2, SwapRB_SSE2, SumRows_SSE2 };
+
+#endif // DMG_SIMD_SSE2
+
+#ifdef DMG_SIMD_AVX2
+
+#define DIV255_EPI16_AVX2(_x) \
+	_mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16((_x), _mm256_set1_epi16(1)), _mm256_srli_epi16((_x), 8)), 8)
+
+// (the AVX2 unpack and pack instructions work within 128-bit lanes, which cancels out since they're always paired)
+
+DMG_TARGET_AVX2 static void BlendRGB_AVX2(BYTE *p, int n, int D, UINT alpha, const UINT *add)
+{
+	if (D != 4)
+	{
+		BlendRGB_SSE2(p, n, D, alpha, add);
+		return;
+	}
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i mul = _mm256_setr_epi16((short)alpha, (short)alpha, (short)alpha, 255, (short)alpha, (short)alpha, (short)alpha, 255,
+		(short)alpha, (short)alpha, (short)alpha, 255, (short)alpha, (short)alpha, (short)alpha, 255);
+	const __m256i addv = _mm256_setr_epi16((short)add[0], (short)add[1], (short)add[2], 0, (short)add[0], (short)add[1], (short)add[2], 0,
+		(short)add[0], (short)add[1], (short)add[2], 0, (short)add[0], (short)add[1], (short)add[2], 0);
+
+	int i = 0;
+	for (; i+8<=n; i+=8)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(p + i * 4));
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), mul), addv);
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), mul), addv);
+		lo = DIV255_EPI16_AVX2(lo);
+		hi = DIV255_EPI16_AVX2(hi);
+		_mm256_storeu_si256((__m256i*)(p + i * 4), _mm256_packus_epi16(lo, hi));
+	}
+
+	BlendRGB_SSE2(p + i * 4, n - i, D, alpha, add);
+}
+
+DMG_TARGET_AVX2 static void DimRGBA_AVX2(BYTE *p, int n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i weights = _mm256_setr_epi16(31, 61, 8, 0, 31, 61, 8, 0, 31, 61, 8, 0, 31, 61, 8, 0);
+	const __m256i div100 = _mm256_set1_epi16(5243);
+	const __m256i alphamask = _mm256_set1_epi32((int)0xFF000000);
+
+	int i = 0;
+	for (; i+8<=n; i+=8)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(p + i * 4));
+
+		__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(v, zero), weights);
+		__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(v, zero), weights);
+		lo = _mm256_add_epi32(lo, _mm256_srli_epi64(lo, 32));
+		hi = _mm256_add_epi32(hi, _mm256_srli_epi64(hi, 32));
+		const __m256i x = _mm256_castps_si256( _mm256_shuffle_ps(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi), _MM_SHUFFLE(2,0,2,0)) );
+
+		__m256i c = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_packs_epi32(x, x), div100), 3 + 1);
+		c = _mm256_unpacklo_epi16(c, zero);
+
+		c = _mm256_or_si256(_mm256_or_si256(c, _mm256_slli_epi32(c, 8)), _mm256_slli_epi32(c, 16));
+		_mm256_storeu_si256((__m256i*)(p + i * 4), _mm256_or_si256(c, _mm256_and_si256(v, alphamask)));
+	}
+
+	DimRGBA_SSE2(p + i * 4, n - i);
+}
+
+DMG_TARGET_AVX2 static void CopyRGB_AVX2(BYTE *dst, const BYTE *src, int n, int D)
+{
+	const __m256i alphamask = _mm256_set1_epi32((int)0xFF000000);
+	int i = 0;
+
+	if (D == 4)
+	{
+		for (; i+8<=n; i+=8)
+		{
+			const __m256i s = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+			const __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i * 4));
+			_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_or_si256(_mm256_andnot_si256(alphamask, s), _mm256_and_si256(d, alphamask)));
+		}
+	}
+	else
+	{
+		// 4 pixels per 128-bit lane, the second lane is loaded from 12 bytes further (loads 28 bytes, so stop 10 pixels
+		// before the end)
+		const __m256i shuf = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+		for (; i+10<=n; i+=8)
+		{
+			const __m128i s0 = _mm_loadu_si128((const __m128i*)(src + i * 3));
+			const __m128i s1 = _mm_loadu_si128((const __m128i*)(src + i * 3 + 12));
+			const __m256i s = _mm256_inserti128_si256(_mm256_castsi128_si256(s0), s1, 1);
+			const __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i * 4));
+			_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(s, shuf), _mm256_and_si256(d, alphamask)));
+		}
+	}
+
+	CopyRGB_SSE2(dst + i * 4, src + i * D, n - i, D);
+}
+
+DMG_TARGET_AVX2 static void SwapRB_AVX2(BYTE *dst, const BYTE *src, int n)
+{
+	const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	int i = 0;
+
+	for (; i+8<=n; i+=8)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+		_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_shuffle_epi8(v, shuf));
+	}
+
+	SwapRB_SSE2(dst + i * 4, src + i * 4, n - i);
+}
+
+DMG_TARGET_AVX2 static void SumRows_AVX2(WORD *dst, const BYTE *src, int iPitch, int iRows, int n)
+{
+	int i = 0;
+
+	for (; i+16<=n; i+=16)
+	{
+		__m256i sum = _mm256_setzero_si256();
+
+		const BYTE *s = src + i;
+		for (int r=0; r<iRows; r++, s+=iPitch)
+			sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16( _mm_loadu_si128((const __m128i*)s) ));
+
+		_mm256_storeu_si256((__m256i*)(dst + i), sum);
+	}
+
+	SumRows_Scalar(dst + i, src + i, iPitch, iRows, n - i);
+}
+
+static const sPixelKernels g_pixelKernelsAVX2 = { "avx2", BlendRGB_AVX2, DimRGBA_AVX2, CopyRGB_AVX2, SwapRB_AVX2, SumRows_AVX2 };
+
+#endif // DMG_SIMD_AVX2
+
+// kernels in use (picked by InitPixelKernels)
+static const sPixelKernels *g_pPixelKernels = &g_pixelKernelsScalar;
+
+#ifdef DMG_SIMD_SSE2
+static BOOL CPUHasSSE2()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+	return TRUE;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif
+
+#ifdef DMG_SIMD_AVX2
+static BOOL CPUHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return FALSE;
+
+	// also requires OS support for saving the YMM registers
+	__cpuid(info, 1);
+	if ( !(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6 )
+		return FALSE;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// get the kernels for a name ("scalar", "sse2" or "avx2"), NULL if not supported by the CPU or build
+static const sPixelKernels* GetPixelKernels(const char *sName)
+{
+	if ( !strcmp(sName, g_pixelKernelsScalar.sName) )
+		return &g_pixelKernelsScalar;
+#ifdef DMG_SIMD_SSE2
+	if (!strcmp(sName, g_pixelKernelsSSE2.sName) && CPUHasSSE2())
+		return &g_pixelKernelsSSE2;
+#endif
+#ifdef DMG_SIMD_AVX2
+	if (!strcmp(sName, g_pixelKernelsAVX2.sName) && CPUHasAVX2())
+		return &g_pixelKernelsAVX2;
+#endif
+	return NULL;
+}
+
+// select the best supported kernels, 'sMax' optionally limits them to a level ("scalar", "sse2" or "avx2")
+static void InitPixelKernels(const char *sMax = NULL)
+{
+	static const char *sNames[] = { "avx2", "sse2", "scalar" };
+
+	int i = 0;
+	if (sMax)
+		while (i < 2 && fl_utf_strcasecmp(sNames[i], sMax))
+			i++;
+
+	for (; i<3; i++)
+	{
+		const sPixelKernels *p = GetPixelKernels(sNames[i]);
+		if (p)
+		{
+			g_pPixelKernels = p;
+			return;
+		}
+	}
+}
+
+// compare all supported kernels against the scalar ones on random data, prints results and returns FALSE on any
+// mismatch
+static BOOL TestPixelKernels()
+{
+	static const char *sNames[] = { "sse2", "avx2" };
+
+	const sPixelKernels &ref = g_pixelKernelsScalar;
+
+	// max pixel count, +3 bytes to test unaligned buffers
+	const int N = 67;
+	const int iBufSize = N * 4 + 3;
+
+	BYTE src[iBufSize], a[iBufSize], b[iBufSize];
+	WORD sa[iBufSize], sb[iBufSize];
+
+	srand(1);
+
+	BOOL bAllOk = TRUE;
+
+	printf("pixel-kernels=%s\n", g_pPixelKernels->sName);
+
+	for (int k=0; k<2; k++)
+	{
+		const sPixelKernels *p = GetPixelKernels(sNames[k]);
+		if (!p)
+		{
+			printf("selftest-%s=unsupported\n", sNames[k]);
+			continue;
+		}
+
+		int iErrors = 0;
+
+		for (int iter=0; iter<64; iter++)
+		{
+			for (int i=0; i<iBufSize; i++)
+				// include extremes
+				src[i] = (iter & 7) == 1 ? 255 : ((iter & 7) == 2 ? 0 : (BYTE)(rand() >> 4));
+
+			const UINT alpha = (iter & 3) == 0 ? 255 : ((iter & 3) == 1 ? 0 : (UINT)(rand() & 255));
+			BYTE bg[3] = { (BYTE)(rand() >> 4), (BYTE)(rand() >> 4), (BYTE)(rand() >> 4) };
+			if (iter & 8)
+				bg[0] = bg[1] = bg[2] = (iter & 16) ? 255 : 0;
+
+			const UINT add[3] = { bg[0] * (255 - alpha), bg[1] * (255 - alpha), bg[2] * (255 - alpha) };
+
+			for (int n=0; n<=N; n++)
+				for (int offs=0; offs<4; offs++)
+				{
+					if (offs + n * 4 > iBufSize)
+						continue;
+
+					for (int D=3; D<=4; D++)
+					{
+						memcpy(a, src, iBufSize);
+						memcpy(b, src, iBufSize);
+						ref.BlendRGB(a + offs, n, D, alpha, add);
+						p->BlendRGB(b + offs, n, D, alpha, add);
+						iErrors += memcmp(a, b, iBufSize) != 0;
+
+						memcpy(a, src, iBufSize);
+						memcpy(b, src, iBufSize);
+						ref.CopyRGB(a, src + offs, n, D);
+						p->CopyRGB(b, src + offs, n, D);
+						iErrors += memcmp(a, b, iBufSize) != 0;
+					}
+
+					memcpy(a, src, iBufSize);
+					memcpy(b, src, iBufSize);
+					ref.DimRGBA(a + offs, n);
+					p->DimRGBA(b + offs, n);
+					iErrors += memcmp(a, b, iBufSize) != 0;
+
+					memset(a, 0, iBufSize);
+					memset(b, 0, iBufSize);
+					ref.SwapRB(a + offs, src, n);
+					p->SwapRB(b + offs, src, n);
+					iErrors += memcmp(a, b, iBufSize) != 0;
+
+					// up to 8 rows of n bytes from the buffer
+					const int iRows = 1 + (n + offs) % 8;
+					const int iPitch = (iBufSize - offs - n) / iRows;
+					if (iPitch >= n)
+					{
+						memset(sa, 0, sizeof(sa));
+						memset(sb, 0, sizeof(sb));
+						ref.SumRows(sa, src + offs, iPitch, iRows, n);
+						p->SumRows(sb, src + offs, iPitch, iRows, n);
+						iErrors += memcmp(sa, sb, sizeof(sa)) != 0;
+					}
+				}
+		}
+
+		printf("selftest-%s=%s\n", sNames[k], iErrors ? "failed" : "ok");
+
+		if (iErrors)
+			bAllOk = FALSE;
+	}
+
+	return bAllOk;
+}
+
+// box filter of the first component of an AA times larger surface into the alpha component of w*h RGBA pixels, the AA
+// rows of each box are summed first (whole rows, vectorized) and then the AA column sums of the needed component
+template <int AA>
+static void DownsampleMaskAA(const BYTE *src, int iPitchSrc, int Dsrc, int w, int h, BYTE *data, WORD *sums)
+{
+	for (int y=0; y<h; y++)
+	{
+		g_pPixelKernels->SumRows(sums, src + y * AA * iPitchSrc, iPitchSrc, AA, w * AA * Dsrc);
+
+		const WORD *s = sums;
+		BYTE *d = data + y * w * 4 + 3;
+
+		for (int x=0; x<w; x++, s+=AA*Dsrc, d+=4)
+		{
+			UINT iSum = 0;
+			for (int xx=0; xx<AA; xx++)
+				iSum += s[xx * Dsrc];
+
+			*d = (BYTE)(iSum / (AA * AA));
+		}
+	}
+}
+
+static void DownsampleMask(const BYTE *src, int iPitchSrc, int Dsrc, int w, int h, int AA, BYTE *data)
+{
+	WORD *sums = new WORD[w * AA * Dsrc];
+
+	switch (AA)
+	{
+	case 1: DownsampleMaskAA<1>(src, iPitchSrc, Dsrc, w, h, data, sums); break;
+	case 2: DownsampleMaskAA<2>(src, iPitchSrc, Dsrc, w, h, data, sums); break;
+	case 3: DownsampleMaskAA<3>(src, iPitchSrc, Dsrc, w, h, data, sums); break;
+	case 4: DownsampleMaskAA<4>(src, iPitchSrc, Dsrc, w, h, data, sums); break;
+	case 5: DownsampleMaskAA<5>(src, iPitchSrc, Dsrc, w, h, data, sums); break;
+	case 6: DownsampleMaskAA<6>(src, iPitchSrc, Dsrc, w, h, data, sums); break;
+	case 7: DownsampleMaskAA<7>(src, iPitchSrc, Dsrc, w, h, data, sums); break;
+	default: DownsampleMaskAA<8>(src, iPitchSrc, Dsrc, w, h, data, sums); break;
+	}
+
+	delete[] sums;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+
+// copy RGB components of the w*h rect at 'xoffs','yoffs' from a map image into a RGBA buffer (alpha is left untouched)
+static void CopyLocationRGB(const Fl_Image *src, int xoffs, int yoffs, int w, int h, BYTE *data)
+{
+	const BYTE *srcdata = (const BYTE*) src->data()[0];
+	const int iPitchSrc = src->w() * src->d() + src->ld();
+
+	const int D = src->d();
+
+	if (D != 3 && D != 4)
+		return;
+
+	for (int y=0; y<h; y++)
+		g_pPixelKernels->CopyRGB(data + y * w * 4, srcdata + (y + yoffs) * iPitchSrc + xoffs * D, w, D);
+}
+
+// copy RGB components of the w*h rect for both SS2 image variants in one pass, the alpha mask that was rendered into
+// 'data' is also copied to 'dataHi'
+static void CopyLocationRGBDual(const Fl_Image *src, const Fl_Image *srcHi, int xoffs, int yoffs, int w, int h, BYTE *data, BYTE *dataHi)
+{
+	const BYTE *srcdata = (const BYTE*) src->data()[0];
+	const int iPitchSrc = src->w() * src->d() + src->ld();
+	const int iStepSrc = src->d();
+
+	const BYTE *srcdataHi = (const BYTE*) srcHi->data()[0];
+	const int iPitchSrcHi = srcHi->w() * srcHi->d() + srcHi->ld();
+	const int iStepSrcHi = srcHi->d();
+
+	for (int y=0; y<h; y++)
+	{
+		const BYTE *s = srcdata + (y + yoffs) * iPitchSrc + xoffs * iStepSrc;
+		const BYTE *sHi = srcdataHi + (y + yoffs) * iPitchSrcHi + xoffs * iStepSrcHi;
+		BYTE *d = data + y * w * 4;
+		BYTE *dHi = dataHi + y * w * 4;
+
+		g_pPixelKernels->CopyRGB(d, s, w, iStepSrc);
+
+		// row is still in cache, take the alpha mask from it
+		memcpy(dHi, d, w * 4);
+		g_pPixelKernels->CopyRGB(dHi, sHi, w, iStepSrcHi);
+	}
+}
+
+static Fl_RGB_Image* GenerateLocationImage(const sMap &map, const sLocation &loc, int *pOutPos, const int iExtraBorder = 0, const int AA = 4)
+{
+	int brect[4];
+	if ( !GetLocationImageRect(map.iImgSize, loc, brect, iExtraBorder) )
+		return NULL;
+
+	const int w = brect[2] - brect[0] + 1;
+	const int h = brect[3] - brect[1] + 1;
+
+	// xy offset for shape upper left corner
+	const int xoffs = brect[0];
+	const int yoffs = brect[1];
+
+	if (pOutPos)
+	{
+		pOutPos[0] = xoffs;
+		pOutPos[1] = yoffs;
+	}
+
+	BYTE *data = new BYTE[w * h * 4];
+
+	GenerateLocationMask(loc, xoffs, yoffs, w, h, data, AA, g_iRasterMode);
+
+	// copy RGB components for brect from unscaled original map image
+	CopyLocationRGB(map.img, xoffs, yoffs, w, h, data);
+
+	// create image object
+
+	Fl_RGB_Image *img = new Fl_RGB_Image(data, w, h, 4);
+
+	return img;
+}
+
+// get the (cached) image of a location for the current zoom level and its position in the image view
+static Fl_Image* GetLocationImageForView(const sMap &map, const sLocation &loc, int *pViewPos, BOOL bDim, const int AA)
+{
+	const int iVariant = (AA << 1) | (bDim ? 1 : 0);
+
+	Fl_Image *cached = g_viewCache.Find(&loc, g_iZoom, iVariant, 0, pViewPos);
+	if (cached)
+		return cached;
+
+	Fl_RGB_Image *img = GenerateLocationImage(map, loc, pViewPos, 0, AA);
+	if (!img)
+		return NULL;
+
+	img->alloc_array = 1;
+
+	if (bDim)
+	{
+		// desaturate and darken the image
+
+		BYTE *data = (BYTE*) img->data()[0];
+		const int iPitch = img->w() * 4 + img->ld();
+
+		for (int y=0; y<img->h(); y++)
+			g_pPixelKernels->DimRGBA(data + y * iPitch, img->w());
+	}
+
+	// scale to view size if necessary
+	Fl_Image *viewimg = img;
+	if (g_iZoom != 1)
+	{
+		viewimg = img->copy(img->w() * g_iZoom, img->h() * g_iZoom);
+		delete img;
+	}
+
+	pViewPos[0] *= g_iZoom;
+	pViewPos[1] *= g_iZoom;
+
+	g_viewCache.Add(&loc, g_iZoom, iVariant, 0, viewimg, pViewPos);
+
+	return viewimg;
+}
+
+
+static void FakeTransparentImage(Fl_Image *img, Fl_Color bg, const UINT alpha)
+{
+	if (!img || (img->d() != 4 && img->d() != 3))
+		return;
+
+	const UINT alpha_inv = 255 - alpha;
+
+	BYTE rgb[3];
+	Fl::get_color(bg, rgb[0], rgb[1], rgb[2]);
+
+	const UINT add[3] = { (UINT)rgb[0] * alpha_inv, (UINT)rgb[1] * alpha_inv, (UINT)rgb[2] * alpha_inv };
+
+	BYTE *data = (BYTE*) img->data()[0];
+	const int D = img->d();
+	const int iPitch = img->w() * D + img->ld();
+
+	for (int y=0; y<img->h(); y++)
+		g_pPixelKernels->BlendRGB(data + y * iPitch, img->w(), D, alpha, add);
+}
+
+// settings of a GenerateFiles run, copied from the globals when the run is started so they don't change while it's in
+// progress
+struct sGenerateSettings
+{
+	BOOL bSaveTGA;
+	BOOL bForce;
+	int iGenerateMap;		// only generate files for this page (-1 = all pages)
+	int iGenerateLocIdx;	// only generate the image of this location on iGenerateMap (-1 = all locations)
+
+	BOOL bShockMaps;
+	int iExtraBorder;
+	int AA;
+	int iRasterMode;
+	int iPngPreset;
+	int iPngLevel;
+	BOOL bTgaRLE;
+	int iThreads;
+	int iMaxPageMem;
+};
+
+static void GetGenerateSettings(sGenerateSettings &settings, BOOL bSaveTGA, BOOL bForce, int iGenerateMap, int iGenerateLocIdx)
+{
+	settings.bSaveTGA = bSaveTGA;
+	settings.bForce = bForce;
+	settings.iGenerateMap = iGenerateMap;
+	settings.iGenerateLocIdx = iGenerateLocIdx;
+
+	settings.bShockMaps = g_bShockMaps;
+	settings.iExtraBorder = g_iLocationImageExtraBorder;
+	settings.AA = g_iAlphaExportAA;
+	settings.iRasterMode = g_iRasterMode;
+	settings.iPngPreset = g_iPngPreset;
+	settings.iPngLevel = g_iPngLevel;
+	settings.bTgaRLE = g_bSaveTgaRLE;
+	settings.iThreads = g_iGenerateThreads > 0 ? g_iGenerateThreads : GetHardwareThreadCount();
+	settings.iMaxPageMem = g_iMaxPageMem;
+}
+
+// apply the encoder settings of a PNG preset
+static void SetPNGCompression(png_structp pPng, const sGenerateSettings &settings)
+{
+	switch (settings.iPngPreset)
+	{
+	case PNG_PRESET_FAST:
+		png_set_compression_level(pPng, 1);
+		png_set_filter(pPng, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+		break;
+	case PNG_PRESET_SMALLEST:
+		png_set_compression_level(pPng, 9);
+		png_set_compression_mem_level(pPng, 9);
+		png_set_filter(pPng, PNG_FILTER_TYPE_BASE, PNG_ALL_FILTERS);
+		break;
+	}
+
+	if (settings.iPngLevel >= 0)
+		png_set_compression_level(pPng, settings.iPngLevel);
+}
+
+static BOOL SavePNG32(Fl_RGB_Image *img, char *sFileName, const sGenerateSettings &settings, long *pFileSize = NULL)
+{
+	if ( !strchr(sFileName, '.') )
+		strcat(sFileName, ".png");
+
+	if (!img || img->d() != 4)
+		return FALSE;
+
+	FILE *f = fopen_utf8_mt(sFileName, "wb");
+	if (!f)
+		return FALSE;
+
+	png_structp pPng = png_create_write_struct_2(PNG_LIBPNG_VER_STRING,
+		NULL, NULL, NULL,
+		NULL, malloc_png, free_png);
+	if (!pPng)
+	{
+		fclose(f);
+		return FALSE;
+	}
+
+	png_infop pPngInfo = png_create_info_struct(pPng);
+	if (!pPngInfo)
+	{
+		png_destroy_write_struct(&pPng, NULL);
+		fclose(f);
+		return FALSE;
+	}
+
+	if ( setjmp( png_jmpbuf(pPng) ) )
+	{
+		// exception thrown during read
+		png_destroy_write_struct(&pPng, &pPngInfo);
+		fclose(f);
+		return FALSE;
+	}
+
+	png_set_write_fn(pPng, (void*)f, fwrite_png, fflush_png);
+
+	SetPNGCompression(pPng, settings);
+
+	png_set_IHDR(pPng, pPngInfo, img->w(), img->h(), 8,
+		PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+		PNG_FILTER_TYPE_BASE);
+
+	png_bytep *pImgLines = new png_bytep[img->h()];
+
+	const BYTE *srcdata = (const BYTE*) img->data()[0];
+	const int iPitchSrc = img->w() * 4 + img->ld();
+	for (int y=0; y<img->h(); y++)
+		pImgLines[y] = (png_bytep)(srcdata + y * iPitchSrc);
+
+	png_write_info(pPng, pPngInfo);
+	png_write_image(pPng, pImgLines);
+	png_write_end(pPng, pPngInfo);
+	png_destroy_write_struct(&pPng, NULL);
+
+	if (pFileSize)
+		*pFileSize = ftell(f);
+
+	fclose(f);
+
+	delete[] pImgLines;
+
+	return TRUE;
+}
+
+static BOOL SaveTGA32(Fl_RGB_Image *img, char *sFileName, BOOL bRLE, long *pFileSize = NULL)
+{
+	if ( !strchr(sFileName, '.') )
+		strcat(sFileName, ".tga");
+
+	if (!img || img->d() != 4)
+		return FALSE;
+
+	FILE *f = fopen_utf8_mt(sFileName, "wb");
+	if (!f)
+		return FALSE;
+
+	#pragma pack(1)
+	struct sTgaHeader
+	{
+		BYTE id_len;
+		BYTE col_map_type;
+		BYTE img_type;
+		WORD col_map_orig;
+		WORD col_map_len;
+		BYTE col_mat_bpp;
+		WORD x_orig;
+		WORD y_orig;
+		WORD width;
+		WORD height;
+		BYTE bpp;
+		BYTE img_descr;
+	};
+	#pragma pack()
+
+	sTgaHeader hdr = {};
+
+	hdr.img_type = bRLE ? 10 : 2;
+	hdr.bpp = 32;
+	hdr.width = img->w();
+	hdr.height = img->h();
+	hdr.img_descr |= 0x20;
+
+	const int w = img->w();
+	const int h = img->h();
+
+	const BYTE *srcdata = (const BYTE*) img->data()[0];
+	const int iPitchSrc = w * 4 + img->ld();
+
+	// the whole image is encoded into a buffer and then written at once (worst case for RLE is one raw packet
+	// header per 128 pixels)
+	BYTE *buf = new BYTE[sizeof(hdr) + h * (w * 4 + (w + 127) / 128)];
+	BYTE *dst = buf;
+
+	memcpy(dst, &hdr, sizeof(hdr));
+	dst += sizeof(hdr);
+
+	BYTE *line = new BYTE[w * 4];
+
+	for (int y=0; y<h; y++)
+	{
+		// swizzle RGBA to BGRA
+		g_pPixelKernels->SwapRB(line, srcdata + y * iPitchSrc, w);
+
+		if (!bRLE)
+		{
+			memcpy(dst, line, w * 4);
+			dst += w * 4;
+			continue;
+		}
+
+		// fully transparent pixels are stored as black so they form runs
+		UINT *pixels = (UINT*)line;
+		for (int x=0; x<w; x++)
+			if (!line[x*4+3])
+				pixels[x] = 0;
+
+		// RLE packets (not crossing scanlines), runs of 2 or more identical pixels become run-length packets and
+		// anything in between raw packets
+		int x = 0;
+		while (x < w)
+		{
+			int n = 1;
+			while (x + n < w && n < 128 && pixels[x + n] == pixels[x])
+				n++;
+
+			if (n >= 2)
+			{
+				*dst++ = (BYTE)(0x80 | (n - 1));
+				memcpy(dst, &pixels[x], 4);
+				dst += 4;
+			}
+			else
+			{
+				while (x + n < w && n < 128 && (x + n + 1 >= w || pixels[x + n] != pixels[x + n + 1]))
+					n++;
+
+				*dst++ = (BYTE)(n - 1);
+				memcpy(dst, &pixels[x], n * 4);
+				dst += n * 4;
+			}
+
+			x += n;
+		}
+	}
+
+	delete[] line;
+
+	const int iSize = (int)(dst - buf);
+	const BOOL ret = (int)fwrite(buf, 1, iSize, f) == iSize;
+
+	delete[] buf;
+
+	if (pFileSize)
+		*pFileSize = iSize;
+
+	fclose(f);
+
+	return ret;
+}
+
+// save PNG or TGA 32-bit image
+static BOOL SaveImg32(Fl_RGB_Image *img, char *sFileName, const sGenerateSettings &settings, long *pFileSize = NULL)
+{
+	return settings.bSaveTGA ? SaveTGA32(img, sFileName, settings.bTgaRLE, pFileSize) : SavePNG32(img, sFileName, settings, pFileSize);
+}
+
+// hash the pixels of an image within a rect (inclusive)
+static UINT64 HashImageRect(UINT64 h, const Fl_Image *img, const int rect[4])
+{
+	if (!img)
+		return HashInt(h, 0);
+
+	const BYTE *srcdata = (const BYTE*) img->data()[0];
+	const int iPitchSrc = img->w() * img->d() + img->ld();
+	const int iRowSize = (rect[2] - rect[0] + 1) * img->d();
+
+	h = HashInt(h, img->d());
+
+	for (int y=rect[1]; y<=rect[3]; y++)
+		h = HashBytes(h, srcdata + y * iPitchSrc + rect[0] * img->d(), iRowSize);
+
+	return h;
+}
+
+// hash all inputs that affect the generated image(s) of a location, if the hash is the same as the one stored in the
+// manifest of the last run then the files don't need to be regenerated
+static UINT64 HashLocationInputs(const Fl_Image *img, const Fl_Image *imgHilightSS2, const sLocation &loc, const int brect[4],
+	const sGenerateSettings &settings)
+{
+	UINT64 h = FNV64_OFFSET_BASIS;
+
+	h = HashInt(h, settings.bShockMaps);
+	h = HashInt(h, settings.bSaveTGA);
+	h = HashInt(h, settings.iExtraBorder);
+	// the analytic rasterizer doesn't supersample
+	if (settings.iRasterMode != RM_ANALYTIC)
+		h = HashInt(h, settings.AA);
+	h = HashInt(h, settings.iRasterMode);
+	if (settings.bSaveTGA)
+		h = HashInt(h, settings.bTgaRLE);
+	else
+	{
+		h = HashInt(h, settings.iPngPreset);
+		h = HashInt(h, settings.iPngLevel);
+	}
+
+	h = HashBytes(h, brect, sizeof(int) * 4);
+
+	for (const sShape *p=loc.shape; p; p=p->next)
+	{
+		h = HashInt(h, p->bHole);
+		h = HashInt(h, p->iVertCount);
+		h = HashBytes(h, p->verts, sizeof(sVertex) * p->iVertCount);
+	}
+
+	h = HashImageRect(h, img, brect);
+	if (settings.bShockMaps)
+		h = HashImageRect(h, imgHilightSS2, brect);
+
+	return h;
+}
+
+// per-location input hashes of the last generated files (stored next to the project file)
+struct sGenerateManifest
+{
+	sGenerateManifest()
+	{
+		memset(bValid, 0, sizeof(bValid));
+	}
+
+	BOOL Load(const char *sDir)
+	{
+		char s[MAX_PATH+32];
+		sprintf(s, "%s" DIRSEP_STR MANIFEST_FILENAME, sDir);
+
+		FILE *f = fopen_utf8_mt(s, "r");
+		if (!f)
+			return FALSE;
+
+		char sLine[128];
+		while ( fgets(sLine, sizeof(sLine), f) )
+		{
+			int iMap, iLocIdx;
+			UINT hi, lo;
+			if (sscanf(sLine, "LOC %d %d %8x%8x", &iMap, &iLocIdx, &hi, &lo) != 4)
+				continue;
+
+			if (iMap < 0 || iMap >= MAX_MAPS || iLocIdx < 0 || iLocIdx >= MAX_LOCATIONS_PER_MAP)
+				continue;
+
+			hash[iMap][iLocIdx] = ((UINT64)hi << 32) | lo;
+			bValid[iMap][iLocIdx] = TRUE;
+		}
+
+		fclose(f);
+
+		return TRUE;
+	}
+
+	BOOL Save(const char *sDir) const
+	{
+		char s[MAX_PATH+32];
+		sprintf(s, "%s" DIRSEP_STR MANIFEST_FILENAME, sDir);
+
+		FILE *f = fopen_utf8_mt(s, "w");
+		if (!f)
+			return FALSE;
+
+		fprintf(f, "// generated by " DARKMAPGEN_TITLE ", delete this file to force all map files to be regenerated\n");
+
+		for (int i=0; i<MAX_MAPS; i++)
+			for (int j=0; j<MAX_LOCATIONS_PER_MAP; j++)
+				if (bValid[i][j])
+					fprintf(f, "LOC %d %d %08X%08X\n", i, j, (UINT)(hash[i][j] >> 32), (UINT)hash[i][j]);
+
+		const BOOL ret = !ferror(f);
+		fclose(f);
+
+		return ret;
+	}
+
+	BOOL IsUnchanged(int iMap, int iLocIdx, UINT64 h) const
+	{
+		return bValid[iMap][iLocIdx] && hash[iMap][iLocIdx] == h;
+	}
+
+	void Set(int iMap, int iLocIdx, UINT64 h)
+	{
+		hash[iMap][iLocIdx] = h;
+		bValid[iMap][iLocIdx] = TRUE;
+	}
+
+	void Invalidate(int iMap, int iLocIdx)
+	{
+		bValid[iMap][iLocIdx] = FALSE;
+	}
+
+	UINT64 hash[MAX_MAPS][MAX_LOCATIONS_PER_MAP];
+	BOOL bValid[MAX_MAPS][MAX_LOCATIONS_PER_MAP];
+};
+
+// (opens the file instead of using fl_stat, which isn't safe to call from worker threads on Windows)
+static BOOL FileExists(const char *sFileName)
+{
+	FILE *f = fopen_utf8_mt(sFileName, "rb");
+	if (!f)
+		return FALSE;
+
+	fclose(f);
+	return TRUE;
+}
+
+// write a file only if its contents differ from the existing file, so unchanged files keep their timestamp
+// ('pBytesWritten' is incremented by the file size if it was written)
+static BOOL WriteFileIfChanged(const char *sFileName, const void *data, int size, UINT64 *pBytesWritten = NULL)
+{
+	FILE *f = fopen_utf8_mt(sFileName, "rb");
+	if (f)
+	{
+		BOOL bSame = FALSE;
+
+		fseek(f, 0, SEEK_END);
+		if (ftell(f) == size)
+		{
+			BYTE *buf = new BYTE[size > 0 ? size : 1];
+
+			fseek(f, 0, SEEK_SET);
+			bSame = (int)fread(buf, 1, size, f) == size && !memcmp(buf, data, size);
+
+			delete[] buf;
+		}
+
+		fclose(f);
+
+		if (bSame)
+			return TRUE;
+	}
+
+	f = fopen_utf8_mt(sFileName, "wb");
+	if (!f)
+		return FALSE;
+
+	const BOOL ret = (int)fwrite(data, 1, size, f) == size;
+	fclose(f);
+
+	if (ret && pBytesWritten)
+		*pBytesWritten += size;
+
+	return ret;
+}
+
+// format a byte count for display
+static void FormatByteSize(char *s, UINT64 iBytes)
+{
+	if (iBytes < 1024)
+		sprintf(s, "%u bytes", (UINT)iBytes);
+	else if (iBytes < 1024*1024)
+		sprintf(s, "%.1f KB", (double)(INT64)iBytes / 1024.0);
+	else
+		sprintf(s, "%.2f MB", (double)(INT64)iBytes / (1024.0*1024.0));
+}
+
+// get the file name (without extension) of a generated location image, 'cType' is 'r' or 'x' (SS2 non-hilighted)
+static void GetLocationImageFileName(char *s, int iMap, int iLocIdx, char cType)
+{
+	sprintf(s, "%s" DIRSEP_STR "p%03d%c%03d", g_pProj->sDir, iMap, cType, iLocIdx);
+}
+
+// check if the generated image file(s) of a location exist
+static BOOL LocationImageFilesExist(int iMap, int iLocIdx, const sGenerateSettings &settings)
+{
+	char s[MAX_PATH+32];
+
+	GetLocationImageFileName(s, iMap, iLocIdx, 'r');
+	strcat(s, settings.bSaveTGA ? ".tga" : ".png");
+	if ( !FileExists(s) )
+		return FALSE;
+
+	if (settings.bShockMaps)
+	{
+		GetLocationImageFileName(s, iMap, iLocIdx, 'x');
+		strcat(s, settings.bSaveTGA ? ".tga" : ".png");
+		if ( !FileExists(s) )
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+// result counters of a GenerateFiles run
+struct sGenerateStats
+{
+	sGenerateStats()
+	{
+		iPages = 0;
+		iImages = 0;
+		iSkipped = 0;
+		iErrors = 0;
+		iBytes = 0;
+	}
+
+	int iPages;
+	int iImages;		// number of generated location images
+	int iSkipped;		// number of unchanged location images that weren't regenerated
+	int iErrors;
+	UINT64 iBytes;		// total size of written files
+};
+
+// an image file of a generated location, saved by a worker thread
+struct sGenerateOutput
+{
+	struct sGenerateJob *pJob;
+	char cType;				// 'r' or 'x' (see GetLocationImageFileName)
+	BYTE *pData;
+
+	long iBytes;
+	BOOL bFailed;
+	char sError[MAX_PATH+64];
+};
+
+// a location image that is generated and saved by a worker thread, if the selected rasterizer isn't thread-safe
+// then the alpha mask is rendered by the main thread before the job is queued, in SS2 mode both variants of the
+// image are composed from the same mask and the hilight variant is saved by a separate task
+struct sGenerateJob
+{
+	struct sGenerateRun *pRun;
+	const struct sGeneratePage *pPage;
+	const sLocation *pLoc;
+	cThreadPool *pPool;
+	int iMap;
+	int iLocIdx;
+	int iPos[2];
+	int iSize[2];
+	UINT64 iHash;
+
+	BYTE *pData;
+	BOOL bMaskRendered;
+	BOOL bCancelled;		// the run was cancelled before the job was started, nothing was saved
+
+	sGenerateOutput out[2];
+	int iOutputCount;
+	int iOutputsLeft;		// outputs that haven't been saved yet (protected by the run's lock)
+};
+
+// a page of a run, page images that were already loaded when the run was started are shared with the project (which
+// keeps them pinned until the run is deleted), the others are decoded by the run itself
+struct sGeneratePage
+{
+	const sMapSnapshot *pMap;	// NULL if the page isn't generated
+	Fl_Image *img;
+	Fl_Image *imgHilightSS2;
+	BOOL bSharedImages;
+	BOOL bLoadFailed;
+	int iLocsTotal;				// locations of the page in the progress total
+};
+
+// a GenerateFiles run, it works on a snapshot of the project and a copy of the settings, so in the editor it can run
+// on a background thread while the project is being edited (progress is passed to the UI with Fl::awake)
+struct sGenerateRun
+{
+	sGenerateRun()
+	{
+		pSnapshot = NULL;
+		memset(pages, 0, sizeof(pages));
+		bBackground = FALSE;
+		iPagesTotal = 0;
+		iPagesDone = 0;
+		iLocsTotal = 0;
+		iLocsDone = 0;
+		iBytesDone = 0;
+		bProgressPosted = FALSE;
+		fStartTime = 0;
+		bCancel = FALSE;
+		sErrors = NULL;
+		iErrorCount = 0;
+	}
+	~sGenerateRun()
+	{
+		for (int i=0; i<iErrorCount; i++)
+			free(sErrors[i]);
+		free(sErrors);
+	}
+
+	sGenerateSettings settings;
+	BOOL bBackground;
+
+	sProjectSnapshot *pSnapshot;
+	sGeneratePage pages[MAX_MAPS];
+
+	sGenerateStats stats;
+
+	// progress counters (protected by 'lock', the totals don't change once the run is started)
+	cMutex lock;
+	int iPagesTotal;
+	int iPagesDone;
+	int iLocsTotal;
+	int iLocsDone;
+	UINT64 iBytesDone;
+	BOOL bProgressPosted;
+	double fStartTime;
+
+	volatile BOOL bCancel;
+
+	// error messages, reported together when the run is finished (also protected by 'lock')
+	char **sErrors;
+	int iErrorCount;
+
+	ThreadHandle thread;
+};
+
+static void OnGenerateProgress(void*);
+static void OnGenerateDone(void*);
+
+static void AddGenerateError(sGenerateRun &run, const char *fmt, ...)
+{
+	char s[MAX_PATH*2+256];
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(s, sizeof(s), fmt, args);
+	va_end(args);
+	s[sizeof(s)-1] = '\0';
+
+	run.lock.Lock();
+	run.sErrors = (char**) realloc(run.sErrors, sizeof(char*) * (run.iErrorCount + 1));
+	run.sErrors[run.iErrorCount++] = strdup(s);
+	run.lock.Unlock();
+}
+
+// let the UI know that the progress of a background run changed (only one update is queued at a time, so the awake
+// queue can't fill up)
+static void PostGenerateProgress(sGenerateRun &run)
+{
+	if (!run.bBackground)
+		return;
+
+	run.lock.Lock();
+	const BOOL bPost = !run.bProgressPosted;
+	run.bProgressPosted = TRUE;
+	run.lock.Unlock();
+
+	if (bPost)
+		Fl::awake(OnGenerateProgress, NULL);
+}
+
+// count a page as done, 'iLocsLeft' locations of the page that won't be generated are counted as done with it
+static void AddGeneratePageDone(sGenerateRun &run, int iLocsLeft, UINT64 iRectBytes)
+{
+	run.lock.Lock();
+	run.iBytesDone += iRectBytes;
+	run.iLocsDone += iLocsLeft;
+	run.iPagesDone++;
+	run.lock.Unlock();
+	PostGenerateProgress(run);
+}
+
+static void SaveOutputTask(void *p)
+{
+	sGenerateOutput &out = *(sGenerateOutput*)p;
+	sGenerateJob &job = *out.pJob;
+	sGenerateRun &run = *job.pRun;
+
+	char s[MAX_PATH+32];
+	GetLocationImageFileName(s, job.iMap, job.iLocIdx, out.cType);
+
+	Fl_RGB_Image *img = new Fl_RGB_Image(out.pData, job.iSize[0], job.iSize[1], 4);
+
+	if ( !SaveImg32(img, s, run.settings, &out.iBytes) )
+	{
+		sprintf(out.sError, "Failed to save location image \"%s\"", s);
+		out.bFailed = TRUE;
+	}
+
+	delete img;
+
+	delete[] out.pData;
+	out.pData = NULL;
+
+	run.lock.Lock();
+	run.iBytesDone += out.iBytes;
+	if (!--job.iOutputsLeft)
+		run.iLocsDone++;
+	run.lock.Unlock();
+
+	PostGenerateProgress(run);
+}
+
+static void GenerateJobTask(void *p)
+{
+	sGenerateJob &job = *(sGenerateJob*)p;
+	const sGenerateRun &run = *job.pRun;
+	const sGeneratePage &page = *job.pPage;
+
+	if (run.bCancel)
+	{
+		delete[] job.pData;
+		job.pData = NULL;
+		job.bCancelled = TRUE;
+		return;
+	}
+
+	const int w = job.iSize[0];
+	const int h = job.iSize[1];
+
+	if (!job.pData)
+		job.pData = new BYTE[w * h * 4];
+
+	if (!job.bMaskRendered)
+		GenerateLocationMask(*job.pLoc, job.iPos[0], job.iPos[1], w, h, job.pData, run.settings.AA, run.settings.iRasterMode);
+
+	for (int i=0; i<job.iOutputCount; i++)
+	{
+		job.out[i].pJob = &job;
+		job.out[i].iBytes = 0;
+		job.out[i].bFailed = FALSE;
+		job.out[i].sError[0] = '\0';
+	}
+
+	if (job.iOutputCount == 2)
+	{
+		// SS2, compose both variants from the mask and unscaled original map images in one pass
+		BYTE *pDataHi = new BYTE[w * h * 4];
+		CopyLocationRGBDual(page.img, page.imgHilightSS2, job.iPos[0], job.iPos[1], w, h, job.pData, pDataHi);
+
+		job.out[0].cType = 'x';
+		job.out[0].pData = job.pData;
+		job.out[1].cType = 'r';
+		job.out[1].pData = pDataHi;
+
+		job.pData = NULL;
+
+		job.pPool->AddTask(SaveOutputTask, &job.out[1]);
+		SaveOutputTask(&job.out[0]);
+	}
+	else
+	{
+		// copy RGB components for brect from unscaled original map image
+		CopyLocationRGB(page.img, job.iPos[0], job.iPos[1], w, h, job.pData);
+
+		job.out[0].cType = 'r';
+		job.out[0].pData = job.pData;
+
+		job.pData = NULL;
+
+		SaveOutputTask(&job.out[0]);
+	}
+}
+
+// create a run with a snapshot of the pages to generate, must be called from the main thread
+static sGenerateRun* CreateGenerateRun(const sGenerateSettings &settings, BOOL bBackground)
+{
+	sGenerateRun *pRun = new sGenerateRun;
+	sGenerateRun &run = *pRun;
+
+	run.settings = settings;
+	run.bBackground = bBackground;
+	run.fStartTime = GetTimeSeconds();
+
+	// FLTK drawing is only possible on the main thread, the adaptive rasterizer supersamples the same way
+	if (bBackground && !IsLocationMaskThreadSafe(run.settings.iRasterMode))
+		run.settings.iRasterMode = RM_ADAPTIVE;
+
+	run.pSnapshot = TakeProjectSnapshot(*g_pProj);
+
+	for (int i=0; i<g_pProj->iMapCount; i++)
+	{
+		sMap &map = g_pProj->maps[i];
+
+		if (!map.IsValid() || !map.iLocationCount || (settings.iGenerateMap >= 0 && settings.iGenerateMap != i))
+			continue;
+
+		sGeneratePage &page = run.pages[i];
+		page.pMap = run.pSnapshot->maps[i];
+
+		if (map.img)
+		{
+			page.img = map.img;
+			page.imgHilightSS2 = map.imgHilightSS2;
+			page.bSharedImages = TRUE;
+			map.iPinCount++;
+		}
+
+		// same locations as visited by RunGenerate
+		for (int j=0; j<map.iLocationCount; j++)
+			if ((settings.iGenerateLocIdx < 0 || settings.iGenerateLocIdx == j) && map.GetByLocationIndex(j))
+				page.iLocsTotal++;
+
+		run.iPagesTotal++;
+		run.iLocsTotal += page.iLocsTotal;
+	}
+
+	return pRun;
+}
+
+// delete a run that is no longer running, must be called from the main thread
+static void DeleteGenerateRun(sGenerateRun *pRun)
+{
+	for (int i=0; i<MAX_MAPS; i++)
+	{
+		sGeneratePage &page = pRun->pages[i];
+		if (!page.pMap)
+			continue;
+
+		if (page.bSharedImages)
+			g_pProj->maps[i].iPinCount--;
+		else
+		{
+			delete page.img;
+			delete page.imgHilightSS2;
+		}
+	}
+
+	ReleaseProjectSnapshot(pRun->pSnapshot);
+
+	delete pRun;
+}
+
+// decode the page images of a run that aren't shared with the project, of all pages at once or only of page
+// 'iOnlyMap' (with a page memory budget), returns FALSE if that page failed to load
+static BOOL DecodeGeneratePages(sGenerateRun &run, cThreadPool *pPool, int iOnlyMap)
+{
+	sPageDecodeJob *pJobs = new sPageDecodeJob[MAX_MAPS * 2];
+	int iJobs = 0;
+
+	const int iImagesPerPage = run.settings.bShockMaps ? 2 : 1;
+
+	for (int i=0; i<MAX_MAPS; i++)
+	{
+		const sGeneratePage &page = run.pages[i];
+		if (!page.pMap || page.img || page.bLoadFailed || (iOnlyMap >= 0 && iOnlyMap != i))
+			continue;
+
+		for (int j=0; j<iImagesPerPage; j++)
+			InitPageDecodeJob(pJobs[iJobs++], i, j == 1);
+	}
+
+	for (int i=0; i<iJobs; i++)
+		pPool->AddTask(PageDecodeTask, &pJobs[i]);
+	pPool->Wait();
+
+	// same as InstallPageImages, but into the pages of the run and without message boxes
+	for (int i=0; i<iJobs; i+=iImagesPerPage)
+	{
+		sGeneratePage &page = run.pages[pJobs[i].iMap];
+
+		BOOL bOk = TRUE;
+		for (int j=i; j<i+iImagesPerPage; j++)
+			if ( !IsPageDecodeJobOk(pJobs[j], page.pMap->iImgSize) )
+			{
+				AddGenerateError(run, "Failed to load image \"%s\"", pJobs[j].sFileName);
+				bOk = FALSE;
+			}
+
+		if (!bOk)
+		{
+			for (int j=i; j<i+iImagesPerPage; j++)
+				FreePageDecodeJob(pJobs[j]);
+
+			page.bLoadFailed = TRUE;
+			continue;
+		}
+
+		page.img = MakePageImage(pJobs[i]);
+		if (run.settings.bShockMaps)
+			page.imgHilightSS2 = MakePageImage(pJobs[i+1]);
+	}
+
+	delete[] pJobs;
+
+	return iOnlyMap < 0 || run.pages[iOnlyMap].img;
+}
+
+// generate the rect files and location images of a run, unless 'bForce' is set locations whose inputs haven't changed
+// since the last run (according to the manifest) are skipped, only works on the snapshot of the run so it can be
+// called from any thread (unless the FLTK rasterizer is used)
+static void RunGenerate(sGenerateRun &run)
+{
+	const sGenerateSettings &settings = run.settings;
+	sGenerateStats &stats = run.stats;
+	char s[MAX_PATH+32];
+
+	sGenerateManifest *pManifest = new sGenerateManifest;
+	pManifest->Load(g_pProj->sDir);
+
+	sGenerateJob *pJobs = new sGenerateJob[run.iLocsTotal > 0 ? run.iLocsTotal : 1];
+	int iJobs = 0;
+
+	// location images are generated, encoded and saved in parallel, unless the rasterizer needs this thread for the
+	// alpha masks, then the number of queued jobs is limited so rendered masks don't pile up if the workers can't
+	// keep up
+	const BOOL bRenderMasks = !IsLocationMaskThreadSafe(settings.iRasterMode);
+	cThreadPool *pPool = new cThreadPool(settings.iThreads);
+	const int iMaxQueued = pPool->GetThreadCount() * 2;
+
+	// without a page memory budget the pages are decoded concurrently up front, otherwise one by one when needed
+	if (settings.iMaxPageMem <= 0)
+		DecodeGeneratePages(run, pPool, -1);
+
+	for (int i=0; i<MAX_MAPS && !run.bCancel; i++)
+	{
+		sGeneratePage &page = run.pages[i];
+		if (!page.pMap)
+			continue;
+
+		const sMapSnapshot &map = *page.pMap;
+
+		stats.iPages++;
+
+		if (!page.img && (settings.iMaxPageMem <= 0 || !DecodeGeneratePages(run, pPool, i)))
+		{
+			stats.iErrors++;
+			AddGeneratePageDone(run, page.iLocsTotal, 0);
+			continue;
+		}
+
+		// locations that were skipped or queued (and are counted as done by the job)
+		int iLocsCounted = 0;
+
+		// dark rects file containing the location positions (in index order), the rects only depend on the location
+		// bounds so they're collected here in order while the images are still being generated
+		short darkRects[MAX_LOCATIONS_PER_MAP][4];
+		int iRectCount = 0;
+
+		for (int j=0; j<map.iLocationCount; j++)
+		{
+			const sLocation *pLoc = map.GetByLocationIndex(j);
+			if (!pLoc)
+			{
+				// no defined location for this index, add dummy entry in rects file
+				memset(darkRects[iRectCount++], 0, sizeof(darkRects[0]));
+
+				if (settings.iGenerateLocIdx < 0)
+					pManifest->Invalidate(i, j);
+
+				continue;
+			}
+
+			const sLocation &loc = *pLoc;
+
+			int brect[4];
+			if ( !GetLocationImageRect(map.iImgSize, loc, brect, settings.iExtraBorder) )
+			{
+				AddGenerateError(run, "Failed to generate location image %03d on PAGE%03d", loc.iLocationIndex, i);
+				stats.iErrors++;
+				break;
+			}
+
+			const int w = brect[2] - brect[0] + 1;
+			const int h = brect[3] - brect[1] + 1;
+
+			// save rect
+			short *darkRect = darkRects[iRectCount++];
+			darkRect[0] = (short)brect[0];
+			darkRect[1] = (short)brect[1];
+			darkRect[2] = (short)(brect[0] + w);
+			darkRect[3] = (short)(brect[1] + h);
+
+			// after a cancel the rects of the page are still completed
+			if ((settings.iGenerateLocIdx >= 0 && settings.iGenerateLocIdx != j) || run.bCancel)
+				continue;
+
+			const UINT64 iHash = HashLocationInputs(page.img, page.imgHilightSS2, loc, brect, settings);
+
+			if (!settings.bForce && pManifest->IsUnchanged(i, loc.iLocationIndex, iHash)
+				&& LocationImageFilesExist(i, loc.iLocationIndex, settings))
+			{
+				stats.iSkipped++;
+				iLocsCounted++;
+
+				run.lock.Lock();
+				run.iLocsDone++;
+				run.lock.Unlock();
+				PostGenerateProgress(run);
+
+				continue;
+			}
+
+			sGenerateJob &job = pJobs[iJobs++];
+			job.pRun = &run;
+			job.pPage = &page;
+			job.pLoc = &loc;
+			job.iMap = i;
+			job.iLocIdx = loc.iLocationIndex;
+			job.iPos[0] = brect[0];
+			job.iPos[1] = brect[1];
+			job.iSize[0] = w;
+			job.iSize[1] = h;
+			job.iHash = iHash;
+			job.pPool = pPool;
+			job.iOutputCount = settings.bShockMaps ? 2 : 1;
+			job.iOutputsLeft = job.iOutputCount;
+
+			job.pData = NULL;
+			job.bMaskRendered = FALSE;
+			job.bCancelled = FALSE;
+
+			if (bRenderMasks)
+			{
+				job.pData = new BYTE[w * h * 4];
+				GenerateLocationMask(loc, brect[0], brect[1], w, h, job.pData, settings.AA, settings.iRasterMode);
+				job.bMaskRendered = TRUE;
+			}
+
+			pPool->AddTask(GenerateJobTask, &job);
+			iLocsCounted++;
+
+			if (job.bMaskRendered)
+				pPool->Wait(iMaxQueued);
+		}
+
+		// only rewrite rect files when they changed
+		UINT64 iRectBytes = 0;
+
+		sprintf(s, "p%03dra.bin", i);
+		if ( !WriteFileIfChanged(s, darkRects, sizeof(darkRects[0]) * iRectCount, &iRectBytes) )
+		{
+			AddGenerateError(run, "Failed to save rects file \"%s\"", s);
+			stats.iErrors++;
+		}
+
+		if (settings.bShockMaps)
+		{
+			sprintf(s, "p%03dxa.bin", i);
+			if ( !WriteFileIfChanged(s, darkRects, sizeof(darkRects[0]) * iRectCount, &iRectBytes) )
+			{
+				AddGenerateError(run, "Failed to save rects file \"%s\"", s);
+				stats.iErrors++;
+			}
+		}
+
+		stats.iBytes += iRectBytes;
+
+		// with a memory budget finish the page before decoding the next one
+		if (settings.iMaxPageMem > 0)
+		{
+			pPool->Wait();
+
+			if (!page.bSharedImages)
+			{
+				delete page.img;
+				page.img = NULL;
+				delete page.imgHilightSS2;
+				page.imgHilightSS2 = NULL;
+			}
+		}
+
+		// locations that weren't reached because of an error are done as well
+		AddGeneratePageDone(run, run.bCancel ? 0 : page.iLocsTotal - iLocsCounted, iRectBytes);
+	}
+
+	delete pPool;
+
+	for (int i=0; i<iJobs; i++)
+	{
+		const sGenerateJob &job = pJobs[i];
+
+		// the manifest keeps the hash of the files from the last run
+		if (job.bCancelled)
+			continue;
+
+		const sGenerateOutput *pFailed = NULL;
+		for (int j=0; j<job.iOutputCount; j++)
+		{
+			stats.iBytes += job.out[j].iBytes;
+			if (job.out[j].bFailed && !pFailed)
+				pFailed = &job.out[j];
+		}
+
+		if (!pFailed)
+		{
+			pManifest->Set(job.iMap, job.iLocIdx, job.iHash);
+			stats.iImages++;
+			continue;
+		}
+
+		pManifest->Invalidate(job.iMap, job.iLocIdx);
+		stats.iErrors++;
+
+		AddGenerateError(run, "%s", pFailed->sError);
+	}
+
+	delete[] pJobs;
+
+	if ( !pManifest->Save(g_pProj->sDir) )
+	{
+		// not fatal, next run will just regenerate everything
+		AddGenerateError(run, "Failed to save manifest file \"%s\"", MANIFEST_FILENAME);
+	}
+
+	delete pManifest;
+}
+
+// generate the map files on the calling thread (batch generation), errors are reported with ReportError, returns FALSE
+// if any occurred
+static BOOL GenerateFiles(BOOL bSaveTGA, BOOL bForce = FALSE, int iGenerateMap = -1, int iGenerateLocIdx = -1, sGenerateStats *pStats = NULL)
+{
+	sGenerateSettings settings;
+	GetGenerateSettings(settings, bSaveTGA, bForce, iGenerateMap, iGenerateLocIdx);
+
+	sGenerateRun *pRun = CreateGenerateRun(settings, FALSE);
+
+	RunGenerate(*pRun);
+
+	for (int i=0; i<pRun->iErrorCount; i++)
+		ReportError("%s", pRun->sErrors[i]);
+
+	if (pStats)
+		*pStats = pRun->stats;
+
+	const BOOL ret = !pRun->stats.iErrors;
+
+	DeleteGenerateRun(pRun);
+
+	return ret;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// background generation in the editor
+
+// the run in progress (only one at a time) and its progress window
+static sGenerateRun *g_pGenerateRun = NULL;
+static Fl_Double_Window *g_pGenerateWnd = NULL;
+static Fl_Progress *g_pGenerateProgress = NULL;
+static Fl_Box *g_pGenerateInfo = NULL;
+static Fl_Button *g_pGenerateCancel = NULL;
+
+static void GenerateRunTask(void *p)
+{
+	RunGenerate(*(sGenerateRun*)p);
+
+	Fl::awake(OnGenerateDone, NULL);
+}
+
+static void OnGenerateCancel(Fl_Widget*, void*)
+{
+	if (!g_pGenerateRun || g_pGenerateRun->bCancel)
+		return;
+
+	// locations that are already being generated are finished, the rest is skipped
+	g_pGenerateRun->bCancel = TRUE;
+
+	g_pGenerateCancel->deactivate();
+	g_pGenerateInfo->copy_label("Cancelling...");
+}
+
+static void OnGenerateProgress(void*)
+{
+	if (!g_pGenerateRun || g_pGenerateRun->bCancel)
+		return;
+
+	sGenerateRun &run = *g_pGenerateRun;
+
+	run.lock.Lock();
+	const int iPagesDone = run.iPagesDone;
+	const int iLocsDone = run.iLocsDone;
+	const UINT64 iBytesDone = run.iBytesDone;
+	run.bProgressPosted = FALSE;
+	run.lock.Unlock();
+
+	g_pGenerateProgress->value(run.iLocsTotal > 0 ? 100.0f * (float)iLocsDone / (float)run.iLocsTotal : 0.0f);
+
+	char sBytes[32];
+	FormatByteSize(sBytes, iBytesDone);
+
+	// estimate the remaining time from the average time per location so far
+	char sTimeLeft[64];
+	const double fElapsed = GetTimeSeconds() - run.fStartTime;
+	if (iLocsDone > 0 && fElapsed >= 1.0)
+	{
+		const int iLeft = (int)(fElapsed * (double)(run.iLocsTotal - iLocsDone) / (double)iLocsDone + 0.5);
+		sprintf(sTimeLeft, "about %d:%02d left", iLeft / 60, iLeft % 60);
+	}
+	else
+		strcpy(sTimeLeft, "estimating time left");
+
+	char s[256];
+	sprintf(s, "%d of %d page(s), %d of %d location(s) done\n%s written, %s",
+		iPagesDone, run.iPagesTotal, iLocsDone, run.iLocsTotal, sBytes, sTimeLeft);
+	g_pGenerateInfo->copy_label(s);
+}
+
+static void ShowGenerateWindow()
+{
+	const int W = 380;
+	const int H = 120;
+
+	g_pGenerateWnd = new Fl_Double_Window(W, H, "Generating Map Files");
+
+	g_pGenerateProgress = new Fl_Progress(10, 10, W-20, 20);
+	g_pGenerateProgress->minimum(0.0f);
+	g_pGenerateProgress->maximum(100.0f);
+	g_pGenerateProgress->selection_color(FL_SELECTION_COLOR);
+
+	g_pGenerateInfo = new Fl_Box(10, 36, W-20, 40);
+	g_pGenerateInfo->align(FL_ALIGN_LEFT | FL_ALIGN_TOP | FL_ALIGN_INSIDE);
+
+	g_pGenerateCancel = new Fl_Button(W-90, H-35, 80, 25, "Cancel");
+	g_pGenerateCancel->callback(OnGenerateCancel);
+
+	g_pGenerateWnd->end();
+
+	// closing the window cancels as well
+	g_pGenerateWnd->callback(OnGenerateCancel);
+	g_pGenerateWnd->set_non_modal();
+
+	g_pGenerateWnd->position(g_pMainWnd->x() + (g_pMainWnd->w() - W) / 2, g_pMainWnd->y() + (g_pMainWnd->h() - H) / 2);
+	g_pGenerateWnd->show();
+}
+
+static void ShowGenerateSummary(const sGenerateRun &run)
+{
+	const sGenerateSettings &settings = run.settings;
+	const sGenerateStats &stats = run.stats;
+
+	char sBytes[32];
+	FormatByteSize(sBytes, stats.iBytes);
+
+	// list the first few errors
+	const int MAX_LISTED_ERRORS = 10;
+	char sErrors[4096];
+	sErrors[0] = '\0';
+
+	int iListed = 0;
+	for (; iListed<run.iErrorCount && iListed<MAX_LISTED_ERRORS; iListed++)
+	{
+		if (strlen(sErrors) + strlen(run.sErrors[iListed]) + 2 >= sizeof(sErrors) - 32)
+			break;
+
+		strcat(sErrors, "\n");
+		strcat(sErrors, run.sErrors[iListed]);
+	}
+
+	if (iListed < run.iErrorCount)
+		sprintf(sErrors + strlen(sErrors), "\n(%d more)", run.iErrorCount - iListed);
+
+	fl_message_position(g_pMainWnd);
+
+	if (stats.iErrors)
+		fl_alert("Errors occurred, generated files are incomplete\n%s", sErrors);
+	else
+	{
+		if (run.bCancel)
+			fl_message("Generation cancelled, generated files for %d location(s)\n%d unchanged location(s) skipped, %s written", stats.iImages, stats.iSkipped, sBytes);
+		else if (settings.iGenerateLocIdx >= 0)
+		{
+			if (stats.iSkipped)
+				fl_message("Location %03d on PAGE%03d is unchanged, no files generated", settings.iGenerateLocIdx, settings.iGenerateMap);
+			else
+				fl_message("Generated files for location %03d on PAGE%03d\n%s written", settings.iGenerateLocIdx, settings.iGenerateMap, sBytes);
+		}
+		else if (settings.iGenerateMap >= 0)
+			fl_message("Generated files for %d location(s) on PAGE%03d\n%d unchanged location(s) skipped, %s written", stats.iImages, settings.iGenerateMap, stats.iSkipped, sBytes);
+		else
+			fl_message("Generated files for %d location(s) on %d page(s)\n%d unchanged location(s) skipped, %s written", stats.iImages, stats.iPages, stats.iSkipped, sBytes);
+
+		// non-fatal errors
+		if (run.iErrorCount)
+			fl_alert("%s", sErrors + 1);
+	}
+
+	ResetMouse();
+}
+
+// wait for the background run to finish and delete it, with 'bShowSummary' the results are shown in a message box
+static void FinishGenerate(BOOL bShowSummary)
+{
+	sGenerateRun *pRun = g_pGenerateRun;
+	if (!pRun)
+		return;
+
+	JoinThread(pRun->thread);
+
+	g_pGenerateRun = NULL;
+
+	g_pGenerateWnd->hide();
+	delete g_pGenerateWnd;
+	g_pGenerateWnd = NULL;
+	g_pGenerateProgress = NULL;
+	g_pGenerateInfo = NULL;
+	g_pGenerateCancel = NULL;
+
+	if (bShowSummary)
+		ShowGenerateSummary(*pRun);
+
+	DeleteGenerateRun(pRun);
+}
+
+static void OnGenerateDone(void*)
+{
+	FinishGenerate(TRUE);
+}
+
+// start generating the map files on a background thread, the editor stays usable and a progress window is shown
+static void StartGenerate(BOOL bSaveTGA, BOOL bForce, int iGenerateMap = -1, int iGenerateLocIdx = -1)
+{
+	if (g_pGenerateRun)
+		return;
+
+	sGenerateSettings settings;
+	GetGenerateSettings(settings, bSaveTGA, bForce, iGenerateMap, iGenerateLocIdx);
+
+	g_pGenerateRun = CreateGenerateRun(settings, TRUE);
+
+	ShowGenerateWindow();
+	OnGenerateProgress(NULL);
+
+	g_pGenerateRun->thread = StartThread(GenerateRunTask, g_pGenerateRun);
+}
+
+// returns TRUE (after telling the user) if map files are being generated in the background
+static BOOL IsGenerateInProgress()
+{
+	if (!g_pGenerateRun)
+		return FALSE;
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+	fl_message("Map files are already being generated.");
+	ResetMouse();
+
+	return TRUE;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+
+static void SetModifiedFlag()
+{
+	if (!g_pProj->bModified)
+	{
+		g_pProj->bModified = TRUE;
+
+		if (g_pMainWnd)
+			g_pMainWnd->label(g_sAppTitleModified);
+	}
+}
+
+static void ClearModifiedFlag()
+{
+	if (g_pProj->bModified)
+	{
+		g_pProj->bModified = FALSE;
+
+		if (g_pMainWnd)
+			g_pMainWnd->label(g_sAppTitle);
+	}
+}
+
+// report an error to the user, with a message box or on stderr when running headless
+static void ReportError(const char *fmt, ...)
+{
+	char s[MAX_PATH*2+256];
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(s, sizeof(s), fmt, args);
+	va_end(args);
+	s[sizeof(s)-1] = '\0';
+
+	if (g_bHeadless)
+	{
+		fprintf(stderr, "error: %s\n", s);
+		return;
+	}
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+	fl_alert("%s", s);
+}
+
+static void ResetMouse()
+{
+	// send a move event to the main window to reset the mouse cursor
+	if (g_pMainWnd)
+		Fl::handle(FL_MOVE, g_pMainWnd);
+}
+
+static void OnWindowResized(int w, int h)
+{
+	const int W = w - g_iWplus;
+	const int H = h - g_iHplus;
+
+	g_pMenuBar->size(W + g_iWplus, g_pMenuBar->h());
+
+	g_pScrollView->size(W, H);
+
+	if (g_pProj->maps[g_pProj->iCurMap].IsValid())
+		g_pImageView->size(g_pProj->maps[g_pProj->iCurMap].iImgSize[0] * g_iZoom, g_pProj->maps[g_pProj->iCurMap].iImgSize[1] * g_iZoom);
+	else
+		g_pImageView->size(640 * g_iZoom, 480 * g_iZoom);
+
+	g_pTreeView->resize(W, g_pTreeView->y(), g_pTreeView->w(), H);
+
+	// if scroll pos is out of range (can happen when zooming out) then clamp scroll pos
+	int x = g_pScrollView->xposition();
+	int y = g_pScrollView->yposition();
+	if (x > g_pImageView->w() - g_pScrollView->w())
+		x = g_pImageView->w() - g_pScrollView->w();
+	if (y > g_pImageView->h() - g_pScrollView->h())
+		y = g_pImageView->h() - g_pScrollView->h();
+	if (x < 0)
+		x = 0;
+	if (y < 0)
+		y = 0;
+	g_pScrollView->scroll_to(x, y);
+
+	g_pTreeView->redraw();
+	g_pImageView->redraw();
+	g_pScrollView->redraw();
+}
+
+static void ChangeMap(int n, BOOL bZoomChangeOnly = FALSE)
+{
+	if (n >= g_pProj->iMapCount)
+	{
+		// should never happen
+		g_pProj->iCurMap = -1;
+		return;
+	}
+
+	g_pProj->iCurMap = n;
+
+	if (n >= 0)
+		LoadPageImages(n);
+
+	g_iCTR = (g_iZoom - 1) / 2;
+
+	if (!bZoomChangeOnly)
+		g_pScrollView->scroll_to(0, 0);
+
+	OnWindowResized(g_pMainWnd->w(), g_pMainWnd->h());
+}
+
+static BOOL ChangeZoom(int n)
+{
+	if (n < MIN_ZOOM)
+		n = MIN_ZOOM;
+	else if (n > MAX_ZOOM)
+		n = MAX_ZOOM;
+
+	if (g_iZoom == n)
+		return FALSE;
+
+	g_iZoom = n;
+
+	ChangeMap(g_pProj->iCurMap, TRUE);
+
+	ResetMouse();
+
+	return TRUE;
+}
+
+static const char* fl_input_ex(const char *label, char *deflt)
+{
+	g_bShowingFlInputDialog = TRUE;
+
+	fl_message_position(g_pMainWnd);
+
+	const char *ret = fl_input("%s", label, deflt);
+
+	g_bShowingFlInputDialog = FALSE;
+
+	return ret;
+}
+
+// fill the tree with the pages and locations, selects the item with tree id 'iSelTreeId' (the first location if
+// there's no such item)
+static void PopulateTree(int iSelTreeId = -1)
+{
+	char s[128];
+
+	g_pTreeView->clear();
+	g_iCurSelTreeId = -1;
+	g_pCurSelTreeItem = NULL;
+
+	if (!g_pProj->iMapCount)
+		return;
+
+	g_pTreeView->begin();
+
+	for (int i=0; i<g_pProj->iMapCount; i++)
+	{
+		if (!g_pProj->maps[i].IsValid())
+			continue;
+
+		sprintf(s, "PAGE%03d", i);
+		Fl_Tree_Item *p = g_pTreeView->add(s);
+		p->user_data((void*)(intptr_t)MAKE_TREE_ID(i, -1));
+		p->labelfont(FL_HELVETICA | FL_BOLD);
+
+		for (int j=0; j<g_pProj->maps[i].iLocationCount; j++)
+		{
+			sLocation &loc = g_pProj->maps[i].locs[j];
+
+			sprintf(s, "PAGE%03d/%03d", i, loc.iLocationIndex);
+			p = g_pTreeView->add(s);
+			p->user_data((void*)(intptr_t)MAKE_TREE_ID(i, loc.iLocationIndex));
+		}
+	}
+
+	g_pTreeView->end();
+
+	Fl_Tree_Item *sel = g_pTreeView->next( g_pTreeView->first() );
+	if (iSelTreeId != -1)
+		for (Fl_Tree_Item *p=g_pTreeView->first(); p; p=g_pTreeView->next(p))
+			if ((intptr_t)p->user_data() == iSelTreeId)
+			{
+				sel = p;
+				break;
+			}
+
+	g_pTreeView->select_only(sel);
+	g_pTreeView->set_item_focus(sel);
+}
+
+static void OnTreeSelChange(Fl_Widget*, void*)
+{
+	Fl_Tree_Item *p = g_pTreeView->first_selected_item();
+	if (!p)
+	{
+		g_iCurSelTreeId = -1;
+		g_pCurSelTreeItem = NULL;
+		g_pImageView->redraw();
+		return;
+	}
+
+	g_iCurSelTreeId = (intptr_t)p->user_data();
+	g_pCurSelTreeItem = p;
+
+	int iMap = MAP_FROM_TREE_ID(g_iCurSelTreeId);
+
+	if (iMap != g_pProj->iCurMap)
+		ChangeMap(iMap);
+	else
+		g_pImageView->redraw();
+}
+
+static void OnMainWndClose(Fl_Widget*, void*)
+{
+	// prevent escape from closing app
+	if (Fl::event() == FL_SHORTCUT && Fl::event_key() == FL_Escape)
+		return;
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+	if ((g_pProj->bModified && fl_choice("Any unsaved changes will be lost. Exit?", "Yes", "No", NULL))
+		|| (g_pGenerateRun && fl_choice("Map files are still being generated. Cancel and exit?", "Yes", "No", NULL)))
+	{
+		ResetMouse();
+		return;
+	}
+
+	if (g_pGenerateRun)
+	{
+		g_pGenerateRun->bCancel = TRUE;
+		FinishGenerate(FALSE);
+	}
+
+	// any unsaved changes are discarded, so they shouldn't be restored on the next start either
+	g_journal.Discard();
+
+	g_pMainWnd->hide();
+}
+
+static void OnCmdExit(Fl_Widget*, void*)
+{
+	OnMainWndClose(NULL, NULL);
+}
+
+static void OnCmdSave(Fl_Widget*, void*)
+{
+	// the project file now has all edits
+	if ( g_pProj->Save() )
+	{
+		g_journal.Discard();
+		g_undo.SetSavePoint();
+	}
+}
+
+static void OnCmdExportText(Fl_Widget*, void*)
+{
+	g_pProj->ExportText();
+}
+
+static void OnCmdGenerateFiles(Fl_Widget*, void *pForce)
+{
+	const BOOL bForce = pForce != NULL;
+
+	if ( IsGenerateInProgress() )
+		return;
+
+	for (int i=0; i<g_pProj->iMapCount; i++)
+		if (g_pProj->maps[i].iLocationCount)
+			goto has_locations;
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+	fl_message("No locations have been defined, nothing to generate.");
+	ResetMouse();
+	return;
+
+has_locations:
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+	int res;
+	if (bForce)
+		res = fl_choice("Regenerate files for all map locations (PNG compression: %s).\nExisting files will be overwritten. Proceed?", "Cancel", "OK", "Generate as TGA", g_sPngPresetNames[g_iPngPreset]);
+	else
+		res = fl_choice("Generate files for all changed map locations (PNG compression: %s).\nExisting files will be overwritten. Proceed?", "Cancel", "OK", "Generate as TGA", g_sPngPresetNames[g_iPngPreset]);
+	ResetMouse();
+	if (!res)
+		return;
+
+	const BOOL bSaveTGA = (res == 2);
+
+	StartGenerate(bSaveTGA, bForce);
+}
+
+static void OnCmdGenerateSelected(Fl_Widget*, void*)
+{
+	int iMap = g_pProj->iCurMap;
+	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+	int iLocIdx = LOCIDX_FROM_TREE_ID(g_iCurSelTreeId);
+
+	if (iMap < 0 && iLoc < 0)
+		return;
+
+	if ( IsGenerateInProgress() )
+		return;
+
+	int res;
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+
+	if (iLoc < 0)
+	{
+		if (!g_pProj->maps[iMap].iLocationCount)
+		{
+			fl_message("No locations have been defined on PAGE%03d, nothing to generate.", iMap);
+			return;
+		}
+
+		res = fl_choice("Generate files for PAGE%03d (PNG compression: %s).\nExisting files will be overwritten. Proceed?", "Cancel", "OK", "Generate as TGA", iMap, g_sPngPresetNames[g_iPngPreset]);
+	}
+	else
+		res = fl_choice("Generate files for location %03d on PAGE%03d (PNG compression: %s).\nExisting files will be overwritten. Proceed?", "Cancel", "OK", "Generate as TGA", iLocIdx, iMap, g_sPngPresetNames[g_iPngPreset]);
+
+	ResetMouse();
+
+	if (!res)
+		return;
+
+	const BOOL bSaveTGA = (res == 2);
+
+	StartGenerate(bSaveTGA, TRUE, iMap, iLocIdx);
+}
+
+static void OnCmdUndo(Fl_Widget*, void *pRedo)
+{
+	if (g_pImageView->m_iDragging || g_pImageView->m_bPanning || g_pImageView->m_bCreatingShape)
+		return;
+
+	const int iMap = pRedo ? g_undo.Redo(*g_pProj) : g_undo.Undo(*g_pProj);
+	if (iMap < 0)
+		return;
+
+	if ( g_undo.IsAtSavePoint() )
+		ClearModifiedFlag();
+	else
+		SetModifiedFlag();
+
+	// the undone edit may have added, deleted or renamed locations, so the tree is rebuilt. the selected location stays
+	// selected if it still exists, otherwise the page of the edit is selected
+	int iSelTreeId = g_iCurSelTreeId;
+	const int iSelLocIdx = LOCIDX_FROM_TREE_ID(iSelTreeId);
+	if (MAP_FROM_TREE_ID(iSelTreeId) != iMap || (iSelLocIdx >= 0 && !g_pProj->maps[iMap].GetByLocationIndex(iSelLocIdx)))
+		iSelTreeId = MAKE_TREE_ID(iMap, -1);
+
+	g_pImageView->ClearHilight();
+	PopulateTree(iSelTreeId);
+
+	ResetMouse();
+
+	g_pTreeView->redraw();
+	g_pImageView->redraw();
+}
+
+static void OnCmdDelete(Fl_Widget*, void*)
+{
+	if (!g_pCurSelTreeItem || g_pImageView->m_iDragging || g_pImageView->m_bPanning)
+		return;
+
+	int iMap = g_pProj->iCurMap;
+	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+	int iLocIndex = LOCIDX_FROM_TREE_ID(g_iCurSelTreeId);
+
+	if (iMap < 0)
+		return;
+
+	if (iLocIndex < 0)
+	{
+		// page item selected in tree, ask if all shapes should be deleted
+
+		if (!g_pProj->maps[iMap].iLocationCount)
+			return;
+
+		fl_cursor(FL_CURSOR_DEFAULT);
+		fl_message_position(g_pMainWnd);
+		if ( !fl_choice("Delete all locations on PAGE%03d?", "Cancel", "OK", NULL, iMap))
+		{
+			fl_message_position(g_pMainWnd);
+			if ( !fl_choice("Are you really sure that you want to delete all locations on PAGE%03d?", "Cancel", "OK", NULL, iMap) )
+			{
+				ResetMouse();
+				return;
+			}
+		}
+
+		g_undo.DeleteAllLocations(g_pProj->maps[iMap]);
+		g_pProj->maps[iMap].FlushScaledImages();
+		g_pProj->maps[iMap].DeleteAllLocations();
+		SetModifiedFlag();
+
+		// delete all child tree items for page
+		while ( g_pCurSelTreeItem->children() )
+			g_pTreeView->remove( g_pCurSelTreeItem->child(0) );
+	}
+	else
+	{
+		fl_cursor(FL_CURSOR_DEFAULT);
+		fl_message_position(g_pMainWnd);
+		if ( !fl_choice("Delete location %03d on PAGE%03d?", "Cancel", "OK", NULL, iLocIndex, iMap) )
+		{
+			ResetMouse();
+			return;
+		}
+
+		g_undo.DeleteLocation(g_pProj->maps[iMap].locs[iLoc]);
+		g_pProj->maps[iMap].DeleteLocation(iLoc);
+		SetModifiedFlag();
+
+		// delete tree item
+		{
+			// get next item on same page to be selected after deletion
+			Fl_Tree_Item *pNewSel = g_pCurSelTreeItem->next_sibling();
+			// if the last item was deleted then move selection to prev instead
+			if (!pNewSel)
+			{
+				pNewSel = g_pCurSelTreeItem->prev_sibling();
+				// if there's no prev either then select the page
+				if (!pNewSel)
+					pNewSel = g_pCurSelTreeItem->parent();
+			}
+
+			g_pTreeView->remove(g_pCurSelTreeItem);
+			g_iCurSelTreeId = -1;
+			g_pCurSelTreeItem = NULL;
+
+			// select new tree item
+			if (pNewSel)
+			{
+				g_pTreeView->select_only(pNewSel);
+				g_pTreeView->set_item_focus(pNewSel);
+			}
+		}
+	}
+
+	ResetMouse();
+
+	g_pTreeView->redraw();
+	g_pImageView->redraw();
+}
+
+static void OnCmdEditIndex(Fl_Widget*, void*)
+{
+	if (g_pImageView->m_iDragging || g_pImageView->m_bPanning)
+		return;
+
+	int iMap = g_pProj->iCurMap;
+	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+
+	if (iLoc < 0)
+		return;
+
+	char s[64];
+	sprintf(s, "%d", g_pProj->maps[iMap].locs[iLoc].iLocationIndex);
+
+retry:
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	const char *t = fl_input_ex("New Index", s);
+	ResetMouse();
+	if (!t)
+		return;
+
+	const int iNewIndex = atoi(t);
+
+	if (iNewIndex < 0 || iNewIndex > MAX_LOCATIONS_PER_MAP-1)
+	{
+		fl_cursor(FL_CURSOR_DEFAULT);
+		fl_message_position(g_pMainWnd);
+		fl_alert("Invalid index, must be a value in the range 0 to %d", MAX_LOCATIONS_PER_MAP-1);
+		goto retry;
+	}
+
+	const int iOldIndex = g_pProj->maps[iMap].locs[iLoc].iLocationIndex;
+	if (iNewIndex == iOldIndex)
+		return;
+
+	sLocation *pPrevLoc = g_pProj->maps[iMap].GetByLocationIndex(iNewIndex);
+	if (pPrevLoc)
+	{
+		fl_cursor(FL_CURSOR_DEFAULT);
+		fl_message_position(g_pMainWnd);
+		if ( !fl_choice("Another location with index %03d already exists. Swap indices?", "Cancel", "OK", NULL, iNewIndex) )
+		{
+			ResetMouse();
+			return;
+		}
+
+		ResetMouse();
+
+		pPrevLoc->iLocationIndex = iOldIndex;
+		pPrevLoc->OnChanged();
+	}
+
+	// change tree item
+
+	g_pProj->maps[iMap].locs[iLoc].iLocationIndex = iNewIndex;
+	g_pProj->maps[iMap].locs[iLoc].OnChanged();
+	SetModifiedFlag();
+	g_undo.SetLocationIndex(iMap, iOldIndex, iNewIndex);
+
+	if (pPrevLoc)
+	{
+		// indices were swapped, ju re-select the new name
+
+		g_iCurSelTreeId = -1;
+		g_pCurSelTreeItem = NULL;
+
+		sprintf(s, "PAGE%03d/%03d", iMap, iNewIndex);
+		Fl_Tree_Item *pItem = g_pTreeView->find_item(s);
+		if (pItem)
+		{
+			g_pTreeView->select_only(pItem);
+			g_pTreeView->set_item_focus(pItem);
+		}
+	}
+	else
+	{
+		// rename tree item
+
+		g_pTreeView->remove(g_pCurSelTreeItem);
+
+		g_iCurSelTreeId = -1;
+		g_pCurSelTreeItem = NULL;
+
+		sprintf(s, "PAGE%03d/%03d", iMap, iNewIndex);
+		g_pTreeView->begin();
+		Fl_Tree_Item *pItem = g_pTreeView->add(s);
+		pItem->user_data( (void*)(intptr_t)MAKE_TREE_ID(iMap, iNewIndex) );
+		g_pTreeView->end();
+		g_pTreeView->select_only(pItem);
+		g_pTreeView->set_item_focus(pItem);
+	}
+
+	g_pImageView->redraw();
+}
+
+static void OnCmdMove(Fl_Widget*, void*)
+{
+	if (g_pImageView->m_iDragging || g_pImageView->m_bPanning)
+		return;
+
+	int iMap = g_pProj->iCurMap;
+	int iLocIndex = LOCIDX_FROM_TREE_ID(g_iCurSelTreeId);
+	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+
+	if (iMap < 0)
+		return;
+
+	if (iLocIndex < 0)
+	{
+		fl_cursor(FL_CURSOR_DEFAULT);
+		fl_message_position(g_pMainWnd);
+
+		if (!g_pProj->maps[iMap].iLocationCount)
+		{
+			fl_message("No locations on this page");
+			ResetMouse();
+			return;
+		}
+
+		if ( !fl_choice("Move all locations on PAGE%03d?", "Cancel", "OK", NULL, iMap) )
+		{
+			ResetMouse();
+			return;
+		}
+
+		if ( !fl_choice("Are you really sure that you want to move all locations on PAGE%03d?", "Cancel", "OK", NULL, iMap) )
+		{
+			ResetMouse();
+			return;
+		}
+	}
+	// should never happen
+	else if (iLoc < 0)
+		return;
+
+	// static so dialog defaults to previously used vals
+	static char s[256] = "0 0";
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	const char *t = fl_input_ex("Move Delta (dX dY)", s);
+	ResetMouse();
+	if (!t)
+		return;
+
+	int dx = 0, dy = 0;
+	sscanf(t, "%d %d", &dx, &dy);
+
+	sprintf(s, "%d %d", dx, dy);
+
+	if (!dx && !dy)
+		return;
+
+	if (abs(dx) > 4096 || abs(dy) > 4096)
+		return;
+
+	if (iLocIndex < 0)
+	{
+		for (int i=0; i<g_pProj->maps[iMap].iLocationCount; i++)
+			g_pProj->maps[iMap].locs[i].MovePos(dx, dy);
+	}
+	else
+		g_pProj->maps[iMap].locs[iLoc].MovePos(dx, dy);
+
+	SetModifiedFlag();
+	g_undo.MoveLocation(iMap, iLocIndex < 0 ? -1 : iLocIndex, dx, dy);
+	g_pImageView->redraw();
+}
+
+static void OnCmdInfo(Fl_Widget*, void *)
+{
+	int iMap = g_pProj->iCurMap;
+	int iLoc = LOC_FROM_TREE_ID(g_iCurSelTreeId);
+
+	if (iMap < 0 || iLoc < 0)
+		return;
+
+	const sLocation &loc = g_pProj->maps[iMap].locs[iLoc];
+
+	int brect[4];
+	GetLocationImageRect(g_pProj->maps[iMap].iImgSize, loc, brect, g_iLocationImageExtraBorder);
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+	fl_message(
+		"Location %03d on PAGE%03d\n"
+		"\n"
+		"Origin: %d, %d\n"
+		"Size: %d x %d\n"
+		,
+		loc.iLocationIndex, iMap,
+		brect[0], brect[1],
+		brect[2]-brect[0]+1, brect[3]-brect[1]+1
+		);
+	ResetMouse();
+}
+
+static void OnCmdRecover(Fl_Widget*, void*)
+{
+	if (g_pProj->iMapCount == 0 || g_pProj->maps[g_pProj->iCurMap].iLocationCount > 0)
+	{
+		fl_cursor(FL_CURSOR_DEFAULT);
+		fl_message_position(g_pMainWnd);
+		fl_message("PAGE%03d must have no existing locations before attempting recovery", g_pProj->iCurMap);
+		ResetMouse();
+		return;
+	}
+
+	int iLocations = 0;
+	BOOL bErrors = FALSE;
+	char s[12];
+
+	fl_cursor(FL_CURSOR_WAIT);
+
+	// dark rects file containing the location positions (in index order)
+	sprintf(s, "p%03dra.bin", g_pProj->iCurMap);
+	FILE *f = fl_fopen(s, "rb");
+	if (!f && g_bShockMaps)
+	{
+		fl_cursor(FL_CURSOR_DEFAULT);
+		fl_message_position(g_pMainWnd);
+		fl_alert("Could not locate rects file \"%s\" for recovery", s);
+		fl_cursor(FL_CURSOR_WAIT);
+		sprintf(s, "p%03dxa.bin", g_pProj->iCurMap);
+		f = fl_fopen(s, "rb");
+	}
+	if (!f)
+	{
+		fl_cursor(FL_CURSOR_DEFAULT);
+		fl_message_position(g_pMainWnd);
+		fl_alert("Could not locate rects file \"%s\" for recovery", s);
+		ResetMouse();
+		return;
+	}
+
+	short darkRect[4] = {0};
+	sShape shape;
+	shape.SetVertCount(4);
+
+	// all recovered locations are undone together
+	g_undo.BeginStep();
+
+	while ( 1 == fread(darkRect, sizeof(darkRect), 1, f) )
+	{
+		const int iNewLocIndex = g_pProj->maps[g_pProj->iCurMap].GetFreeLocationIndex();
+		if (iNewLocIndex < 0)
+		{
+			bErrors = TRUE;
+			break;
+		}
+
+		sMap &map = g_pProj->maps[g_pProj->iCurMap];
+
+		// construct rectangle (clockwise)
+		shape.verts[0].x = darkRect[0];
+		shape.verts[0].y = darkRect[1];
+		shape.verts[1].x = darkRect[2];
+		shape.verts[1].y = darkRect[1];
+		shape.verts[2].x = darkRect[2];
+		shape.verts[2].y = darkRect[3];
+		shape.verts[3].x = darkRect[0];
+		shape.verts[3].y = darkRect[3];
+
+		sLocation &newLoc = map.AddLocation(iNewLocIndex);
+
+		// default label offset to bounds center
+		shape.CalcBoundingRect();
+		shape.iLabelPos[0] = shape.iBoundRect[0] + ((shape.iBoundRect[2] - shape.iBoundRect[0]) / 2);
+		shape.iLabelPos[1] = shape.iBoundRect[1] + ((shape.iBoundRect[3] - shape.iBoundRect[1]) / 2);
+
+		g_undo.AddShape( *newLoc.AddShape(shape) );
+
+		g_pTreeView->begin();
+		sprintf(s, "PAGE%03d/%03d", g_pProj->iCurMap, iNewLocIndex);
+		Fl_Tree_Item *p = g_pTreeView->add(s);
+		p->user_data( (void*)(intptr_t)MAKE_TREE_ID(g_pProj->iCurMap, iNewLocIndex) );
+		g_pTreeView->end();
+
+		iLocations++;
+	}
+
+	fclose(f);
+
+	g_undo.EndStep();
+
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+
+	if (bErrors)
+		fl_alert("Errors occurred, not all locations could be recovered");
+	else
+		fl_message("Successfully recovered %d locations", iLocations);
+
+	ResetMouse();
+
+	SetModifiedFlag();
+
+	g_pTreeView->redraw();
+	g_pImageView->redraw();
+}
+
+static void OnCmdPngPreset(Fl_Widget*, void *p)
+{
+	g_iPngPreset = (int)(intptr_t)p;
+}
+
+static void OnCmdDisplayMode(Fl_Widget*, void *p)
+{
+	if (g_displayMode == (DisplayMode)(intptr_t)p)
+		return;
+
+	g_displayMode = (DisplayMode)(intptr_t)p;
+	g_pImageView->redraw();
+}
+
+static void OnCmdZoom(Fl_Widget*, void *p)
+{
+	if (g_pImageView->m_iDragging || g_pImageView->m_bPanning)
+		return;
+
+	// zoom around view center (maintain same orig map XY pos at center before and after zoom change)
+	const int Xclient = g_pScrollView->w() / 2;
+	const int Yclient = g_pScrollView->h() / 2;
+	const int Xmap = (g_pScrollView->xposition() + Xclient) / g_iZoom;
+	const int Ymap = (g_pScrollView->yposition() + Yclient) / g_iZoom;
+
+	if ( ChangeZoom(g_iZoom + (intptr_t)p) )
+		ScrollImageTo(Xmap * g_iZoom - Xclient, Ymap * g_iZoom - Yclient);
+}
+
+static void OnCmdToggleThickLines(Fl_Widget*, void*)
+{
+	g_iLineWidth = g_iLineWidth ? 0 : 2;
+	g_pImageView->redraw();
+}
+
+static void OnCmdToggleLabels(Fl_Widget*, void*)
+{
+	g_bDrawLabels = !g_bDrawLabels;
+	g_pImageView->redraw();
+}
+
+static void OnCmdToggleFillNewShape(Fl_Widget*, void*)
+{
+	g_bFillNewShape = !g_bFillNewShape;
+	g_pImageView->redraw();
+}
+
+static void OnCmdToggleCursorGuides(Fl_Widget*, void*)
+{
+	g_bDrawCursorGuides = !g_bDrawCursorGuides;
+	g_pImageView->redraw();
+}
+
+static void OnCmdToggleHideSelOutlines(Fl_Widget*, void*)
+{
+	g_bHideSelectedOutline = !g_bHideSelectedOutline;
+	g_pImageView->redraw();
+}
+
+static void OnCmdChangePage(Fl_Widget*, void *p)
+{
+	if (!g_pCurSelTreeItem || g_pImageView->m_bCreatingShape || g_pImageView->m_iDragging || g_pImageView->m_bPanning)
+		return;
+
+	char s[64];
+	sprintf(s, "PAGE%03d", g_pProj->iCurMap + (int)(intptr_t)p);
+	Fl_Tree_Item *pItem = g_pTreeView->find_item(s);
+	if (pItem)
+	{
+		g_pTreeView->select_only(pItem);
+		g_pTreeView->set_item_focus(pItem);
+	}
+}
+
+static void OnCmdWidgetScheme(Fl_Widget*, void *p)
+{
+	const char *scheme = (const char *)p;
+
+	if (!Fl::is_scheme(scheme))
+		Fl::scheme(scheme);
+
+	g_pMainWnd->redraw();
+}
+
+#ifndef NO_FLEET
+static void OnCmdWidgetExScheme(Fl_Widget*, void *p)
+{
+	const char *scheme = (const char *)p;
+
+	fle_set_scheme(scheme);
+
+	g_pMainWnd->redraw();
+}
+
+static void OnCmdColorScheme(Fl_Widget*, void *p)
+{
+	const char *colors = (const char *)p;
+
+	fle_set_colors(colors);
+
+	g_pMainWnd->redraw();
+}
+#endif
+
+static void OnCmdAbout(Fl_Widget*, void*)
+{
+	fl_cursor(FL_CURSOR_DEFAULT);
+	fl_message_position(g_pMainWnd);
+	fl_message(
+		"DarkMapGen " DARKMAPGEN_VERSION "\n"
+		"\n"
+		"A tool for defining and generating auto-map locations for the Dark engine.\n"
+		"\n"
+		"\n"
+		"This program uses:\n"
+		"\n"
+		"    FLTK (fltk.org)\n"
+		"    libpng (libpng.org)\n"
+		);
+	ResetMouse();
+}
+
+
+/////////////////////////////////////////////////////////////////////
+
+static void InitControls()
+{
+	sprintf(g_sAppTitle, DARKMAPGEN_TITLE " " DARKMAPGEN_VERSION " %s - %s", g_bShockMaps?"[SS2]":"[Thief]", g_pProj->sDir);
+	strcpy(g_sAppTitleModified, g_sAppTitle);
+	if (strlen(g_sAppTitleModified)+2 < sizeof(g_sAppTitleModified))
+		strcat(g_sAppTitleModified, " *");
+
+	g_pMainWnd->label(g_sAppTitle);
+
+	// center on desktop
+	g_pMainWnd->position(
+		Fl::x() + ((Fl::w() - g_pMainWnd->w()) / 2),
+		Fl::y() + ((Fl::h() - g_pMainWnd->h()) / 2)
+		);
+
+	// main menu
+
+	const int MAX_MENU_ITEMS = 128;
+	int menu_items = 0;
+
+	// NOTE: don't forget to update the command-line InvokeShortcutFLTK calls if any shortcuts here change or display modes are added
+
+	static Fl_Menu_Item menu[MAX_MENU_ITEMS];
+
+	MENU_SET( {"&File", 0, NULL, NULL, FL_SUBMENU, 0, 0, 0, 0} );
+		MENU_SET( {"&Save Project", FL_COMMAND+'s', OnCmdSave, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {"&Export Text Project", 0, OnCmdExportText, NULL, FL_MENU_DIVIDER, 0, 0, 0, 0} );
+		MENU_SET( {"&Generate Map Files ", FL_F+7, OnCmdGenerateFiles, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {"&Regenerate All Map Files ", FL_SHIFT+(FL_F+7), OnCmdGenerateFiles, (void*)1, 0, 0, 0, 0, 0} );
+		MENU_SET( {"G&enerate Selected Only ", FL_COMMAND+(FL_F+7), OnCmdGenerateSelected, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {"PNG &Compression", 0, NULL, NULL, FL_SUBMENU|FL_MENU_DIVIDER, 0, 0, 0, 0} );
+			MENU_SET( {"&Fast", 0, OnCmdPngPreset, (void*)PNG_PRESET_FAST, FL_MENU_RADIO|(g_iPngPreset==PNG_PRESET_FAST?FL_MENU_VALUE:0), 0, 0, 0, 0} );
+			MENU_SET( {"&Default", 0, OnCmdPngPreset, (void*)PNG_PRESET_DEFAULT, FL_MENU_RADIO|(g_iPngPreset==PNG_PRESET_DEFAULT?FL_MENU_VALUE:0), 0, 0, 0, 0} );
+			MENU_SET( {"&Smallest", 0, OnCmdPngPreset, (void*)PNG_PRESET_SMALLEST, FL_MENU_RADIO|(g_iPngPreset==PNG_PRESET_SMALLEST?FL_MENU_VALUE:0), 0, 0, 0, 0} );
+			MENU_SET( {} );
+		MENU_SET( {"E&xit", FL_ALT+'x', OnCmdExit, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {} );
+
+	MENU_SET( {"&Edit", 0, NULL, NULL, FL_SUBMENU, 0, 0, 0, 0} );
+		MENU_SET( {"&Undo", FL_COMMAND+'z', OnCmdUndo, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {"&Redo", FL_COMMAND+'y', OnCmdUndo, (void*)1, FL_MENU_DIVIDER, 0, 0, 0, 0} );
+		MENU_SET( {"&Delete Selected Location ", FL_Delete, OnCmdDelete, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {"Edit Location &Index ", FL_F+9, OnCmdEditIndex, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {"&Move Selected Location ", 'm', OnCmdMove, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {"&View Location Info", 'i', OnCmdInfo, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {"&Recover Page Locations", 'r', OnCmdRecover, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {} );
+
+	MENU_SET( {"&View", 0, NULL, NULL, FL_SUBMENU, 0, 0, 0, 0} );
+		MENU_SET( {"&Outlines Only", FL_COMMAND+'1', OnCmdDisplayMode, (void*)DM_OUTLINES, FL_MENU_RADIO|FL_MENU_VALUE, 0, 0, 0, 0} );
+		MENU_SET( {"Fill &Selection", FL_COMMAND+'2', OnCmdDisplayMode, (void*)DM_FILLSEL, FL_MENU_RADIO, 0, 0, 0, 0} );
+		MENU_SET( {"Fill &All", FL_COMMAND+'3', OnCmdDisplayMode, (void*)DM_FILLALL, FL_MENU_RADIO, 0, 0, 0, 0} );
+		MENU_SET( {"&Dim All", FL_COMMAND+'4', OnCmdDisplayMode, (void*)DM_DIMMED, FL_MENU_RADIO, 0, 0, 0, 0} );
+		MENU_SET( {"Fade &Unselected", FL_COMMAND+'5', OnCmdDisplayMode, (void*)DM_FADE_NONSEL, FL_MENU_RADIO|FL_MENU_DIVIDER, 0, 0, 0, 0} );
+		MENU_SET( {"&Thick Lines", FL_COMMAND+'t', OnCmdToggleThickLines, NULL, FL_MENU_TOGGLE, 0, 0, 0, 0} );
+		MENU_SET( {"Draw &Labels", FL_COMMAND+'l', OnCmdToggleLabels, NULL, FL_MENU_TOGGLE, 0, 0, 0, 0} );
+		MENU_SET( {"&Fill Create Shape", FL_COMMAND+'f', OnCmdToggleFillNewShape, NULL, FL_MENU_TOGGLE, 0, 0, 0, 0} );
+		MENU_SET( {"Draw Cursor &Guides", FL_COMMAND+'g', OnCmdToggleCursorGuides, NULL, FL_MENU_TOGGLE, 0, 0, 0, 0} );
+		MENU_SET( {"&Hide Selection Outline ", FL_COMMAND+'h', OnCmdToggleHideSelOutlines, NULL, FL_MENU_TOGGLE|FL_MENU_DIVIDER, 0, 0, 0, 0} );
+		MENU_SET( {"Zoom O&ut", FL_KP+'-', OnCmdZoom, (void*)-1, 0, 0, 0, 0, 0} );
+		MENU_SET( {"Zoom &In", FL_KP+'+', OnCmdZoom, (void*)1, FL_MENU_DIVIDER, 0, 0, 0, 0} );
+		MENU_SET( {"T&heme", 0, NULL, NULL, FL_SUBMENU, 0, 0, 0, 0} );
+			for (int i=0; i<Fl_Scheme::num_schemes(); i++)
+			{
+				const char *scheme = Fl_Scheme::names()[i];
+				MENU_SET( {scheme, 0, OnCmdWidgetScheme, (void*)scheme, FL_MENU_RADIO|(Fl::is_scheme(scheme)?FL_MENU_VALUE:0), 0, 0, 0, 0} );
+			}
+#ifndef NO_FLEET
+			for (int i=0; i<fle_num_schemes(); i++)
+			{
+				const char *scheme = fle_scheme_name(i);
+				MENU_SET( {scheme, 0, OnCmdWidgetExScheme, (void*)scheme, FL_MENU_RADIO|(!strcmp(scheme,fle_get_scheme())?FL_MENU_VALUE:0), 0, 0, 0, 0} );
+			}
+			MENU_SET( {} );
+		MENU_SET( {"&Colors", 0, NULL, NULL, FL_SUBMENU|FL_MENU_DIVIDER, 0, 0, 0, 0} );
+			for (int i=0; i<fle_num_colors(); i++)
+			{
+				const char *colors = fle_colors_name(i);
+				MENU_SET( {colors, 0, OnCmdColorScheme, (void*)colors, FL_MENU_RADIO|(!strcmp(colors,fle_get_colors())?FL_MENU_VALUE:0), 0, 0, 0, 0} );
+			}
+#endif
+			MENU_SET( {} );
+		MENU_SET( {"About...", 0, OnCmdAbout, NULL, 0, 0, 0, 0, 0} );
+		MENU_SET( {} );
+
+	// hidden entries, only provide app-wide shortcuts
+	MENU_SET( {"Prev Page", FL_Page_Up, OnCmdChangePage, (void*)-1, FL_MENU_INVISIBLE, 0, 0, 0, 0} );
+	MENU_SET( {"Next Page", FL_Page_Down, OnCmdChangePage, (void*)1, FL_MENU_INVISIBLE, 0, 0, 0, 0} );
+
+	MENU_SET( {} );
+
+	g_pMenuBar->menu(menu);
+
+	PopulateTree();
+
+	for (int i=0; i<g_pProj->iMapCount; i++)
+		if (g_pProj->maps[i].IsValid())
+		{
+			ChangeMap(i);
+			if (!g_bUserDefinedWindowSize)
+			{
+				int cx = g_pMainWnd->x() + (g_pMainWnd->w() / 2);
+				int cy = g_pMainWnd->y() + (g_pMainWnd->h() / 2);
+
+				int iZoom = g_iZoom > 2 ? 2 : g_iZoom;
+				int w = g_pProj->maps[i].iImgSize[0] * iZoom + g_iWplus;
+				int h = g_pProj->maps[i].iImgSize[1] * iZoom + g_iHplus;
+
+				g_pMainWnd->resize(cx - (w / 2), cy - (h / 2), w, h);
+			}
+			break;
+		}
+}
+
+
+static void MakeWindow(int W, int H)
+{
+	if (W <= 0 || H <= 0)
+	{
+		W = 800;
+		H = 507;
+	}
+
+	g_pMainWnd = new cMainWindow(W, H, DARKMAPGEN_TITLE);
+	g_pMainWnd->end();
+
+    g_pMenuBar = new Fl_Menu_Bar(0, 0, W, 25);
+	g_pMainWnd->add(g_pMenuBar);
+
+	g_pScrollView = new Fl_Scroll(0, 25, W-160, H-27);
+	g_pScrollView->end();
+	g_pMainWnd->add(g_pScrollView);
+	g_pScrollView->box(FL_FLAT_BOX);
+
+	g_pImageView = new cImageView(0, 25, W-160, H-27);
+	g_pScrollView->add(g_pImageView);
+
+    g_pTreeView = new Fl_Tree_Ex(W-160, 25, 160, H-27);
+	g_pMainWnd->add(g_pTreeView);
+	//g_pTreeView->color(FL_LIGHT3);
+	g_pTreeView->selectmode(FL_TREE_SELECT_SINGLE);
+	g_pTreeView->sortorder(FL_TREE_SORT_ASCENDING);
+	g_pTreeView->showroot(0);
+	g_pTreeView->when(FL_WHEN_CHANGED);
+	g_pTreeView->callback(OnTreeSelChange);
+	g_pTreeView->marginleft(0);
+
+    g_pMainWnd->resizable(g_pScrollView);
+	g_pMainWnd->callback(OnMainWndClose);
+
+	// get number of pixels to add to g_pScrollView to get the window size
+	g_iWplus = g_pMainWnd->w() - g_pScrollView->w();
+	g_iHplus = g_pMainWnd->h() - g_pScrollView->h();
+
+	g_pMainWnd->size_range(320 + g_iWplus, 240 + g_iHplus, 0, 0);
+}
+
+
+static int GetScrollViewClientWidth()
+{
+	if (g_pScrollView)
+	{
+		if ( g_pScrollView->scrollbar.visible() )
+			return g_pScrollView->scrollbar_size() ? g_pScrollView->w() - g_pScrollView->scrollbar_size() : g_pScrollView->w() - Fl::scrollbar_size();
+
+		return g_pScrollView->w();
+	}
+
+	return 0;
+}
+
+static int GetScrollViewClientHeight()
+{
+	if (g_pScrollView)
+	{
+		if ( g_pScrollView->hscrollbar.visible() )
+			return g_pScrollView->scrollbar_size() ? g_pScrollView->h() - g_pScrollView->scrollbar_size() : g_pScrollView->h() - Fl::scrollbar_size();
+
+		return g_pScrollView->h();
+	}
+
+	return 0;
+}
+
+static void ScrollImageTo(int Xzoomed, int Yzoomed)
+{
+	if (Xzoomed < 0)
+		Xzoomed = 0;
+	else
+	{
+		const int xmax = g_pImageView->w() - GetScrollViewClientWidth();
+		if (Xzoomed > xmax)
+			Xzoomed = xmax;
+		if (Xzoomed < 0)
+			Xzoomed = 0;
+	}
+
+	if (Yzoomed < 0)
+		Yzoomed = 0;
+	else
+	{
+		const int ymax = g_pImageView->h() - GetScrollViewClientHeight();
+		if (Yzoomed > ymax)
+			Yzoomed = ymax;
+		if (Yzoomed < 0)
+			Yzoomed = 0;
+	}
+
+	g_pScrollView->scroll_to(Xzoomed, Yzoomed);
+}
+
+
+static void InitFLTK(const char *lpszFlTheme, const char *lpszColors)
+{
+	Fl::visual(FL_RGB);
+
+#ifndef NO_FLEET
+	fle_set_colors(lpszColors);
+#endif
+	Fl::scheme(lpszFlTheme);
+
+	fl_message_icon()->box(FL_FLAT_BOX);
+	fl_message_icon()->color(FL_GRAY0+20);
+}
+
+static BOOL HasCommandLineOption(int argc, char **argv, const char *lpszOption)
+{
+	for (int i=1; i<argc; i++)
+		if ( !fl_utf_strcasecmp(argv[i], lpszOption) )
+			return TRUE;
+
+	return FALSE;
+}
+
+static BOOL GetCommandLineInt(int argc, char **argv, const char *lpszOption, int &iVal)
+{
+	for (int i=1; i<argc; i++)
+		if (!fl_utf_strcasecmp(argv[i], lpszOption) && argc > i+1 && isdigit((int)(UINT)(BYTE)argv[i+1][0]))
+		{
+			iVal = atoi(argv[i+1]);
+			return TRUE;
+		}
+
+	return FALSE;
+}
+
+static BOOL GetCommandLineString(int argc, char **argv, const char *lpszOption, const char *&pszVal)
+{
+	for (int i=1; i<argc; i++)
+		if (!fl_utf_strcasecmp(argv[i], lpszOption) && argc > i+1 && argv[i+1][0] != '-')
+		{
+			pszVal = argv[i+1];
+			return TRUE;
+		}
+
+	return FALSE;
+}
+
+static void InvokeShortcutFLTK(int key)
+{
+	int e_state = Fl::e_state;
+	int e_keysym = Fl::e_keysym;
+	char *e_text = Fl::e_text;
+	int e_length = Fl::e_length;
+
+	char s[1] = {0};
+	Fl::e_text = s;
+	Fl::e_length = 0;
+
+	Fl::e_state = (e_state & FL_NUM_LOCK) | (key & ~FL_KEY_MASK);
+	Fl::e_keysym = key & FL_KEY_MASK;
+
+	g_pMenuBar->handle(FL_SHORTCUT);
+
+	Fl::e_state = e_state;
+	Fl::e_keysym = e_keysym;
+	Fl::e_text = e_text;
+	Fl::e_length = e_length;
+}
+
+// command-line batch generation (--generate <dir>), runs without ever creating a window and prints a key=value summary
+// on stdout, returns the process exit code (0 = success, 1 = generation errors, 2 = bad arguments or project not loaded)
+static int RunHeadlessGenerate(int argc, char **argv, const char *sDir)
+{
+	g_bHeadless = TRUE;
+
+	// the FLTK rasterizer needs a display connection, so unless it's explicitly requested use the built-in one
+	const char *sRaster;
+	if ( !GetCommandLineString(argc, argv, "--raster", sRaster) )
+		g_iRasterMode = RM_ANALYTIC;
+
+	const BOOL bSaveTGA = HasCommandLineOption(argc, argv, "--tga") || g_bSaveTgaRLE;
+	const BOOL bForce = HasCommandLineOption(argc, argv, "--force");
+
+	int iGenerateMap = -1;
+	int iGenerateLocIdx = -1;
+	GetCommandLineInt(argc, argv, "--page", iGenerateMap);
+	GetCommandLineInt(argc, argv, "--loc", iGenerateLocIdx);
+
+	if (iGenerateLocIdx >= 0 && iGenerateMap < 0)
+	{
+		ReportError("--loc requires --page");
+		printf("result=failed\n");
+		return 2;
+	}
+
+	if ( fl_chdir(sDir) )
+	{
+		ReportError("Failed to open map directory \"%s\"", sDir);
+		printf("result=failed\n");
+		return 2;
+	}
+
+	char s[MAX_PATH];
+	if ( !LoadProject( fl_getcwd(s, sizeof(s)) ) )
+	{
+		ReportError("Failed to load project file \"%s\"", PROJ_FILENAME);
+		printf("result=failed\n");
+		return 2;
+	}
+
+	if (!g_pProj->iMapCount)
+	{
+		ReportError("No map pages found in \"%s\"", g_pProj->sDir);
+		printf("result=failed\n");
+		return 2;
+	}
+
+	if (iGenerateMap >= 0 && (iGenerateMap >= g_pProj->iMapCount || !g_pProj->maps[iGenerateMap].IsValid()))
+	{
+		ReportError("PAGE%03d not found", iGenerateMap);
+		printf("result=failed\n");
+		return 2;
+	}
+
+	sGenerateStats stats;
+	const BOOL bOk = GenerateFiles(bSaveTGA, bForce, iGenerateMap, iGenerateLocIdx, &stats);
+
+	printf("dir=%s\n", g_pProj->sDir);
+	printf("mode=%s\n", g_bShockMaps ? "shock" : "thief");
+	printf("format=%s\n", bSaveTGA ? (g_bSaveTgaRLE ? "tga-rle" : "tga") : "png");
+	if (!bSaveTGA)
+		printf("png-preset=%s\n", g_sPngPresetNames[g_iPngPreset]);
+	printf("pages=%d\n", stats.iPages);
+	printf("locations=%d\n", stats.iImages + stats.iSkipped);
+	printf("generated=%d\n", stats.iImages);
+	printf("skipped=%d\n", stats.iSkipped);
+	printf("bytes=%.0f\n", (double)(INT64)stats.iBytes);
+	printf("errors=%d\n", stats.iErrors);
+	printf("result=%s\n", bOk ? "ok" : "errors");
+
+	delete g_pProj;
+	g_pProj = NULL;
+
+	return bOk ? 0 : 1;
+}
+
+// command-line export of the project in the text format (--export-text <dir>), for diffing binary projects, returns the
+// process exit code (0 = success, 1 = project couldn't be loaded or saved)
+static int RunHeadlessExport(const char *sDir)
+{
+	g_bHeadless = TRUE;
+
+	if ( fl_chdir(sDir) )
+	{
+		ReportError("Failed to open map directory \"%s\"", sDir);
+		return 1;
+	}
+
+	char s[MAX_PATH];
+	if ( !LoadProject( fl_getcwd(s, sizeof(s)) ) )
+	{
+		ReportError("Failed to load project file");
+		return 1;
+	}
+
+	const BOOL bOk = g_pProj->ExportText();
+
+	delete g_pProj;
+	g_pProj = NULL;
+
+	return bOk ? 0 : 1;
+}
+
+// time loading a synthetic project with 10000 shapes in the text and binary formats (--benchmark), the files are
+// written to the current directory and deleted again, prints a key=value summary, returns the process exit code
+static int RunProjectBenchmark()
+{
+	g_bHeadless = TRUE;
+
+	const char *sTextFile = "DarkMapGen-benchmark.proj";
+	const char *sBinFile = "DarkMapGen-benchmark.projb";
+	const int iRuns = 5;
+
+	// 40 pages with 200 locations each, every 4th location has a hole
+	sProject *pProj = new sProject;
+
+	sShape shape;
+	int iShapes = 0;
+	int iVerts = 0;
+
+	for (int j=0; j<MAX_MAPS; j++)
+		for (int i=0; i<200; i++)
+		{
+			sLocation &loc = pProj->maps[j].AddLocation(i);
+
+			const int cx = 100 + (i % 16) * 120;
+			const int cy = 100 + (i / 16) * 120;
+
+			for (int k=0; k<(i % 4 ? 1 : 2); k++)
+			{
+				const int n = 8 + (i * 7 + j) % 25;
+				const int r = k ? 20 : 50;
+
+				shape.SetVertCount(n);
+				for (int v=0; v<n; v++)
+				{
+					const double a = 6.283185307 * v / n;
+					shape.verts[v].x = (short)(cx + r * cos(a));
+					shape.verts[v].y = (short)(cy + r * sin(a));
+				}
+
+				shape.CalcBoundingRect();
+				shape.iLabelPos[0] = cx;
+				shape.iLabelPos[1] = cy;
+
+				loc.AddShape(shape, k == 1);
+
+				iShapes++;
+				iVerts += n;
+			}
+		}
+
+	BOOL bOk = pProj->SaveText(sTextFile) && pProj->SaveBinary(sBinFile);
+
+	delete pProj;
+
+	double fText = 0, fBin = 0;
+
+	for (int i=0; i<iRuns && bOk; i++)
+	{
+		pProj = new sProject;
+		double t = GetTimeSeconds();
+		bOk = pProj->LoadText(sTextFile) && pProj->maps[MAX_MAPS-1].iLocationCount == 200;
+		t = GetTimeSeconds() - t;
+		delete pProj;
+
+		if (!i || t < fText)
+			fText = t;
+
+		pProj = new sProject;
+		t = GetTimeSeconds();
+		bOk = bOk && pProj->LoadBinary(sBinFile) && pProj->maps[MAX_MAPS-1].iLocationCount == 200;
+		t = GetTimeSeconds() - t;
+		delete pProj;
+
+		if (!i || t < fBin)
+			fBin = t;
+	}
+
+	struct stat st;
+	printf("shapes=%d\n", iShapes);
+	printf("verts=%d\n", iVerts);
+	printf("text-bytes=%.0f\n", fl_stat(sTextFile, &st) ? 0.0 : (double)st.st_size);
+	printf("binary-bytes=%.0f\n", fl_stat(sBinFile, &st) ? 0.0 : (double)st.st_size);
+	printf("text-load-ms=%.2f\n", fText * 1000.0);
+	printf("binary-load-ms=%.2f\n", fBin * 1000.0);
+	printf("result=%s\n", bOk ? "ok" : "failed");
+
+	fl_unlink(sTextFile);
+	fl_unlink(sBinFile);
+
+	return bOk ? 0 : 1;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	BOOL bUseCurrentDir = FALSE;
+#ifdef DEF_THEME
+#define DEF_THEME_S(s) DEF_THEME_S_(s)
+#define DEF_THEME_S_(s) #s
+	char szFlTheme[32] = DEF_THEME_S(DEF_THEME);
+#undef DEF_THEME_S
+#undef DEF_THEME_S_
+#else
+	char szFlTheme[32] = "gtk+";
+#endif
+#ifdef DEF_COLORS
+#define DEF_COLORS_S(s) DEF_COLORS_S_(s)
+#define DEF_COLORS_S_(s) #s
+	char szColors[32] = DEF_COLORS_S(DEF_COLORS);
+#undef DEF_COLORS_S
+#undef DEF_COLORS_S_
+#else
+	char szColors[32] = "default";
+#endif
+	int w = -1, h = -1;
+
+	g_bShockMaps = -1;
+
+	if (argc > 1)
+	{
+		if ( HasCommandLineOption(argc, argv, "--thief") )
+			g_bShockMaps = FALSE;
+		else if ( HasCommandLineOption(argc, argv, "--shock") )
+			g_bShockMaps = TRUE;
+		bUseCurrentDir = HasCommandLineOption(argc, argv, "--cwd");
+
+		if ( GetCommandLineInt(argc, argv, "--zoom", g_iZoom) )
+		{
+				if (g_iZoom < MIN_ZOOM)
+					g_iZoom = MIN_ZOOM;
+				else if (g_iZoom > MAX_ZOOM)
+					g_iZoom = MAX_ZOOM;
+		}
+
+		if ( GetCommandLineInt(argc, argv, "--margin", g_iLocationImageExtraBorder) )
+			if (g_iLocationImageExtraBorder < 0)
+				g_iLocationImageExtraBorder = 0;
+
+		if ( GetCommandLineInt(argc, argv, "--aa", g_iAlphaExportAA) )
+		{
+			if (g_iAlphaExportAA < 1)
+				g_iAlphaExportAA = 1;
+			else if (g_iAlphaExportAA > 8)
+				g_iAlphaExportAA = 8;
+		}
+
+		const char *szArg;
+		if ( GetCommandLineString(argc, argv, "--raster", szArg) )
+		{
+			if ( !fl_utf_strcasecmp(szArg, "analytic") )
+				g_iRasterMode = RM_ANALYTIC;
+			else if ( !fl_utf_strcasecmp(szArg, "adaptive") )
+				g_iRasterMode = RM_ADAPTIVE;
+			else if ( !fl_utf_strcasecmp(szArg, "fltk") )
+				g_iRasterMode = RM_FLTK;
+		}
+
+		if ( GetCommandLineString(argc, argv, "--png-preset", szArg) )
+		{
+			for (int i=0; i<PNG_NUM_PRESETS; i++)
+				if ( !fl_utf_strcasecmp(szArg, g_sPngPresetNames[i]) )
+					g_iPngPreset = i;
+		}
+
+		if ( GetCommandLineInt(argc, argv, "--png-level", g_iPngLevel) )
+			if (g_iPngLevel > 9)
+				g_iPngLevel = 9;
+
+		if ( HasCommandLineOption(argc, argv, "--tga-rle") )
+			g_bSaveTgaRLE = TRUE;
+
+		if ( HasCommandLineOption(argc, argv, "--binary-project") )
+			g_bBinaryProject = TRUE;
+
+		GetCommandLineInt(argc, argv, "--max-page-mem", g_iMaxPageMem);
+		GetCommandLineInt(argc, argv, "--max-undo-mem", g_iMaxUndoMem);
+
+		if ( HasCommandLineOption(argc, argv, "--no-page-cache") )
+			g_bPageCache = FALSE;
+
+		InitPixelKernels( GetCommandLineString(argc, argv, "--simd", szArg) ? szArg : NULL );
+
+		if ( GetCommandLineInt(argc, argv, "--jobs", g_iGenerateThreads) )
+			if (g_iGenerateThreads > 64)
+				g_iGenerateThreads = 64;
+
+		if ( GetCommandLineString(argc, argv, "--theme", szArg) )
+		{
+			strncpy(szFlTheme, szArg, sizeof(szFlTheme)-1);
+			szFlTheme[sizeof(szFlTheme)-1] = '\0';
+		}
+		if ( GetCommandLineString(argc, argv, "--colors", szArg) )
+		{
+			strncpy(szColors, szArg, sizeof(szColors)-1);
+			szColors[sizeof(szColors)-1] = '\0';
+		}
+
+		for (int i=1; i<argc; i++)
+			if (!fl_utf_strcasecmp(argv[i], "--winsize") && argc > i+1)
+			{
+				sscanf(argv[i+1], "%dx%d", &w, &h);
+				if (h > 0)
+				{
+					if (w < 320 + g_iWplus)
+						w = 320 + g_iWplus;
+					if (h < 240 + g_iHplus)
+						h = 240 + g_iHplus;
+
+					g_bUserDefinedWindowSize = TRUE;
+				}
+			}
+	}
+	else
+		InitPixelKernels();
+
+	if ( argc > 1 && HasCommandLineOption(argc, argv, "--selftest") )
+		return TestPixelKernels() ? 0 : 1;
+
+	const char *szGenerateDir;
+	if ( argc > 1 && GetCommandLineString(argc, argv, "--generate", szGenerateDir) )
+		return RunHeadlessGenerate(argc, argv, szGenerateDir);
+
+	const char *szExportDir;
+	if ( argc > 1 && GetCommandLineString(argc, argv, "--export-text", szExportDir) )
+		return RunHeadlessExport(szExportDir);
+
+	if ( argc > 1 && HasCommandLineOption(argc, argv, "--benchmark") )
+		return RunProjectBenchmark();
+
+	InitFLTK(szFlTheme, szColors);
+
+    MakeWindow(w, h);
+
+	if (g_pMainWnd)
+	{
+		if (!bUseCurrentDir)
+		{
+			char *sDir = fl_dir_chooser("Select Map Directory", NULL, 0);
+			if (!sDir)
+			{
+				delete g_pMainWnd;
+				return 0;
+			}
+
+			fl_chdir(sDir);
+		}
+
+		char s[MAX_PATH];
+		LoadProject( fl_getcwd(s, sizeof(s)) );
+
+		if (!g_pProj->iMapCount)
+		{
+			fl_alert("No map pages found. Make sure that the working directory contains properly named map page images as PNG.");
+			return 0;
+		}
+
+		// restore the edits of a previous session that didn't exit properly
+		g_journal.Open(g_pProj->sDir);
+		if ( g_journal.HasRecords() )
+		{
+			if ( fl_choice("DarkMapGen was not closed properly last time. Restore the unsaved changes of that session?", "Discard", "Restore", NULL) )
+			{
+				const int n = g_journal.Replay(*g_pProj);
+				if (n < 0)
+				{
+					fl_alert("The edit journal doesn't belong to the current project file, the changes can't be restored.");
+					g_journal.Discard();
+				}
+				else if (n > 0)
+				{
+					SetModifiedFlag();
+					g_undo.SetSavePoint(FALSE);
+				}
+			}
+			else
+				g_journal.Discard();
+		}
+
+		InitControls();
+
+		g_pMainWnd->show();
+
+		// apply any command-line settings for UI configurable settings
+		if (argc > 1)
+		{
+			int i;
+
+			if (GetCommandLineInt(argc, argv, "--viewmode", i) && i >= 1 && i < DM_NUM_MODES)
+				InvokeShortcutFLTK(FL_COMMAND+'1'+(i-1));
+			if ( HasCommandLineOption(argc, argv, "--thicklines") )
+				InvokeShortcutFLTK(FL_COMMAND+'t');
+			if ( HasCommandLineOption(argc, argv, "--labels") )
+				InvokeShortcutFLTK(FL_COMMAND+'l');
+			if ( HasCommandLineOption(argc, argv, "--cguides") )
+				InvokeShortcutFLTK(FL_COMMAND+'g');
+			if ( HasCommandLineOption(argc, argv, "--fillnew") )
+				InvokeShortcutFLTK(FL_COMMAND+'f');
+			if ( HasCommandLineOption(argc, argv, "--hidelines") )
+				InvokeShortcutFLTK(FL_COMMAND+'h');
+		}
+
+		// enables Fl::awake for the background generation thread
+		Fl::lock();
+
+		Fl::run();
+
+		delete g_pMainWnd;
+
+		if (g_pProj)
+		{
+			delete g_pProj;
+			g_pProj = NULL;
+		}
+	}
+
+	return 0;
+}